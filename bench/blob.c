@@ -0,0 +1,99 @@
+/*
+ * blob.c
+ *
+ * Measures writing and reading multi-megabyte blobs. For each payload size it
+ * times ip_WriteBlob() with ordinary and with streaming (non-temporal) stores,
+ * and how long it takes afterwards to walk a small working set that was in cache
+ * before the write, which shows how much of the cache the write threw out.
+ * It also times copying the payload out with ip_ReadBlob().
+ *
+ * Run it on a quiet machine: bin/blobbench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/interprocess.h"
+
+#define ROUNDS 50
+#define WORKING_SET (256 * 1024)
+
+static double nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Walk the working set, one cache line at a time */
+static unsigned int walk(const unsigned char* set) {
+	unsigned int sum = 0;
+	int k = 0;
+	for (k = 0; k < WORKING_SET; k += 64)
+		sum += set[k];
+	return sum;
+}
+
+int main() {
+	SharedMemory_handle sm = ip_CreateSharedMemoryHost((char*) "blobbench");
+	if (sm == NULL) {
+		printf("creating shared memory failed.\n");
+		return IP_ERROR;
+	}
+
+	int sizes[] = { 2 * 1024 * 1024, 8 * 1024 * 1024 };
+	int numSizes = sizeof(sizes) / sizeof(sizes[0]);
+	unsigned char* source = (unsigned char*) malloc(sizes[numSizes - 1]);
+	unsigned char* dest = (unsigned char*) malloc(sizes[numSizes - 1]);
+	unsigned char* set = (unsigned char*) malloc(WORKING_SET);
+	memset(source, 1, sizes[numSizes - 1]);
+	memset(set, 1, WORKING_SET);
+	unsigned int sink = 0;
+
+	printf("mode, payload_bytes, write_gb_per_s, walk_after_write_ns, read_gb_per_s\n");
+	int streaming = 0;
+	int s = 0;
+	for (streaming = 0; streaming <= 1; ++streaming) {
+		for (s = 0; s < numSizes; ++s) {
+			Blob_handle blob = NULL;
+			int flags = IP_BLOB_PREFAULT | (streaming ? IP_BLOB_STREAMING : 0);
+			if (ip_CreateBlob(sm, (char*) "image", sizes[s], flags, &blob) != IP_SUCCESS) {
+				printf("creating the blob failed.\n");
+				ip_CloseSharedMemory(sm);
+				return IP_ERROR;
+			}
+
+			double writing = 0;
+			double walking = 0;
+			int k = 0;
+			for (k = 0; k < ROUNDS; ++k) {
+				sink += walk(set);
+				double t0 = nowNs();
+				ip_WriteBlob(blob, source, sizes[s]);
+				double t1 = nowNs();
+				sink += walk(set);
+				writing += t1 - t0;
+				walking += nowNs() - t1;
+			}
+
+			int size = 0;
+			double t0 = nowNs();
+			for (k = 0; k < ROUNDS; ++k)
+				ip_ReadBlob(blob, dest, &size);
+			double reading = nowNs() - t0;
+
+			printf("%s, %d, %.2f, %.0f, %.2f\n", streaming ? "streaming" : "memcpy", sizes[s],
+					(double) sizes[s] * ROUNDS / writing, walking / ROUNDS,
+					(double) size * ROUNDS / reading);
+			ip_CloseBlob(blob);
+			ip_ClearField(sm, (char*) "image");
+		}
+	}
+
+	free(source);
+	free(dest);
+	free(set);
+	ip_CloseSharedMemory(sm);
+	return (sink == 0) ? IP_ERROR : IP_SUCCESS;
+}
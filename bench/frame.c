@@ -0,0 +1,140 @@
+/*
+ * frame.c
+ *
+ * Measures what publishing a triple-buffered frame costs the writer, for a few
+ * frame sizes, both copying the frame in and building it in place, while a forked
+ * reader keeps taking the latest frame. Every frame is filled with its own number,
+ * and the reader checks the first and last word of each frame it takes, so a torn
+ * frame would show up.
+ *
+ * Run it on a quiet machine: bin/framebench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/interprocess.h"
+
+#define FRAMES 2000
+#define MAX_FRAME (1024 * 1024)
+
+static double nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Fill a frame with its number, one word at a time */
+static void fill(unsigned int* frame, int size, unsigned int number) {
+	int k = 0;
+	for (k = 0; k < size / (int) sizeof(unsigned int); ++k)
+		frame[k] = number;
+}
+
+/*
+ * Take frames until the last one shows up, checking each. Exits with 1 if a frame
+ * was torn or frames went backwards.
+ */
+static int watch(char* frameName) {
+	SharedMemory_handle sm = ip_CreateSharedMemoryClient((char*) "framebench");
+	Frame_handle reader = NULL;
+	if (sm == NULL || ip_OpenFrameReader(sm, frameName, &reader) != IP_SUCCESS) {
+		printf("opening %s failed.\n", frameName);
+		return 1;
+	}
+
+	int bad = 0;
+	unsigned int last = 0;
+	while (last < FRAMES) {
+		const void* data = NULL;
+		int size = 0;
+		unsigned int number = 0;
+		if (ip_AcquireLatestFrame(reader, &data, &size, &number) != IP_SUCCESS) {
+			sched_yield();
+			continue;
+		}
+		const unsigned int* words = (const unsigned int*) data;
+		int numWords = size / (int) sizeof(unsigned int);
+		if (number < last || words[0] != number || words[numWords - 1] != number)
+			bad++;
+		last = number;
+		ip_ReleaseFrame(reader);
+		sched_yield();
+	}
+	ip_CloseFrame(reader);
+	ip_CloseSharedMemory(sm);
+	return bad;
+}
+
+int main() {
+	SharedMemory_config config;
+	memset(&config, 0, sizeof(config));
+	config.capacity = 8 * 1024 * 1024;
+	SharedMemory_handle sm = ip_CreateSharedMemoryHostEx((char*) "framebench", &config);
+	if (sm == NULL) {
+		printf("creating shared memory failed.\n");
+		return IP_ERROR;
+	}
+
+	unsigned int* source = (unsigned int*) malloc(MAX_FRAME);
+	int sizes[] = { 4096, 65536, MAX_FRAME };
+	int numSizes = sizeof(sizes) / sizeof(sizes[0]);
+	int failed = 0;
+
+	printf("mode, frame_bytes, frames, ns_per_publish, torn\n");
+	int inPlace = 0;
+	int s = 0;
+	for (inPlace = 0; inPlace <= 1; ++inPlace) {
+		for (s = 0; s < numSizes; ++s) {
+			char frameName[IP_FIELD_NAME_SIZE];
+			snprintf(frameName, sizeof(frameName), "frame_%d_%d", inPlace, sizes[s]);
+			Frame_handle writer = NULL;
+			if (ip_CreateFrame(sm, frameName, MAX_FRAME, &writer) != IP_SUCCESS) {
+				printf("creating %s failed.\n", frameName);
+				ip_CloseSharedMemory(sm);
+				return IP_ERROR;
+			}
+
+			pid_t pid = fork();
+			if (pid == 0)
+				_exit(watch(frameName) ? 1 : 0);
+
+			/* only the publishing is timed, not filling in the frame */
+			double spent = 0;
+			unsigned int n = 0;
+			for (n = 1; n <= FRAMES; ++n) {
+				double t0 = 0;
+				if (inPlace) {
+					void* buffer = NULL;
+					ip_GetFrameBuffer(writer, &buffer);
+					fill((unsigned int*) buffer, sizes[s], n);
+					t0 = nowNs();
+					ip_PublishFrame(writer, NULL, sizes[s]);
+				} else {
+					fill(source, sizes[s], n);
+					t0 = nowNs();
+					ip_PublishFrame(writer, source, sizes[s]);
+				}
+				spent += nowNs() - t0;
+			}
+
+			int status = 0;
+			waitpid(pid, &status, 0);
+			int bad = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+			failed |= bad;
+			printf("%s, %d, %d, %.1f, %d\n", inPlace ? "in_place" : "copy", sizes[s], FRAMES,
+					spent / FRAMES, bad);
+			ip_CloseFrame(writer);
+			ip_ClearField(sm, frameName);
+		}
+	}
+
+	free(source);
+	ip_CloseSharedMemory(sm);
+	return failed ? IP_ERROR : IP_SUCCESS;
+}
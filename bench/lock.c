@@ -0,0 +1,145 @@
+/*
+ * lock.c
+ *
+ * Measures how long it takes to acquire the shared memory lock when 2, 4 and 8
+ * processes fight over it. Every process takes and releases the lock in a loop
+ * (through ip_GetSharedMemoryStatus(), which only checks the shared data under the
+ * lock) for DURATION_S seconds and records how long each acquisition took.
+ *
+ * Reports the median and 99th percentile latency, how many attempts timed out, and
+ * how evenly the lock was shared: the fewest acquisitions any one process got over
+ * the most any one got (1 is perfectly fair).
+ *
+ * Run it on a quiet machine: bin/lockbench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/interprocess.h"
+
+#define DURATION_S 1.0
+#define MAX_PROCESSES 8
+#define MAX_SAMPLES 2000000
+
+/* filled in by the processes, in memory shared with the parent */
+struct Results_t {
+	int ready;
+	int go;
+	long long end; /* when everyone stops, the same for all so that the counts compare */
+	long long acquired[MAX_PROCESSES];
+	long long busy[MAX_PROCESSES];
+	long long samples[MAX_PROCESSES][MAX_SAMPLES];
+};
+
+static long long nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare(const void* a, const void* b) {
+	long long x = *(const long long*) a;
+	long long y = *(const long long*) b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Take the lock over and over for DURATION_S seconds, recording each acquisition.
+ */
+static int contend(struct Results_t* results, int me) {
+	SharedMemory_handle sm = ip_CreateSharedMemoryClient((char*) "lockbench");
+	if (sm == NULL) {
+		printf("opening shared memory failed.\n");
+		return 1;
+	}
+	ip_SetSharedMemoryLockWaitTime(sm, 1000);
+
+	__atomic_add_fetch(&(results->ready), 1, __ATOMIC_RELEASE);
+	while (!__atomic_load_n(&(results->go), __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	long long n = 0;
+	for (;;) {
+		long long t0 = nowNs();
+		if (t0 > results->end)
+			break;
+		int ret = ip_GetSharedMemoryStatus(sm);
+		long long t1 = nowNs();
+		if (ret != IP_SUCCESS) {
+			results->busy[me]++;
+			continue;
+		}
+		if (n < MAX_SAMPLES)
+			results->samples[me][n] = t1 - t0;
+		n++;
+	}
+	results->acquired[me] = n;
+	ip_CloseSharedMemory(sm);
+	return 0;
+}
+
+int main() {
+	SharedMemory_handle sm = ip_CreateSharedMemoryHost((char*) "lockbench");
+	struct Results_t* results = (struct Results_t*) mmap(NULL, sizeof(struct Results_t),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	long long* all = (long long*) malloc(sizeof(long long) * MAX_PROCESSES * MAX_SAMPLES);
+	if (sm == NULL || results == MAP_FAILED || all == NULL) {
+		printf("setting up failed.\n");
+		return IP_ERROR;
+	}
+
+	int numProcesses[] = { 2, 4, 8 };
+	int numRuns = sizeof(numProcesses) / sizeof(numProcesses[0]);
+
+	printf("processes, acquisitions, p50_ns, p99_ns, max_ns, timeouts, fairness\n");
+	int run = 0;
+	for (run = 0; run < numRuns; ++run) {
+		int count = numProcesses[run];
+		memset(results, 0, sizeof(struct Results_t) - sizeof(results->samples));
+
+		pid_t pids[MAX_PROCESSES];
+		int k = 0;
+		for (k = 0; k < count; ++k) {
+			pids[k] = fork();
+			if (pids[k] == 0)
+				_exit(contend(results, k));
+		}
+		while (__atomic_load_n(&(results->ready), __ATOMIC_ACQUIRE) < count)
+			sched_yield();
+		results->end = nowNs() + (long long) (DURATION_S * 1e9);
+		__atomic_store_n(&(results->go), 1, __ATOMIC_RELEASE);
+		for (k = 0; k < count; ++k)
+			waitpid(pids[k], NULL, 0);
+
+		long long total = 0;
+		long long busy = 0;
+		long long least = -1;
+		long long most = 0;
+		for (k = 0; k < count; ++k) {
+			long long n = results->acquired[k];
+			long long kept = (n < MAX_SAMPLES) ? n : MAX_SAMPLES;
+			memcpy(all + total, results->samples[k], sizeof(long long) * kept);
+			total += kept;
+			busy += results->busy[k];
+			least = (least < 0 || n < least) ? n : least;
+			most = (n > most) ? n : most;
+		}
+		qsort(all, total, sizeof(long long), compare);
+		if (total > 0)
+			printf("%d, %lld, %lld, %lld, %lld, %lld, %.2f\n", count, total, all[total / 2],
+					all[total * 99 / 100], all[total - 1], busy,
+					(most > 0) ? (double) least / most : 0.0);
+	}
+
+	free(all);
+	munmap(results, sizeof(struct Results_t));
+	ip_CloseSharedMemory(sm);
+	return IP_SUCCESS;
+}
@@ -0,0 +1,141 @@
+/*
+ * lookup.c
+ *
+ * Measures how long it takes to find a field by name as the number of
+ * fields in the shared memory grows. For each field count it times
+ *  - reading the most recently added field (worst case for a linear scan)
+ *  - reading a field that does not exist
+ *  - overwriting an existing field
+ *  - reading and writing that field through a pre-resolved Field_handle
+ *
+ * Then it checks that lock-free lookups never copy another field's value: a child
+ * keeps adding a small and a large field and clearing the small one, which moves the
+ * large one into its slot, while the parent reads the small one by name, by handle
+ * and in a batch into an int followed by a canary that must stay untouched.
+ *
+ * Run it on a quiet machine: bin/lookupbench
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/interprocess.h"
+
+#define ITERATIONS 200000
+#define MOVING_SECONDS 3
+
+/* An int to read into, and a canary the size of the largest value right after it */
+struct Guarded {
+	int value;
+	unsigned char canary[IP_FIELD_DATA_CONTAINER_SIZE];
+};
+
+static double nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main() {
+	SharedMemory_handle sm = ip_CreateSharedMemoryHost((char*) "lookupbench");
+	if (sm == NULL) {
+		printf("creating shared memory failed.\n");
+		return IP_ERROR;
+	}
+
+	int counts[] = { 1, 16, 64, 128, 256, 400 };
+	int numCounts = sizeof(counts) / sizeof(counts[0]);
+	int added = 0;
+	char name[IP_FIELD_NAME_SIZE];
+	int val = 0;
+
+	printf("fields, hit_ns, miss_ns, overwrite_ns, handle_read_ns, handle_write_ns\n");
+	int c = 0;
+	for (c = 0; c < numCounts; ++c) {
+		for (; added < counts[c]; ++added) {
+			snprintf(name, sizeof(name), "field_%d", added);
+			if (ip_WriteValue(sm, name, &added, sizeof(int)) != IP_SUCCESS) {
+				printf("could not add %s\n", name);
+				ip_CloseSharedMemory(sm);
+				return IP_ERROR;
+			}
+		}
+		snprintf(name, sizeof(name), "field_%d", added - 1);
+
+		int k = 0;
+		double t0 = nowNs();
+		for (k = 0; k < ITERATIONS; ++k)
+			ip_ReadValue(sm, name, &val);
+		double hit = (nowNs() - t0) / ITERATIONS;
+
+		t0 = nowNs();
+		for (k = 0; k < ITERATIONS; ++k)
+			ip_ReadValue(sm, (char*) "no_such_field", &val);
+		double miss = (nowNs() - t0) / ITERATIONS;
+
+		t0 = nowNs();
+		for (k = 0; k < ITERATIONS; ++k)
+			ip_WriteValue(sm, name, &k, sizeof(int));
+		double overwrite = (nowNs() - t0) / ITERATIONS;
+
+		Field_handle handle;
+		ip_ResolveField(sm, name, &handle);
+		t0 = nowNs();
+		for (k = 0; k < ITERATIONS; ++k)
+			ip_ReadValueByHandle(sm, handle, &val);
+		double handleRead = (nowNs() - t0) / ITERATIONS;
+
+		t0 = nowNs();
+		for (k = 0; k < ITERATIONS; ++k)
+			ip_WriteValueByHandle(sm, handle, &k, sizeof(int));
+		double handleWrite = (nowNs() - t0) / ITERATIONS;
+
+		printf("%d, %.1f, %.1f, %.1f, %.1f, %.1f\n", added, hit, miss, overwrite,
+				handleRead, handleWrite);
+	}
+
+	/** Moving fields: the large one keeps landing in the small one's slot **/
+	pid_t pid = fork();
+	if (pid == 0) {
+		SharedMemory_handle client = ip_CreateSharedMemoryClient((char*) "lookupbench");
+		static char image[IP_FIELD_DATA_CONTAINER_SIZE];
+		memset(image, 0xee, sizeof(image));
+		int flag = 1;
+		for (;;) {
+			ip_WriteValue(client, (char*) "flag", &flag, sizeof(int));
+			ip_WriteValue(client, (char*) "image", image, sizeof(image));
+			ip_ClearField(client, (char*) "flag");
+			ip_ClearField(client, (char*) "image");
+		}
+	}
+	static struct Guarded guarded;
+	memset(guarded.canary, 0x5a, sizeof(guarded.canary));
+	Field_value batch;
+	memset(&batch, 0, sizeof(batch));
+	batch.name = (char*) "flag";
+	batch.data = &guarded;
+	Field_handle handle = { -1, 0 };
+	long reads = 0;
+	int trampled = 0;
+	double end = nowNs() + MOVING_SECONDS * 1e9;
+	while (nowNs() < end && !trampled) {
+		ip_ReadValue(sm, (char*) "flag", &guarded);
+		if (ip_ReadValueByHandle(sm, handle, &guarded) != IP_SUCCESS)
+			ip_ResolveField(sm, (char*) "flag", &handle);
+		ip_ReadValues(sm, &batch, 1);
+		reads += 3;
+		/* a value copied over it would start right after the int */
+		if (guarded.canary[0] != 0x5a || guarded.canary[sizeof(guarded.canary) - 1] != 0x5a)
+			trampled = 1;
+	}
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	printf("moving fields: %ld reads, canary %s\n", reads, trampled ? "overwritten, WRONG" : "intact");
+
+	ip_CloseSharedMemory(sm);
+	return trampled ? IP_ERROR : IP_SUCCESS;
+}
@@ -0,0 +1,154 @@
+/*
+ * queue.c
+ *
+ * Measures the throughput of a queue between two processes. The host pushes
+ * MESSAGES messages and a forked client pops them, first one at a time with
+ * ip_QueuePush()/ip_QueuePop(), then BATCH at a time with the batched calls,
+ * for a few message sizes. Every message carries its sequence number, which
+ * the consumer checks.
+ *
+ * Run it on a quiet machine: bin/queuebench
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/interprocess.h"
+
+#define MESSAGES 2000000
+#define CAPACITY 1024
+#define BATCH 32
+#define MAX_MESSAGE 256
+
+static double nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Pop every message, checking that they arrive in order. Returns the number out of order. */
+static int consume(char* queueName, int batched) {
+	SharedMemory_handle sm = ip_CreateSharedMemoryClient((char*) "queuebench");
+	Queue_handle queue = NULL;
+	if (sm == NULL || ip_OpenQueue(sm, queueName, &queue) != IP_SUCCESS) {
+		printf("opening %s failed.\n", queueName);
+		return 1;
+	}
+
+	char buffers[BATCH][MAX_MESSAGE];
+	void* data[BATCH];
+	int sizes[BATCH];
+	int k = 0;
+	for (k = 0; k < BATCH; ++k)
+		data[k] = buffers[k];
+
+	int bad = 0;
+	int received = 0;
+	while (received < MESSAGES) {
+		int n = 0;
+		if (batched)
+			n = ip_QueuePopBatch(queue, data, sizes, BATCH);
+		else
+			n = (ip_QueuePop(queue, data[0], &(sizes[0])) == IP_SUCCESS) ? 1 : 0;
+		if (n <= 0) {
+			sched_yield();
+			continue;
+		}
+		for (k = 0; k < n; ++k, ++received) {
+			int seq = -1;
+			memcpy(&seq, data[k], sizeof(int));
+			if (seq != received)
+				bad++;
+		}
+	}
+	ip_CloseQueue(queue);
+	ip_CloseSharedMemory(sm);
+	return bad;
+}
+
+/* Push every message. */
+static void produce(Queue_handle queue, int size, int batched) {
+	char buffers[BATCH][MAX_MESSAGE];
+	void* data[BATCH];
+	int sizes[BATCH];
+	int k = 0;
+	memset(buffers, 0, sizeof(buffers));
+	for (k = 0; k < BATCH; ++k) {
+		data[k] = buffers[k];
+		sizes[k] = size;
+	}
+
+	int sent = 0;
+	while (sent < MESSAGES) {
+		int want = batched ? BATCH : 1;
+		if (want > MESSAGES - sent)
+			want = MESSAGES - sent;
+		for (k = 0; k < want; ++k) {
+			int seq = sent + k;
+			memcpy(buffers[k], &seq, sizeof(int));
+		}
+		int n = 0;
+		if (batched)
+			n = ip_QueuePushBatch(queue, data, sizes, want);
+		else
+			n = (ip_QueuePush(queue, data[0], size) == IP_SUCCESS) ? 1 : 0;
+		if (n <= 0)
+			sched_yield();
+		else
+			sent += n;
+	}
+}
+
+int main() {
+	SharedMemory_config config;
+	memset(&config, 0, sizeof(config));
+	config.capacity = 4 * 1024 * 1024;
+	SharedMemory_handle sm = ip_CreateSharedMemoryHostEx((char*) "queuebench", &config);
+	if (sm == NULL) {
+		printf("creating shared memory failed.\n");
+		return IP_ERROR;
+	}
+
+	int sizes[] = { 8, 64, 256 };
+	int numSizes = sizeof(sizes) / sizeof(sizes[0]);
+	int failed = 0;
+
+	printf("mode, message_bytes, messages, msgs_per_s, mb_per_s, out_of_order\n");
+	int s = 0;
+	int batched = 0;
+	for (batched = 0; batched <= 1; ++batched) {
+		for (s = 0; s < numSizes; ++s) {
+			char queueName[IP_FIELD_NAME_SIZE];
+			snprintf(queueName, sizeof(queueName), "queue_%d_%d", batched, sizes[s]);
+			Queue_handle queue = NULL;
+			if (ip_CreateQueue(sm, queueName, CAPACITY, MAX_MESSAGE, &queue) != IP_SUCCESS) {
+				printf("creating %s failed.\n", queueName);
+				ip_CloseSharedMemory(sm);
+				return IP_ERROR;
+			}
+
+			double t0 = nowNs();
+			pid_t pid = fork();
+			if (pid == 0)
+				_exit(consume(queueName, batched) ? 1 : 0);
+			produce(queue, sizes[s], batched);
+			int status = 0;
+			waitpid(pid, &status, 0);
+			double seconds = (nowNs() - t0) / 1e9;
+
+			int bad = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+			failed |= bad;
+			printf("%s, %d, %d, %.0f, %.1f, %d\n", batched ? "batch" : "single", sizes[s],
+					MESSAGES, MESSAGES / seconds, MESSAGES * (double) sizes[s] / seconds / 1e6, bad);
+			ip_CloseQueue(queue);
+			ip_ClearField(sm, queueName);
+		}
+	}
+
+	ip_CloseSharedMemory(sm);
+	return failed ? IP_ERROR : IP_SUCCESS;
+}
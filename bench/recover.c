@@ -0,0 +1,157 @@
+/*
+ * recover.c
+ *
+ * Kills a writer halfway through an update and measures how long the next process
+ * takes to get past it, checking what it finds there. A forked child starts writing
+ * a field with ip_BeginWrite(), scribbles over the value and is killed with SIGKILL
+ * before ip_CommitWrite(); the parent then reads the field, which takes over the
+ * dead writer's lock and rolls its write back:
+ *
+ *  small  a small value overwritten in place comes back as it was
+ *  grown  a value moved to a bigger block comes back in its old block
+ *  large  a large value overwritten in place can't be restored, and comes back empty
+ *  lock   a child dies holding the shared memory lock, and the next one to take the
+ *         lock gets it anyway
+ *  churn  fields are created and cleared over and over, queues as well as values
+ *         written twice in one batch, and never run the heap dry
+ *
+ * Run it: bin/recoverbench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/interprocess.h"
+
+#define LARGE 1000
+#define CHURN 200000 /* enough rounds to use up the heap if any of them leaks */
+
+static double nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Fork a child that begins writing size bytes of 0xff to field and dies before
+ * committing, and wait for it to be gone.
+ */
+static void dieWriting(SharedMemory_handle sm, char* field, int size) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		void* data = NULL;
+		if (ip_BeginWrite(sm, field, size, &data) == IP_SUCCESS)
+			memset(data, 0xff, size);
+		raise(SIGKILL);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+/*
+ * Write value to field, have a child die writing size bytes to it, then time reading
+ * it back. Returns the time taken in ns, and leaves the size read in size.
+ */
+static double recoverField(SharedMemory_handle sm, char* field, void* value, int valueSize,
+		int* size, void* data) {
+	ip_WriteValue(sm, field, value, valueSize);
+	dieWriting(sm, field, *size);
+
+	double t0 = nowNs();
+	int ret = ip_ReadValue(sm, field, data);
+	double t1 = nowNs();
+	if (ret != IP_SUCCESS || ip_GetValueSize(sm, field, size) != IP_SUCCESS)
+		*size = -1;
+	return t1 - t0;
+}
+
+int main() {
+	SharedMemory_handle sm = ip_CreateSharedMemoryHost((char*) "recoverbench");
+	if (sm == NULL) {
+		printf("setting up failed.\n");
+		return IP_ERROR;
+	}
+	ip_SetSharedMemoryLockWaitTime(sm, 1000);
+	int failures = 0;
+	char data[LARGE];
+
+	/** Small value, overwritten in place **/
+	int small = 42;
+	int size = sizeof(int);
+	double ns = recoverField(sm, (char*) "small", &small, sizeof(int), &size, data);
+	int ok = (size == sizeof(int) && memcmp(data, &small, sizeof(int)) == 0);
+	printf("small: recovered in %.1f us, value %s\n", ns / 1e3, ok ? "restored" : "WRONG");
+	failures += !ok;
+
+	/** Small value, moved to a bigger block **/
+	size = LARGE;
+	ns = recoverField(sm, (char*) "grown", &small, sizeof(int), &size, data);
+	ok = (size == sizeof(int) && memcmp(data, &small, sizeof(int)) == 0);
+	printf("grown: recovered in %.1f us, value %s\n", ns / 1e3, ok ? "restored" : "WRONG");
+	failures += !ok;
+
+	/** Large value, overwritten in place: lost **/
+	char large[LARGE];
+	memset(large, 7, LARGE);
+	size = LARGE;
+	ns = recoverField(sm, (char*) "large", large, LARGE, &size, data);
+	ok = (size == 0);
+	printf("large: recovered in %.1f us, value %s\n", ns / 1e3, ok ? "emptied" : "WRONG");
+	failures += !ok;
+
+	/** The field is usable again **/
+	ok = (ip_WriteValue(sm, (char*) "large", large, LARGE) == IP_SUCCESS
+			&& ip_ReadValue(sm, (char*) "large", data) == IP_SUCCESS
+			&& memcmp(data, large, LARGE) == 0);
+	printf("large: rewritten %s\n", ok ? "fine" : "WRONG");
+	failures += !ok;
+
+	/** Shared memory lock **/
+	pid_t pid = fork();
+	if (pid == 0) {
+		if (AcquireLock(sm) == IP_SUCCESS)
+			raise(SIGKILL);
+		_exit(1);
+	}
+	waitpid(pid, NULL, 0);
+	double t0 = nowNs();
+	int ret = AcquireLock(sm);
+	double t1 = nowNs();
+	if (ret == IP_SUCCESS)
+		ReleaseLock(sm);
+	ok = (ret == IP_SUCCESS && ip_WriteValue(sm, (char*) "after", &small, sizeof(int)) == IP_SUCCESS);
+	printf("lock: taken over in %.1f us, %s\n", (t1 - t0) / 1e3, ok ? "fine" : "WRONG");
+	failures += !ok;
+
+	/** Create and clear fields until a leak would have used up the heap **/
+	int round = 0;
+	ok = 1;
+	for (round = 0; round < CHURN && ok; ++round) {
+		Queue_handle queue;
+		ok = (ip_CreateQueue(sm, (char*) "churn", 4, sizeof(int), &queue) == IP_SUCCESS);
+		if (ok) {
+			ip_CloseQueue(queue);
+			ok = (ip_ClearField(sm, (char*) "churn") == IP_SUCCESS);
+		}
+
+		/* moved to a bigger block and back again under the same lock */
+		Field_value twice[2] = {
+			{ (char*) "twice", { 0, 0 }, large, LARGE, 0 },
+			{ (char*) "twice", { 0, 0 }, &small, sizeof(int), 0 }
+		};
+		ok = ok && ip_WriteValue(sm, (char*) "twice", &small, sizeof(int)) == IP_SUCCESS
+				&& ip_WriteValues(sm, twice, 2) == IP_SUCCESS
+				&& ip_ClearField(sm, (char*) "twice") == IP_SUCCESS
+				&& ip_WriteValues(sm, twice, 2) == IP_SUCCESS
+				&& ip_ClearField(sm, (char*) "twice") == IP_SUCCESS;
+	}
+	printf("churn: %d rounds of creating and clearing, %s\n", round, ok ? "fine" : "WRONG");
+	failures += !ok;
+
+	ip_CloseSharedMemory(sm);
+	return failures ? IP_ERROR : IP_SUCCESS;
+}
@@ -0,0 +1,159 @@
+/*
+ * ring.c
+ *
+ * Measures how fast the writer of a broadcast ring appends messages as readers
+ * are added. The host writes MESSAGES messages of MESSAGE_SIZE bytes as fast as it
+ * can while 0, 1, 2 and 4 forked readers follow it. Every message carries its
+ * number, and each reader checks that what it reads (plus what it was told it lost
+ * when lapped) adds up to the full sequence.
+ *
+ * Run it on a quiet machine: bin/ringbench
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/interprocess.h"
+
+#define MESSAGES 2000000
+#define CAPACITY 4096
+#define MESSAGE_SIZE 64
+#define MAX_READERS 8
+#define STOP 0xffffffffu
+
+static double nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Follow the ring until the stop message, checking the numbering.
+ * Exits with 1 if a message was out of order.
+ */
+static int follow(char* ringName, int* ready) {
+	SharedMemory_handle sm = ip_CreateSharedMemoryClient((char*) "ringbench");
+	Ring_handle reader = NULL;
+	if (sm == NULL || ip_OpenRingReader(sm, ringName, &reader) != IP_SUCCESS) {
+		printf("opening %s failed.\n", ringName);
+		return 1;
+	}
+	__atomic_add_fetch(ready, 1, __ATOMIC_RELEASE);
+
+	char data[MESSAGE_SIZE];
+	unsigned int expected = 0;
+	unsigned int read = 0;
+	unsigned int lostTotal = 0;
+	int bad = 0;
+	for (;;) {
+		int size = 0;
+		unsigned int lost = 0;
+		int ret = ip_RingRead(reader, data, &size, &lost);
+		if (ret == IP_BUSY) {
+			sched_yield();
+			continue;
+		}
+		if (ret == IP_LAPPED) {
+			expected += lost;
+			lostTotal += lost;
+			continue;
+		}
+		unsigned int number = 0;
+		memcpy(&number, data, sizeof(number));
+		if (number == STOP)
+			break;
+		if (number != expected)
+			bad++;
+		expected = number + 1;
+		read++;
+	}
+	if (read + lostTotal != MESSAGES)
+		bad++;
+	ip_CloseRing(reader);
+	ip_CloseSharedMemory(sm);
+	return bad;
+}
+
+int main() {
+	SharedMemory_config config;
+	memset(&config, 0, sizeof(config));
+	config.capacity = 4 * 1024 * 1024;
+	SharedMemory_handle sm = ip_CreateSharedMemoryHostEx((char*) "ringbench", &config);
+	if (sm == NULL) {
+		printf("creating shared memory failed.\n");
+		return IP_ERROR;
+	}
+
+	/* readers count themselves in here once registered, so none misses the start */
+	int* ready = NULL;
+	int numReaders[] = { 0, 1, 2, 4 };
+	int numRuns = sizeof(numReaders) / sizeof(numReaders[0]);
+	int failed = 0;
+
+	printf("readers, messages, writes_per_s, ns_per_write, max_lag, out_of_order\n");
+	int run = 0;
+	for (run = 0; run < numRuns; ++run) {
+		char ringName[IP_FIELD_NAME_SIZE];
+		snprintf(ringName, sizeof(ringName), "ring_%d", numReaders[run]);
+		Ring_handle writer = NULL;
+		if (ip_CreateRing(sm, ringName, CAPACITY, MESSAGE_SIZE, MAX_READERS, &writer) != IP_SUCCESS
+				|| ip_BeginWrite(sm, (char*) "ready", sizeof(int), (void**) &ready) != IP_SUCCESS) {
+			printf("creating %s failed.\n", ringName);
+			ip_CloseSharedMemory(sm);
+			return IP_ERROR;
+		}
+		*ready = 0;
+		ip_CommitWrite(sm);
+
+		pid_t pids[MAX_READERS];
+		int k = 0;
+		for (k = 0; k < numReaders[run]; ++k) {
+			pids[k] = fork();
+			if (pids[k] == 0)
+				_exit(follow(ringName, ready) ? 1 : 0);
+		}
+		while (__atomic_load_n(ready, __ATOMIC_ACQUIRE) < numReaders[run])
+			sched_yield();
+
+		char data[MESSAGE_SIZE];
+		memset(data, 0, sizeof(data));
+		unsigned int maxLag = 0;
+		unsigned int lags[MAX_READERS];
+		unsigned int n = 0;
+		double t0 = nowNs();
+		for (n = 0; n < MESSAGES; ++n) {
+			memcpy(data, &n, sizeof(n));
+			ip_RingWrite(writer, data, sizeof(data));
+			if ((n & 1023) == 0) {
+				int r = ip_GetRingReaders(writer, lags, MAX_READERS);
+				for (k = 0; k < r && k < MAX_READERS; ++k)
+					maxLag = (lags[k] > maxLag) ? lags[k] : maxLag;
+			}
+		}
+		double elapsed = nowNs() - t0;
+
+		/* readers stop at this one, which is never overwritten as it is the last */
+		n = STOP;
+		memcpy(data, &n, sizeof(n));
+		ip_RingWrite(writer, data, sizeof(data));
+
+		int bad = 0;
+		for (k = 0; k < numReaders[run]; ++k) {
+			int status = 0;
+			waitpid(pids[k], &status, 0);
+			bad += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+		}
+		failed |= bad;
+		printf("%d, %d, %.0f, %.1f, %u, %d\n", numReaders[run], MESSAGES,
+				MESSAGES / (elapsed / 1e9), elapsed / MESSAGES, maxLag, bad);
+		ip_CloseRing(writer);
+		ip_ClearField(sm, ringName);
+	}
+
+	ip_CloseSharedMemory(sm);
+	return failed ? IP_ERROR : IP_SUCCESS;
+}
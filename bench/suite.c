@@ -0,0 +1,342 @@
+/*
+ * suite.c
+ *
+ * Headless benchmark suite, for tracking the cost of the basic operations from one
+ * release to the next. The process hosts a shared memory, and forks client processes
+ * that open it like any other client and hammer it for a while. Each operation
+ * is timed, and the suite reports latency percentiles and total throughput for these
+ * workloads:
+ *
+ *  read          ip_ReadValue() of a random field
+ *  write         ip_WriteValue() of a random field
+ *  mixed         90% reads, 10% writes
+ *  createdelete  ip_WriteValue() of a new field then ip_ClearField() of it, as one operation
+ *
+ * Starting from a baseline (2 clients, 64 fields of 4 bytes, no Read Time Delay, the
+ * default lock wait time), every workload is run again with one parameter changed at
+ * a time: the value size (up to IP_FIELD_DATA_CONTAINER_SIZE), the number of fields,
+ * the number of clients, the Read Time Delay and the lock wait time.
+ *
+ * Usage: bin/benchsuite [--duration ms] [--csv file] [--json file]
+ * Writes CSV to stdout unless told otherwise; "make bench" writes bin/bench.csv and
+ * bin/bench.json.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/interprocess.h"
+
+#define MAX_CLIENTS 8
+#define MAX_SAMPLES 1000000
+#define DEFAULT_DURATION_MS 200
+#define DEFAULT_LOCK_WAIT_MS 4 /* what the library waits for a lock unless told otherwise */
+
+enum { READ, WRITE, MIXED, CREATEDELETE, NUM_WORKLOADS };
+static const char* workloadNames[NUM_WORKLOADS] = { "read", "write", "mixed", "createdelete" };
+
+/* What one run does */
+struct Run_t {
+	int workload;
+	int clients;
+	int fields;
+	int valueSize;
+	int readTimeDelay_ms;
+	int lockWaitTime_ms;
+};
+
+/* What it measured */
+struct Result_t {
+	long long ops;
+	long long errors;
+	double seconds;
+	long long p50, p99, p999, max; /* ns */
+};
+
+/* filled in by the clients, in memory shared with the parent */
+struct Shared_t {
+	int ready;
+	int go;
+	long long end;
+	long long ops[MAX_CLIENTS];
+	long long errors[MAX_CLIENTS];
+	long long samples[MAX_CLIENTS][MAX_SAMPLES];
+};
+
+static long long nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare(const void* a, const void* b) {
+	long long x = *(const long long*) a;
+	long long y = *(const long long*) b;
+	return (x > y) - (x < y);
+}
+
+static unsigned int nextRandom(unsigned int* state) {
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+/*
+ * One client: open the shared memory, wait for the start, then run the workload
+ * until the end time, recording how long every operation took.
+ */
+static int client(struct Shared_t* shared, struct Run_t* run, int me) {
+	/* keep the library's chatter out of the results */
+	if (freopen("/dev/null", "w", stdout) == NULL)
+		return 1;
+	SharedMemory_handle sm = ip_CreateSharedMemoryClient((char*) "benchsuite");
+	char* value = (char*) malloc(IP_FIELD_DATA_CONTAINER_SIZE);
+	if (sm == NULL || value == NULL)
+		return 1;
+	ip_SetSharedMemoryReadRefractoryPeriodTimeDelay(sm, run->readTimeDelay_ms);
+	ip_SetSharedMemoryLockWaitTime(sm, run->lockWaitTime_ms);
+	memset(value, me, run->valueSize);
+	unsigned int random = 2463534242u + me;
+	char name[IP_FIELD_NAME_SIZE];
+
+	__atomic_add_fetch(&(shared->ready), 1, __ATOMIC_RELEASE);
+	while (!__atomic_load_n(&(shared->go), __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	long long n = 0;
+	long long errors = 0;
+	for (;;) {
+		long long t0 = nowNs();
+		if (t0 > shared->end)
+			break;
+		int ret = IP_SUCCESS;
+		int op = run->workload;
+		if (op == MIXED)
+			op = (nextRandom(&random) % 10 == 0) ? WRITE : READ;
+		if (op == CREATEDELETE) {
+			snprintf(name, sizeof(name), "new_%d_%lld", me, n);
+			ret = ip_WriteValue(sm, name, value, run->valueSize);
+			if (ret == IP_SUCCESS)
+				ret = ip_ClearField(sm, name);
+		} else {
+			snprintf(name, sizeof(name), "field_%u", nextRandom(&random) % run->fields);
+			if (op == READ)
+				ret = ip_ReadValue(sm, name, value);
+			else
+				ret = ip_WriteValue(sm, name, value, run->valueSize);
+		}
+		long long t1 = nowNs();
+		if (ret != IP_SUCCESS) {
+			errors++;
+			continue;
+		}
+		if (n < MAX_SAMPLES)
+			shared->samples[me][n] = t1 - t0;
+		n++;
+	}
+	shared->ops[me] = n;
+	shared->errors[me] = errors;
+	free(value);
+	ip_CloseSharedMemory(sm);
+	return 0;
+}
+
+/*
+ * Host the shared memory for one run, fork its clients and collect what they measured.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+static int runOne(struct Run_t* run, int duration_ms, struct Shared_t* shared, long long* all,
+		struct Result_t* result) {
+	/** Room for every field, with slack for the heap's size classes and for createdelete **/
+	SharedMemory_config config;
+	memset(&config, 0, sizeof(config));
+	long long bytes = (long long) (run->fields + 4 * MAX_CLIENTS) * 2 * run->valueSize
+			+ (4 << 20);
+	config.capacity = (bytes > IP_BUF_SIZE) ? (int) bytes : IP_BUF_SIZE;
+	config.maxNumFields = run->fields + 4 * MAX_CLIENTS;
+	SharedMemory_handle sm = ip_CreateSharedMemoryHostEx((char*) "benchsuite", &config);
+	if (sm == NULL)
+		return IP_ERROR;
+	char* value = (char*) calloc(1, run->valueSize);
+	char name[IP_FIELD_NAME_SIZE];
+	int k = 0;
+	for (k = 0; k < run->fields; ++k) {
+		snprintf(name, sizeof(name), "field_%d", k);
+		if (value == NULL || ip_WriteValue(sm, name, value, run->valueSize) != IP_SUCCESS) {
+			free(value);
+			ip_CloseSharedMemory(sm);
+			return IP_ERROR;
+		}
+	}
+	free(value);
+
+	memset(shared, 0, offsetof(struct Shared_t, samples));
+	fflush(NULL); /* or the clients would write out our buffered output once more */
+	pid_t pids[MAX_CLIENTS];
+	for (k = 0; k < run->clients; ++k) {
+		pids[k] = fork();
+		if (pids[k] == 0)
+			_exit(client(shared, run, k));
+	}
+	while (__atomic_load_n(&(shared->ready), __ATOMIC_ACQUIRE) < run->clients)
+		sched_yield();
+	long long start = nowNs();
+	shared->end = start + (long long) duration_ms * 1000000LL;
+	__atomic_store_n(&(shared->go), 1, __ATOMIC_RELEASE);
+	int failed = 0;
+	for (k = 0; k < run->clients; ++k) {
+		int status = 0;
+		waitpid(pids[k], &status, 0);
+		failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+	}
+	ip_CloseSharedMemory(sm);
+	if (failed)
+		return IP_ERROR;
+
+	/** Pool every client's samples **/
+	long long total = 0;
+	memset(result, 0, sizeof(struct Result_t));
+	for (k = 0; k < run->clients; ++k) {
+		long long kept = (shared->ops[k] < MAX_SAMPLES) ? shared->ops[k] : MAX_SAMPLES;
+		memcpy(all + total, shared->samples[k], sizeof(long long) * kept);
+		total += kept;
+		result->ops += shared->ops[k];
+		result->errors += shared->errors[k];
+	}
+	result->seconds = (double) (shared->end - start) / 1e9;
+	if (total > 0) {
+		qsort(all, total, sizeof(long long), compare);
+		result->p50 = all[total / 2];
+		result->p99 = all[total * 99 / 100];
+		result->p999 = all[total * 999 / 1000];
+		result->max = all[total - 1];
+	}
+	return IP_SUCCESS;
+}
+
+static void printCsv(FILE* out, struct Run_t* run, struct Result_t* r) {
+	fprintf(out, "%s,%d,%d,%d,%d,%d,%lld,%lld,%.0f,%lld,%lld,%lld,%lld\n",
+			workloadNames[run->workload], run->clients, run->fields, run->valueSize,
+			run->readTimeDelay_ms, run->lockWaitTime_ms, r->ops, r->errors,
+			(r->seconds > 0) ? r->ops / r->seconds : 0.0, r->p50, r->p99, r->p999, r->max);
+	fflush(out);
+}
+
+static void printJson(FILE* out, struct Run_t* run, struct Result_t* r, int first) {
+	fprintf(out, "%s\n    {\"workload\": \"%s\", \"clients\": %d, \"fields\": %d, "
+			"\"value_size\": %d, \"read_time_delay_ms\": %d, \"lock_wait_time_ms\": %d, "
+			"\"ops\": %lld, \"errors\": %lld, \"ops_per_s\": %.0f, "
+			"\"p50_ns\": %lld, \"p99_ns\": %lld, \"p999_ns\": %lld, \"max_ns\": %lld}",
+			first ? "" : ",", workloadNames[run->workload], run->clients, run->fields,
+			run->valueSize, run->readTimeDelay_ms, run->lockWaitTime_ms, r->ops, r->errors,
+			(r->seconds > 0) ? r->ops / r->seconds : 0.0, r->p50, r->p99, r->p999, r->max);
+}
+
+int main(int argc, char** argv) {
+	int duration_ms = DEFAULT_DURATION_MS;
+	FILE* csv = stdout;
+	FILE* json = NULL;
+	int a = 1;
+	for (a = 1; a < argc; ++a) {
+		if (strcmp(argv[a], "--duration") == 0 && a + 1 < argc) {
+			duration_ms = atoi(argv[++a]);
+		} else if (strcmp(argv[a], "--csv") == 0 && a + 1 < argc) {
+			csv = fopen(argv[++a], "w");
+		} else if (strcmp(argv[a], "--json") == 0 && a + 1 < argc) {
+			json = fopen(argv[++a], "w");
+		} else {
+			printf("usage: %s [--duration ms] [--csv file] [--json file]\n", argv[0]);
+			return IP_ERROR;
+		}
+		if (csv == NULL || duration_ms <= 0) {
+			printf("bad argument %s\n", argv[a]);
+			return IP_ERROR;
+		}
+	}
+
+	struct Shared_t* shared = (struct Shared_t*) mmap(NULL, sizeof(struct Shared_t),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	long long* all = (long long*) malloc(sizeof(long long) * MAX_CLIENTS * MAX_SAMPLES);
+	if (shared == MAP_FAILED || all == NULL) {
+		printf("setting up failed.\n");
+		return IP_ERROR;
+	}
+
+	/** The baseline, and the values each parameter takes in turn **/
+	struct Run_t baseline = { READ, 2, 64, 4, 0, DEFAULT_LOCK_WAIT_MS };
+	int sizes[] = { 256, 4096, IP_FIELD_DATA_CONTAINER_SIZE };
+	int fields[] = { 8, 1024 };
+	int clients[] = { 1, 4, MAX_CLIENTS };
+	int delays[] = { 1 };
+	int waits[] = { 1, 100 };
+
+	struct Run_t runs[NUM_WORKLOADS * 16];
+	int numRuns = 0;
+	int w = 0;
+	unsigned int k = 0;
+	for (w = 0; w < NUM_WORKLOADS; ++w) {
+		struct Run_t run = baseline;
+		run.workload = w;
+		runs[numRuns++] = run;
+		for (k = 0; k < sizeof(sizes) / sizeof(int); ++k) {
+			runs[numRuns] = run;
+			runs[numRuns++].valueSize = sizes[k];
+		}
+		for (k = 0; k < sizeof(fields) / sizeof(int); ++k) {
+			runs[numRuns] = run;
+			runs[numRuns++].fields = fields[k];
+		}
+		for (k = 0; k < sizeof(clients) / sizeof(int); ++k) {
+			runs[numRuns] = run;
+			runs[numRuns++].clients = clients[k];
+		}
+		for (k = 0; k < sizeof(delays) / sizeof(int); ++k) {
+			runs[numRuns] = run;
+			runs[numRuns++].readTimeDelay_ms = delays[k];
+		}
+		for (k = 0; k < sizeof(waits) / sizeof(int); ++k) {
+			runs[numRuns] = run;
+			runs[numRuns++].lockWaitTime_ms = waits[k];
+		}
+	}
+
+	fprintf(csv, "workload,clients,fields,value_size,read_time_delay_ms,lock_wait_time_ms,"
+			"ops,errors,ops_per_s,p50_ns,p99_ns,p999_ns,max_ns\n");
+	if (json != NULL)
+		fprintf(json, "{\n  \"duration_ms\": %d,\n  \"cpus\": %ld,\n  \"runs\": [", duration_ms,
+				sysconf(_SC_NPROCESSORS_ONLN));
+	int failures = 0;
+	int printed = 0;
+	int r = 0;
+	for (r = 0; r < numRuns; ++r) {
+		struct Result_t result;
+		if (runOne(&runs[r], duration_ms, shared, all, &result) != IP_SUCCESS) {
+			fprintf(stderr, "run %d (%s) failed\n", r, workloadNames[runs[r].workload]);
+			failures++;
+			continue;
+		}
+		printCsv(csv, &runs[r], &result);
+		if (json != NULL)
+			printJson(json, &runs[r], &result, printed == 0);
+		printed++;
+	}
+	if (json != NULL) {
+		fprintf(json, "\n  ]\n}\n");
+		fclose(json);
+	}
+	if (csv != stdout)
+		fclose(csv);
+
+	free(all);
+	munmap(shared, sizeof(struct Shared_t));
+	return failures ? IP_ERROR : IP_SUCCESS;
+}
@@ -0,0 +1,217 @@
+/*
+ * typed.cpp
+ *
+ * Measures what the C++ interface (interprocess.hpp) costs over the C functions:
+ * reading and writing a small struct by name, by Field_handle, through ip::Field,
+ * which resolves the field once and checks the size of every read, and through an
+ * ip::SchemaSegment, whose handles are compile time constants.
+ * Also checks that ip::Field refuses values of the wrong size, that the RAII
+ * types clean up after themselves, that a moved Segment keeps working, and that a
+ * client with a different schema is turned away.
+ *
+ * Run it on a quiet machine: bin/typedbench
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/interprocess.hpp"
+
+#define ITERATIONS 1000000
+
+struct Pose {
+	double x, y, theta;
+	unsigned int frame;
+};
+
+constexpr ip::Schema<int, Pose, double> telemetry = { { "mode", "pose", "gain" } };
+enum { MODE, POSE, GAIN };
+
+/* the same fields, but the gain became a float */
+constexpr ip::Schema<int, Pose, float> changed = { { "mode", "pose", "gain" } };
+
+static_assert(telemetry.hash() != changed.hash(), "the schemas should differ");
+
+static double nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main() {
+	ip::Segment segment = ip::Segment::host("typedbench");
+	if (!segment) {
+		printf("creating shared memory failed.\n");
+		return IP_ERROR;
+	}
+	int failures = 0;
+
+	/** Fill the shared memory with other fields, so that lookups by name have work to do **/
+	char name[IP_FIELD_NAME_SIZE];
+	int k = 0;
+	for (k = 0; k < 256; ++k) {
+		snprintf(name, sizeof(name), "other_%d", k);
+		ip_WriteValue(segment.get(), name, &k, sizeof(int));
+	}
+
+	ip::Field<Pose> pose = segment.field<Pose>("pose");
+	Pose p = { 1.0, 2.0, 0.5, 0 };
+	if (pose.write(p) != IP_SUCCESS) {
+		printf("writing pose failed.\n");
+		return IP_ERROR;
+	}
+	Field_handle handle = pose.handle();
+	char pname[] = "pose";
+
+	printf("access, read_ns, write_ns\n");
+
+	double t0 = nowNs();
+	for (k = 0; k < ITERATIONS; ++k)
+		ip_ReadValue(segment.get(), pname, &p);
+	double read = (nowNs() - t0) / ITERATIONS;
+	t0 = nowNs();
+	for (k = 0; k < ITERATIONS; ++k) {
+		p.frame = k;
+		ip_WriteValue(segment.get(), pname, &p, sizeof(Pose));
+	}
+	double write = (nowNs() - t0) / ITERATIONS;
+	printf("name, %.1f, %.1f\n", read, write);
+
+	t0 = nowNs();
+	for (k = 0; k < ITERATIONS; ++k)
+		ip_ReadValueByHandle(segment.get(), handle, &p);
+	read = (nowNs() - t0) / ITERATIONS;
+	t0 = nowNs();
+	for (k = 0; k < ITERATIONS; ++k) {
+		p.frame = k;
+		ip_WriteValueByHandle(segment.get(), handle, &p, sizeof(Pose));
+	}
+	write = (nowNs() - t0) / ITERATIONS;
+	printf("handle, %.1f, %.1f\n", read, write);
+
+	t0 = nowNs();
+	for (k = 0; k < ITERATIONS; ++k)
+		pose.read(p);
+	read = (nowNs() - t0) / ITERATIONS;
+	t0 = nowNs();
+	for (k = 0; k < ITERATIONS; ++k) {
+		p.frame = k;
+		pose.write(p);
+	}
+	write = (nowNs() - t0) / ITERATIONS;
+	printf("ip::Field, %.1f, %.1f\n", read, write);
+
+	/** Schema **/
+	ip::SchemaSegment<decltype(telemetry)> host =
+			ip::SchemaSegment<decltype(telemetry)>::host("typedschema", telemetry);
+	if (!host) {
+		printf("creating shared memory with a schema failed.\n");
+		return IP_ERROR;
+	}
+	for (k = 0; k < 256; ++k) {
+		snprintf(name, sizeof(name), "other_%d", k);
+		ip_WriteValue(host.get(), name, &k, sizeof(int));
+	}
+	host.write<POSE>(p);
+	t0 = nowNs();
+	for (k = 0; k < ITERATIONS; ++k)
+		host.read<POSE>(p);
+	read = (nowNs() - t0) / ITERATIONS;
+	t0 = nowNs();
+	for (k = 0; k < ITERATIONS; ++k) {
+		p.frame = k;
+		host.write<POSE>(p);
+	}
+	write = (nowNs() - t0) / ITERATIONS;
+	printf("ip::SchemaSegment, %.1f, %.1f\n", read, write);
+
+	Schema_field fields[3];
+	telemetry.fields(fields);
+	if (ip_SchemaHash(fields, 3) != telemetry.hash()
+			|| ip_GetSchemaHash(host.get()) != telemetry.hash()) {
+		printf("schema hash at compile time and at run time: WRONG\n");
+		failures++;
+	}
+	ip::SchemaSegment<decltype(telemetry)> client =
+			ip::SchemaSegment<decltype(telemetry)>::client("typedschema", telemetry);
+	ip::SchemaSegment<decltype(changed)> stranger =
+			ip::SchemaSegment<decltype(changed)>::client("typedschema", changed);
+	int mode = 3;
+	int modeBack = 0;
+	if (!client || stranger || client.write<MODE>(mode) != IP_SUCCESS
+			|| host.read<MODE>(modeBack) != IP_SUCCESS || modeBack != 3) {
+		printf("opening with the same and another schema: WRONG\n");
+		failures++;
+	}
+	if (host.segment().clear("pose") != IP_ERROR || host.segment().clearAll() != IP_SUCCESS
+			|| host.read<MODE>(modeBack) != IP_SUCCESS || modeBack != 0
+			|| client.write<GAIN>(0.5) != IP_SUCCESS) {
+		printf("clearing the fields of a schema: WRONG\n");
+		failures++;
+	}
+
+	/** A value of the wrong size is never copied into a T **/
+	double big[8] = { 0 };
+	ip_WriteValue(segment.get(), pname, big, sizeof(big));
+	Pose untouched = { 7.0, 7.0, 7.0, 7 };
+	int ret = pose.read(untouched);
+	if (ret != IP_NO_MORE_ROOM || untouched.x != 7.0) {
+		printf("reading a larger value: %d, WRONG\n", ret);
+		failures++;
+	}
+	ip_WriteValue(segment.get(), pname, big, sizeof(double));
+	ret = pose.read(untouched);
+	if (ret != IP_ERROR || untouched.x != 7.0) {
+		printf("reading a smaller value: %d, WRONG\n", ret);
+		failures++;
+	}
+
+	/** A stale handle is resolved again **/
+	segment.clear("other_0"); /* moves the last field, pose, into its slot */
+	p.frame = 42;
+	Pose back = { 0, 0, 0, 0 };
+	if (pose.write(p) != IP_SUCCESS || pose.read(back) != IP_SUCCESS || back.frame != 42) {
+		printf("resolving a moved field again: WRONG\n");
+		failures++;
+	}
+
+	/** Views, lock guards and in-place writes **/
+	{
+		ip::InPlaceWrite w(segment, "built", 3);
+		if (w)
+			memcpy(w.bytes().data(), "abc", 3);
+	}
+	ip::View view;
+	if (segment.view("built", view) != IP_SUCCESS || view.size() != 3
+			|| memcmp(view.data(), "abc", 3) != 0 || !view.valid()) {
+		printf("in-place write and view: WRONG\n");
+		failures++;
+	}
+	{
+		ip::LockGuard lock(segment);
+		if (!lock)
+			failures++;
+	}
+	ip::LockGuard again(segment); /* would time out had the first guard not let go */
+	if (!again) {
+		printf("lock guard did not release the lock: WRONG\n");
+		failures++;
+	}
+	again.unlock();
+
+	/** A queue closes itself, and a moved segment keeps working **/
+	{
+		ip::Queue queue;
+		if (ip_CreateQueue(segment.get(), (char*) "jobs", 16, 64, queue.out()) != IP_SUCCESS)
+			failures++;
+	}
+	ip::Segment moved = std::move(segment);
+	if (segment || moved.field<Pose>("pose").read(back) != IP_SUCCESS) {
+		printf("moved segment: WRONG\n");
+		failures++;
+	}
+
+	printf("%s\n", failures ? "FAILED" : "all checks passed");
+	return failures ? IP_ERROR : IP_SUCCESS;
+}
@@ -5,9 +5,14 @@
  *      Author: andy
  */
 
-#include <conio.h>
 #include <stdio.h>
 
+#ifdef _WIN32
+#include <conio.h>
+#else
+#define getch getchar
+#endif
+
 #include "../src/interprocess.h"
 
 int main(){
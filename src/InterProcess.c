@@ -25,12 +25,35 @@
  *
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
 #include <windows.h>
 #include <conio.h>
 #include <tchar.h>
-#include <string.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define IP_HAVE_STREAMING_STORES
+#endif
 
 #include "interprocess.h"
 
@@ -39,25 +62,384 @@
 /** Time in ms a client thread should wait for a mutex to become available **/
 #define IP_WAIT_FOR_MUTEX_AVAILABILITY 4
 
-/** Default refactory period (time delay) for client reads in ms**/
+/**
+ * Default refactory period (time delay) for client reads in ms.
+ * The POSIX lock is fair by itself (see ticketLock()), so there is none there.
+ **/
+#ifdef _WIN32
 #define IP_DEFAULT_REFRACTORY_PERIOD 5
+#else
+#define IP_DEFAULT_REFRACTORY_PERIOD 0
+#endif
+
+/** Number of optimistic attempts a reader makes before falling back to the lock **/
+#define IP_SEQLOCK_MAX_RETRIES 64
+
+/** Same for ip_Snapshot(), each attempt of which copies every value **/
+#define IP_SNAPSHOT_MAX_RETRIES 4
+
+/** Records of a snapshot start on multiples of this **/
+#define IP_SNAPSHOT_ALIGN 8
+
+/** Number of times a writer spins on a busy field lock before it starts yielding the CPU **/
+#define IP_FIELD_LOCK_SPINS 100
+
+/** Number of times a waiter for the shared memory lock spins before it sleeps in the kernel **/
+#define IP_LOCK_SPINS 200
+
+/** Number of waiters of the shared memory lock that sleep apart from each other, see ticketLock() **/
+#define IP_LOCK_SLOTS 64
+
+/** How often (in ns) a waiter checks that the holder of a lock is still alive **/
+#define IP_OWNER_CHECK_NS 1000000LL
+
+/** Returned by lockWord() when the lock was taken over from a process that died holding it **/
+#define IP_OWNER_DIED 2
+
+/** How to roll back the write in progress on a field, should its writer die, see repairField() **/
+#define IP_UNDO_NONE 0 /* no write in progress */
+#define IP_UNDO_BLOCK 1 /* the new value goes to a new block; the old block is kept until the end */
+#define IP_UNDO_COPY 2 /* the old value is overwritten in place, and a copy is kept in undoData */
+#define IP_UNDO_LOST 3 /* the old value is overwritten in place, and too large to keep */
+
+/** Largest old value kept aside while it is overwritten in place **/
+#define IP_UNDO_SIZE 32
+
+/*
+ * Atomic helpers for the sequence counters that let readers work without the lock.
+ * A sequence counter is odd while a writer is in the middle of an update.
+ */
+#define IP_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define IP_LOAD_RELAXED(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define IP_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define IP_STORE_RELAXED(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#if defined(__i386__) || defined(__x86_64__)
+#define IP_CPU_RELAX() __builtin_ia32_pause()
+#else
+#define IP_CPU_RELAX() do { } while (0)
+#endif
+
+/** Marks shared memory that a host has finished laying out ("IPC1") **/
+#define IP_MAGIC 0x31435049
+
+/**
+ * Version of the layout of the shared data, recorded in it so that a host never takes
+ * over a file laid out by another version of the library. Bump it whenever
+ * SharedData_t, field_t or any of the tables change.
+ **/
+#define IP_LAYOUT_VERSION 1
+
+/** Alignment of the tables that make up the shared data **/
+#define IP_LAYOUT_ALIGN 64
+#define IP_ALIGN_UP(x, a) ((((x) + (a) - 1) / (a)) * (a))
+
+/*
+ * Field values live in a heap at the end of the shared memory. The heap is cut into
+ * slabs and every slab is carved into blocks of one size class. Size classes are the
+ * powers of two from IP_MIN_BLOCK_SIZE up to the slab size, which is the largest value
+ * a field may hold rounded up to a power of two, but never less than a page.
+ */
+#define IP_MIN_BLOCK_SIZE 8
+#define IP_MIN_SLAB_SIZE 4096
+#define IP_MAX_SIZE_CLASSES 32
+
+/*
+ * Blocks larger than a slab are runs of whole slabs. The first slab of a run is marked
+ * IP_SLAB_RUN and counts the slabs of the run in usedBlocks, the rest are IP_SLAB_RUN_TAIL.
+ */
+#define IP_SLAB_UNUSED -1
+#define IP_SLAB_RUN -2
+#define IP_SLAB_RUN_TAIL -3
+
+/** Size of a cache line; data written by different processes is kept this far apart **/
+#define IP_CACHE_LINE 64
+
+/** Statistics are kept unless built with -DIP_ENABLE_STATS=0, see ip_GetStats() **/
+#ifndef IP_ENABLE_STATS
+#define IP_ENABLE_STATS 1
+#endif
+
+/** Number of copies of the statistics, processes add to the one picked by their id **/
+#define IP_STATS_STRIPES 16
+
+/*
+ * Add to a statistics counter; nothing at all without IP_ENABLE_STATS.
+ * IP_STAT_BUMP() skips the locked instruction, so of two processes bumping the same
+ * counter at the same moment one may be lost. Counters of fields are bumped, see fieldStats_t.
+ */
+#if IP_ENABLE_STATS
+#define IP_STAT_ADD(p, n) __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+#define IP_STAT_BUMP(p) IP_STORE_RELAXED((p), IP_LOAD_RELAXED(p) + 1)
+#else
+#define IP_STAT_ADD(p, n) do { } while (0)
+#define IP_STAT_BUMP(p) do { } while (0)
+#endif
+
+/** Huge page backing: where hugetlbfs is mounted, and the size its files are rounded up to **/
+#define IP_HUGETLBFS_DIR "/dev/hugepages"
+#define IP_HUGE_PAGE_SIZE (2 * 1024 * 1024)
 
 /*
  * A field is the term I use for a variable that is stored in shared memory.
+ * The value itself is stored in a block of the heap; everything in shared memory
+ * is referred to by its offset from the start of the shared memory, never by pointer,
+ * because every process maps the shared memory at a different address.
  */
 struct field_t {
-	char name[IP_FIELD_NAME_SIZE];
-	char data[IP_FIELD_DATA_CONTAINER_SIZE];
+	unsigned int seq; /* sequence counter, odd while a writer holds the field's lock */
+	unsigned int hash; /* hash of the name, see hashFieldName() */
+	unsigned int generation; /* bumped whenever the slot starts or stops holding a field */
+	unsigned int waiters; /* processes blocked in ip_WaitForFieldChange() on this field */
 	int size; /* Size of data container used for data*/
+	int offset; /* offset of the data block, 0 if the field has none */
+	int capacity; /* size of the data block */
+	int kind; /* IP_KIND_VALUE, or the kind of object the data block holds */
+	int history; /* offset of the field's history_t, 0 if it keeps no history */
+	char name[IP_FIELD_NAME_SIZE];
+	unsigned int writer; /* pid of the process holding the field's lock, 0 if none */
+	int undo; /* IP_UNDO_*, how to roll back the write in progress */
+	int undoOffset; /* the block, capacity and size of the value before the write in progress */
+	int undoCapacity;
+	int undoSize;
+	char undoData[IP_UNDO_SIZE];
+};
+
+/*
+ * One copy of the statistics of the shared memory, see ip_GetStats().
+ * Every process adds to the stripe picked by its id, so that processes busy at the same
+ * time rarely write to the same cache line; ip_GetStats() adds the stripes up.
+ */
+struct statsStripe_t {
+	unsigned long long reads;
+	unsigned long long writes;
+	unsigned long long misses;
+	unsigned long long busy;
+	unsigned long long lockWait[IP_STATS_BUCKETS];
+	unsigned long long lockHold[IP_STATS_BUCKETS];
+	char pad[IP_CACHE_LINE - ((4 + 2 * IP_STATS_BUCKETS) * sizeof(unsigned long long)) % IP_CACHE_LINE];
+};
+
+/*
+ * How often the field in a slot of the field table was read and written. Kept apart
+ * from the field table, so that counting a read never writes to the cache line that
+ * other readers check the field's sequence counter on. Every process shares these,
+ * so they are bumped without a locked instruction and may miss the odd concurrent
+ * access; the totals in the stripes are exact.
+ */
+struct fieldStats_t {
+	unsigned long long reads;
+	unsigned long long writes;
+};
+
+/*
+ * A single-producer/single-consumer queue, kept in the data block of a field of kind
+ * IP_KIND_QUEUE. head is only written by the consumer and tail only by the producer,
+ * and each sits on a cache line of its own so the two processes never write to the
+ * same line. Both count messages from the start and wrap around freely; the slot of
+ * message n is n & (capacity - 1). The slots follow the header.
+ * Each slot holds the length of its message as an int, then the message itself.
+ */
+struct queue_t {
+	int capacity; /* number of slots, a power of two */
+	int slotSize; /* bytes per slot */
+	int maxMessageSize; /* largest message a slot holds */
+	char pad0[IP_CACHE_LINE - 3 * sizeof(int)];
+	unsigned int head; /* messages popped so far, written by the consumer */
+	char pad1[IP_CACHE_LINE - sizeof(unsigned int)];
+	unsigned int tail; /* messages pushed so far, written by the producer */
+	char pad2[IP_CACHE_LINE - sizeof(unsigned int)];
+};
+
+/*
+ * A broadcast ring, kept in the data block of a field of kind IP_KIND_RING.
+ * One writer appends messages and never waits for anyone; every reader follows at
+ * its own pace with a cursor of its own. The writer numbers messages from the start,
+ * wrapping around freely, and message n goes in slot n & (capacity - 1), overwriting
+ * whatever was there. The header is followed by the reader table and then the slots.
+ */
+struct ring_t {
+	int capacity; /* number of slots, a power of two */
+	int slotSize; /* bytes per slot, header included */
+	int maxMessageSize; /* largest message a slot holds */
+	int maxReaders; /* number of entries in the reader table */
+	char pad0[IP_CACHE_LINE - 4 * sizeof(int)];
+	unsigned int tail; /* messages written so far, written by the writer */
+	char pad1[IP_CACHE_LINE - sizeof(unsigned int)];
+};
+
+/*
+ * An entry of a ring's reader table, one cache line per reader.
+ * The cursor is only published for the writer to see how far behind readers are;
+ * the writer never waits for it.
+ */
+struct ringReader_t {
+	unsigned int pid; /* of the process with the reader open, 0 if the entry is free */
+	unsigned int cursor; /* number of the next message the reader will read */
+	char pad[IP_CACHE_LINE - 2 * sizeof(unsigned int)];
+};
+
+/*
+ * The header of a slot of a ring. seq is the slot's own sequence counter, odd while
+ * the writer fills the slot, so readers can tell when a message was overwritten
+ * while they copied it. The message follows.
+ */
+struct ringSlot_t {
+	unsigned int seq;
+	unsigned int number; /* number of the message in the slot */
+	int length; /* size of the message */
+	int pad;
+};
+
+/*
+ * A triple-buffered frame, kept in the data block of a field of kind IP_KIND_FRAME.
+ * At any time the writer owns one buffer (back), the reader owns another (front) and
+ * the third holds the latest frame published. state is the index of that third buffer,
+ * with IP_FRAME_NEW set until the reader takes it. Publishing swaps the back buffer
+ * into state and taking a frame swaps the front buffer in, each with a single atomic
+ * exchange, so neither side ever waits for the other.
+ * The header is followed by the three buffers, each starting with a frameBuffer_t.
+ */
+struct frame_t {
+	int maxFrameSize; /* largest frame a buffer holds */
+	int bufferSize; /* bytes per buffer, header included */
+	unsigned int reader; /* pid of the process with the reader open, 0 if none */
+	unsigned int back; /* buffer the writer fills next */
+	unsigned int front; /* buffer the reader holds */
+	char pad0[IP_CACHE_LINE - 3 * sizeof(int) - 2 * sizeof(unsigned int)];
+	unsigned int state; /* buffer with the latest frame, and IP_FRAME_NEW */
+	char pad1[IP_CACHE_LINE - sizeof(unsigned int)];
+};
+
+/*
+ * The header of a frame buffer
+ */
+struct frameBuffer_t {
+	unsigned int number; /* number of the frame in the buffer, 0 if none yet */
+	int size; /* size of the frame */
+	char pad[IP_CACHE_LINE - 2 * sizeof(int)];
+};
+
+/** The bits of frame_t.state **/
+#define IP_FRAME_INDEX 3
+#define IP_FRAME_NEW 4
+
+/*
+ * A blob, kept in the data block of a field of kind IP_KIND_BLOB. This is only the
+ * description: the payload lives in a shared memory object of its own, named after
+ * the shared memory and the field (see blobPath()), which every process maps once.
+ * The field's sequence counter guards the payload like it guards a value.
+ */
+struct blob_t {
+	int capacity; /* size of the payload's shared memory object */
+	int size; /* size of the payload */
+	int flags; /* IP_BLOB_HUGE_PAGES, IP_BLOB_PREFAULT, IP_BLOB_STREAMING */
+	int hugePages; /* the payload is in hugetlbfs (or on Windows large pages) */
+};
+
+/*
+ * The history of a field: the last depth values written to it, kept in a heap block
+ * of its own. Version n (counting from 1) goes in entry (n - 1) % depth. Each entry
+ * is a historyEntry_t followed by the value.
+ */
+struct history_t {
+	int depth; /* number of entries */
+	int entrySize; /* bytes per entry, header included */
+	int maxValueSize; /* largest value an entry holds */
+	unsigned int count; /* versions written so far */
+};
+
+/*
+ * The header of an entry of a field's history. seq is 0 while the entry is being
+ * rewritten, so a reader can tell that the version it copied was replaced meanwhile.
+ */
+struct historyEntry_t {
+	unsigned int seq; /* version held, counting from 1 */
+	int size; /* size of the value */
+	long long timestamp; /* when it was written, in ns on the monotonic clock */
+};
+
+/** Stride for touching every page of a mapping **/
+#define IP_PAGE_SIZE 4096
+
+/*
+ * A slab of the heap
+ */
+struct slab_t {
+	int sizeClass; /* size class the slab is carved into, or IP_SLAB_UNUSED, IP_SLAB_RUN, IP_SLAB_RUN_TAIL */
+	int usedBlocks; /* number of blocks handed out */
+	int carved; /* bytes at the start of the slab that have ever been handed out */
+	int freeList; /* offset of the first returned block, 0 if none. Each free block stores the next. */
+};
+
+/*
+ * Slab allocator for field values. Guarded by its own lock, which is always
+ * the last lock taken.
+ */
+struct heap_t {
+	unsigned int lock; /* pid of the process holding the heap lock, 0 if none */
+	int offset; /* offset of the first slab */
+	int numSlabs;
+	int slabSize; /* size of every slab, and of the largest size class */
+	int numSizeClasses;
+	int slabsOffset; /* offset of the table of numSlabs slab_t */
+	int partialSlab[IP_MAX_SIZE_CLASSES]; /* where to start looking for a free block of each class */
+};
+
+/*
+ * Where the waiters holding tickets t with the same t % IP_LOCK_SLOTS sleep
+ */
+struct ticketSlot_t {
+	unsigned int turn; /* bumped when one of the slot's tickets comes up */
+	unsigned int sleepers; /* number of waiters asleep on turn */
+	unsigned int skip; /* a ticket of the slot given up by a waiter that ran out of time, or 0 */
+};
+
+/*
+ * A fair lock that lives in shared memory: processes are served in the order they
+ * asked for the lock, each waiting for its ticket to come up. See ticketLock().
+ */
+struct ticketLock_t {
+	unsigned int next; /* next ticket to hand out */
+	char pad1[IP_CACHE_LINE - sizeof(unsigned int)];
+	unsigned int serving; /* ticket holding the lock */
+	unsigned int damaged; /* set when a process died holding the lock, see repairLayout() */
+	unsigned long long owner; /* pid of the holder in the high half, its ticket in the low half */
+	char pad2[IP_CACHE_LINE - 2 * sizeof(unsigned int) - sizeof(unsigned long long)];
+	struct ticketSlot_t slots[IP_LOCK_SLOTS];
 };
 
 /*
  * Shared data type that will ultimately be stored in shared memory
+ *
+ * This header sits at the very start of the shared memory and records its geometry,
+ * so that a client can find everything without knowing how the host was configured.
+ * The tables that follow it are located by their offsets.
  */
 struct SharedData_t {
+	unsigned int magic; /* IP_MAGIC once the host has laid out the shared data */
+	int layoutVersion; /* IP_LAYOUT_VERSION of the library that laid it out */
+	int clean; /* nonzero once the host has closed it; only means anything for a file */
+	int bufferSize; /* size of the whole shared memory in bytes */
 	int maxNumFields; /* max number of fields in the shared data */
+	int maxValueSize; /* largest value a single field can hold */
+	int hugePages; /* the shared memory is backed by huge pages */
+	/*
+	 * Open addressing hash index (linear probing) from name hash to field, indexSize buckets.
+	 * Each bucket holds the field's position in the field table plus one; 0 marks an empty bucket.
+	 */
+	int indexSize; /* a power of two, at least twice maxNumFields */
+	int indexOffset;
+	int fieldsOffset; /* offset of the table of maxNumFields field_t */
 	int usedFields;
-	struct field_t fields[(IP_BUF_SIZE / sizeof(struct field_t)) - 1];
+	unsigned int layoutSeq; /* sequence counter, odd while fields are added, moved or removed */
+	int schemaFields; /* fields of the schema, in slots 0 to schemaFields - 1 for good */
+	unsigned long long schemaHash; /* ip_SchemaHash() of the schema, 0 if none */
+	int statsOffset; /* offset of IP_STATS_STRIPES statsStripe_t, then maxNumFields fieldStats_t */
+#ifndef _WIN32
+	struct ticketLock_t lock; /* lock guarding the shared data */
+#endif
+	struct heap_t heap;
+	/* the field index, the field table, the statistics, the slab table and the heap follow */
 };
 
 /*
@@ -66,27 +448,137 @@ struct SharedData_t {
 struct SharedMemory_t {
 
 	/* Properties of the Shared Memory */
-	char name[IP_MAX_MEM_NAME_LENGTH];
+	char name[IP_MAX_MEM_NAME_LENGTH]; /* the name, or for a file the key derived from its path */
+	char path[IP_MAX_MEM_NAME_LENGTH]; /* the file that holds the shared memory, empty if none */
+	int syncPolicy; /* the host's IP_SYNC_NONE or IP_SYNC_ON_CLOSE, for a file */
+	int ownsFile; /* the host of a file, which marks it clean on close */
 	int BufferSize;
 	int ReadTimeDelay;
 
 	/* Application Level Data */
 	struct SharedData_t* sd; /* pointer to the location of the shared data  (eventually will be pBuf)*/
 
+#ifdef _WIN32
 	/* Windows Level File Mapping **/
+	HANDLE hFile; /* the file that holds the shared memory, if any */
 	HANDLE hMapFile; /* handle to mapped file of the shared memroy */
 	LPCTSTR pBuf; /* pointer to location of shared memory */
 
 	/* Mutex Locking Properties */
 	HANDLE ghMutex; /*  mutex  indicates who has a lock on the data */
-	DWORD lockWaitTime; /* number of ms to wait for lock */
+#else
+	/* POSIX Level Shared Memory Object **/
+	int fd; /* file descriptor returned by shm_open(), or of the hugetlbfs file or sm->path */
+	void* pBuf; /* pointer to location of shared memory */
+	int isHost; /* the host unlinks the shared memory object on close */
+#endif
+	int hugePages; /* the mapping is backed by huge pages */
+	int readOnly; /* the mapping is read-only, see ip_CreateSharedMemoryObserver() */
+	/*
+	 * The shared data of a handle from ip_CreateSharedMemoryObserver(). sd stays NULL
+	 * for such a handle, so every call that could write to the shared memory turns it away.
+	 */
+	struct SharedData_t* observed;
+	struct field_t* reserved; /* field locked by ip_BeginWrite() until ip_CommitWrite() */
+	long long lockWaitTime; /* number of ns to wait for lock */
+	long long lockTakenNs; /* when this process took the shared memory lock, for the statistics */
+
+};
+
+/*
+ * What an object handle knows of the field its object lives in, to tell whether the
+ * object is still there, see checkObject(). header holds the first headerInts ints of
+ * the object's header in shared memory, its geometry.
+ */
+struct objectRef_t {
+	struct field_t* f; /* the field's slot */
+	unsigned int generation;
+	char name[IP_FIELD_NAME_SIZE];
+	int kind;
+	int offset; /* of the object's data block */
+	int header[4];
+	int headerInts;
+};
+
+/*
+ * Local object for one end of a queue in shared memory.
+ * Each end remembers the last index it saw of the other end, so that it only has
+ * to read the other end's cache line when the queue looks full (or empty).
+ */
+struct Queue_t {
+	SharedMemory_handle sm;
+	struct objectRef_t ref; /* the queue's field */
+	struct queue_t* q; /* the queue in shared memory */
+	char* slots; /* first slot of the queue */
+	unsigned int mask; /* capacity - 1 */
+	int slotSize;
+	int maxMessageSize;
+	unsigned int cachedHead; /* the producer's last look at head */
+	unsigned int cachedTail; /* the consumer's last look at tail */
+};
+
+/*
+ * Local object for the writer or one of the readers of a broadcast ring.
+ */
+struct Ring_t {
+	SharedMemory_handle sm;
+	struct objectRef_t ref; /* the ring's field */
+	struct ring_t* r; /* the ring in shared memory */
+	struct ringReader_t* readers; /* the ring's reader table */
+	char* slots; /* first slot of the ring */
+	unsigned int mask; /* capacity - 1 */
+	int slotSize;
+	int maxMessageSize;
+	int maxReaders;
+	int reader; /* entry of the reader table held, or -1 for the writer */
+	unsigned int cursor; /* the next message to write, or to read */
+};
+
+/*
+ * Local object for the writer or the reader of a triple-buffered frame.
+ */
+struct Frame_t {
+	SharedMemory_handle sm;
+	struct objectRef_t ref; /* the frame's field */
+	struct frame_t* fr; /* the frame in shared memory */
+	char* buffers; /* first of the three buffers */
+	int bufferSize;
+	int maxFrameSize;
+	int isReader;
+	unsigned int index; /* the buffer owned: back for the writer, front for the reader */
+	unsigned int published; /* frames published so far (writer only) */
+	int held; /* the reader holds the front buffer until ip_ReleaseFrame() */
+};
 
+/*
+ * Local object for a blob, with this process's mapping of its payload.
+ */
+struct Blob_t {
+	SharedMemory_handle sm;
+	char name[IP_FIELD_NAME_SIZE]; /* name of the blob's field */
+	char* base; /* the payload, mapped into this process */
+	int capacity; /* largest payload */
+	int mapSize; /* size of the mapping, capacity rounded up to huge pages */
+	int flags;
+	int hugePages;
+	int isOwner; /* the creator removes the payload's name on close */
+	struct field_t* reserved; /* field locked by ip_BeginBlobWrite() until ip_CommitBlobWrite() */
+#ifdef _WIN32
+	HANDLE hMapFile;
+#else
+	int fd;
+#endif
 };
 
 /*
  *  Tries to acquire a lock by waiting until the mutex is released.
  *  The function will wait the amount of time specified in the SharedMemory object
- *  (the default is 4ms).
+ *  (the default is 4ms). On POSIX the lock is fair: processes get it in the order
+ *  they asked for it.
+ *
+ *  The lock guards the layout of the shared memory: while it is held no fields
+ *  can be added or removed. Values of existing fields are protected by a lock of
+ *  their own, so they can still be written by other processes.
  *
  *  This function returns
  *  0 IP_SUCCESS
@@ -115,844 +607,6403 @@ int zeroField(struct field_t* field);
  * Create Shared Memory Object
  *
  */
-SharedMemory_handle createSharedMemoryObj(char* name, HANDLE hMapFile,
-		LPCTSTR pBuf);
+SharedMemory_handle createSharedMemoryObj(char* name);
 
 /*
- * Create Shared Data chunk.
- * This returns a pointer to a chunk of data that is to be stored in shared memory.
+ * Check whether the name of a shared memory is the path of a file that holds it:
+ * whether it has a slash in it (or a backslash, on Windows).
  */
-struct SharedData_t* createSharedData();
+int isFilePath(const char* name);
 
 /*
- * destroy Shared Data chunkc
+ * Create (host) or open (client) the operating system's named shared memory,
+ * or the file sm->path, and map it into this process.
+ * The host creates size bytes, on huge pages if hugePages is set and the system
+ * allows it (size may then be rounded up). A file is only resized, so whatever it
+ * held is still there. A client maps however much the host created,
+ * read-only if sm->readOnly is set.
+ * Either way sm->BufferSize holds the size of the mapping afterwards.
+ * Returns IP_SUCCESS or IP_ERROR.
  */
-int destroySharedData(SharedData_t* sd);
+int mapSharedMemory(SharedMemory_handle sm, int create, int size, int hugePages);
 
 /*
- * Do a simple sanity check on the Shared Data Struct
+ * Unmap and close the operating system's named shared memory.
  */
-int verifySharedDataStruct(SharedData_t* sd);
+int unmapSharedMemory(SharedMemory_handle sm);
 
 /*
- * Create field
- * (uses malloc() to allocate memory for field..
- * Don't forget to call destroyField()
- *
- * Returns NULL if there is an error.
+ * Write the first size bytes of the shared memory out to the file that holds it,
+ * and wait until they are on disk.
+ * Returns IP_SUCCESS or IP_ERROR.
  */
-struct field_t* createField(char* name);
-
-int destroyField(struct field_t** f);
+int flushSharedMemory(SharedMemory_handle sm, int size);
 
 /*
- * Adds a field to a shared data struct.
- * If a field of the same name already exists, that field is overwritten
- * The data object is full, the function returns IP_NO_MORE_ROOM, -3
- * Otherwise the function returns IP_ERROR -1, or IP_SUCCES 0.
+ * Create the lock that guards the shared data.
+ * On Windows this is a named mutex, on POSIX a fair ticket lock
+ * living inside the shared data itself (see ticketLock()), reset only if create is
+ * nonzero: clients, and a host taking over a kept file, leave it as it is.
+ * Returns IP_SUCCESS or IP_ERROR.
  */
-int addFieldToSharedData(struct field_t* f, struct SharedData_t* sd);
+int createLock(SharedMemory_handle sm, int create);
 
 /*
- * Deletes a field to from a shared data struct given the field name.
- * Internally, this function moves the last field into the place of the
- * deleted field so that all used fields are contiguous.
- *
- * If the field does not exist, returns IP_ERROR -1
- * Otherwise, IP_SUCCES 0.
+ * Sleep the calling thread for time_ms milliseconds
  */
-int deleteFieldFromSharedData(char* name, struct SharedData_t* sd);
+void sleepMs(int time_ms);
 
+#ifndef _WIN32
 /*
- * Write data to a field
+ * Build the name of the shared memory object: a POSIX shared memory name, or
+ * with hugetlbfs set, the path of the file in hugetlbfs that stands in for it.
  */
-int writeField(struct field_t* f, void *data, int dataSize);
+void shmPath(SharedMemory_handle sm, int hugetlbfs, char* path, int length);
 
 /*
- * Copy a field
- * IP_SUCCESS
- * IP_ERROR
- *
+ * Forget the cached id of the process, in a child just after fork()
  */
-int copyField(struct field_t* dest, struct field_t* src);
-
-/*********************************************************************************/
-/*********************************************************************************/
-/* 			P R I V A T E      F U N C T I O N S                                 */
-/*********************************************************************************/
-/*********************************************************************************/
+void forgetProcessId();
+#endif
 
 /*
- * Zero a field
+ * Give up the rest of the calling thread's time slice
  */
-int zeroField(struct field_t* field) {
-	memset(field->name, '\0', sizeof(char) * IP_FIELD_NAME_SIZE );
-	memset(field->data, '\0', sizeof(char) * IP_FIELD_DATA_CONTAINER_SIZE );
-	return IP_SUCCESS;
-}
+void yieldThread();
 
 /*
- * Create field
- * (uses malloc() to allocate memory for field..
- * Don't forget to call destroyField()
- *
- * Returns NULL if there is an error.
+ * Nanoseconds on a monotonic clock
  */
-struct field_t* createField(char* name) {
-	if (strlen(name) > IP_FIELD_NAME_SIZE) {
-		printf("Field name is too long in createField().\n");
-		return NULL;
-	}
-
-	struct field_t* f = (struct field_t*) malloc(sizeof(struct field_t));
-	strncpy(f->name, name, IP_FIELD_NAME_SIZE - 1);
-	f->name[IP_FIELD_NAME_SIZE - 1] = '\0';
-	return f;
-}
+long long monotonicNs();
 
-int destroyField(struct field_t** f) {
-	if (*f == NULL) {
-		return IP_SUCCESS;
-	}
-	zeroField(*f);
-	free(*f);
-	*f = NULL;
-	return IP_SUCCESS;
-}
+/*
+ * Nanoseconds since 1970 (UTC) on the wall clock
+ */
+long long wallClockNs();
 
 /*
- * Copy a field
- * IP_SUCCESS
- * IP_ERROR
- *
+ * Block until *word may no longer hold value, for at most timeout_ns
+ * (forever if timeout_ns is negative). May return early, so check again.
+ * wakeWord() wakes everyone blocked on word, in any process.
  */
-int copyField(struct field_t* dest, struct field_t* src) {
-	if (dest == NULL || src == NULL)
-		return IP_ERROR;
-	if (strlen(src->name) > IP_FIELD_NAME_SIZE) {
-		printf("Src field name is too long in copyField().\n");
-		return IP_ERROR;
-	}
+void waitOnWord(unsigned int* word, unsigned int value, long long timeout_ns);
+void wakeWord(unsigned int* word);
 
-	zeroField(dest);
+/*
+ * The id of the calling process, as recorded in the locks it holds
+ */
+unsigned int processId();
 
-	strncpy(dest->name, src->name, IP_FIELD_NAME_SIZE - 1);
-	dest->name[IP_FIELD_NAME_SIZE - 1] = '\0';
-	memcpy(dest->data, src->data, src->size);
-	dest->size = src->size;
-	return IP_SUCCESS;
-}
+/*
+ * Check whether the process with the given id is still running.
+ * A process that has exited but not yet been reaped by its parent counts as running.
+ */
+int processAlive(unsigned int pid);
 
 /*
- * Write data to a field
+ * Initialize the Shared Data chunk in place.
+ * sd points to the start of the mapped shared memory, which is bufferSize bytes long.
+ * The tables are laid out to hold what config asks for (no member may be zero).
+ * Returns IP_ERROR if that does not fit.
  */
-int writeField(struct field_t* f, void *data, int dataSize) {
-	if (f == NULL)
-		return IP_DOES_NOT_EXIST;
+int initSharedData(struct SharedData_t* sd, int bufferSize, SharedMemory_config* config);
 
-	/** To be valid the field must have a legitimate name **/
-	if (f->name == NULL) {
-		printf("ERROR: name is null in writeField()\n");
-		return IP_ERROR;
-	}
-	if (strlen(f->name) == 0) {
-		printf("ERROR: name has two few characters\n");
-		return IP_ERROR;
-	}
+/*
+ * Fill in the members the caller left at zero with the defaults.
+ * src may be NULL, meaning all defaults.
+ */
+void resolveConfig(SharedMemory_config* dest, SharedMemory_config* src);
 
-	/** "delete" the current data in the field **/
-	f->size = 0;
+/*
+ * Check whether the file a host just mapped holds shared data it can take over as it
+ * is: laid out by this version of the library with the geometry and schema of config,
+ * and closed cleanly by the last host. Says why not, unless the file is new.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int keptSharedData(SharedMemory_handle sm, SharedMemory_config* config);
 
-	/** Copy in the new data **/
-	memcpy(f->data, data, dataSize);
-	f->size = dataSize;
-	return IP_SUCCESS;
-}
+/*
+ * Take over the shared data in a file kept from an earlier host (see keptSharedData()):
+ * clear the blobs whose payloads went away with their creators, and mark it in use.
+ * Must be called with the shared memory lock held.
+ */
+void reopenSharedData(SharedMemory_handle sm);
 
 /*
- * Find field of a given name in a shared Data Struct
+ * Let go of the shared data in a file as its host: write it out as sm->syncPolicy
+ * asks, then mark it clean, so that the next host takes it over as it is.
  */
-int findField(struct field_t** f, struct SharedData_t* sd, char* name) {
-	if (name == NULL)
-		return IP_ERROR;
-	if (strlen(name) == 0)
-		return IP_ERROR;
-	if (verifySharedDataStruct(sd) == IP_ERROR)
-		return IP_ERROR;
+void closeSharedData(SharedMemory_handle sm);
 
-	int k = 0;
-	for (k = 0; k < sd->usedFields; ++k) {
-		if (strncmp(name, sd->fields[k].name, IP_FIELD_NAME_SIZE - 1) == 0) {
-			/** Found a match! **/
-			*f = &(sd->fields[k]);
-			return IP_SUCCESS;
-		}
+/*
+ * Create the fields of a schema in slots 0, 1, ... of a shared data being initialized.
+ * Returns IP_ERROR if the schema is invalid, or IP_NO_MORE_ROOM.
+ */
+int addSchemaFields(struct SharedData_t* sd, const Schema_field* schema, int count);
 
-	}
-	return IP_DOES_NOT_EXIST;
-}
+/*
+ * Give field k of the schema a zeroed value of size bytes, and put it in the index.
+ * Returns IP_SUCCESS or IP_NO_MORE_ROOM.
+ */
+int fillSchemaField(struct SharedData_t* sd, int k, int size);
 
 /*
- * Adds a field to a shared data struct.
- * If a field of the same name already exists, that field is overwritten
- * The data object is full, the function returns IP_NO_MORE_ROOM, -3
- * Otherwise the function returns IP_ERROR -1, or IP_SUCCES 0.
+ * Locate the tables of the shared data
+ *  fieldAt() returns the field in slot k of the field table.
+ *  fieldSlot() returns the slot of a field in the field table.
+ *  fieldIndex() returns the buckets of the field index.
+ *  slabAt() returns slab k of the heap.
  */
-int addFieldToSharedData(struct field_t* f, struct SharedData_t* sd) {
-	if (verifySharedDataStruct(sd) == IP_ERROR) {
-		printf("ERROR: shared data struct is invalid in addFieldToSharedData()");
-		return IP_ERROR;
-	}
-	if (f->name == NULL) {
-		printf("ERROR: name is null in addFieldToSharedData()");
-		return IP_ERROR;
-	}
+struct field_t* fieldAt(struct SharedData_t* sd, int k);
+int fieldSlot(struct SharedData_t* sd, struct field_t* f);
+int* fieldIndex(struct SharedData_t* sd);
+struct slab_t* slabAt(struct SharedData_t* sd, int k);
 
-	struct field_t * dest_f = NULL;
-	if (findField(&dest_f, sd, f->name) == IP_SUCCESS) {
-		/** a field with that name already exists, so let's replace it **/
-		copyField(dest_f, f);
-	} else {
-		/** A field of that name doesn't already exist.**/
-		/** Let's see if we have room **/
-		if (sd->usedFields < sd->maxNumFields) {
-			/** there is room **/
+/*
+ * The shared data of a handle, whether it may write to it or only look at it
+ * (see ip_CreateSharedMemoryObserver()). NULL if there is none.
+ */
+struct SharedData_t* observedData(SharedMemory_handle sm);
 
-			/** write to the n+1th field **/
-			int ret = copyField(&(sd->fields[sd->usedFields]), f);
-			printf(
-					"In shared memory, *(sd->fields[sd->usedFields].data)is %d\n",
-					(int) *(sd->fields[sd->usedFields].data));
+/*
+ * Statistics, see ip_GetStats()
+ *  statsStripe() returns the stripe the calling process adds to.
+ *  fieldStatsAt() returns the counters of the field in slot k.
+ *  countRead() and countWrite() count a read or a write of the field in slot k,
+ *  countMiss() a read of a field that does not exist and countBusy() a lock that
+ *  was not taken in time. They do nothing without IP_ENABLE_STATS.
+ */
+struct statsStripe_t* statsStripe(struct SharedData_t* sd);
+struct fieldStats_t* fieldStatsAt(struct SharedData_t* sd, int k);
+void countRead(struct SharedData_t* sd, int k);
+void countWrite(struct SharedData_t* sd, int k);
+void countMiss(struct SharedData_t* sd);
+void countBusy(struct SharedData_t* sd);
 
-			(sd->usedFields)++; /** important! increment # of fields used **/
-			if (ret == IP_ERROR)
-				printf("unable to copy field in addFieldToSharedData()\n");
+/*
+ * Time the shared memory lock for the statistics. Pass the statsClock() from before
+ * asking for the lock to countLockWait(), along with what asking returned;
+ * countLockHold() counts how long the lock was held, just before it is released.
+ * Without IP_ENABLE_STATS none of them looks at the clock.
+ */
+long long statsClock();
+void countLockWait(SharedMemory_handle sm, long long start, int ret);
+void countLockHold(SharedMemory_handle sm);
 
-			return ret;
+/*
+ * The bucket of the lock time histograms that ns nanoseconds go in, see SharedMemory_stats
+ */
+int statsBucket(long long ns);
 
-		} else {
-			/** no more room **/
-			return IP_NO_MORE_ROOM;
-		}
+/*
+ * Keep the counters of the fields in step with the field table: clearFieldStats()
+ * zeroes those of slot k, and moveFieldStats() carries those of slot from over to
+ * slot to, zeroing slot from. Must be called with the shared memory lock held.
+ */
+void clearFieldStats(struct SharedData_t* sd, int k);
+void moveFieldStats(struct SharedData_t* sd, int from, int to);
 
-	}
+/*
+ * Do a simple sanity check on the Shared Data Struct
+ */
+int verifySharedDataStruct(SharedData_t* sd);
 
-}
+/*
+ * Give a field its name (and the hash of its name), clearing everything else.
+ * Returns IP_ERROR if the name is too long.
+ */
+int nameField(struct field_t* f, char* name);
 
 /*
- * Deletes a field to from a shared data struct given the field name.
- * Internally, this function moves the last field into the place of the
+ * Adds a field with the given name and the value in data to a shared data struct.
+ * If a field of the same name already exists, that field is overwritten
+ * If data is NULL, room for dataSize bytes is made but nothing is copied.
+ * If locked is not NULL, the field is left locked on success and stored in *locked,
+ * so the caller can finish it off before anyone sees it. Don't forget to unlockField() it.
+ * The data object is full, the function returns IP_NO_MORE_ROOM, -3
+ * If the field's lock could not be taken within waitTime_ns, returns IP_BUSY 1.
+ * Otherwise the function returns IP_ERROR -1, or IP_SUCCES 0.
+ * Must be called with the shared memory lock held.
+ */
+int addFieldToSharedData(char* name, void *data, int dataSize,
+		struct SharedData_t* sd, long long waitTime_ns, struct field_t** locked);
+
+/*
+ * Add a field like addFieldToSharedData(), of the given kind. A field for an object
+ * is given a zeroed block of dataSize bytes in one go, without the limits on values,
+ * and is never written over: if the name is taken, returns IP_ERROR.
+ */
+int insertField(char* name, int kind, void *data, int dataSize,
+		struct SharedData_t* sd, long long waitTime_ns, struct field_t** locked);
+
+/*
+ * Deletes a field to from a shared data struct given the field name.
+ * Internally, this function moves the last field into the place of the
  * deleted field so that all used fields are contiguous.
  *
- * If the field does not exist, returns IP_DOES_NOT_EXIST -2
- * Success IP_SUCCES 0.
- * Error IP_ERROR
+ * If the field does not exist, returns IP_ERROR -1
+ * If a field lock could not be taken within waitTime_ns, returns IP_BUSY 1.
+ * Otherwise, IP_SUCCES 0.
+ * Must be called with the shared memory lock held.
  */
-int deleteFieldFromSharedData(char* name, struct SharedData_t* sd) {
-	if (strlen(name) == 0)
-		return IP_ERROR;
-	if (verifySharedDataStruct(sd) == IP_ERROR)
-		return IP_ERROR;
-	if (sd->usedFields == 0)
-		return IP_DOES_NOT_EXIST; /** nothing to delete **/
-
-	struct field_t* dest_f = NULL; /** field to delete **/
+int deleteFieldFromSharedData(char* name, struct SharedData_t* sd, long long waitTime_ns);
 
-	if (findField(&dest_f, sd, name) == IP_SUCCESS) {
-		/* delete the data in that field */
-		zeroField(dest_f);
-		if (sd->usedFields > 1) { /** If there is more than one field present **/
-			/** copy the field in last place into the place where the deleted field was. **/
-			writeField(dest_f, sd->fields[sd->usedFields - 1].data,
-					sd->fields[sd->usedFields - 1].size);
+/*
+ * Write data to a field in shared memory, moving the value to a block of a
+ * different size class if it no longer fits its current one.
+ * If data is NULL the field is only made dataSize bytes long, for the caller to fill in.
+ * Must be called with the field's lock held.
+ * A field that keeps a history records the new value in it, unless data is NULL.
+ * Returns IP_SUCCESS, IP_ERROR (value too large, or the field is not a plain value)
+ * or IP_NO_MORE_ROOM (heap full).
+ */
+int writeField(struct SharedData_t* sd, struct field_t* f, void *data, int dataSize);
 
-			/** Clear the last field **/
-			zeroField(&(sd->fields[sd->usedFields - 1]));
-		}
-		(sd->usedFields)--;
+/*
+ * Give a field a data block of at least size bytes, keeping its current block if
+ * that is already the right size. The contents are not preserved.
+ * The old block is freed, unless it is the one kept for undoing the write: that one
+ * is left for finishUndo() to free.
+ * Must be called with the field's lock held.
+ * Returns IP_SUCCESS or IP_NO_MORE_ROOM.
+ */
+int allocField(struct SharedData_t* sd, struct field_t* f, int size);
 
-	} else {
-		return IP_DOES_NOT_EXIST;
-	}
-}
+/*
+ * Copy the value of a field in shared memory into data.
+ * The field's offset and size are checked against the heap first, so this is
+ * safe to call without the field's lock (the copy may then be torn, of course).
+ * Nothing is copied if the value is larger than capacity bytes; pass a negative
+ * capacity if data is known to be large enough.
+ * Returns the number of bytes copied, IP_ERROR if the field is not a plain value,
+ * or IP_NO_MORE_ROOM if the value does not fit.
+ */
+int readField(struct SharedData_t* sd, struct field_t* f, void *data, int capacity);
 
 /*
- * and when you write the delete function,
- * swap in the nth' field for the field you are deleting
- * (unless of course you happen to be deleting the n'th field)
- *
+ * Where the value of a field is: what loadValueRef() takes down from the field.
  */
+struct valueRef_t {
+	int kind;
+	int offset;
+	int size;
+	unsigned int generation;
+};
 
 /*
- * Create Shared Memory Object
- *
+ * Take down where the value of a field is, for copyValue() to copy it from.
+ * Without the field's lock this may be torn, or belong to a field that has since been
+ * moved into the slot, so a lock-free reader checks the sequence counters (and the
+ * generation) again before copying: the size is then that of the field asked for, and
+ * no larger value is copied into a buffer meant for it.
  */
-SharedMemory_handle createSharedMemoryObj(char* name, HANDLE hMapFile,
-		LPCTSTR pBuf) {
-	/* Create Local Shared Memory Object to Store Information */
-	SharedMemory_handle sm = (SharedMemory_handle) malloc(
-			sizeof(struct SharedMemory_t));
+void loadValueRef(struct field_t* f, struct valueRef_t* ref);
 
-	/* Initialize the Local Shared Memory Object */
-	strncpy(sm->name, name, IP_MAX_MEM_NAME_LENGTH - 1);
-	sm->name[IP_MAX_MEM_NAME_LENGTH - 1] = '\0';
-	sm->BufferSize = IP_BUF_SIZE;
-	sm->ReadTimeDelay = IP_DEFAULT_REFRACTORY_PERIOD;
-	sm->pBuf = pBuf;
-	sm->hMapFile = hMapFile;
-	sm->sd = NULL;
+/*
+ * Copy the value that ref points at into data, like readField().
+ */
+int copyValue(struct SharedData_t* sd, struct valueRef_t* ref, void *data, int capacity);
 
-	/** Create Mutex for Shared Memory **/
-	// Create a mutex with no initial owner
-	sm->ghMutex = NULL;
-	sm->lockWaitTime = 4;
+/*
+ * Locate the history of a field from the offset in its history member.
+ * Returns NULL unless the offset is that of a sane history within the heap, so an
+ * offset read without the field's lock is safe to follow.
+ */
+struct history_t* historyAt(struct SharedData_t* sd, int offset);
 
-	/* give the mutex the same name as the memory object but with the prefix "mutex_" */
-	char mutex_name[IP_MAX_MEM_NAME_LENGTH + 5];
-	strcpy(mutex_name, "mutex_");
-	strncat(mutex_name, name, IP_MAX_MEM_NAME_LENGTH - 1);
-	mutex_name[IP_MAX_MEM_NAME_LENGTH + 5 - 1] = '\0';
+/*
+ * Locate the entry of a history that holds (or held) version n
+ */
+struct historyEntry_t* historyEntry(struct history_t* h, unsigned int n);
 
-	sm->ghMutex = CreateMutex(NULL, // default security attributes
-			FALSE, // initially not owned
-			mutex_name); //mutex
+/*
+ * Record the field's current value as its next version in its history, if it keeps one.
+ * Must be called with the field's lock held.
+ */
+void appendHistory(struct SharedData_t* sd, struct field_t* f);
 
-	if (sm->ghMutex == NULL) {
-		printf("CreateMutex error: %d\n", GetLastError());
-	}
-	return sm;
-}
+/*
+ * Copy the versions of the history of field f newer than sinceSeq into out, up to max
+ * of them, and return how many were copied. Entries rewritten while being copied, or
+ * too large for their buffer in out, are skipped.
+ * Without the field's lock (locked 0) the history is checked to still be f's, and the
+ * layout to still be layout, before each copy; if either changed, returns
+ * IP_STALE_HANDLE for the caller to start over. Returns IP_ERROR if f keeps no history.
+ */
+int copyHistory(struct SharedData_t* sd, struct field_t* f, unsigned int layout, int locked,
+		unsigned int sinceSeq, History_entry* out, int max);
 
 /*
- * Destroy Shared memory and deallocate memory
- *
- * WARNING. This may destroy all data in shared memory.
+ * Locate a value of size bytes at offset in the heap.
+ * Returns NULL unless all of it lies within the heap, so an offset and size
+ * read without the field's lock are safe to follow.
  */
-int destroySharedMemoryObj(SharedMemory_handle sm) {
-	if (sm != NULL) {
-		sm->name[0] = '\0';
-		/*Close out the shared memory file */
-		if (sm->pBuf != NULL)
-			UnmapViewOfFile((PVOID) sm->pBuf);
-		if (sm->hMapFile != NULL)
-			CloseHandle(sm->hMapFile);
-		if (sm->ghMutex != NULL)
-			CloseHandle(sm->ghMutex);
-		free(sm);
-		sm = NULL;
-	}
-	return IP_SUCCESS;
-}
+char* valueAt(struct SharedData_t* sd, int offset, int size);
 
-/*************
- *
- * Create and Destroy Shared Data
+/*
+ * Copy a field's name and the reference to its value (not the value itself)
+ * IP_SUCCESS
+ * IP_ERROR
  *
  */
+int copyField(struct field_t* dest, struct field_t* src);
 
 /*
- * Create Shared Data chunk.
- * This returns a pointer to a chunk of data that is to be stored in shared memory.
+ * Slab allocator for field values.
+ *  initHeap() marks every slab of the heap unused.
+ *  heapAlloc() finds a block of at least size bytes and stores its offset and capacity.
+ *  Blocks larger than a slab are made of consecutive unused slabs.
+ *  Returns IP_SUCCESS or IP_NO_MORE_ROOM.
+ *  heapFree() returns the block at offset to the heap.
+ * The heap lock is taken internally and is always the last lock taken.
  */
-struct SharedData_t* createSharedData() {
-	struct SharedData_t* sdata = (struct SharedData_t*) malloc(
-			sizeof(struct SharedData_t));
-	if (sdata != NULL) {
-		sdata->usedFields = 0;
-		sdata->maxNumFields = (IP_BUF_SIZE / sizeof(struct field_t)) - 1;
-
-		/** Blank out the data with zeros **/
-		int k = 0;
-		for (k = 0; k < sdata->maxNumFields; ++k) {
-			/* clear field */
-			zeroField(&(sdata->fields[k]));
-		}
+void initHeap(struct SharedData_t* sd);
+int heapAlloc(struct SharedData_t* sd, int size, int* offset, int* capacity);
+int heapAllocRun(struct SharedData_t* sd, int size, int* offset, int* capacity);
+void heapFree(struct SharedData_t* sd, int offset);
 
-		/** Create the mutex **/
+/*
+ * Return the size class of the smallest block that holds size bytes
+ */
+int sizeClassOf(int size);
 
-	}
-	return sdata;
+/*
+ * Return the size of the block heapAlloc() hands out for size bytes:
+ * its size class, or for more than a slab, a whole number of slabs.
+ */
+int blockSizeOf(struct SharedData_t* sd, int size);
 
-}
 /*
- * destroy Shared Data chunk
+ * Take a lock word (holding the pid of the process that holds the lock, 0 when free),
+ * waiting up to waitTime_ns, or forever if waitTime_ns is negative.
+ * A lock whose holder died is taken over.
+ * Returns IP_SUCCESS, IP_BUSY or IP_OWNER_DIED (taken over: whatever the lock guards
+ * may have been left halfway through a change).
  */
-int destroySharedData(SharedData_t* sd) {
-	if (sd != NULL) {
-		/** Blank out the fields with zeros **/
-		sd->usedFields = 0;
-		int k = 0;
-		for (k = 0; k < sd->maxNumFields; ++k) {
-			/* clear field */
-			zeroField(&(sd->fields[k]));
-		}
+int lockWord(unsigned int* word, long long waitTime_ns);
+void unlockWord(unsigned int* word);
 
-	}
-	free(sd);
-	return IP_SUCCESS;
-}
+/*
+ * Claim a word holding the pid of the process that uses something, 0 when unused,
+ * taking it over if that process died. Never waits.
+ * Returns IP_SUCCESS, or IP_BUSY if a live process has it.
+ */
+int claimWord(unsigned int* word);
 
 /*
- * Do a simple sanity check on the Shared Data Struct
+ * Take a ticket lock, waiting up to waitTime_ns for it (not at all if waitTime_ns
+ * is not positive). Returns IP_SUCCESS or IP_BUSY.
+ * ticketUnlock() hands the lock to the next waiter in line.
  */
-int verifySharedDataStruct(SharedData_t* sd) {
-	if (sd->maxNumFields > 0) {
-		return IP_SUCCESS;
-	} else {
-		return IP_ERROR;
-	}
-}
+int ticketLock(struct ticketLock_t* lock, long long waitTime_ns);
+void ticketUnlock(struct ticketLock_t* lock);
 
-/********************
- *
- * Get Lock
- *
+/*
+ * If the holder of a ticket lock died with it, release the lock on its behalf and mark
+ * the lock damaged, for the next holder to repair what it guards.
+ * Returns nonzero if it did.
  */
+int releaseDeadTicket(struct ticketLock_t* lock);
 
 /*
- *  Tries to acquire a lock by waiting until the mutex is released.
- *  The function will wait the amount of time specified in the SharedMemory object
- *  (the default is 4ms).
+ * Per field writer lock.
+ * Taking the lock makes the field's sequence counter odd, releasing it makes it even
+ * again, so readers that see the counter change while they copy the field throw the
+ * copy away and try again.
  *
- *  This function returns
- *  0 IP_SUCCESS
- *  1 IP_BUSY
+ * lockField() waits up to waitTime_ns for another writer and returns IP_SUCCESS or IP_BUSY.
+ * If the writer died holding the lock, the lock is taken over and the write it was in
+ * the middle of rolled back (see repairField()).
+ * unlockField() publishes a changed field and wakes whoever waits for it to change.
+ * unlockFieldUnchanged() releases the lock of a field that was not modified, restoring
+ * the sequence counter so that concurrent readers do not have to retry.
  *
- *  Don't forget to call ReleaseLock()
+ * The lock order is: the shared memory lock (AcquireLock()) first, then field locks.
  */
-int AcquireLock(SharedMemory_handle sm) {
-	/*Try to Attain Mutex Lock */
-	if (sm->ghMutex == NULL) {
-		printf("DUDE! sm->ghMutex is null!\n");
+int lockField(struct SharedData_t* sd, struct field_t* f, long long waitTime_ns);
+void unlockField(struct SharedData_t* sd, struct field_t* f);
+void unlockFieldUnchanged(struct field_t* f);
 
-	}
-	// Request ownership of mutex.
-	DWORD dwWaitResult;
-	dwWaitResult = WaitForSingleObject(sm->ghMutex, // handle to mutex
-			sm->lockWaitTime); // no time-out interval
-	switch (dwWaitResult) {
-	// The thread got ownership of the mutex
-	case WAIT_OBJECT_0:
-		return IP_SUCCESS;
+/*
+ * Keep what it takes to roll back a write of a size byte value to a field, should this
+ * process die halfway through it: the old block if the value moves to a new one, else
+ * a copy of the old value if it is small. finishUndo() forgets it once the write is
+ * done, freeing the old block. A field written more than once under its lock keeps
+ * the record of the first write, which is what a rollback has to go back to.
+ * Must be called with the field's lock held.
+ */
+void beginUndo(struct SharedData_t* sd, struct field_t* f, int size);
+void finishUndo(struct SharedData_t* sd, struct field_t* f);
 
-		// The thread got ownership of an abandoned mutex
-	case WAIT_ABANDONED:
+/*
+ * Roll back the write a process was in the middle of when it died holding the
+ * field's lock. Must be called with the field's lock held.
+ */
+void repairField(struct SharedData_t* sd, struct field_t* f);
 
-		return IP_BUSY;
-	}
-}
+/*
+ * Put the layout right after a process died holding the shared memory lock halfway
+ * through adding or removing a field: drop empty and duplicate slots, rebuild the
+ * index and end the layout update. Must be called with the lock held.
+ */
+void repairLayout(struct SharedData_t* sd);
 
 /*
- * Tries to release the mutex. Returns IP_ERROR or IP_SUCCESS;
+ * Bracket a structural change of the shared data (adding, moving or removing fields).
+ * Must be called with the lock held.
  */
-int ReleaseLock(SharedMemory_handle sm) {
-	// Release ownership of the mutex object
-	if (!ReleaseMutex(sm->ghMutex)) {
-		printf("ERROR: Unable to release mutex\n");
-		return IP_ERROR;
-	} else {
-		return IP_SUCCESS;
-	}
+void beginLayoutUpdate(struct SharedData_t* sd);
+void endLayoutUpdate(struct SharedData_t* sd);
 
-}
+/*
+ * Read a field without taking the lock, using the sequence counters.
+ * Returns IP_SUCCESS, IP_DOES_NOT_EXIST, IP_ERROR,
+ * or IP_BUSY if writers kept interfering for IP_SEQLOCK_MAX_RETRIES attempts.
+ */
+int readFieldLockFree(struct SharedData_t* sd, char* name, void* data);
 
-/*********************************************************************************/
-/*********************************************************************************/
-/* 			P U B L I C        F U N C T I O N S                                 */
-/*********************************************************************************/
-/*********************************************************************************/
+/*
+ * Find the field a handle refers to.
+ * Returns IP_SUCCESS, IP_ERROR or IP_STALE_HANDLE. Safe to call without the lock,
+ * but then the generation must be checked again once the field has been copied.
+ */
+int findFieldByHandle(struct field_t** f, struct SharedData_t* sd, Field_handle handle);
 
-/*************
- *  Create and Destroy Shared Memory
- *
- *
+/*
+ * Read a field by handle without taking the lock, using the field's sequence counter.
+ * At most capacity bytes are copied (see readField()), and the size of the value is
+ * stored in *size unless size is NULL.
+ * Returns IP_SUCCESS, IP_ERROR, IP_STALE_HANDLE, IP_NO_MORE_ROOM (the value does not fit),
+ * or IP_BUSY if writers kept interfering for IP_SEQLOCK_MAX_RETRIES attempts.
  */
+int readHandleLockFree(struct SharedData_t* sd, Field_handle handle, void* data, int capacity,
+		int* size);
 
 /*
- * Start the shared memory host and create a shared memory object.
- * This is to be run on the host process.
+ * Block until the version of a field (by name, or else by handle) differs from
+ * lastVersion, for at most timeout_ns (forever if negative).
+ * Returns IP_SUCCESS with the new version in *version, IP_BUSY when the time is up,
+ * IP_DOES_NOT_EXIST, IP_STALE_HANDLE or IP_ERROR.
  */
-SharedMemory_handle ip_CreateSharedMemoryHost(char* name) {
-	/* Create NULL local shared memory object **/
-	SharedMemory_handle sm = NULL;
+int waitFieldChange(SharedMemory_handle sm, char* name, Field_handle* handle,
+		unsigned int lastVersion, long long timeout_ns, unsigned int* version);
 
-	HANDLE hMapFile;
-	LPCTSTR pBuf;
+/*
+ * A field taking part in a batch (ip_WriteValues(), ip_ReadValues()), with the
+ * sequence counter it had when it was read.
+ */
+struct batchSlot_t {
+	struct field_t* f;
+	unsigned int seq;
+};
 
-	/** Create file mapping **/
-	hMapFile = CreateFileMapping(INVALID_HANDLE_VALUE, // use paging file
-			NULL, // default security
-			PAGE_READWRITE, // read/write access
-			0, // maximum object size (high-order DWORD)
-			IP_BUF_SIZE, // maximum object size (low-order DWORD)
-			name); // name of mapping object
-	if (hMapFile == NULL) {
-		_tprintf(TEXT("Could not create file mapping object (%d).\n"),
-				GetLastError());
-		return sm;
-	}
+/*
+ * Return whether the first n slots of a batch already hold field f
+ * (a batch may name the same field twice).
+ */
+int batchHolds(struct batchSlot_t* slots, int n, struct field_t* f);
 
-	/* Create a buffer for the map opbject*/
-	pBuf = (LPTSTR) MapViewOfFile(hMapFile, // handle to map object
-			FILE_MAP_ALL_ACCESS, // read/write permission
-			0, 0, IP_BUF_SIZE);
+/*
+ * Find the field of a batch entry, by name or else by handle.
+ * Returns IP_SUCCESS, IP_ERROR, IP_DOES_NOT_EXIST or IP_STALE_HANDLE. Safe to call
+ * without the lock, but then the result must be checked like findField()'s.
+ */
+int findBatchField(struct field_t** f, struct SharedData_t* sd, Field_value* value);
 
-	if (pBuf == NULL) {
-		_tprintf(TEXT("Could not map view of file (%d).\n"), GetLastError());
+/*
+ * Read a batch without taking any lock, using the sequence counters.
+ * The values read are a consistent snapshot: no batch write is seen half done.
+ * Returns IP_SUCCESS once every entry has its status,
+ * or IP_BUSY if writers kept interfering for IP_SEQLOCK_MAX_RETRIES attempts.
+ */
+int readBatchLockFree(struct SharedData_t* sd, Field_value* values, int count,
+		struct batchSlot_t* slots);
 
-		CloseHandle(hMapFile);
+/*
+ * Copy the value of field f for a snapshot into data, which has room for capacity
+ * bytes, storing its size in *size and the version it had in *version. Nothing is
+ * locked. Without perValue this is a single try; with it, writers in the way are
+ * waited out for IP_SEQLOCK_MAX_RETRIES attempts.
+ * Returns IP_SUCCESS, IP_BUSY, IP_ERROR or IP_NO_MORE_ROOM (see readField()).
+ */
+int snapshotValue(struct SharedData_t* sd, struct field_t* f, char* data, int capacity,
+		int perValue, int* size, unsigned int* version);
 
-		return sm;
-	}
+/*
+ * Take a snapshot (see ip_Snapshot()) of the values in the shared data, into buffer,
+ * which is capacity bytes long, storing the bytes used, or needed, in *size.
+ * Nothing is locked. Without perValue the snapshot only holds if no value changed
+ * and no field moved while it was copied; with it, each value only has to be whole
+ * (see snapshotValue()) and no field may have moved. Otherwise it is IP_BUSY.
+ * Returns IP_SUCCESS, IP_BUSY or IP_NO_MORE_ROOM.
+ */
+int takeSnapshot(struct SharedData_t* sd, char* buffer, int capacity, int* size, int perValue);
 
-	/* Create Local Shared Memory Object to Store Information */
-	sm = createSharedMemoryObj(name, hMapFile, pBuf);
+/*
+ * Add a field called name holding a zeroed data block of bytes bytes for an object of
+ * the given kind, leaving it locked for the caller to set the object up. Don't forget
+ * to unlockField() it. Must be called with the shared memory lock held.
+ * Returns IP_SUCCESS, IP_ERROR (also if the name is taken), IP_BUSY or IP_NO_MORE_ROOM.
+ */
+int addObjectField(SharedMemory_handle sm, char* name, int kind, int bytes,
+		struct field_t** locked);
 
-	/* Create a Local Copy of the Shared Data Object (and mutex)*/
-	struct SharedData_t* local_sd = createSharedData();
+/*
+ * Find the field called name, which must hold an object of the given kind, and lock it.
+ * Don't forget to unlockFieldUnchanged() it.
+ * Returns IP_SUCCESS, IP_ERROR (also if the field holds something else), IP_BUSY
+ * or IP_DOES_NOT_EXIST.
+ */
+int lockObjectField(SharedMemory_handle sm, char* name, int kind, struct field_t** locked);
 
-	/*Try to Attain Mutex Lock */
-	if (AcquireLock(sm) == IP_SUCCESS) {
-		/* Copy the local copy of the Shared Data Object into Shared Memory */
-		CopyMemory((PVOID) pBuf, &local_sd, sizeof(local_sd));
-		// Release ownership of the mutex object
-		ReleaseLock(sm);
+/*
+ * Remember which field f, locked, holds the object whose header has headerInts ints
+ * of geometry, for checkObject().
+ */
+void setObjectRef(struct SharedData_t* sd, struct field_t* f, int headerInts,
+		struct objectRef_t* ref);
 
-		/* Update the Shared MEmory Obj to reflect that the local data is now in shared MEmory */
-		sm->sd = (SharedData_t*) pBuf;
+/*
+ * Check that the object an object handle was opened on is still in its field, so the
+ * handle's pointers into the heap are still good. An object moved to another slot by
+ * the clearing of another field is followed there. Cheap unless the slot changed.
+ * Returns IP_SUCCESS, IP_STALE_HANDLE if the object's field was cleared, or IP_BUSY.
+ */
+int checkObject(SharedMemory_handle sm, struct objectRef_t* ref);
 
-	} else {
-		printf("The mutex appears to be busy!. Sad. \n");
-		sm = NULL;
-	}
+/*
+ * The slow part of checkObject(), for when the slot changed hands
+ */
+int followObject(SharedMemory_handle sm, struct objectRef_t* ref);
 
-	/*Destroy the local copy of the Shared Data object */
-	destroySharedData(local_sd);
-	return sm;
-}
+/*
+ * Check that size bytes at offset (the data block of an object) lie within the heap
+ */
+int blockInHeap(struct SharedData_t* sd, int offset, int size);
 
 /*
- * Start the shared memory client and create a shared memory object.
- * This is to be run on the client process.
+ * Return the size of the data block of a queue of capacity slots holding messages of
+ * up to maxMessageSize bytes, or -1 if that is more than fits in an int.
  */
-SharedMemory_handle ip_CreateSharedMemoryClient(char* name) {
-	/* Create NULL local shared memory object **/
-	SharedMemory_handle sm = NULL;
+int queueBytes(int capacity, int maxMessageSize);
 
-	HANDLE hMapFile;
-	LPCTSTR pBuf;
+/*
+ * Make a local queue object for the queue held by field f.
+ * Must be called with the field's lock held.
+ * Returns IP_SUCCESS, or IP_ERROR if the queue is corrupt.
+ */
+int openQueueField(SharedMemory_handle sm, struct field_t* f, Queue_handle* queue);
 
-	/** Create file mapping **/
-	hMapFile = OpenFileMapping(FILE_MAP_ALL_ACCESS, // read/write access
-			FALSE, // do not inherit the name
-			name); // name of mapping object
+/*
+ * Return the size of the data block of a ring of capacity slots holding messages of
+ * up to maxMessageSize bytes for up to maxReaders readers, or -1 if that is more
+ * than fits in an int.
+ */
+int ringBytes(int capacity, int maxMessageSize, int maxReaders);
 
-	if (hMapFile == NULL) {
-		_tprintf(TEXT("Could not create file mapping object (%d).\n"),
-				GetLastError());
-		return sm;
-	}
+/*
+ * Make a local object for the ring held by field f, for its writer, or with
+ * asReader set, for a new reader, which takes a free entry of the reader table.
+ * Must be called with the field's lock held.
+ * Returns IP_SUCCESS, IP_ERROR if the ring is corrupt, or IP_NO_MORE_ROOM if the
+ * reader table is full.
+ */
+int openRingField(SharedMemory_handle sm, struct field_t* f, int asReader, Ring_handle* ring);
 
-	/* Create a buffer for the map opbject*/
-	pBuf = (LPTSTR) MapViewOfFile(hMapFile, // handle to map object
-			FILE_MAP_ALL_ACCESS, // read/write permission
-			0, 0, IP_BUF_SIZE);
+/*
+ * Copy message number n of a ring into data, if the slot still holds it.
+ * Returns the size of the message, or -1 if it has been overwritten.
+ */
+int readRingSlot(Ring_handle ring, unsigned int n, void* data);
 
-	if (pBuf == NULL) {
-		_tprintf(TEXT("Could not map view of file (%d).\n"), GetLastError());
+/*
+ * Return the size of the data block of a triple-buffered frame of up to maxFrameSize
+ * bytes, or -1 if that is more than fits in an int.
+ */
+int frameBytes(int maxFrameSize);
 
-		CloseHandle(hMapFile);
+/*
+ * Make a local object for the frame held by field f, for its writer, or with
+ * asReader set, for its reader, of which there can only be one at a time.
+ * Must be called with the field's lock held.
+ * Returns IP_SUCCESS, IP_ERROR if the frame is corrupt, or IP_NO_MORE_ROOM if
+ * a running process has the reader open; one that died holding it is taken over.
+ */
+int openFrameField(SharedMemory_handle sm, struct field_t* f, int asReader, Frame_handle* frame);
 
-		return sm;
-	}
+/*
+ * Locate buffer k of a frame
+ */
+struct frameBuffer_t* frameBuffer(Frame_handle frame, unsigned int k);
 
-	/* Create Local Shared Memory Object to Store Information */
-	sm = createSharedMemoryObj(name, hMapFile, pBuf);
-	/* Update the Shared MEmory Obj to reflect that shared data  is now in shared MEmory */
-	sm->sd = (SharedData_t*) pBuf;
+/*
+ * Make a local blob object, not mapped yet, for the blob in the field called name
+ */
+Blob_handle createBlobObj(SharedMemory_handle sm, char* name);
 
+/*
+ * Create (the blob's creator) or open the shared memory object holding a blob's
+ * payload and map it into this process. The creator makes capacity bytes, on huge
+ * pages if hugePages is set and the system allows it; everyone else maps what the
+ * creator made, as described by blob->hugePages.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int mapBlob(Blob_handle blob, int create, int capacity, int hugePages);
 
+/*
+ * Unmap a blob's payload; its creator also removes the payload's name.
+ */
+int unmapBlob(Blob_handle blob);
 
+/*
+ * Build the name of the shared memory object of a blob's payload, made of the names
+ * of the shared memory and of the blob's field. With hugetlbfs set, build the path
+ * of the file in hugetlbfs that stands in for it (POSIX only).
+ */
+void blobPath(Blob_handle blob, int hugetlbfs, char* path, int length);
 
-	 /*Attain Mutex Lock */
-	if (AcquireLock(sm) == IP_SUCCESS) {
+/*
+ * Touch every page of a mapping so that it is faulted in now rather than on first
+ * use: by writing, for memory about to be filled, or else by reading.
+ */
+void prefaultPages(char* base, int size, int write);
 
-		/* Check to see that Shared Data Struct is Valid */
-		if (verifySharedDataStruct(sm->sd) == IP_SUCCESS) {
-			printf("SUCCESS: Shared data structure verified!\n");
-			printf("sm->sd->usedFields=	 %d\n", sm->sd->usedFields);
+/*
+ * Copy size bytes with non-temporal (streaming) stores where the CPU has them,
+ * so that a large copy does not push everything else out of the cache.
+ * Falls back to memcpy() elsewhere.
+ */
+void streamCopy(char* dest, const char* src, int size);
+
+/*
+ * Hash a field name (FNV-1a over at most IP_FIELD_NAME_SIZE - 1 characters,
+ * which is all of the name that is stored).
+ */
+unsigned int hashFieldName(const char* name);
+
+/*
+ * Maintain the hash index of the shared data. Must be called with the lock held
+ * and inside beginLayoutUpdate()/endLayoutUpdate().
+ *  indexInsert() records that slot k holds a field whose name hashes to hash.
+ *  indexRemove() forgets slot k.
+ *  indexMove() records that the field in slot from now lives in slot to.
+ */
+void indexInsert(struct SharedData_t* sd, unsigned int hash, int k);
+void indexRemove(struct SharedData_t* sd, unsigned int hash, int k);
+void indexMove(struct SharedData_t* sd, unsigned int hash, int from, int to);
+
+/*********************************************************************************/
+/*********************************************************************************/
+/* 			P R I V A T E      F U N C T I O N S                                 */
+/*********************************************************************************/
+/*********************************************************************************/
+
+/*
+ * Zero a field
+ */
+int zeroField(struct field_t* field) {
+	field->hash = 0;
+	field->size = 0;
+	field->offset = 0;
+	field->capacity = 0;
+	field->kind = IP_KIND_VALUE;
+	field->history = 0;
+	field->undo = IP_UNDO_NONE;
+	memset(field->name, '\0', sizeof(char) * IP_FIELD_NAME_SIZE );
+	return IP_SUCCESS;
+}
+
+/*
+ * Give a field its name (and the hash of its name), clearing everything else.
+ * Returns IP_ERROR if the name is too long.
+ */
+int nameField(struct field_t* f, char* name) {
+	if (strlen(name) > IP_FIELD_NAME_SIZE) {
+		printf("Field name is too long in nameField().\n");
+		return IP_ERROR;
+	}
+
+	zeroField(f);
+	strncpy(f->name, name, IP_FIELD_NAME_SIZE - 1);
+	f->name[IP_FIELD_NAME_SIZE - 1] = '\0';
+	f->hash = hashFieldName(f->name);
+	return IP_SUCCESS;
+}
+
+/*
+ * Copy a field's name and the reference to its value (not the value itself)
+ * IP_SUCCESS
+ * IP_ERROR
+ *
+ */
+int copyField(struct field_t* dest, struct field_t* src) {
+	if (dest == NULL || src == NULL)
+		return IP_ERROR;
+	if (strlen(src->name) > IP_FIELD_NAME_SIZE) {
+		printf("Src field name is too long in copyField().\n");
+		return IP_ERROR;
+	}
+
+	zeroField(dest);
+
+	memcpy(dest->name, src->name, IP_FIELD_NAME_SIZE - 1);
+	dest->name[IP_FIELD_NAME_SIZE - 1] = '\0';
+	dest->hash = src->hash;
+	dest->size = src->size;
+	dest->offset = src->offset;
+	dest->capacity = src->capacity;
+	dest->kind = src->kind;
+	dest->history = src->history;
+	return IP_SUCCESS;
+}
+
+/*
+ * Return the size class of the smallest block that holds size bytes
+ */
+int sizeClassOf(int size) {
+	int sizeClass = 0;
+	while ((IP_MIN_BLOCK_SIZE << sizeClass) < size)
+		sizeClass++;
+	return sizeClass;
+}
+
+/*
+ * Return the size of the block heapAlloc() hands out for size bytes:
+ * its size class, or for more than a slab, a whole number of slabs.
+ */
+int blockSizeOf(struct SharedData_t* sd, int size) {
+	if (size > sd->heap.slabSize)
+		return IP_ALIGN_UP(size, sd->heap.slabSize);
+	return IP_MIN_BLOCK_SIZE << sizeClassOf(size);
+}
+
+/*
+ * Slab allocator for field values.
+ * Mark every slab of the heap unused. Where the slabs are and how big they are
+ * was settled by initSharedData().
+ */
+void initHeap(struct SharedData_t* sd) {
+	struct heap_t* heap = &(sd->heap);
+	int k = 0;
+	for (k = 0; k < IP_MAX_SIZE_CLASSES; ++k)
+		heap->partialSlab[k] = 0;
+	for (k = 0; k < heap->numSlabs; ++k) {
+		struct slab_t* slab = slabAt(sd, k);
+		slab->sizeClass = IP_SLAB_UNUSED;
+		slab->usedBlocks = 0;
+		slab->carved = 0;
+		slab->freeList = 0;
+	}
+}
+
+/*
+ * Find a block of at least size bytes and store its offset and capacity.
+ * Returns IP_SUCCESS or IP_NO_MORE_ROOM.
+ */
+int heapAlloc(struct SharedData_t* sd, int size, int* offset, int* capacity) {
+	struct heap_t* heap = &(sd->heap);
+	if (size < 0)
+		return IP_NO_MORE_ROOM;
+	if (size > heap->slabSize)
+		return heapAllocRun(sd, size, offset, capacity);
+	int sizeClass = sizeClassOf(size);
+	int blockSize = IP_MIN_BLOCK_SIZE << sizeClass;
+
+	lockWord(&(heap->lock), -1);
+
+	/** Prefer a slab of this class with room left, starting where we last found one **/
+	int found = -1;
+	int k = 0;
+	for (k = 0; k < heap->numSlabs && found < 0; ++k) {
+		int i = (heap->partialSlab[sizeClass] + k) % heap->numSlabs;
+		struct slab_t* slab = slabAt(sd, i);
+		if (slab->sizeClass == sizeClass
+				&& (slab->freeList != 0 || slab->carved + blockSize <= heap->slabSize))
+			found = i;
+	}
+	/** Otherwise start carving up an unused slab **/
+	for (k = 0; k < heap->numSlabs && found < 0; ++k) {
+		struct slab_t* slab = slabAt(sd, k);
+		if (slab->sizeClass == IP_SLAB_UNUSED) {
+			slab->sizeClass = sizeClass;
+			slab->usedBlocks = 0;
+			slab->carved = 0;
+			slab->freeList = 0;
+			found = k;
+		}
+	}
+	if (found < 0) {
+		unlockWord(&(heap->lock));
+		return IP_NO_MORE_ROOM;
+	}
+
+	struct slab_t* slab = slabAt(sd, found);
+	if (slab->freeList != 0) {
+		*offset = slab->freeList;
+		memcpy(&(slab->freeList), (char*) sd + *offset, sizeof(int));
+	} else {
+		*offset = heap->offset + found * heap->slabSize + slab->carved;
+		slab->carved += blockSize;
+	}
+	slab->usedBlocks++;
+	*capacity = blockSize;
+	heap->partialSlab[sizeClass] = found;
+
+	unlockWord(&(heap->lock));
+	return IP_SUCCESS;
+}
+
+/*
+ * Find a run of unused slabs holding at least size bytes and store its offset and capacity.
+ * Returns IP_SUCCESS or IP_NO_MORE_ROOM.
+ */
+int heapAllocRun(struct SharedData_t* sd, int size, int* offset, int* capacity) {
+	struct heap_t* heap = &(sd->heap);
+	int numSlabs = (size + heap->slabSize - 1) / heap->slabSize;
+
+	lockWord(&(heap->lock), -1);
+
+	/** First fit **/
+	int first = 0;
+	int length = 0;
+	int k = 0;
+	for (k = 0; k < heap->numSlabs && length < numSlabs; ++k) {
+		if (slabAt(sd, k)->sizeClass == IP_SLAB_UNUSED) {
+			if (length++ == 0)
+				first = k;
 		} else {
-			printf("ERROR: The Shared Data Struct is not valid!\n");
-			return NULL;
+			length = 0;
 		}
-		ReleaseLock(sm);
+	}
+	if (length < numSlabs) {
+		unlockWord(&(heap->lock));
+		return IP_NO_MORE_ROOM;
+	}
+
+	for (k = first; k < first + numSlabs; ++k) {
+		slabAt(sd, k)->sizeClass = IP_SLAB_RUN_TAIL;
+		slabAt(sd, k)->usedBlocks = 0;
+	}
+	slabAt(sd, first)->sizeClass = IP_SLAB_RUN;
+	slabAt(sd, first)->usedBlocks = numSlabs;
+	*offset = heap->offset + first * heap->slabSize;
+	*capacity = numSlabs * heap->slabSize;
+
+	unlockWord(&(heap->lock));
+	return IP_SUCCESS;
+}
+
+/*
+ * Return the block at offset to the heap. Once every block of a slab has been
+ * returned the slab can be carved up for any size class again.
+ */
+void heapFree(struct SharedData_t* sd, int offset) {
+	struct heap_t* heap = &(sd->heap);
+	if (offset < heap->offset || offset >= heap->offset + heap->numSlabs * heap->slabSize)
+		return;
+
+	lockWord(&(heap->lock), -1);
+	int first = (offset - heap->offset) / heap->slabSize;
+	struct slab_t* slab = slabAt(sd, first);
+	if (slab->sizeClass == IP_SLAB_RUN) {
+		/** a run goes back in one piece **/
+		int k = 0;
+		int numSlabs = slab->usedBlocks;
+		for (k = first; k < first + numSlabs && k < heap->numSlabs; ++k) {
+			slabAt(sd, k)->sizeClass = IP_SLAB_UNUSED;
+			slabAt(sd, k)->usedBlocks = 0;
+		}
+	} else if (--(slab->usedBlocks) <= 0) {
+		slab->sizeClass = IP_SLAB_UNUSED;
+		slab->usedBlocks = 0;
+		slab->carved = 0;
+		slab->freeList = 0;
 	} else {
-		printf(
-				"Shared memory busy.\nUnable to attain lock to verify the shared data structs.\n");
-		destroySharedMemoryObj(sm);
-		sm = NULL;
+		memcpy((char*) sd + offset, &(slab->freeList), sizeof(int));
+		slab->freeList = offset;
 	}
+	unlockWord(&(heap->lock));
+}
 
-	/* if sm is null something went wrong */
-	return sm;
+/*
+ * Write data to a field in shared memory, moving the value to a block of a
+ * different size class if it no longer fits its current one.
+ * If data is NULL the field is only made dataSize bytes long, for the caller to fill in.
+ * Must be called with the field's lock held.
+ * A field that keeps a history records the new value in it, unless data is NULL.
+ * Returns IP_SUCCESS, IP_ERROR (value too large, or the field is not a plain value)
+ * or IP_NO_MORE_ROOM (heap full).
+ */
+int writeField(struct SharedData_t* sd, struct field_t* f, void *data, int dataSize) {
+	if (f == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (f->kind != IP_KIND_VALUE) {
+		printf("ERROR: field %s is not a plain value\n", f->name);
+		return IP_ERROR;
+	}
+	struct history_t* h = historyAt(sd, f->history);
+	if (dataSize < 0 || dataSize > sd->maxValueSize
+			|| (h != NULL && dataSize > h->maxValueSize)) {
+		printf("ERROR: value of %d bytes is too large for field %s\n", dataSize, f->name);
+		return IP_ERROR;
+	}
+
+	/** Remember the old value until the new one is published, see repairField() **/
+	int opened = (f->undo == IP_UNDO_NONE);
+	beginUndo(sd, f, dataSize);
+	int ret = allocField(sd, f, dataSize);
+	if (ret != IP_SUCCESS) {
+		if (opened)
+			f->undo = IP_UNDO_NONE;
+		return ret;
+	}
+
+	/** Copy in the new data **/
+	f->size = dataSize;
+	if (data != NULL) {
+		memcpy((char*) sd + f->offset, data, dataSize);
+		appendHistory(sd, f);
+		countWrite(sd, fieldSlot(sd, f));
+	}
+	return IP_SUCCESS;
 }
 
 /*
- *  Close the shared memory.
- *  Returns 0 if success (IP_SUCCESS).
- *  Returns -1 if error (IP_ERROR).
+ * Give a field a data block of at least size bytes, keeping its current block if
+ * that is already the right size. The contents are not preserved.
+ * The old block is freed, unless it is the one kept for undoing the write: that one
+ * is left for finishUndo() to free.
+ * Must be called with the field's lock held.
+ * Returns IP_SUCCESS or IP_NO_MORE_ROOM.
  */
-int ip_CloseSharedMemory(SharedMemory_handle sm) {
+int allocField(struct SharedData_t* sd, struct field_t* f, int size) {
+	/** Keep the block unless the value now belongs in another size class **/
+	if (f->offset != 0 && blockSizeOf(sd, size) == f->capacity)
+		return IP_SUCCESS;
 
-	return destroySharedMemoryObj(sm);
+	int offset = 0;
+	int capacity = 0;
+	int ret = heapAlloc(sd, size, &offset, &capacity);
+	if (ret != IP_SUCCESS)
+		return ret;
+	if (f->offset != 0 && (f->undo != IP_UNDO_BLOCK || f->offset != f->undoOffset))
+		heapFree(sd, f->offset);
+	f->offset = offset;
+	f->capacity = capacity;
+	return IP_SUCCESS;
+}
 
+/*
+ * Copy the value of a field in shared memory into data.
+ * The field's offset and size are checked against the heap first, so this is
+ * safe to call without the field's lock (the copy may then be torn, of course).
+ * Nothing is copied if the value is larger than capacity bytes; pass a negative
+ * capacity if data is known to be large enough.
+ * Returns the number of bytes copied, IP_ERROR if the field is not a plain value,
+ * or IP_NO_MORE_ROOM if the value does not fit.
+ */
+int readField(struct SharedData_t* sd, struct field_t* f, void *data, int capacity) {
+	struct valueRef_t ref;
+	loadValueRef(f, &ref);
+	return copyValue(sd, &ref, data, capacity);
 }
 
-/*********************
+/*
+ * Take down where the value of a field is, for copyValue() to copy it from.
+ * Without the field's lock this may be torn, or belong to a field that has since been
+ * moved into the slot, so a lock-free reader checks the sequence counters (and the
+ * generation) again before copying: the size is then that of the field asked for, and
+ * no larger value is copied into a buffer meant for it.
+ */
+void loadValueRef(struct field_t* f, struct valueRef_t* ref) {
+	ref->kind = IP_LOAD_RELAXED(&(f->kind));
+	ref->offset = IP_LOAD_RELAXED(&(f->offset));
+	ref->size = IP_LOAD_RELAXED(&(f->size));
+	ref->generation = IP_LOAD_RELAXED(&(f->generation));
+}
+
+/*
+ * Copy the value that ref points at into data, like readField().
+ */
+int copyValue(struct SharedData_t* sd, struct valueRef_t* ref, void *data, int capacity) {
+	if (ref->kind != IP_KIND_VALUE)
+		return IP_ERROR;
+	char* value = valueAt(sd, ref->offset, ref->size);
+	if (value == NULL || ref->size <= 0)
+		return 0;
+	if (capacity >= 0 && ref->size > capacity)
+		return IP_NO_MORE_ROOM;
+	memcpy(data, value, ref->size);
+	return ref->size;
+}
+
+/*
+ * Locate the history of a field from the offset in its history member.
+ * Returns NULL unless the offset is that of a sane history within the heap, so an
+ * offset read without the field's lock is safe to follow.
+ */
+struct history_t* historyAt(struct SharedData_t* sd, int offset) {
+	if (offset == 0 || !blockInHeap(sd, offset, sizeof(struct history_t)))
+		return NULL;
+	struct history_t* h = (struct history_t*) ((char*) sd + offset);
+	int depth = IP_LOAD_RELAXED(&(h->depth));
+	int entrySize = IP_LOAD_RELAXED(&(h->entrySize));
+	int maxValueSize = IP_LOAD_RELAXED(&(h->maxValueSize));
+	long long bytes = (long long) sizeof(struct history_t) + (long long) depth * entrySize;
+	if (depth <= 0 || maxValueSize < 0 || maxValueSize > sd->maxValueSize
+			|| entrySize != IP_ALIGN_UP((int) sizeof(struct historyEntry_t) + maxValueSize, 8)
+			|| bytes > 0x7fffffff || !blockInHeap(sd, offset, (int) bytes))
+		return NULL;
+	return h;
+}
+
+/*
+ * Locate the entry of a history that holds (or held) version n
+ */
+struct historyEntry_t* historyEntry(struct history_t* h, unsigned int n) {
+	return (struct historyEntry_t*) ((char*) h + sizeof(struct history_t)
+			+ (size_t) ((n - 1) % (unsigned int) h->depth) * h->entrySize);
+}
+
+/*
+ * Record the field's current value as its next version in its history, if it keeps one.
+ * Must be called with the field's lock held.
+ */
+void appendHistory(struct SharedData_t* sd, struct field_t* f) {
+	struct history_t* h = historyAt(sd, f->history);
+	if (h == NULL || f->size > h->maxValueSize)
+		return;
+	unsigned int n = h->count + 1;
+	struct historyEntry_t* entry = historyEntry(h, n);
+
+	/* readers of the version this entry held must see it go before anything changes */
+	IP_STORE_RELAXED(&(entry->seq), 0);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	entry->size = f->size;
+	entry->timestamp = monotonicNs();
+	memcpy((char*) entry + sizeof(struct historyEntry_t), (char*) sd + f->offset, f->size);
+	IP_STORE_RELEASE(&(entry->seq), n);
+	IP_STORE_RELEASE(&(h->count), n);
+}
+
+/*
+ * Locate a value of size bytes at offset in the heap.
+ * Returns NULL unless all of it lies within the heap, so an offset and size
+ * read without the field's lock are safe to follow.
+ */
+char* valueAt(struct SharedData_t* sd, int offset, int size) {
+	if (offset < sd->heap.offset || size < 0 || size > sd->maxValueSize
+			|| offset + size > sd->heap.offset + sd->heap.numSlabs * sd->heap.slabSize)
+		return NULL;
+	return (char*) sd + offset;
+}
+
+/*
+ * Take a lock word (holding the pid of the process that holds the lock, 0 when free),
+ * waiting up to waitTime_ns, or forever if waitTime_ns is negative.
+ * A lock whose holder died is taken over.
+ * Returns IP_SUCCESS, IP_BUSY or IP_OWNER_DIED (taken over: whatever the lock guards
+ * may have been left halfway through a change).
+ */
+int lockWord(unsigned int* word, long long waitTime_ns) {
+	unsigned int me = processId();
+	long long deadline = 0;
+	long long nextCheck = 0;
+	int spins = 0;
+	for (;;) {
+		unsigned int holder = IP_LOAD_RELAXED(word);
+		if (holder == 0 && __atomic_compare_exchange_n(word, &holder, me, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return IP_SUCCESS;
+
+		/* another writer has it: spin briefly, then get out of its way */
+		if (++spins < IP_FIELD_LOCK_SPINS) {
+			IP_CPU_RELAX();
+			continue;
+		}
+		long long now = monotonicNs();
+		if (holder != 0 && now >= nextCheck) {
+			/** Make sure the holder is still around to let go of the lock **/
+			nextCheck = now + IP_OWNER_CHECK_NS;
+			if (!processAlive(holder) && __atomic_compare_exchange_n(word, &holder, me, 0,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				printf("ERROR: process %u died holding a lock, taking it over\n", holder);
+				return IP_OWNER_DIED;
+			}
+		}
+		if (waitTime_ns >= 0) {
+			if (deadline == 0) {
+				deadline = now + waitTime_ns;
+			} else if (now > deadline) {
+				return IP_BUSY;
+			}
+		}
+		yieldThread();
+	}
+}
+
+/*
+ * Release a lock word
+ */
+void unlockWord(unsigned int* word) {
+	IP_STORE_RELEASE(word, 0);
+}
+
+/*
+ * Claim a word holding the pid of the process that uses something, 0 when unused,
+ * taking it over if that process died. Never waits.
+ * Returns IP_SUCCESS, or IP_BUSY if a live process has it.
+ */
+int claimWord(unsigned int* word) {
+	unsigned int holder = IP_LOAD_RELAXED(word);
+	if (holder != 0 && processAlive(holder))
+		return IP_BUSY;
+	if (!__atomic_compare_exchange_n(word, &holder, processId(), 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		return IP_BUSY;
+	if (holder != 0)
+		printf("ERROR: process %u died holding a reader's place, taking it over\n", holder);
+	return IP_SUCCESS;
+}
+
+/*
+ * Take a ticket lock, waiting up to waitTime_ns for it (not at all if waitTime_ns
+ * is not positive). Returns IP_SUCCESS or IP_BUSY.
  *
- *  Get Properties of Shared Memory
+ * Each waiter takes the next ticket and waits for serving to reach it, so the lock
+ * goes round in the order it was asked for and nobody can be starved. A waiter spins
+ * briefly, then sleeps in its ticket's slot, so that handing the lock on wakes only
+ * the next waiter in line rather than all of them.
+ * A waiter that runs out of time cannot hand its ticket back, so it leaves it in
+ * its slot instead, for whoever releases the lock to pass over.
+ */
+int ticketLock(struct ticketLock_t* lock, long long waitTime_ns) {
+	unsigned long long me = (unsigned long long) processId() << 32;
+
+	/** Uncontended case: a single atomic operation, and only if nobody is in line **/
+	unsigned int serving = IP_LOAD_ACQUIRE(&(lock->serving));
+	unsigned int ticket = serving;
+	if (__atomic_compare_exchange_n(&(lock->next), &ticket, serving + 1, 0,
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		IP_STORE_RELAXED(&(lock->owner), me | serving);
+		return IP_SUCCESS;
+	}
+	if (waitTime_ns <= 0) {
+		/* not waiting, but a holder that died would keep everyone out for good */
+		if (releaseDeadTicket(lock))
+			return ticketLock(lock, 0);
+		return IP_BUSY;
+	}
+
+	ticket = __atomic_fetch_add(&(lock->next), 1, __ATOMIC_RELAXED);
+	long long deadline = monotonicNs() + waitTime_ns;
+	struct ticketSlot_t* slot = &(lock->slots[ticket % IP_LOCK_SLOTS]);
+	int spins = 0;
+	for (;;) {
+		if (IP_LOAD_ACQUIRE(&(lock->serving)) == ticket) {
+			IP_STORE_RELAXED(&(lock->owner), me | ticket);
+			return IP_SUCCESS;
+		}
+		if (++spins < IP_LOCK_SPINS) {
+			IP_CPU_RELAX();
+			continue;
+		}
+
+		long long left = deadline - monotonicNs();
+		if (left <= 0) {
+			/** Out of time: leave the ticket to be passed over, unless another one is in its place **/
+			unsigned int empty = 0;
+			if (ticket != 0 && __atomic_compare_exchange_n(&(slot->skip), &empty, ticket, 0,
+					__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+				/* the lock may have come up just before the ticket was left, see ticketUnlock() */
+				unsigned int mark = ticket;
+				if (__atomic_load_n(&(lock->serving), __ATOMIC_SEQ_CST) == ticket
+						&& __atomic_compare_exchange_n(&(slot->skip), &mark, 0, 0,
+								__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+					IP_STORE_RELAXED(&(lock->owner), me | ticket);
+					return IP_SUCCESS;
+				}
+				return IP_BUSY;
+			}
+			left = 1000000LL; /* try again in a millisecond */
+		}
+
+		/* the holder may have died with the lock, in which case nobody would wake us */
+		if (releaseDeadTicket(lock))
+			continue;
+		if (left > IP_OWNER_CHECK_NS)
+			left = IP_OWNER_CHECK_NS;
+
+		/* count ourselves before looking at serving again, so the releaser knows to wake us */
+		unsigned int turn = __atomic_load_n(&(slot->turn), __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&(slot->sleepers), 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&(lock->serving), __ATOMIC_SEQ_CST) != ticket)
+			waitOnWord(&(slot->turn), turn, left);
+		__atomic_sub_fetch(&(slot->sleepers), 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/*
+ * Release a ticket lock, handing it to the next waiter in line
+ */
+void ticketUnlock(struct ticketLock_t* lock) {
+	unsigned int held = lock->serving;
+	unsigned int next = held + 1;
+	struct ticketSlot_t* slot = NULL;
+	for (;;) {
+		__atomic_store_n(&(lock->serving), next, __ATOMIC_SEQ_CST);
+		slot = &(lock->slots[next % IP_LOCK_SLOTS]);
+
+		/* pass over a ticket given up by a waiter that ran out of time; the waiter
+		   checks serving after leaving its ticket, so exactly one of us clears it */
+		unsigned int mark = next;
+		if (next == 0 || !__atomic_compare_exchange_n(&(slot->skip), &mark, 0, 0,
+				__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			break;
+		next++;
+	}
+
+	/* forget the holder, unless the next one has already written itself down */
+	unsigned long long owner = ((unsigned long long) processId() << 32) | held;
+	__atomic_compare_exchange_n(&(lock->owner), &owner, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+
+	if (__atomic_load_n(&(slot->sleepers), __ATOMIC_SEQ_CST) != 0) {
+		__atomic_add_fetch(&(slot->turn), 1, __ATOMIC_SEQ_CST);
+		wakeWord(&(slot->turn));
+	}
+}
+
+/*
+ * If the holder of a ticket lock died with it, release the lock on its behalf and mark
+ * the lock damaged, for the next holder to repair what it guards.
+ * Returns nonzero if it did.
  *
+ * The owner records the holder's ticket as well as its pid, and tickets are never
+ * handed out twice, so a record left behind by a process that died just after letting
+ * go of the lock (serving has moved on) is told apart from one that died holding it.
+ */
+int releaseDeadTicket(struct ticketLock_t* lock) {
+	unsigned long long owner = __atomic_load_n(&(lock->owner), __ATOMIC_SEQ_CST);
+	unsigned int pid = (unsigned int) (owner >> 32);
+	unsigned int ticket = (unsigned int) owner;
+	if (pid == 0 || processAlive(pid))
+		return 0;
+	if (__atomic_load_n(&(lock->serving), __ATOMIC_SEQ_CST) != ticket)
+		return 0;
+	unsigned long long mine = ((unsigned long long) processId() << 32) | ticket;
+	if (!__atomic_compare_exchange_n(&(lock->owner), &owner, mine, 0,
+			__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		return 0; /* another waiter got there first */
+
+	printf("ERROR: process %u died holding the shared memory lock, releasing it\n", pid);
+	IP_STORE_RELAXED(&(lock->damaged), 1);
+	ticketUnlock(lock);
+	return 1;
+}
+
+/*
+ * Per field writer lock.
+ * Taking the lock makes the field's sequence counter odd, releasing it makes it even
+ * again, so readers that see the counter change while they copy the field throw the
+ * copy away and try again.
  *
+ * lockField() waits up to waitTime_ns for another writer and returns IP_SUCCESS or IP_BUSY.
+ * If the writer died holding the lock, the lock is taken over and the write it was in
+ * the middle of rolled back (see repairField()).
+ */
+int lockField(struct SharedData_t* sd, struct field_t* f, long long waitTime_ns) {
+	int ret = lockWord(&(f->writer), waitTime_ns);
+	if (ret == IP_BUSY) {
+		countBusy(sd);
+		return IP_BUSY;
+	}
+
+	/* the counter is still odd if the writer died before letting go of the field */
+	if (ret == IP_SUCCESS || !(f->seq & 1)) {
+		IP_STORE_RELAXED(&(f->seq), f->seq + 1);
+		/* the odd counter must be visible before any of the new bytes */
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+	if (ret == IP_OWNER_DIED)
+		repairField(sd, f);
+	return IP_SUCCESS;
+}
+
+/*
+ * Release a field's lock and publish the changes made to it,
+ * waking anyone waiting for the field to change.
+ */
+void unlockField(struct SharedData_t* sd, struct field_t* f) {
+	finishUndo(sd, f);
+	/* the new counter must be visible before the waiters are counted, see waitFieldChange() */
+	__atomic_add_fetch(&(f->seq), 1, __ATOMIC_SEQ_CST);
+	if (IP_LOAD_RELAXED(&(f->waiters)) != 0)
+		wakeWord(&(f->seq));
+	unlockWord(&(f->writer));
+}
+
+/*
+ * Release the lock of a field that was not modified, restoring the sequence counter
+ * so that concurrent readers do not have to retry.
  */
+void unlockFieldUnchanged(struct field_t* f) {
+	IP_STORE_RELEASE(&(f->seq), f->seq - 1);
+	unlockWord(&(f->writer));
+}
 
 /*
- * Get the name of the shared memory. This name is used as the unique identifier.
+ * Keep what it takes to roll back a write of a size byte value to a field, should this
+ * process die halfway through it: the old block if the value moves to a new one, else
+ * a copy of the old value if it is small. finishUndo() forgets it once the write is
+ * done, freeing the old block. A field written more than once under its lock keeps
+ * the record of the first write, which is what a rollback has to go back to.
+ * Must be called with the field's lock held.
  */
-char* ip_GetSharedMemoryName(SharedMemory_handle sm) {
-	return sm->name;
+void beginUndo(struct SharedData_t* sd, struct field_t* f, int size) {
+	if (f->undo == IP_UNDO_COPY && blockSizeOf(sd, size) != f->capacity) {
+		/* the value moves off the block it was copied from: put the copy back, keep the block */
+		memcpy((char*) sd + f->offset, f->undoData, f->undoSize);
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		f->undo = IP_UNDO_BLOCK;
+	}
+	if (f->undo != IP_UNDO_NONE)
+		return;
+
+	f->undoOffset = f->offset;
+	f->undoCapacity = f->capacity;
+	f->undoSize = f->size;
+	if (f->offset == 0 || blockSizeOf(sd, size) != f->capacity) {
+		f->undo = IP_UNDO_BLOCK;
+	} else if (f->size <= IP_UNDO_SIZE) {
+		memcpy(f->undoData, (char*) sd + f->offset, f->size);
+		f->undo = IP_UNDO_COPY;
+	} else {
+		f->undo = IP_UNDO_LOST;
+	}
+	/* a process can be killed between any two instructions, so keep the compiler in order */
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+void finishUndo(struct SharedData_t* sd, struct field_t* f) {
+	if (f->undo == IP_UNDO_NONE)
+		return;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	int old = (f->undo == IP_UNDO_BLOCK && f->undoOffset != f->offset) ? f->undoOffset : 0;
+	f->undo = IP_UNDO_NONE;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	if (old != 0)
+		heapFree(sd, old);
+}
+
+/*
+ * Roll back the write a process was in the middle of when it died holding the
+ * field's lock. Must be called with the field's lock held.
+ */
+void repairField(struct SharedData_t* sd, struct field_t* f) {
+	switch (f->undo) {
+	case IP_UNDO_BLOCK:
+		if (f->offset != f->undoOffset)
+			heapFree(sd, f->offset);
+		f->offset = f->undoOffset;
+		f->capacity = f->undoCapacity;
+		f->size = f->undoSize;
+		break;
+	case IP_UNDO_COPY:
+		memcpy((char*) sd + f->offset, f->undoData, f->undoSize);
+		f->size = f->undoSize;
+		break;
+	case IP_UNDO_LOST:
+		printf("ERROR: the value of field %s was lost with its writer\n", f->name);
+		f->size = 0;
+		break;
+	}
+	f->undo = IP_UNDO_NONE;
+
+	/* views taken before the interrupted write must not check out against what is there now */
+	IP_STORE_RELAXED(&(f->seq), f->seq + 2);
+}
+
+/*
+ * Bracket a structural change of the shared data (adding, moving or removing fields).
+ * Must be called with the lock held.
+ */
+void beginLayoutUpdate(struct SharedData_t* sd) {
+	IP_STORE_RELAXED(&(sd->layoutSeq), sd->layoutSeq + 1);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void endLayoutUpdate(struct SharedData_t* sd) {
+	IP_STORE_RELEASE(&(sd->layoutSeq), sd->layoutSeq + 1);
+}
 
+/*
+ * Hash a field name (FNV-1a over at most IP_FIELD_NAME_SIZE - 1 characters,
+ * which is all of the name that is stored).
+ */
+unsigned int hashFieldName(const char* name) {
+	unsigned int hash = 2166136261u;
+	int k = 0;
+	for (k = 0; k < IP_FIELD_NAME_SIZE - 1 && name[k] != '\0'; ++k) {
+		hash ^= (unsigned char) name[k];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * Record in the hash index that slot k holds a field whose name hashes to hash.
+ */
+void indexInsert(struct SharedData_t* sd, unsigned int hash, int k) {
+	int* index = fieldIndex(sd);
+	unsigned int mask = sd->indexSize - 1;
+	unsigned int b = hash & mask;
+	while (index[b] != 0)
+		b = (b + 1) & mask;
+	index[b] = k + 1;
+}
+
+/*
+ * Forget slot k in the hash index.
+ * Later entries of the same probe chain are shifted back so that no
+ * tombstones are needed and lookups can stop at the first empty bucket.
+ */
+void indexRemove(struct SharedData_t* sd, unsigned int hash, int k) {
+	int* index = fieldIndex(sd);
+	unsigned int mask = sd->indexSize - 1;
+	unsigned int b = hash & mask;
+	while (index[b] != k + 1) {
+		if (index[b] == 0)
+			return; /* not indexed */
+		b = (b + 1) & mask;
+	}
+
+	unsigned int hole = b;
+	unsigned int next = (hole + 1) & mask;
+	while (index[next] != 0) {
+		/* bucket this entry would ideally live in */
+		unsigned int home = fieldAt(sd, index[next] - 1)->hash & mask;
+		/* move it into the hole unless its home lies cyclically in (hole, next] */
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			index[hole] = index[next];
+			hole = next;
+		}
+		next = (next + 1) & mask;
+	}
+	index[hole] = 0;
+}
+
+/*
+ * Record in the hash index that the field in slot from now lives in slot to.
+ */
+void indexMove(struct SharedData_t* sd, unsigned int hash, int from, int to) {
+	int* index = fieldIndex(sd);
+	unsigned int mask = sd->indexSize - 1;
+	unsigned int b = hash & mask;
+	while (index[b] != 0) {
+		if (index[b] == from + 1) {
+			index[b] = to + 1;
+			return;
+		}
+		b = (b + 1) & mask;
+	}
+}
+
+/*
+ * Find field of a given name in a shared Data Struct
+ *
+ * This is a hash lookup. It is also used by readers that do not hold the lock,
+ * so every bucket is checked for sanity before it is followed.
+ */
+int findField(struct field_t** f, struct SharedData_t* sd, char* name) {
+	if (name == NULL)
+		return IP_ERROR;
+	if (name[0] == '\0')
+		return IP_ERROR;
+	if (verifySharedDataStruct(sd) == IP_ERROR)
+		return IP_ERROR;
+
+	int* index = fieldIndex(sd);
+	unsigned int mask = sd->indexSize - 1;
+	unsigned int hash = hashFieldName(name);
+	unsigned int b = hash & mask;
+	int probes = 0;
+	for (probes = 0; probes < sd->indexSize; ++probes) {
+		int entry = IP_LOAD_RELAXED(&(index[b]));
+		if (entry <= 0 || entry > sd->maxNumFields)
+			break; /* end of the probe chain */
+
+		struct field_t* candidate = fieldAt(sd, entry - 1);
+		if (candidate->hash == hash
+				&& strncmp(name, candidate->name, IP_FIELD_NAME_SIZE - 1) == 0) {
+			/** Found a match! **/
+			*f = candidate;
+			return IP_SUCCESS;
+		}
+		b = (b + 1) & mask;
+	}
+	return IP_DOES_NOT_EXIST;
+}
+
+/*
+ * Read a field without taking the lock, using the sequence counters.
+ * Returns IP_SUCCESS, IP_DOES_NOT_EXIST, IP_ERROR,
+ * or IP_BUSY if writers kept interfering for IP_SEQLOCK_MAX_RETRIES attempts.
+ */
+int readFieldLockFree(struct SharedData_t* sd, char* name, void* data) {
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SEQLOCK_MAX_RETRIES; ++attempt) {
+		unsigned int layout = IP_LOAD_ACQUIRE(&(sd->layoutSeq));
+		if (layout & 1) {
+			/* fields are being moved around, come back in a moment */
+			IP_CPU_RELAX();
+			continue;
+		}
+
+		struct field_t* f = NULL;
+		int ret = findField(&f, sd, name);
+		if (ret != IP_SUCCESS) {
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (IP_LOAD_RELAXED(&(sd->layoutSeq)) != layout)
+				continue;
+			if (ret == IP_DOES_NOT_EXIST)
+				countMiss(sd);
+			return ret;
+		}
+
+		unsigned int seq = IP_LOAD_ACQUIRE(&(f->seq));
+		if (seq & 1) {
+			IP_CPU_RELAX();
+			continue;
+		}
+		/** Only copy once sure the size is this field's: the slot may hold another by now **/
+		struct valueRef_t ref;
+		loadValueRef(f, &ref);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (IP_LOAD_RELAXED(&(f->seq)) != seq || IP_LOAD_RELAXED(&(sd->layoutSeq)) != layout)
+			continue;
+		int copied = copyValue(sd, &ref, data, -1);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (IP_LOAD_RELAXED(&(f->seq)) == seq
+				&& IP_LOAD_RELAXED(&(sd->layoutSeq)) == layout) {
+			if (copied < 0)
+				return IP_ERROR;
+			countRead(sd, fieldSlot(sd, f));
+			return IP_SUCCESS;
+		}
+	}
+	return IP_BUSY;
+}
+
+/*
+ * Find the field a handle refers to.
+ * Returns IP_SUCCESS, IP_ERROR or IP_STALE_HANDLE. Safe to call without the lock,
+ * but then the generation must be checked again once the field has been copied.
+ */
+int findFieldByHandle(struct field_t** f, struct SharedData_t* sd, Field_handle handle) {
+	if (verifySharedDataStruct(sd) == IP_ERROR)
+		return IP_ERROR;
+	if (handle.slot < 0 || handle.slot >= sd->maxNumFields)
+		return IP_STALE_HANDLE;
+
+	*f = fieldAt(sd, handle.slot);
+	if (IP_LOAD_RELAXED(&((*f)->generation)) != handle.generation)
+		return IP_STALE_HANDLE;
+	return IP_SUCCESS;
+}
+
+/*
+ * Put the layout right after a process died holding the shared memory lock halfway
+ * through adding or removing a field: drop empty and duplicate slots, rebuild the
+ * index and end the layout update. Must be called with the lock held.
+ */
+void repairLayout(struct SharedData_t* sd) {
+	if (!(IP_LOAD_RELAXED(&(sd->layoutSeq)) & 1))
+		return; /* it died outside of a layout update, so there is nothing to put right */
+
+	memset(fieldIndex(sd), 0, sizeof(int) * sd->indexSize);
+	int k = 0;
+	while (k < sd->usedFields) {
+		struct field_t* f = fieldAt(sd, k);
+		struct field_t* other = NULL;
+		if (f->name[0] != '\0' && findField(&other, sd, f->name) != IP_SUCCESS) {
+			indexInsert(sd, f->hash, k);
+			k++;
+			continue;
+		}
+
+		/** An empty slot (or a copy left by an interrupted move): fill it with the last field **/
+		struct field_t* last_f = fieldAt(sd, sd->usedFields - 1);
+		if (last_f != f) {
+			copyField(f, last_f);
+			moveFieldStats(sd, sd->usedFields - 1, k);
+		} else {
+			zeroField(f);
+			clearFieldStats(sd, k);
+		}
+		f->generation++;
+		if (last_f != f) {
+			zeroField(last_f);
+			last_f->generation++;
+		}
+		sd->usedFields--;
+	}
+	endLayoutUpdate(sd);
+}
+
+/*
+ * Read a field by handle without taking the lock, using the field's sequence counter.
+ * At most capacity bytes are copied (see readField()), and the size of the value is
+ * stored in *size unless size is NULL.
+ * Returns IP_SUCCESS, IP_ERROR, IP_STALE_HANDLE, IP_NO_MORE_ROOM (the value does not fit),
+ * or IP_BUSY if writers kept interfering for IP_SEQLOCK_MAX_RETRIES attempts.
+ */
+int readHandleLockFree(struct SharedData_t* sd, Field_handle handle, void* data, int capacity,
+		int* size) {
+	struct field_t* f = NULL;
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SEQLOCK_MAX_RETRIES; ++attempt) {
+		int ret = findFieldByHandle(&f, sd, handle);
+		if (ret != IP_SUCCESS)
+			return ret;
+
+		unsigned int seq = IP_LOAD_ACQUIRE(&(f->seq));
+		if (seq & 1) {
+			IP_CPU_RELAX();
+			continue;
+		}
+		/** Only copy once sure it is still the field we were asked for **/
+		struct valueRef_t ref;
+		loadValueRef(f, &ref);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (IP_LOAD_RELAXED(&(f->seq)) != seq)
+			continue;
+		if (ref.generation != handle.generation)
+			return IP_STALE_HANDLE;
+		int copied = copyValue(sd, &ref, data, capacity);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (IP_LOAD_RELAXED(&(f->seq)) == seq
+				&& IP_LOAD_RELAXED(&(f->generation)) == ref.generation) {
+			if (size != NULL)
+				*size = ref.size;
+			if (copied == IP_NO_MORE_ROOM)
+				return IP_NO_MORE_ROOM;
+			if (copied < 0)
+				return IP_ERROR;
+			countRead(sd, handle.slot);
+			return IP_SUCCESS;
+		}
+	}
+	return IP_BUSY;
+}
+
+/*
+ * Block until the version of a field (by name, or else by handle) differs from
+ * lastVersion, for at most timeout_ns (forever if negative).
+ * Returns IP_SUCCESS with the new version in *version, IP_BUSY when the time is up,
+ * IP_DOES_NOT_EXIST, IP_STALE_HANDLE or IP_ERROR.
+ *
+ * The version is the field's sequence counter, which every write moves on. A waiter
+ * first counts itself in the field's waiters and only then looks at the counter,
+ * while unlockField() moves the counter on and only then looks at the waiters
+ * (both with full barriers), so either the waiter sees the new version or the
+ * writer sees the waiter and wakes it.
+ */
+int waitFieldChange(SharedMemory_handle sm, char* name, Field_handle* handle,
+		unsigned int lastVersion, long long timeout_ns, unsigned int* version) {
+	long long deadline = (timeout_ns >= 0) ? monotonicNs() + timeout_ns : -1;
+	for (;;) {
+		/* look the field up every time, it may have moved while we slept */
+		struct field_t* f = NULL;
+		Field_handle h;
+		int ret = IP_SUCCESS;
+		if (name != NULL) {
+			ret = ip_ResolveField(sm, name, &h);
+		} else {
+			h = *handle;
+		}
+		if (ret == IP_SUCCESS)
+			ret = findFieldByHandle(&f, sm->sd, h);
+		if (ret != IP_SUCCESS)
+			return ret;
+
+		__atomic_add_fetch(&(f->waiters), 1, __ATOMIC_SEQ_CST);
+		unsigned int seq = __atomic_load_n(&(f->seq), __ATOMIC_SEQ_CST);
+		if (IP_LOAD_RELAXED(&(f->generation)) != h.generation) {
+			ret = (name != NULL) ? IP_SUCCESS : IP_STALE_HANDLE; /* by name: look again */
+		} else if (!(seq & 1) && seq != lastVersion) {
+			*version = seq;
+			__atomic_sub_fetch(&(f->waiters), 1, __ATOMIC_RELAXED);
+			return IP_SUCCESS;
+		} else {
+			long long left = -1;
+			if (deadline >= 0) {
+				left = deadline - monotonicNs();
+				if (left <= 0)
+					ret = IP_BUSY;
+			}
+			if (ret == IP_SUCCESS)
+				waitOnWord(&(f->seq), seq, left);
+		}
+		__atomic_sub_fetch(&(f->waiters), 1, __ATOMIC_RELAXED);
+		if (ret != IP_SUCCESS)
+			return ret;
+	}
+}
+
+/*
+ * Return whether the first n slots of a batch already hold field f
+ * (a batch may name the same field twice).
+ */
+int batchHolds(struct batchSlot_t* slots, int n, struct field_t* f) {
+	int k = 0;
+	for (k = 0; k < n; ++k) {
+		if (slots[k].f == f)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Find the field of a batch entry, by name or else by handle.
+ * Returns IP_SUCCESS, IP_ERROR, IP_DOES_NOT_EXIST or IP_STALE_HANDLE. Safe to call
+ * without the lock, but then the result must be checked like findField()'s.
+ */
+int findBatchField(struct field_t** f, struct SharedData_t* sd, Field_value* value) {
+	if (value->name != NULL)
+		return findField(f, sd, value->name);
+	return findFieldByHandle(f, sd, value->handle);
+}
+
+/*
+ * Read a batch without taking any lock, using the sequence counters.
+ * The values read are a consistent snapshot: no batch write is seen half done.
+ * Returns IP_SUCCESS once every entry has its status,
+ * or IP_BUSY if writers kept interfering for IP_SEQLOCK_MAX_RETRIES attempts.
+ */
+int readBatchLockFree(struct SharedData_t* sd, Field_value* values, int count,
+		struct batchSlot_t* slots) {
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SEQLOCK_MAX_RETRIES; ++attempt) {
+		unsigned int layout = IP_LOAD_ACQUIRE(&(sd->layoutSeq));
+		if (layout & 1) {
+			IP_CPU_RELAX();
+			continue;
+		}
+
+		/** Copy out every value, remembering each counter **/
+		int k = 0;
+		for (k = 0; k < count; ++k) {
+			Field_value* value = &(values[k]);
+			slots[k].f = NULL;
+			value->status = findBatchField(&(slots[k].f), sd, value);
+			if (value->status != IP_SUCCESS)
+				continue;
+			slots[k].seq = IP_LOAD_ACQUIRE(&(slots[k].f->seq));
+			if (slots[k].seq & 1)
+				break; /* mid-write, start over */
+			/* only copy once sure the size is this field's: the slot may hold another by now */
+			struct valueRef_t ref;
+			loadValueRef(slots[k].f, &ref);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (IP_LOAD_RELAXED(&(slots[k].f->seq)) != slots[k].seq
+					|| IP_LOAD_RELAXED(&(sd->layoutSeq)) != layout)
+				break; /* start over */
+			if (value->name == NULL && ref.generation != value->handle.generation)
+				value->status = IP_STALE_HANDLE;
+			else if ((value->size = copyValue(sd, &ref, value->data, -1)) < 0)
+				value->status = IP_ERROR;
+		}
+		if (k < count) {
+			IP_CPU_RELAX();
+			continue;
+		}
+
+		/** The snapshot holds if nothing moved and no counter changed since **/
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		int consistent = (IP_LOAD_RELAXED(&(sd->layoutSeq)) == layout);
+		for (k = 0; k < count && consistent; ++k) {
+			if (slots[k].f != NULL && IP_LOAD_RELAXED(&(slots[k].f->seq)) != slots[k].seq)
+				consistent = 0;
+		}
+		if (!consistent)
+			continue;
+		for (k = 0; k < count; ++k) {
+			if (values[k].status == IP_SUCCESS)
+				countRead(sd, fieldSlot(sd, slots[k].f));
+			else if (values[k].status == IP_DOES_NOT_EXIST)
+				countMiss(sd);
+		}
+		return IP_SUCCESS;
+	}
+	return IP_BUSY;
+}
+
+/*
+ * Copy the value of field f for a snapshot into data, which has room for capacity
+ * bytes, storing its size in *size and the version it had in *version. Nothing is
+ * locked. Without perValue this is a single try; with it, writers in the way are
+ * waited out for IP_SEQLOCK_MAX_RETRIES attempts.
+ * Returns IP_SUCCESS, IP_BUSY, IP_ERROR or IP_NO_MORE_ROOM (see readField()).
+ */
+int snapshotValue(struct SharedData_t* sd, struct field_t* f, char* data, int capacity,
+		int perValue, int* size, unsigned int* version) {
+	int attempt = 0;
+	for (attempt = 0; attempt < (perValue ? IP_SEQLOCK_MAX_RETRIES : 1); ++attempt) {
+		unsigned int seq = IP_LOAD_ACQUIRE(&(f->seq));
+		if (seq & 1) {
+			IP_CPU_RELAX();
+			continue;
+		}
+		int ret = readField(sd, f, data, capacity);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (IP_LOAD_RELAXED(&(f->seq)) != seq)
+			continue;
+		if (ret < 0)
+			return ret;
+		*size = ret;
+		*version = seq;
+		return IP_SUCCESS;
+	}
+	return IP_BUSY;
+}
+
+/*
+ * Take a snapshot (see ip_Snapshot()) of the values in the shared data, into buffer,
+ * which is capacity bytes long, storing the bytes used, or needed, in *size.
+ * Nothing is locked. Without perValue the snapshot only holds if no value changed
+ * and no field moved while it was copied; with it, each value only has to be whole
+ * (see snapshotValue()) and no field may have moved. Otherwise it is IP_BUSY.
+ * Returns IP_SUCCESS, IP_BUSY or IP_NO_MORE_ROOM.
+ */
+int takeSnapshot(struct SharedData_t* sd, char* buffer, int capacity, int* size, int perValue) {
+	unsigned int layout = IP_LOAD_ACQUIRE(&(sd->layoutSeq));
+	if (layout & 1)
+		return IP_BUSY;
+	int n = IP_LOAD_RELAXED(&(sd->usedFields));
+	if (n > sd->maxNumFields)
+		n = sd->maxNumFields; /* torn, the check below throws it away */
+
+	/** A record for every value, copied straight into place; once full, only count **/
+	long long headerSize = IP_ALIGN_UP((long long) sizeof(Snapshot_header), IP_SNAPSHOT_ALIGN);
+	long long used = headerSize;
+	int fits = (used <= capacity);
+	int numFields = 0;
+	int k = 0;
+	for (k = 0; k < n; ++k) {
+		struct field_t* f = fieldAt(sd, k);
+		if (IP_LOAD_RELAXED(&(f->kind)) != IP_KIND_VALUE)
+			continue;
+		Snapshot_field* record = (Snapshot_field*) (buffer + used);
+		char* data = (char*) record + sizeof(Snapshot_field);
+		long long room = capacity - used - (long long) sizeof(Snapshot_field);
+		int valueSize = 0;
+		unsigned int version = 0;
+		if (fits && room >= 0) {
+			int ret = snapshotValue(sd, f, data, (int) room, perValue, &valueSize, &version);
+			if (ret == IP_BUSY)
+				return IP_BUSY;
+			if (ret == IP_ERROR)
+				continue; /* no longer a value: torn, the check below throws it away */
+			if (ret == IP_NO_MORE_ROOM)
+				fits = 0;
+		} else {
+			fits = 0;
+		}
+		if (!fits) {
+			valueSize = IP_LOAD_RELAXED(&(f->size));
+			if (valueSize < 0 || valueSize > sd->maxValueSize)
+				valueSize = sd->maxValueSize;
+		}
+		long long recordSize = IP_ALIGN_UP((long long) sizeof(Snapshot_field) + valueSize,
+				IP_SNAPSHOT_ALIGN);
+		if (fits) {
+			record->recordSize = (unsigned int) recordSize;
+			record->version = version;
+			record->size = valueSize;
+			record->slot = k;
+			memcpy(record->name, f->name, IP_FIELD_NAME_SIZE);
+			record->name[IP_FIELD_NAME_SIZE - 1] = '\0';
+			memset(data + valueSize, 0, recordSize - sizeof(Snapshot_field) - valueSize);
+		}
+		used += recordSize;
+		numFields++;
+	}
+
+	/** The snapshot holds if nothing moved (and no value changed) since it was copied **/
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	long long pos = headerSize;
+	for (k = 0; k < numFields && fits && !perValue; ++k) {
+		Snapshot_field* record = (Snapshot_field*) (buffer + pos);
+		if (IP_LOAD_RELAXED(&(fieldAt(sd, record->slot)->seq)) != record->version)
+			return IP_BUSY;
+		pos += record->recordSize;
+	}
+	if (IP_LOAD_RELAXED(&(sd->layoutSeq)) != layout)
+		return IP_BUSY;
+
+	*size = (used > INT_MAX) ? INT_MAX : (int) used;
+	if (!fits)
+		return IP_NO_MORE_ROOM;
+	Snapshot_header* header = (Snapshot_header*) buffer;
+	header->magic = IP_SNAPSHOT_MAGIC;
+	header->format = IP_SNAPSHOT_FORMAT;
+	header->headerSize = (unsigned int) headerSize;
+	header->flags = perValue ? 0 : IP_SNAPSHOT_POINT_IN_TIME;
+	header->size = (unsigned int) used;
+	header->numFields = numFields;
+	header->schemaHash = sd->schemaHash;
+	header->timeNs = wallClockNs();
+	memset(buffer + sizeof(Snapshot_header), 0, headerSize - sizeof(Snapshot_header));
+	return IP_SUCCESS;
+}
+
+/*
+ * Adds a field with the given name and the value in data to a shared data struct.
+ * If a field of the same name already exists, that field is overwritten
+ * If data is NULL, room for dataSize bytes is made but nothing is copied.
+ * If locked is not NULL, the field is left locked on success and stored in *locked,
+ * so the caller can finish it off before anyone sees it. Don't forget to unlockField() it.
+ * The data object is full, the function returns IP_NO_MORE_ROOM, -3
+ * If the field's lock could not be taken within waitTime_ns, returns IP_BUSY 1.
+ * Otherwise the function returns IP_ERROR -1, or IP_SUCCES 0.
+ * Must be called with the shared memory lock held.
+ */
+int addFieldToSharedData(char* name, void *data, int dataSize,
+		struct SharedData_t* sd, long long waitTime_ns, struct field_t** locked) {
+	return insertField(name, IP_KIND_VALUE, data, dataSize, sd, waitTime_ns, locked);
+}
+
+/*
+ * Add a field like addFieldToSharedData(), of the given kind. A field for an object
+ * is given a zeroed block of dataSize bytes in one go, without the limits on values,
+ * and is never written over: if the name is taken, returns IP_ERROR.
+ */
+int insertField(char* name, int kind, void *data, int dataSize,
+		struct SharedData_t* sd, long long waitTime_ns, struct field_t** locked) {
+	if (verifySharedDataStruct(sd) == IP_ERROR) {
+		printf("ERROR: shared data struct is invalid in addFieldToSharedData()");
+		return IP_ERROR;
+	}
+	if (strlen(name) == 0) {
+		printf("ERROR: name is empty in addFieldToSharedData()");
+		return IP_ERROR;
+	}
+
+	struct field_t * dest_f = NULL;
+	if (findField(&dest_f, sd, name) == IP_SUCCESS) {
+		if (kind != IP_KIND_VALUE) {
+			printf("ERROR: field %s already exists\n", name);
+			return IP_ERROR;
+		}
+		/** a field with that name already exists, so let's replace it **/
+		if (lockField(sd, dest_f, waitTime_ns) != IP_SUCCESS)
+			return IP_BUSY;
+		int ret = writeField(sd, dest_f, data, dataSize);
+		if (ret != IP_SUCCESS) {
+			unlockFieldUnchanged(dest_f);
+		} else if (locked != NULL) {
+			*locked = dest_f;
+		} else {
+			unlockField(sd, dest_f);
+		}
+		return ret;
+	} else {
+		/** A field of that name doesn't already exist.**/
+		/** Let's see if we have room **/
+		if (sd->usedFields < sd->maxNumFields) {
+			/** there is room **/
+
+			/** write to the n+1th field **/
+			struct field_t* new_f = fieldAt(sd, sd->usedFields);
+			/** a writer holding a stale handle may briefly hold the slot's lock **/
+			if (lockField(sd, new_f, waitTime_ns) != IP_SUCCESS)
+				return IP_BUSY;
+			beginLayoutUpdate(sd);
+			/** name the slot in place, no temporary field **/
+			int ret = nameField(new_f, name);
+			if (ret == IP_SUCCESS && kind != IP_KIND_VALUE) {
+				ret = allocField(sd, new_f, dataSize);
+				if (ret == IP_SUCCESS) {
+					memset((char*) sd + new_f->offset, 0, dataSize);
+					new_f->kind = kind;
+				}
+			} else if (ret == IP_SUCCESS) {
+				ret = writeField(sd, new_f, data, dataSize);
+			}
+			if (ret != IP_SUCCESS) {
+				/** no room for the value, leave the slot empty **/
+				zeroField(new_f);
+				unlockField(sd, new_f);
+				endLayoutUpdate(sd);
+				return ret;
+			}
+			new_f->generation++; /** handles to whatever lived here before are stale **/
+			if (locked != NULL) {
+				*locked = new_f;
+			} else {
+				unlockField(sd, new_f);
+			}
+			indexInsert(sd, new_f->hash, sd->usedFields);
+			(sd->usedFields)++; /** important! increment # of fields used **/
+			endLayoutUpdate(sd);
+
+			return ret;
+
+		} else {
+			/** no more room **/
+			return IP_NO_MORE_ROOM;
+		}
+
+	}
+
+}
+
+/*
+ * Deletes a field to from a shared data struct given the field name.
+ * Internally, this function moves the last field into the place of the
+ * deleted field so that all used fields are contiguous.
+ *
+ * If the field does not exist, returns IP_DOES_NOT_EXIST -2
+ * If a field lock could not be taken within waitTime_ns, returns IP_BUSY 1.
+ * Success IP_SUCCES 0.
+ * Error IP_ERROR
+ * Must be called with the shared memory lock held.
+ */
+int deleteFieldFromSharedData(char* name, struct SharedData_t* sd, long long waitTime_ns) {
+	if (strlen(name) == 0)
+		return IP_ERROR;
+	if (verifySharedDataStruct(sd) == IP_ERROR)
+		return IP_ERROR;
+	if (sd->usedFields == 0)
+		return IP_DOES_NOT_EXIST; /** nothing to delete **/
+
+	struct field_t* dest_f = NULL; /** field to delete **/
+
+	if (findField(&dest_f, sd, name) == IP_SUCCESS) {
+		int dest_k = fieldSlot(sd, dest_f);
+		int last_k = sd->usedFields - 1;
+		if (dest_k < sd->schemaFields) {
+			printf("ERROR: field %s is part of the schema and can't be removed\n", name);
+			return IP_ERROR;
+		}
+		struct field_t* last_f = fieldAt(sd, last_k);
+
+		/** Wait for writers of both fields involved before changing anything **/
+		if (lockField(sd, dest_f, waitTime_ns) != IP_SUCCESS)
+			return IP_BUSY;
+		if (dest_f != last_f && lockField(sd, last_f, waitTime_ns) != IP_SUCCESS) {
+			unlockFieldUnchanged(dest_f);
+			return IP_BUSY;
+		}
+
+		beginLayoutUpdate(sd);
+		indexRemove(sd, dest_f->hash, dest_k);
+		/* delete the data in that field */
+		heapFree(sd, dest_f->offset);
+		heapFree(sd, dest_f->history);
+		zeroField(dest_f);
+		clearFieldStats(sd, dest_k);
+		dest_f->generation++; /** handles to the deleted field are stale **/
+		if (dest_f != last_f) { /** If the deleted field is not the last one **/
+			/** copy the field in last place into the place where the deleted field was. **/
+			copyField(dest_f, last_f);
+			moveFieldStats(sd, last_k, dest_k);
+			indexMove(sd, last_f->hash, last_k, dest_k);
+
+			/** Clear the last field **/
+			zeroField(last_f);
+			last_f->generation++; /** handles to the moved field must be resolved again **/
+			unlockField(sd, last_f);
+		}
+		unlockField(sd, dest_f);
+		(sd->usedFields)--;
+		endLayoutUpdate(sd);
+
+	} else {
+		return IP_DOES_NOT_EXIST;
+	}
+	return IP_SUCCESS;
+}
+
+/*
+ * Add a field called name holding a zeroed data block of bytes bytes for an object of
+ * the given kind, leaving it locked for the caller to set the object up. Don't forget
+ * to unlockField() it. Must be called with the shared memory lock held.
+ * Returns IP_SUCCESS, IP_ERROR (also if the name is taken), IP_BUSY or IP_NO_MORE_ROOM.
+ */
+int addObjectField(SharedMemory_handle sm, char* name, int kind, int bytes,
+		struct field_t** locked) {
+	struct field_t* f = NULL;
+	int ret = insertField(name, kind, NULL, bytes, sm->sd, sm->lockWaitTime, &f);
+	if (ret != IP_SUCCESS)
+		return ret;
+	*locked = f;
+	return IP_SUCCESS;
+}
+
+/*
+ * Find the field called name, which must hold an object of the given kind, and lock it.
+ * Don't forget to unlockFieldUnchanged() it.
+ * Returns IP_SUCCESS, IP_ERROR (also if the field holds something else), IP_BUSY
+ * or IP_DOES_NOT_EXIST.
+ */
+int lockObjectField(SharedMemory_handle sm, char* name, int kind, struct field_t** locked) {
+	Field_handle handle;
+	int ret = ip_ResolveField(sm, name, &handle);
+	struct field_t* f = NULL;
+	if (ret == IP_SUCCESS)
+		ret = findFieldByHandle(&f, sm->sd, handle);
+	if (ret != IP_SUCCESS)
+		return ret;
+
+	if (lockField(sm->sd, f, sm->lockWaitTime) != IP_SUCCESS)
+		return IP_BUSY;
+	if (f->generation != handle.generation) {
+		unlockFieldUnchanged(f);
+		return IP_BUSY; /* the field moved just now, try again */
+	}
+	if (f->kind != kind) {
+		unlockFieldUnchanged(f);
+		printf("ERROR: field %s holds something else\n", name);
+		return IP_ERROR;
+	}
+	*locked = f;
+	return IP_SUCCESS;
+}
+
+/*
+ * Remember which field f, locked, holds the object whose header has headerInts ints
+ * of geometry, for checkObject().
+ */
+void setObjectRef(struct SharedData_t* sd, struct field_t* f, int headerInts,
+		struct objectRef_t* ref) {
+	memcpy(ref->name, f->name, IP_FIELD_NAME_SIZE);
+	ref->kind = f->kind;
+	ref->f = f;
+	ref->generation = f->generation;
+	ref->offset = f->offset;
+	memcpy(ref->header, (char*) sd + f->offset, headerInts * sizeof(int));
+	ref->headerInts = headerInts;
+}
+
+/*
+ * Check that the object an object handle was opened on is still in its field, so the
+ * handle's pointers into the heap are still good. An object moved to another slot by
+ * the clearing of another field is followed there. Cheap unless the slot changed.
+ * Returns IP_SUCCESS, IP_STALE_HANDLE if the object's field was cleared, or IP_BUSY.
+ */
+int checkObject(SharedMemory_handle sm, struct objectRef_t* ref) {
+	if (IP_LOAD_ACQUIRE(&(ref->f->generation)) == ref->generation)
+		return IP_SUCCESS;
+	return followObject(sm, ref);
+}
+
+/*
+ * The slow part of checkObject(), for when the slot changed hands
+ */
+int followObject(SharedMemory_handle sm, struct objectRef_t* ref) {
+	/** Find the field by name, it may just have moved **/
+	struct SharedData_t* sd = sm->sd;
+	Field_handle handle;
+	int ret = ip_ResolveField(sm, ref->name, &handle);
+	if (ret == IP_BUSY)
+		return IP_BUSY;
+	if (ret != IP_SUCCESS)
+		return IP_STALE_HANDLE;
+	struct field_t* f = fieldAt(sd, handle.slot);
+	if (lockField(sd, f, sm->lockWaitTime) != IP_SUCCESS)
+		return IP_BUSY;
+	/* a new object of the same kind and geometry in the same block is as good as the old one */
+	ret = (f->generation == handle.generation && f->kind == ref->kind && f->offset == ref->offset
+			&& memcmp((char*) sd + f->offset, ref->header, ref->headerInts * sizeof(int)) == 0)
+			? IP_SUCCESS : IP_STALE_HANDLE;
+	unlockFieldUnchanged(f);
+	if (ret == IP_SUCCESS) {
+		ref->f = f;
+		ref->generation = handle.generation;
+	}
+	return ret;
+}
+
+/*
+ * Check that size bytes at offset (the data block of an object) lie within the heap
+ */
+int blockInHeap(struct SharedData_t* sd, int offset, int size) {
+	return offset >= sd->heap.offset && size >= 0
+			&& (long long) offset + size
+					<= sd->heap.offset + (long long) sd->heap.numSlabs * sd->heap.slabSize;
+}
+
+/*
+ * Return the size of the data block of a queue of capacity slots holding messages of
+ * up to maxMessageSize bytes, or -1 if that is more than fits in an int.
+ */
+int queueBytes(int capacity, int maxMessageSize) {
+	long long slotSize = IP_ALIGN_UP((long long) sizeof(int) + maxMessageSize, 8);
+	long long bytes = (long long) sizeof(struct queue_t) + slotSize * capacity;
+	if (bytes > 0x7fffffff)
+		return -1;
+	return (int) bytes;
+}
+
+/*
+ * Make a local queue object for the queue held by field f.
+ * Must be called with the field's lock held.
+ * Returns IP_SUCCESS, or IP_ERROR if the queue is corrupt.
+ */
+int openQueueField(SharedMemory_handle sm, struct field_t* f, Queue_handle* queue) {
+	struct SharedData_t* sd = sm->sd;
+
+	/** Check the queue against its block before trusting it **/
+	struct queue_t* q = (struct queue_t*) ((char*) sd + f->offset);
+	if (!blockInHeap(sd, f->offset, f->capacity)
+			|| q->capacity <= 0 || (q->capacity & (q->capacity - 1)) != 0
+			|| q->maxMessageSize < 0
+			|| q->slotSize != IP_ALIGN_UP((int) sizeof(int) + q->maxMessageSize, 8)
+			|| queueBytes(q->capacity, q->maxMessageSize) < 0
+			|| queueBytes(q->capacity, q->maxMessageSize) > f->capacity) {
+		printf("ERROR: queue %s is corrupt\n", f->name);
+		return IP_ERROR;
+	}
+
+	Queue_handle queueObj = (Queue_handle) malloc(sizeof(struct Queue_t));
+	if (queueObj == NULL)
+		return IP_ERROR;
+	queueObj->sm = sm;
+	setObjectRef(sd, f, 3, &(queueObj->ref));
+	queueObj->q = q;
+	queueObj->slots = (char*) q + sizeof(struct queue_t);
+	queueObj->mask = (unsigned int) q->capacity - 1;
+	queueObj->slotSize = q->slotSize;
+	queueObj->maxMessageSize = q->maxMessageSize;
+	queueObj->cachedHead = IP_LOAD_ACQUIRE(&(q->head));
+	queueObj->cachedTail = IP_LOAD_ACQUIRE(&(q->tail));
+	*queue = queueObj;
+	return IP_SUCCESS;
+}
+
+/*
+ * Return the size of the data block of a ring of capacity slots holding messages of
+ * up to maxMessageSize bytes for up to maxReaders readers, or -1 if that is more
+ * than fits in an int.
+ */
+int ringBytes(int capacity, int maxMessageSize, int maxReaders) {
+	long long slotSize = IP_ALIGN_UP((long long) sizeof(struct ringSlot_t) + maxMessageSize, 8);
+	long long bytes = (long long) sizeof(struct ring_t)
+			+ (long long) sizeof(struct ringReader_t) * maxReaders + slotSize * capacity;
+	if (bytes > 0x7fffffff)
+		return -1;
+	return (int) bytes;
+}
+
+/*
+ * Make a local object for the ring held by field f, for its writer, or with
+ * asReader set, for a new reader, which takes a free entry of the reader table.
+ * Must be called with the field's lock held.
+ * Returns IP_SUCCESS, IP_ERROR if the ring is corrupt, or IP_NO_MORE_ROOM if the
+ * reader table is full.
+ */
+int openRingField(SharedMemory_handle sm, struct field_t* f, int asReader, Ring_handle* ring) {
+	struct SharedData_t* sd = sm->sd;
+
+	/** Check the ring against its block before trusting it **/
+	struct ring_t* r = (struct ring_t*) ((char*) sd + f->offset);
+	if (!blockInHeap(sd, f->offset, f->capacity)
+			|| r->capacity <= 0 || (r->capacity & (r->capacity - 1)) != 0
+			|| r->maxMessageSize < 0 || r->maxReaders < 0
+			|| r->slotSize != IP_ALIGN_UP((int) sizeof(struct ringSlot_t) + r->maxMessageSize, 8)
+			|| ringBytes(r->capacity, r->maxMessageSize, r->maxReaders) < 0
+			|| ringBytes(r->capacity, r->maxMessageSize, r->maxReaders) > f->capacity) {
+		printf("ERROR: ring %s is corrupt\n", f->name);
+		return IP_ERROR;
+	}
+	struct ringReader_t* readers = (struct ringReader_t*) ((char*) r + sizeof(struct ring_t));
+
+	/** Readers claim an entry of the reader table, free or left by a dead process,
+	 ** and start at the next message **/
+	int reader = -1;
+	unsigned int cursor = IP_LOAD_ACQUIRE(&(r->tail));
+	if (asReader) {
+		int k = 0;
+		for (k = 0; k < r->maxReaders && reader < 0; ++k) {
+			if (claimWord(&(readers[k].pid)) == IP_SUCCESS)
+				reader = k;
+		}
+		if (reader < 0)
+			return IP_NO_MORE_ROOM;
+		IP_STORE_RELAXED(&(readers[reader].cursor), cursor);
+	}
+
+	Ring_handle ringObj = (Ring_handle) malloc(sizeof(struct Ring_t));
+	if (ringObj == NULL) {
+		if (reader >= 0)
+			IP_STORE_RELEASE(&(readers[reader].pid), 0);
+		return IP_ERROR;
+	}
+	ringObj->sm = sm;
+	setObjectRef(sd, f, 4, &(ringObj->ref));
+	ringObj->r = r;
+	ringObj->readers = readers;
+	ringObj->slots = (char*) readers + sizeof(struct ringReader_t) * r->maxReaders;
+	ringObj->mask = (unsigned int) r->capacity - 1;
+	ringObj->slotSize = r->slotSize;
+	ringObj->maxMessageSize = r->maxMessageSize;
+	ringObj->maxReaders = r->maxReaders;
+	ringObj->reader = reader;
+	ringObj->cursor = cursor;
+	*ring = ringObj;
+	return IP_SUCCESS;
+}
+
+/*
+ * Copy message number n of a ring into data, if the slot still holds it.
+ * Returns the size of the message, or -1 if it has been overwritten.
+ */
+int readRingSlot(Ring_handle ring, unsigned int n, void* data) {
+	struct ringSlot_t* slot = (struct ringSlot_t*) (ring->slots
+			+ (size_t) (n & ring->mask) * ring->slotSize);
+	unsigned int seq = IP_LOAD_ACQUIRE(&(slot->seq));
+	if (seq & 1)
+		return -1;
+	int length = IP_LOAD_RELAXED(&(slot->length));
+	if (IP_LOAD_RELAXED(&(slot->number)) != n || length < 0 || length > ring->maxMessageSize)
+		return -1;
+	memcpy(data, (char*) slot + sizeof(struct ringSlot_t), length);
+
+	/* the copy only counts if the writer did not start on the slot meanwhile */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (IP_LOAD_RELAXED(&(slot->seq)) != seq)
+		return -1;
+	return length;
+}
+
+/*
+ * Return the size of the data block of a triple-buffered frame of up to maxFrameSize
+ * bytes, or -1 if that is more than fits in an int.
+ */
+int frameBytes(int maxFrameSize) {
+	long long bufferSize = IP_ALIGN_UP((long long) sizeof(struct frameBuffer_t) + maxFrameSize,
+			IP_CACHE_LINE);
+	long long bytes = (long long) sizeof(struct frame_t) + 3 * bufferSize;
+	if (bytes > 0x7fffffff)
+		return -1;
+	return (int) bytes;
+}
+
+/*
+ * Make a local object for the frame held by field f, for its writer, or with
+ * asReader set, for its reader, of which there can only be one at a time.
+ * Must be called with the field's lock held.
+ * Returns IP_SUCCESS, IP_ERROR if the frame is corrupt, or IP_NO_MORE_ROOM if
+ * a running process has the reader open; one that died holding it is taken over.
+ */
+int openFrameField(SharedMemory_handle sm, struct field_t* f, int asReader, Frame_handle* frame) {
+	struct SharedData_t* sd = sm->sd;
+
+	/** Check the frame against its block before trusting it **/
+	struct frame_t* fr = (struct frame_t*) ((char*) sd + f->offset);
+	if (!blockInHeap(sd, f->offset, f->capacity) || fr->maxFrameSize < 0
+			|| fr->bufferSize != IP_ALIGN_UP((int) sizeof(struct frameBuffer_t) + fr->maxFrameSize,
+					IP_CACHE_LINE)
+			|| frameBytes(fr->maxFrameSize) < 0 || frameBytes(fr->maxFrameSize) > f->capacity
+			|| fr->back > 2 || fr->front > 2) {
+		printf("ERROR: frame %s is corrupt\n", f->name);
+		return IP_ERROR;
+	}
+
+	/** A reader that died without closing the frame is taken over **/
+	if (asReader && claimWord(&(fr->reader)) != IP_SUCCESS)
+		return IP_NO_MORE_ROOM;
+
+	Frame_handle frameObj = (Frame_handle) malloc(sizeof(struct Frame_t));
+	if (frameObj == NULL) {
+		if (asReader)
+			IP_STORE_RELEASE(&(fr->reader), 0);
+		return IP_ERROR;
+	}
+	frameObj->sm = sm;
+	setObjectRef(sd, f, 2, &(frameObj->ref));
+	frameObj->fr = fr;
+	frameObj->buffers = (char*) fr + sizeof(struct frame_t);
+	frameObj->bufferSize = fr->bufferSize;
+	frameObj->maxFrameSize = fr->maxFrameSize;
+	frameObj->isReader = asReader;
+	frameObj->index = asReader ? fr->front : fr->back;
+	frameObj->published = 0;
+	frameObj->held = 0;
+	*frame = frameObj;
+	return IP_SUCCESS;
+}
+
+/*
+ * Locate buffer k of a frame
+ */
+struct frameBuffer_t* frameBuffer(Frame_handle frame, unsigned int k) {
+	return (struct frameBuffer_t*) (frame->buffers + (size_t) k * frame->bufferSize);
+}
+
+/*
+ * Make a local blob object, not mapped yet, for the blob in the field called name
+ */
+Blob_handle createBlobObj(SharedMemory_handle sm, char* name) {
+	Blob_handle blob = (Blob_handle) malloc(sizeof(struct Blob_t));
+	if (blob == NULL)
+		return NULL;
+	memset(blob, 0, sizeof(struct Blob_t));
+	blob->sm = sm;
+	strncpy(blob->name, name, IP_FIELD_NAME_SIZE - 1);
+	blob->name[IP_FIELD_NAME_SIZE - 1] = '\0';
+	blob->base = NULL;
+	blob->reserved = NULL;
+#ifdef _WIN32
+	blob->hMapFile = NULL;
+#else
+	blob->fd = -1;
+#endif
+	return blob;
+}
+
+/*
+ * Build the name of the shared memory object of a blob's payload, made of the names
+ * of the shared memory and of the blob's field. With hugetlbfs set, build the path
+ * of the file in hugetlbfs that stands in for it (POSIX only).
+ */
+void blobPath(Blob_handle blob, int hugetlbfs, char* path, int length) {
+	if (hugetlbfs) {
+		snprintf(path, length, "%s/interprocess_%s_%s", IP_HUGETLBFS_DIR, blob->sm->name,
+				blob->name);
+	} else {
+#ifdef _WIN32
+		snprintf(path, length, "%s_%s", blob->sm->name, blob->name);
+#else
+		snprintf(path, length, "/%s_%s", blob->sm->name, blob->name);
+#endif
+	}
+}
+
+/*
+ * Touch every page of a mapping so that it is faulted in now rather than on first
+ * use: by writing, for memory about to be filled, or else by reading.
+ */
+void prefaultPages(char* base, int size, int write) {
+	volatile char* page = (volatile char*) base;
+	int k = 0;
+	for (k = 0; k < size; k += IP_PAGE_SIZE) {
+		if (write)
+			page[k] = 0;
+		else
+			(void) page[k];
+	}
+}
+
+/*
+ * Copy size bytes with non-temporal (streaming) stores where the CPU has them,
+ * so that a large copy does not push everything else out of the cache.
+ * Falls back to memcpy() elsewhere.
+ */
+void streamCopy(char* dest, const char* src, int size) {
+#ifdef IP_HAVE_STREAMING_STORES
+	/* streaming stores need an aligned destination */
+	int k = (int) ((16 - ((size_t) dest & 15)) & 15);
+	if (k > size)
+		k = size;
+	memcpy(dest, src, k);
+	for (; k + 64 <= size; k += 64) {
+		__m128i a = _mm_loadu_si128((const __m128i*) (src + k));
+		__m128i b = _mm_loadu_si128((const __m128i*) (src + k + 16));
+		__m128i c = _mm_loadu_si128((const __m128i*) (src + k + 32));
+		__m128i d = _mm_loadu_si128((const __m128i*) (src + k + 48));
+		_mm_stream_si128((__m128i*) (dest + k), a);
+		_mm_stream_si128((__m128i*) (dest + k + 16), b);
+		_mm_stream_si128((__m128i*) (dest + k + 32), c);
+		_mm_stream_si128((__m128i*) (dest + k + 48), d);
+	}
+	memcpy(dest + k, src + k, size - k);
+	/* streaming stores are weakly ordered, so fence them before the blob is published */
+	_mm_sfence();
+#else
+	memcpy(dest, src, size);
+#endif
+}
+
+/*
+ * and when you write the delete function,
+ * swap in the nth' field for the field you are deleting
+ * (unless of course you happen to be deleting the n'th field)
+ *
+ */
+
+/*
+ * Check whether the name of a shared memory is the path of a file that holds it:
+ * whether it has a slash in it (or a backslash, on Windows).
+ */
+int isFilePath(const char* name) {
+#ifdef _WIN32
+	if (strchr(name, '\\') != NULL)
+		return 1;
+#endif
+	return strchr(name, '/') != NULL;
+}
+
+/*
+ * Create Shared Memory Object
+ *
+ */
+SharedMemory_handle createSharedMemoryObj(char* name) {
+	/* Create Local Shared Memory Object to Store Information */
+	SharedMemory_handle sm = (SharedMemory_handle) malloc(
+			sizeof(struct SharedMemory_t));
+	if (sm == NULL)
+		return NULL;
+
+	/* Initialize the Local Shared Memory Object */
+	strncpy(sm->name, name, IP_MAX_MEM_NAME_LENGTH - 1);
+	sm->name[IP_MAX_MEM_NAME_LENGTH - 1] = '\0';
+	sm->path[0] = '\0';
+	if (isFilePath(name)) {
+		/* The lock, the blobs and the Windows mapping still need a name, derived from the path */
+		strcpy(sm->path, sm->name);
+		char* c = sm->name;
+		for (; *c != '\0'; ++c) {
+			if (*c == '/' || *c == '\\' || *c == ':')
+				*c = '_';
+		}
+	}
+	sm->syncPolicy = IP_SYNC_NONE;
+	sm->ownsFile = 0;
+	sm->BufferSize = 0;
+	sm->hugePages = 0;
+	sm->readOnly = 0;
+	sm->observed = NULL;
+	sm->reserved = NULL;
+	sm->ReadTimeDelay = IP_DEFAULT_REFRACTORY_PERIOD;
+	sm->pBuf = NULL;
+	sm->sd = NULL;
+	sm->lockWaitTime = IP_WAIT_FOR_MUTEX_AVAILABILITY * 1000000LL;
+#ifdef _WIN32
+	sm->hFile = INVALID_HANDLE_VALUE;
+	sm->hMapFile = NULL;
+	sm->ghMutex = NULL;
+#else
+	sm->fd = -1;
+	sm->isHost = 0;
+#endif
+	return sm;
+}
+
+#ifdef _WIN32
+
+/*
+ * Create (host) or open (client) the operating system's named shared memory,
+ * or the file sm->path, and map it into this process.
+ * The host creates size bytes, on huge pages if hugePages is set and the system
+ * allows it (size may then be rounded up). A file is only resized, so whatever it
+ * held is still there. A client maps however much the host created,
+ * read-only if sm->readOnly is set.
+ * Either way sm->BufferSize holds the size of the mapping afterwards.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int mapSharedMemory(SharedMemory_handle sm, int create, int size, int hugePages) {
+	/** Create file mapping **/
+	sm->hugePages = 0;
+	if (sm->path[0] != '\0') {
+		/* a file outlives its host, and is never put on large pages */
+		hugePages = 0;
+		sm->hFile = CreateFile(sm->path, sm->readOnly ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+				FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, create ? OPEN_ALWAYS : OPEN_EXISTING,
+				FILE_ATTRIBUTE_NORMAL, NULL);
+		if (sm->hFile == INVALID_HANDLE_VALUE) {
+			printf("Could not open shared memory file %s (%d).\n", sm->path, GetLastError());
+			return IP_ERROR;
+		}
+		if (create) {
+			LARGE_INTEGER end;
+			end.QuadPart = size;
+			SetFilePointerEx(sm->hFile, end, NULL, FILE_BEGIN);
+			SetEndOfFile(sm->hFile);
+		} else {
+			/* the mapping goes away with the last process that has it open, the file does not */
+			sm->hMapFile = CreateFileMapping(sm->hFile, NULL,
+					sm->readOnly ? PAGE_READONLY : PAGE_READWRITE, 0, 0, sm->name);
+		}
+	}
+	if (create) {
+		/* Large pages need the SeLockMemoryPrivilege and a whole number of large pages */
+		SIZE_T largePage = hugePages ? GetLargePageMinimum() : 0;
+		if (largePage > 0) {
+			DWORD largeSize = (DWORD) (((size + largePage - 1) / largePage) * largePage);
+			sm->hMapFile = CreateFileMapping(INVALID_HANDLE_VALUE, // use paging file
+					NULL, // default security
+					PAGE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES, // read/write access on large pages
+					0, // maximum object size (high-order DWORD)
+					largeSize, // maximum object size (low-order DWORD)
+					sm->name); // name of mapping object
+			if (sm->hMapFile != NULL) {
+				size = (int) largeSize;
+				sm->hugePages = 1;
+			}
+		}
+		if (sm->hMapFile == NULL) {
+			sm->hMapFile = CreateFileMapping(sm->hFile, // the file, or INVALID_HANDLE_VALUE for the paging file
+					NULL, // default security
+					PAGE_READWRITE, // read/write access
+					0, // maximum object size (high-order DWORD)
+					(DWORD) size, // maximum object size (low-order DWORD)
+					sm->name); // name of mapping object
+		}
+	} else if (sm->hMapFile == NULL) {
+		sm->hMapFile = OpenFileMapping(sm->readOnly ? FILE_MAP_READ : FILE_MAP_ALL_ACCESS, // read/write access
+				FALSE, // do not inherit the name
+				sm->name); // name of mapping object
+	}
+	if (sm->hMapFile == NULL) {
+		_tprintf(TEXT("Could not create file mapping object (%d).\n"),
+				GetLastError());
+		return IP_ERROR;
+	}
+
+	/* Create a buffer for the map opbject (a client maps all of it, whatever its size) */
+	DWORD access = sm->readOnly ? FILE_MAP_READ : FILE_MAP_ALL_ACCESS;
+#ifdef FILE_MAP_LARGE_PAGES
+	if (sm->hugePages)
+		access |= FILE_MAP_LARGE_PAGES;
+#endif
+	sm->pBuf = (LPTSTR) MapViewOfFile(sm->hMapFile, // handle to map object
+			access, // read/write permission
+			0, 0, create ? size : 0);
+#ifdef FILE_MAP_LARGE_PAGES
+	if (sm->pBuf == NULL && !create) {
+		/* the host may have put it on large pages */
+		sm->pBuf = (LPTSTR) MapViewOfFile(sm->hMapFile, access | FILE_MAP_LARGE_PAGES, 0, 0, 0);
+		sm->hugePages = (sm->pBuf != NULL);
+	}
+#endif
+
+	if (sm->pBuf == NULL) {
+		_tprintf(TEXT("Could not map view of file (%d).\n"), GetLastError());
+		CloseHandle(sm->hMapFile);
+		sm->hMapFile = NULL;
+		return IP_ERROR;
+	}
+
+	/* How much did we get? */
+	MEMORY_BASIC_INFORMATION info;
+	if (VirtualQuery((LPCVOID) sm->pBuf, &info, sizeof(info)) == 0) {
+		sm->BufferSize = size;
+	} else {
+		sm->BufferSize = (int) info.RegionSize;
+	}
+	return IP_SUCCESS;
+}
+
+/*
+ * Unmap and close the operating system's named shared memory.
+ */
+int unmapSharedMemory(SharedMemory_handle sm) {
+	/*Close out the shared memory file */
+	if (sm->pBuf != NULL)
+		UnmapViewOfFile((PVOID) sm->pBuf);
+	if (sm->hMapFile != NULL)
+		CloseHandle(sm->hMapFile);
+	if (sm->ghMutex != NULL)
+		CloseHandle(sm->ghMutex);
+	if (sm->hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(sm->hFile);
+	sm->pBuf = NULL;
+	sm->hMapFile = NULL;
+	sm->ghMutex = NULL;
+	sm->hFile = INVALID_HANDLE_VALUE;
+	return IP_SUCCESS;
+}
+
+/*
+ * Write the first size bytes of the shared memory out to the file that holds it,
+ * and wait until they are on disk.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int flushSharedMemory(SharedMemory_handle sm, int size) {
+	if (sm->pBuf == NULL || !FlushViewOfFile((LPCVOID) sm->pBuf, size)
+			|| !FlushFileBuffers(sm->hFile)) {
+		printf("Could not write shared memory file %s (%d).\n", sm->path, GetLastError());
+		return IP_ERROR;
+	}
+	return IP_SUCCESS;
+}
+
+/*
+ * Create (the blob's creator) or open the shared memory object holding a blob's
+ * payload and map it into this process. The creator makes capacity bytes, on huge
+ * pages if hugePages is set and the system allows it; everyone else maps what the
+ * creator made, as described by blob->hugePages.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int mapBlob(Blob_handle blob, int create, int capacity, int hugePages) {
+	char name[IP_MAX_MEM_NAME_LENGTH + IP_FIELD_NAME_SIZE + 2];
+	blobPath(blob, 0, name, sizeof(name));
+	int size = capacity;
+	if (create) {
+		blob->hugePages = 0;
+		SIZE_T largePage = hugePages ? GetLargePageMinimum() : 0;
+		if (largePage > 0) {
+			DWORD largeSize = (DWORD) (((capacity + largePage - 1) / largePage) * largePage);
+			blob->hMapFile = CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+					PAGE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES, 0, largeSize, name);
+			if (blob->hMapFile != NULL) {
+				size = (int) largeSize;
+				blob->hugePages = 1;
+			}
+		}
+		if (blob->hMapFile == NULL)
+			blob->hMapFile = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+					(DWORD) capacity, name);
+	} else {
+		blob->hMapFile = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, name);
+	}
+	if (blob->hMapFile == NULL) {
+		_tprintf(TEXT("Could not create file mapping object (%d).\n"), GetLastError());
+		return IP_ERROR;
+	}
+
+	DWORD access = FILE_MAP_ALL_ACCESS;
+#ifdef FILE_MAP_LARGE_PAGES
+	if (blob->hugePages)
+		access |= FILE_MAP_LARGE_PAGES;
+#endif
+	blob->base = (char*) MapViewOfFile(blob->hMapFile, access, 0, 0, create ? size : 0);
+	if (blob->base == NULL) {
+		_tprintf(TEXT("Could not map view of file (%d).\n"), GetLastError());
+		CloseHandle(blob->hMapFile);
+		blob->hMapFile = NULL;
+		return IP_ERROR;
+	}
+
+	MEMORY_BASIC_INFORMATION info;
+	if (VirtualQuery((LPCVOID) blob->base, &info, sizeof(info)) == 0) {
+		blob->mapSize = size;
+	} else {
+		blob->mapSize = (int) info.RegionSize;
+	}
+	return IP_SUCCESS;
+}
+
+/*
+ * Unmap a blob's payload. Windows removes the name with the last handle to it.
+ */
+int unmapBlob(Blob_handle blob) {
+	if (blob->base != NULL)
+		UnmapViewOfFile((PVOID) blob->base);
+	if (blob->hMapFile != NULL)
+		CloseHandle(blob->hMapFile);
+	blob->base = NULL;
+	blob->hMapFile = NULL;
+	return IP_SUCCESS;
+}
+
+/*
+ * Create the lock that guards the shared data.
+ * On Windows this is a named mutex, on POSIX a fair ticket lock
+ * living inside the shared data itself (see ticketLock()), reset only if create is
+ * nonzero: clients, and a host taking over a kept file, leave it as it is.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int createLock(SharedMemory_handle sm, int create) {
+	/* give the mutex the same name as the memory object but with the prefix "mutex_" */
+	char mutex_name[IP_MAX_MEM_NAME_LENGTH + 6];
+	strcpy(mutex_name, "mutex_");
+	strncat(mutex_name, sm->name, IP_MAX_MEM_NAME_LENGTH - 1);
+	mutex_name[IP_MAX_MEM_NAME_LENGTH + 6 - 1] = '\0';
+
+	// Create a mutex with no initial owner
+	sm->ghMutex = CreateMutex(NULL, // default security attributes
+			FALSE, // initially not owned
+			mutex_name); //mutex
+
+	if (sm->ghMutex == NULL) {
+		printf("CreateMutex error: %d\n", GetLastError());
+		return IP_ERROR;
+	}
+	return IP_SUCCESS;
+}
+
+/*
+ * Sleep the calling thread for time_ms milliseconds
+ */
+void sleepMs(int time_ms) {
+	Sleep(time_ms);
+}
+
+/*
+ * Give up the rest of the calling thread's time slice
+ */
+void yieldThread() {
+	SwitchToThread();
+}
+
+/*
+ * Block until *word may no longer hold value, for at most timeout_ns
+ * (forever if timeout_ns is negative). May return early, so check again.
+ *
+ * WaitOnAddress() only works within one process, so this just naps.
+ */
+void waitOnWord(unsigned int* word, unsigned int value, long long timeout_ns) {
+	if (timeout_ns >= 0 && timeout_ns < 1000000LL) {
+		yieldThread();
+	} else {
+		sleepMs(1);
+	}
+}
+
+/*
+ * Wake everyone blocked on word, in any process. Nappers wake up on their own.
+ */
+void wakeWord(unsigned int* word) {
+}
+
+/*
+ * Nanoseconds on a monotonic clock
+ */
+long long monotonicNs() {
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (long long) ((double) counter.QuadPart * 1e9 / (double) frequency.QuadPart);
+}
+
+/*
+ * Nanoseconds since 1970 (UTC) on the wall clock
+ */
+long long wallClockNs() {
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	/* 100 ns ticks since 1601 */
+	long long ticks = ((long long) now.dwHighDateTime << 32) | now.dwLowDateTime;
+	return (ticks - 116444736000000000LL) * 100;
+}
+
+/*
+ * The id of the calling process, as recorded in the locks it holds
+ */
+unsigned int processId() {
+	return (unsigned int) GetCurrentProcessId();
+}
+
+/*
+ * Check whether the process with the given id is still running.
+ */
+int processAlive(unsigned int pid) {
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD) pid);
+	if (process == NULL)
+		return GetLastError() != ERROR_INVALID_PARAMETER; /* no such process */
+	DWORD ret = WaitForSingleObject(process, 0);
+	CloseHandle(process);
+	return ret == WAIT_TIMEOUT;
+}
+
+#else /* POSIX */
+
+/*
+ * Build the name of the shared memory object: a POSIX shared memory name, or
+ * with hugetlbfs set, the path of the file in hugetlbfs that stands in for it.
+ */
+void shmPath(SharedMemory_handle sm, int hugetlbfs, char* path, int length) {
+	if (hugetlbfs) {
+		snprintf(path, length, "%s/interprocess_%s", IP_HUGETLBFS_DIR, sm->name);
+	} else {
+		/* POSIX shared memory names must begin with a slash */
+		snprintf(path, length, "/%s", sm->name);
+	}
+}
+
+/*
+ * Create (host) or open (client) the operating system's named shared memory,
+ * or the file sm->path, and map it into this process.
+ * The host creates size bytes, on huge pages if hugePages is set and the system
+ * allows it (size may then be rounded up). A file is only resized, so whatever it
+ * held is still there. A client maps however much the host created,
+ * read-only if sm->readOnly is set.
+ * Either way sm->BufferSize holds the size of the mapping afterwards.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int mapSharedMemory(SharedMemory_handle sm, int create, int size, int hugePages) {
+	char shm_name[IP_MAX_MEM_NAME_LENGTH + 64];
+	char huge_name[IP_MAX_MEM_NAME_LENGTH + 64];
+	shmPath(sm, 0, shm_name, sizeof(shm_name));
+	shmPath(sm, 1, huge_name, sizeof(huge_name));
+	/* a file outlives its host, and is never put on huge pages */
+	sm->isHost = create && sm->path[0] == '\0';
+	sm->hugePages = 0;
+	if (sm->path[0] != '\0')
+		hugePages = 0;
+
+	if (create && hugePages) {
+		/*
+		 * Named huge pages come from a file in hugetlbfs, which must be a whole number
+		 * of huge pages. The pages are only reserved by mmap(), so that is where this
+		 * fails when none are free.
+		 */
+		int hugeSize = ((size + IP_HUGE_PAGE_SIZE - 1) / IP_HUGE_PAGE_SIZE) * IP_HUGE_PAGE_SIZE;
+		sm->fd = open(huge_name, O_CREAT | O_RDWR, 0666);
+		if (sm->fd != -1) {
+			if (ftruncate(sm->fd, hugeSize) == 0) {
+				sm->pBuf = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+						sm->fd, 0);
+				if (sm->pBuf != MAP_FAILED) {
+					sm->hugePages = 1;
+					sm->BufferSize = hugeSize;
+					shm_unlink(shm_name); /* so no client picks up a stale one */
+					return IP_SUCCESS;
+				}
+			}
+			close(sm->fd);
+			unlink(huge_name);
+		}
+		sm->pBuf = NULL;
+		printf("No huge pages available in %s, using normal shared memory.\n",
+				IP_HUGETLBFS_DIR);
+	}
+
+	if (sm->path[0] != '\0') {
+		sm->fd = open(sm->path, create ? (O_CREAT | O_RDWR) : (sm->readOnly ? O_RDONLY : O_RDWR), 0666);
+	} else if (create) {
+		sm->fd = shm_open(shm_name, O_CREAT | O_RDWR, 0666);
+	} else {
+		int flags = sm->readOnly ? O_RDONLY : O_RDWR;
+		sm->fd = shm_open(shm_name, flags, 0666);
+		if (sm->fd == -1 && errno == ENOENT) {
+			/* the host may have put it on huge pages */
+			sm->fd = open(huge_name, flags);
+			if (sm->fd != -1)
+				sm->hugePages = 1;
+			else
+				errno = ENOENT;
+		}
+	}
+	if (sm->fd == -1) {
+		printf("Could not open shared memory object (%s).\n", strerror(errno));
+		return IP_ERROR;
+	}
+
+	if (create) {
+		if (ftruncate(sm->fd, size) == -1) {
+			printf("Could not size shared memory object (%s).\n", strerror(errno));
+			close(sm->fd);
+			sm->fd = -1;
+			return IP_ERROR;
+		}
+		if (hugePages)
+			unlink(huge_name); /* so no client picks up a stale one */
+	} else {
+		/* The client maps whatever the host created */
+		struct stat info;
+		if (fstat(sm->fd, &info) == -1 || info.st_size < (off_t) sizeof(struct SharedData_t)) {
+			printf("Shared memory object is not ready.\n");
+			close(sm->fd);
+			sm->fd = -1;
+			return IP_ERROR;
+		}
+		size = (int) info.st_size;
+	}
+
+	sm->pBuf = mmap(NULL, size, sm->readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED,
+			sm->fd, 0);
+	if (sm->pBuf == MAP_FAILED) {
+		printf("Could not map shared memory object (%s).\n", strerror(errno));
+		sm->pBuf = NULL;
+		close(sm->fd);
+		sm->fd = -1;
+		return IP_ERROR;
+	}
+	sm->BufferSize = size;
+
+#ifdef MADV_HUGEPAGE
+	/* No hugetlbfs pages, but transparent huge pages may still be had (best effort) */
+	if (create && hugePages)
+		madvise(sm->pBuf, size, MADV_HUGEPAGE);
+#endif
+	return IP_SUCCESS;
+}
+
+/*
+ * Unmap and close the operating system's named shared memory.
+ */
+int unmapSharedMemory(SharedMemory_handle sm) {
+	if (sm->pBuf != NULL)
+		munmap(sm->pBuf, sm->BufferSize);
+	if (sm->fd != -1)
+		close(sm->fd);
+	if (sm->isHost) {
+		/* The host owns the name. Clients that are still attached keep their mapping. */
+		char shm_name[IP_MAX_MEM_NAME_LENGTH + 64];
+		shmPath(sm, sm->hugePages, shm_name, sizeof(shm_name));
+		if (sm->hugePages) {
+			unlink(shm_name);
+		} else {
+			shm_unlink(shm_name);
+		}
+	}
+	sm->pBuf = NULL;
+	sm->fd = -1;
+	return IP_SUCCESS;
+}
+
+/*
+ * Write the first size bytes of the shared memory out to the file that holds it,
+ * and wait until they are on disk.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int flushSharedMemory(SharedMemory_handle sm, int size) {
+	if (sm->pBuf == NULL || msync(sm->pBuf, size, MS_SYNC) == -1) {
+		printf("Could not write shared memory file %s (%s).\n", sm->path, strerror(errno));
+		return IP_ERROR;
+	}
+	return IP_SUCCESS;
+}
+
+/*
+ * Create (the blob's creator) or open the shared memory object holding a blob's
+ * payload and map it into this process. The creator makes capacity bytes, on huge
+ * pages if hugePages is set and the system allows it; everyone else maps what the
+ * creator made, as described by blob->hugePages.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int mapBlob(Blob_handle blob, int create, int capacity, int hugePages) {
+	char path[IP_MAX_MEM_NAME_LENGTH + IP_FIELD_NAME_SIZE + 64];
+	if (create)
+		blob->hugePages = 0;
+
+	if ((create && hugePages) || (!create && blob->hugePages)) {
+		/* a whole number of huge pages, as for the shared memory itself */
+		int hugeSize = IP_ALIGN_UP(capacity, IP_HUGE_PAGE_SIZE);
+		blobPath(blob, 1, path, sizeof(path));
+		blob->fd = open(path, create ? (O_CREAT | O_RDWR) : O_RDWR, 0666);
+		if (blob->fd != -1 && (!create || ftruncate(blob->fd, hugeSize) == 0)) {
+			blob->base = (char*) mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+					blob->fd, 0);
+			if (blob->base != MAP_FAILED) {
+				blob->hugePages = 1;
+				blob->mapSize = hugeSize;
+				return IP_SUCCESS;
+			}
+		}
+		if (blob->fd != -1)
+			close(blob->fd);
+		blob->fd = -1;
+		blob->base = NULL;
+		if (!create) {
+			printf("Could not map blob %s (%s).\n", path, strerror(errno));
+			return IP_ERROR;
+		}
+		unlink(path);
+		printf("No huge pages available in %s, using normal shared memory.\n",
+				IP_HUGETLBFS_DIR);
+	}
+
+	blobPath(blob, 0, path, sizeof(path));
+	blob->fd = shm_open(path, create ? (O_CREAT | O_RDWR) : O_RDWR, 0666);
+	if (blob->fd == -1) {
+		printf("Could not open blob %s (%s).\n", path, strerror(errno));
+		return IP_ERROR;
+	}
+	if (create && ftruncate(blob->fd, capacity) == -1) {
+		printf("Could not size blob %s (%s).\n", path, strerror(errno));
+		close(blob->fd);
+		blob->fd = -1;
+		shm_unlink(path);
+		return IP_ERROR;
+	}
+	blob->base = (char*) mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, blob->fd, 0);
+	if (blob->base == MAP_FAILED) {
+		printf("Could not map blob %s (%s).\n", path, strerror(errno));
+		blob->base = NULL;
+		close(blob->fd);
+		blob->fd = -1;
+		if (create)
+			shm_unlink(path);
+		return IP_ERROR;
+	}
+	blob->mapSize = capacity;
+
+#ifdef MADV_HUGEPAGE
+	/* No hugetlbfs pages, but transparent huge pages may still be had (best effort) */
+	if (create && hugePages)
+		madvise(blob->base, capacity, MADV_HUGEPAGE);
+#endif
+	return IP_SUCCESS;
+}
+
+/*
+ * Unmap a blob's payload; its creator also removes the payload's name.
+ * Others that still have it mapped keep their mapping.
+ */
+int unmapBlob(Blob_handle blob) {
+	if (blob->base != NULL)
+		munmap(blob->base, blob->mapSize);
+	if (blob->fd != -1)
+		close(blob->fd);
+	if (blob->isOwner) {
+		char path[IP_MAX_MEM_NAME_LENGTH + IP_FIELD_NAME_SIZE + 64];
+		blobPath(blob, blob->hugePages, path, sizeof(path));
+		if (blob->hugePages) {
+			unlink(path);
+		} else {
+			shm_unlink(path);
+		}
+	}
+	blob->base = NULL;
+	blob->fd = -1;
+	return IP_SUCCESS;
+}
+
+/*
+ * Create the lock that guards the shared data.
+ * On Windows this is a named mutex, on POSIX a fair ticket lock
+ * living inside the shared data itself (see ticketLock()), reset only if create is
+ * nonzero: clients, and a host taking over a kept file, leave it as it is.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int createLock(SharedMemory_handle sm, int create) {
+	if (!create)
+		return IP_SUCCESS; /* the host already initialized the lock in shared memory */
+
+	struct SharedData_t* sd = (struct SharedData_t*) sm->pBuf;
+	memset(&(sd->lock), 0, sizeof(struct ticketLock_t));
+	return IP_SUCCESS;
+}
+
+/*
+ * Sleep the calling thread for time_ms milliseconds
+ */
+void sleepMs(int time_ms) {
+	if (time_ms <= 0)
+		return;
+	struct timespec ts;
+	ts.tv_sec = time_ms / 1000;
+	ts.tv_nsec = (long) (time_ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+/*
+ * Give up the rest of the calling thread's time slice
+ */
+void yieldThread() {
+	sched_yield();
+}
+
+/*
+ * Nanoseconds on a monotonic clock
+ */
+long long monotonicNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Nanoseconds since 1970 (UTC) on the wall clock
+ */
+long long wallClockNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#ifdef __linux__
+
+/*
+ * Block until *word may no longer hold value, for at most timeout_ns
+ * (forever if timeout_ns is negative). May return early, so check again.
+ *
+ * This is a futex wait. The word lives in shared memory, so the futex must not be
+ * FUTEX_PRIVATE: the kernel then keys it on the page itself and every process
+ * mapping the page shares it.
+ */
+void waitOnWord(unsigned int* word, unsigned int value, long long timeout_ns) {
+	struct timespec ts;
+	struct timespec* timeout = NULL;
+	if (timeout_ns >= 0) {
+		ts.tv_sec = timeout_ns / 1000000000LL;
+		ts.tv_nsec = timeout_ns % 1000000000LL;
+		timeout = &ts;
+	}
+	syscall(SYS_futex, word, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+/*
+ * Wake everyone blocked on word, in any process.
+ */
+void wakeWord(unsigned int* word) {
+	syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+#else /* other POSIX systems have no futex */
+
+/*
+ * Block until *word may no longer hold value, for at most timeout_ns
+ * (forever if timeout_ns is negative). May return early, so check again.
+ *
+ * Without futexes this just naps.
+ */
+void waitOnWord(unsigned int* word, unsigned int value, long long timeout_ns) {
+	if (timeout_ns >= 0 && timeout_ns < 1000000LL) {
+		yieldThread();
+	} else {
+		sleepMs(1);
+	}
+}
+
+/*
+ * Wake everyone blocked on word, in any process. Nappers wake up on their own.
+ */
+void wakeWord(unsigned int* word) {
+}
+
+#endif /* __linux__ */
+
+/* getpid() is a system call, so the id is looked up once (and again after a fork()) */
+static unsigned int currentPid = 0;
+static int forkHandlerSet = 0;
+
+/*
+ * Forget the cached id of the process, in a child just after fork()
+ */
+void forgetProcessId() {
+	IP_STORE_RELAXED(&currentPid, 0);
+}
+
+/*
+ * The id of the calling process, as recorded in the locks it holds
+ */
+unsigned int processId() {
+	unsigned int pid = IP_LOAD_RELAXED(&currentPid);
+	if (pid == 0) {
+		if (!__atomic_exchange_n(&forkHandlerSet, 1, __ATOMIC_RELAXED))
+			pthread_atfork(NULL, NULL, forgetProcessId);
+		pid = (unsigned int) getpid();
+		IP_STORE_RELAXED(&currentPid, pid);
+	}
+	return pid;
+}
+
+/*
+ * Check whether the process with the given id is still running.
+ * A process that has exited but not yet been reaped by its parent counts as running.
+ */
+int processAlive(unsigned int pid) {
+	return kill((pid_t) pid, 0) == 0 || errno != ESRCH;
+}
+
+#endif /* _WIN32 */
+
+/*
+ * Destroy Shared memory and deallocate memory
+ *
+ * WARNING. This may destroy all data in shared memory.
+ */
+int destroySharedMemoryObj(SharedMemory_handle sm) {
+	if (sm != NULL) {
+		if (sm->reserved != NULL)
+			unlockField(sm->sd, sm->reserved); /* publish whatever was written so far */
+		unmapSharedMemory(sm);
+		sm->name[0] = '\0';
+		free(sm);
+		sm = NULL;
+	}
+	return IP_SUCCESS;
+}
+
+/*************
+ *
+ * Create and Destroy Shared Data
+ *
+ */
+
+/*
+ * Initialize the Shared Data chunk in place.
+ * sd points to the start of the mapped shared memory, which is bufferSize bytes long.
+ * The tables are laid out to hold what config asks for (no member may be zero).
+ * Returns IP_ERROR if that does not fit.
+ */
+int initSharedData(struct SharedData_t* sd, int bufferSize, SharedMemory_config* config) {
+	if (sd == NULL || config == NULL)
+		return IP_ERROR;
+	sd->magic = 0;
+	if (config->maxNumFields <= 0 || config->maxValueSize <= 0
+			|| (long long) config->maxNumFields * (long long) sizeof(struct field_t) > bufferSize
+			|| config->maxValueSize > bufferSize / 2) {
+		printf("ERROR: %d fields of up to %d bytes do not fit in %d bytes of shared memory.\n",
+				config->maxNumFields, config->maxValueSize, bufferSize);
+		return IP_ERROR;
+	}
+	sd->layoutVersion = IP_LAYOUT_VERSION;
+	sd->clean = 0;
+	sd->bufferSize = bufferSize;
+	sd->maxNumFields = config->maxNumFields;
+	sd->maxValueSize = config->maxValueSize;
+	sd->hugePages = config->hugePages;
+	sd->usedFields = 0;
+	sd->layoutSeq = 0;
+	sd->schemaFields = 0;
+	sd->schemaHash = 0;
+
+	/** Lay out the tables after the header: index, fields, slabs, then the heap itself **/
+	sd->indexSize = 1;
+	while (sd->indexSize < 2 * sd->maxNumFields)
+		sd->indexSize <<= 1;
+	long long end = sizeof(struct SharedData_t);
+	sd->indexOffset = (int) IP_ALIGN_UP(end, IP_LAYOUT_ALIGN);
+	end = sd->indexOffset + (long long) sd->indexSize * sizeof(int);
+	sd->fieldsOffset = (int) IP_ALIGN_UP(end, IP_LAYOUT_ALIGN);
+	end = sd->fieldsOffset + (long long) sd->maxNumFields * sizeof(struct field_t);
+	sd->statsOffset = (int) IP_ALIGN_UP(end, IP_LAYOUT_ALIGN);
+	end = sd->statsOffset + IP_STATS_STRIPES * (long long) sizeof(struct statsStripe_t)
+			+ (long long) sd->maxNumFields * sizeof(struct fieldStats_t);
+
+	struct heap_t* heap = &(sd->heap);
+	heap->slabSize = IP_MIN_SLAB_SIZE;
+	while (heap->slabSize < sd->maxValueSize)
+		heap->slabSize <<= 1;
+	heap->numSizeClasses = sizeClassOf(heap->slabSize) + 1;
+	heap->slabsOffset = (int) IP_ALIGN_UP(end, IP_LAYOUT_ALIGN);
+	/* whatever is left is shared between the slab table and page aligned slabs */
+	long long left = (long long) bufferSize - heap->slabsOffset - IP_MIN_SLAB_SIZE;
+	heap->numSlabs = (left > 0) ? (int) (left / (heap->slabSize + sizeof(struct slab_t))) : 0;
+	heap->offset = (int) IP_ALIGN_UP(heap->slabsOffset + (long long) heap->numSlabs * sizeof(struct slab_t),
+			IP_MIN_SLAB_SIZE);
+	if (heap->numSlabs < 1) {
+		printf("ERROR: %d fields leave no room for values in %d bytes of shared memory.\n",
+				sd->maxNumFields, bufferSize);
+		return IP_ERROR;
+	}
+
+	/** Blank out the data with zeros **/
+	memset(fieldIndex(sd), 0, sd->indexSize * sizeof(int));
+	memset((char*) sd + sd->statsOffset, 0, IP_STATS_STRIPES * sizeof(struct statsStripe_t)
+			+ sd->maxNumFields * sizeof(struct fieldStats_t));
+	int k = 0;
+	for (k = 0; k < sd->maxNumFields; ++k) {
+		/* clear field */
+		struct field_t* f = fieldAt(sd, k);
+		zeroField(f);
+		f->seq = 0;
+		f->writer = 0;
+		f->generation = 0;
+		f->waiters = 0;
+	}
+
+	/** All of the space after the tables holds the values **/
+	heap->lock = 0;
+	initHeap(sd);
+
+	if (config->schema != NULL && config->schemaCount > 0
+			&& addSchemaFields(sd, config->schema, config->schemaCount) != IP_SUCCESS)
+		return IP_ERROR;
+
+	/** Only now may clients use it **/
+	IP_STORE_RELEASE(&(sd->magic), IP_MAGIC);
+	return IP_SUCCESS;
+}
+
+/*
+ * Do a simple sanity check on the Shared Data Struct
+ */
+int verifySharedDataStruct(SharedData_t* sd) {
+	if (IP_LOAD_ACQUIRE(&(sd->magic)) == IP_MAGIC && sd->maxNumFields > 0) {
+		return IP_SUCCESS;
+	} else {
+		return IP_ERROR;
+	}
+}
+
+/*
+ * Fill in the members the caller left at zero with the defaults.
+ * src may be NULL, meaning all defaults.
+ */
+void resolveConfig(SharedMemory_config* dest, SharedMemory_config* src) {
+	memset(dest, 0, sizeof(SharedMemory_config));
+	if (src != NULL)
+		*dest = *src;
+	if (dest->capacity == 0)
+		dest->capacity = IP_BUF_SIZE;
+	if (dest->maxNumFields == 0)
+		dest->maxNumFields = IP_MAX_NUM_FIELDS;
+	if (dest->maxValueSize == 0)
+		dest->maxValueSize = IP_FIELD_DATA_CONTAINER_SIZE;
+}
+
+/*
+ * Check whether the file a host just mapped holds shared data it can take over as it
+ * is: laid out by this version of the library with the geometry and schema of config,
+ * and closed cleanly by the last host. Says why not, unless the file is new.
+ * Returns IP_SUCCESS or IP_ERROR.
+ */
+int keptSharedData(SharedMemory_handle sm, SharedMemory_config* config) {
+	struct SharedData_t* sd = (struct SharedData_t*) sm->pBuf;
+	if (IP_LOAD_ACQUIRE(&(sd->magic)) != IP_MAGIC)
+		return IP_ERROR; /* a new file */
+	if (sd->layoutVersion != IP_LAYOUT_VERSION || sd->bufferSize != sm->BufferSize
+			|| sd->maxNumFields != config->maxNumFields || sd->maxValueSize != config->maxValueSize
+			|| sd->schemaHash != ip_SchemaHash(config->schema, config->schemaCount)) {
+		printf("Shared memory file %s was laid out differently, starting over.\n", sm->path);
+		return IP_ERROR;
+	}
+	if (!IP_LOAD_ACQUIRE(&(sd->clean))) {
+		printf("Shared memory file %s was not closed cleanly, starting over.\n", sm->path);
+		return IP_ERROR;
+	}
+	return IP_SUCCESS;
+}
+
+/*
+ * Take over the shared data in a file kept from an earlier host (see keptSharedData()):
+ * clear the blobs whose payloads went away with their creators, and mark it in use.
+ * Must be called with the shared memory lock held.
+ */
+void reopenSharedData(SharedMemory_handle sm) {
+	struct SharedData_t* sd = (struct SharedData_t*) sm->pBuf;
+	/* backwards, since clearing a field moves the last one into its slot */
+	int k = 0;
+	for (k = sd->usedFields - 1; k >= sd->schemaFields; --k) {
+		struct field_t* f = fieldAt(sd, k);
+		if (f->kind != IP_KIND_BLOB)
+			continue;
+		/** The payload is there for as long as its creator has it open **/
+		struct Blob_t probe;
+		memset(&probe, 0, sizeof(probe));
+		probe.sm = sm;
+		strcpy(probe.name, f->name);
+		probe.hugePages = ((struct blob_t*) ((char*) sd + f->offset))->hugePages;
+#ifdef _WIN32
+		probe.hMapFile = NULL;
+#else
+		probe.fd = -1;
+#endif
+		if (mapBlob(&probe, 0, ((struct blob_t*) ((char*) sd + f->offset))->capacity, 0) == IP_SUCCESS) {
+			unmapBlob(&probe);
+		} else {
+			deleteFieldFromSharedData(probe.name, sd, sm->lockWaitTime);
+		}
+	}
+	IP_STORE_RELEASE(&(sd->clean), 0);
+}
+
+/*
+ * Let go of the shared data in a file as its host: write it out as sm->syncPolicy
+ * asks, then mark it clean, so that the next host takes it over as it is.
+ */
+void closeSharedData(SharedMemory_handle sm) {
+	struct SharedData_t* sd = sm->sd;
+	if (sm->reserved != NULL) {
+		unlockField(sd, sm->reserved); /* publish whatever was written so far */
+		sm->reserved = NULL;
+	}
+	/* everything on disk before the flag that says so */
+	if (sm->syncPolicy == IP_SYNC_ON_CLOSE && flushSharedMemory(sm, sm->BufferSize) != IP_SUCCESS)
+		return;
+	IP_STORE_RELEASE(&(sd->clean), 1);
+	if (sm->syncPolicy == IP_SYNC_ON_CLOSE)
+		flushSharedMemory(sm, sizeof(struct SharedData_t));
+}
+
+/*
+ * Create the fields of a schema in slots 0, 1, ... of a shared data being initialized.
+ * Returns IP_ERROR if the schema is invalid, or IP_NO_MORE_ROOM.
+ */
+int addSchemaFields(struct SharedData_t* sd, const Schema_field* schema, int count) {
+	if (count > sd->maxNumFields) {
+		printf("ERROR: a schema of %d fields does not fit in %d fields.\n", count, sd->maxNumFields);
+		return IP_NO_MORE_ROOM;
+	}
+	int k = 0;
+	for (k = 0; k < count; ++k) {
+		const char* name = schema[k].name;
+		int duplicate = 0;
+		int j = 0;
+		for (j = 0; j < k && name != NULL; ++j)
+			duplicate |= (strcmp(name, schema[j].name) == 0);
+		if (name == NULL || strlen(name) < 1 || strlen(name) >= IP_FIELD_NAME_SIZE
+				|| schema[k].size <= 0 || schema[k].size > sd->maxValueSize || duplicate) {
+			printf("ERROR: field %d of the schema (%s, %d bytes) is invalid.\n", k,
+					(name != NULL) ? name : "NULL", schema[k].size);
+			return IP_ERROR;
+		}
+		nameField(fieldAt(sd, k), (char*) name);
+		int ret = fillSchemaField(sd, k, schema[k].size);
+		if (ret != IP_SUCCESS)
+			return ret;
+		sd->usedFields++;
+	}
+	sd->schemaFields = count;
+	sd->schemaHash = ip_SchemaHash(schema, count);
+	return IP_SUCCESS;
+}
+
+/*
+ * Give field k of the schema a zeroed value of size bytes, and put it in the index.
+ * Returns IP_SUCCESS or IP_NO_MORE_ROOM.
+ */
+int fillSchemaField(struct SharedData_t* sd, int k, int size) {
+	struct field_t* f = fieldAt(sd, k);
+	int ret = allocField(sd, f, size);
+	if (ret != IP_SUCCESS)
+		return ret;
+	memset((char*) sd + f->offset, 0, size);
+	f->size = size;
+	indexInsert(sd, f->hash, k);
+	return IP_SUCCESS;
+}
+
+/*
+ * Locate the tables of the shared data
+ */
+struct field_t* fieldAt(struct SharedData_t* sd, int k) {
+	return (struct field_t*) ((char*) sd + sd->fieldsOffset) + k;
+}
+
+int fieldSlot(struct SharedData_t* sd, struct field_t* f) {
+	return (int) (f - fieldAt(sd, 0));
+}
+
+int* fieldIndex(struct SharedData_t* sd) {
+	return (int*) ((char*) sd + sd->indexOffset);
+}
+
+struct slab_t* slabAt(struct SharedData_t* sd, int k) {
+	return (struct slab_t*) ((char*) sd + sd->heap.slabsOffset) + k;
+}
+
+/*
+ * The shared data of a handle, whether it may write to it or only look at it
+ * (see ip_CreateSharedMemoryObserver()). NULL if there is none.
+ */
+struct SharedData_t* observedData(SharedMemory_handle sm) {
+	return (sm->sd != NULL) ? sm->sd : sm->observed;
+}
+
+/*************
+ *
+ * Statistics
+ *
+ */
+
+/*
+ * Statistics, see ip_GetStats()
+ *  statsStripe() returns the stripe the calling process adds to.
+ *  fieldStatsAt() returns the counters of the field in slot k.
+ *  countRead() and countWrite() count a read or a write of the field in slot k,
+ *  countMiss() a read of a field that does not exist and countBusy() a lock that
+ *  was not taken in time. They do nothing without IP_ENABLE_STATS.
+ */
+struct statsStripe_t* statsStripe(struct SharedData_t* sd) {
+	return (struct statsStripe_t*) ((char*) sd + sd->statsOffset)
+			+ processId() % IP_STATS_STRIPES;
+}
+
+struct fieldStats_t* fieldStatsAt(struct SharedData_t* sd, int k) {
+	return (struct fieldStats_t*) ((char*) sd + sd->statsOffset
+			+ IP_STATS_STRIPES * sizeof(struct statsStripe_t)) + k;
+}
+
+void countRead(struct SharedData_t* sd, int k) {
+#if IP_ENABLE_STATS
+	IP_STAT_ADD(&(statsStripe(sd)->reads), 1);
+	IP_STAT_BUMP(&(fieldStatsAt(sd, k)->reads));
+#endif
+}
+
+void countWrite(struct SharedData_t* sd, int k) {
+#if IP_ENABLE_STATS
+	IP_STAT_ADD(&(statsStripe(sd)->writes), 1);
+	IP_STAT_BUMP(&(fieldStatsAt(sd, k)->writes));
+#endif
+}
+
+void countMiss(struct SharedData_t* sd) {
+	IP_STAT_ADD(&(statsStripe(sd)->misses), 1);
+}
+
+void countBusy(struct SharedData_t* sd) {
+	IP_STAT_ADD(&(statsStripe(sd)->busy), 1);
+}
+
+/*
+ * Time the shared memory lock for the statistics. Pass the statsClock() from before
+ * asking for the lock to countLockWait(), along with what asking returned;
+ * countLockHold() counts how long the lock was held, just before it is released.
+ * Without IP_ENABLE_STATS none of them looks at the clock.
+ */
+long long statsClock() {
+#if IP_ENABLE_STATS
+	return monotonicNs();
+#else
+	return 0;
+#endif
+}
+
+void countLockWait(SharedMemory_handle sm, long long start, int ret) {
+#if IP_ENABLE_STATS
+	if (sm->sd == NULL || verifySharedDataStruct(sm->sd) == IP_ERROR)
+		return; /* not laid out yet */
+	long long now = monotonicNs();
+	IP_STAT_ADD(&(statsStripe(sm->sd)->lockWait[statsBucket(now - start)]), 1);
+	if (ret == IP_SUCCESS)
+		sm->lockTakenNs = now;
+	else
+		countBusy(sm->sd);
+#endif
+}
+
+void countLockHold(SharedMemory_handle sm) {
+#if IP_ENABLE_STATS
+	if (sm->sd == NULL || verifySharedDataStruct(sm->sd) == IP_ERROR)
+		return; /* not laid out yet */
+	long long held = monotonicNs() - sm->lockTakenNs;
+	IP_STAT_ADD(&(statsStripe(sm->sd)->lockHold[statsBucket(held)]), 1);
+#endif
+}
+
+/*
+ * The bucket of the lock time histograms that ns nanoseconds go in, see SharedMemory_stats
+ */
+int statsBucket(long long ns) {
+	if (ns < 64)
+		return 0;
+	int bucket = 63 - __builtin_clzll((unsigned long long) ns) - 5; /* 64 to 127 ns is bucket 1 */
+	return (bucket < IP_STATS_BUCKETS - 1) ? bucket : IP_STATS_BUCKETS - 1;
+}
+
+/*
+ * Keep the counters of the fields in step with the field table: clearFieldStats()
+ * zeroes those of slot k, and moveFieldStats() carries those of slot from over to
+ * slot to, zeroing slot from. Must be called with the shared memory lock held.
+ */
+void clearFieldStats(struct SharedData_t* sd, int k) {
+	struct fieldStats_t* fs = fieldStatsAt(sd, k);
+	IP_STORE_RELAXED(&(fs->reads), 0);
+	IP_STORE_RELAXED(&(fs->writes), 0);
+}
+
+void moveFieldStats(struct SharedData_t* sd, int from, int to) {
+	struct fieldStats_t* src = fieldStatsAt(sd, from);
+	struct fieldStats_t* dest = fieldStatsAt(sd, to);
+	IP_STORE_RELAXED(&(dest->reads), IP_LOAD_RELAXED(&(src->reads)));
+	IP_STORE_RELAXED(&(dest->writes), IP_LOAD_RELAXED(&(src->writes)));
+	clearFieldStats(sd, from);
+}
+
+/********************
+ *
+ * Get Lock
+ *
+ */
+
+/*
+ *  Tries to acquire a lock by waiting until the mutex is released.
+ *  The function will wait the amount of time specified in the SharedMemory object
+ *  (the default is 4ms). On POSIX the lock is fair: processes get it in the order
+ *  they asked for it.
+ *
+ *  The lock guards the layout of the shared memory: while it is held no fields
+ *  can be added or removed. Values of existing fields are protected by a lock of
+ *  their own, so they can still be written by other processes.
+ *
+ *  This function returns
+ *  0 IP_SUCCESS
+ *  1 IP_BUSY
+ *
+ *  Don't forget to call ReleaseLock()
+ */
+#ifdef _WIN32
+
+int AcquireLock(SharedMemory_handle sm) {
+	/*Try to Attain Mutex Lock */
+	if (sm->ghMutex == NULL) {
+		printf("DUDE! sm->ghMutex is null!\n");
+
+	}
+	// Request ownership of mutex.
+	DWORD dwWaitResult;
+	long long start = statsClock();
+	dwWaitResult = WaitForSingleObject(sm->ghMutex, // handle to mutex
+			(sm->lockWaitTime > 0) ? (DWORD) ((sm->lockWaitTime + 999999LL) / 1000000LL) : 0); // time-out interval in ms
+	countLockWait(sm, start, (dwWaitResult == WAIT_OBJECT_0 || dwWaitResult == WAIT_ABANDONED)
+			? IP_SUCCESS : IP_BUSY);
+	switch (dwWaitResult) {
+	// The thread got ownership of the mutex
+	case WAIT_OBJECT_0:
+		return IP_SUCCESS;
+
+		// The thread got ownership of an abandoned mutex: its owner died holding it
+	case WAIT_ABANDONED:
+		printf("ERROR: a process died holding the shared memory lock, taking it over\n");
+		if (sm->pBuf != NULL)
+			repairLayout((struct SharedData_t*) sm->pBuf);
+		return IP_SUCCESS;
+	}
+	return IP_BUSY;
+}
+
+/*
+ * Tries to release the mutex. Returns IP_ERROR or IP_SUCCESS;
+ */
+int ReleaseLock(SharedMemory_handle sm) {
+	// Release ownership of the mutex object
+	countLockHold(sm);
+	if (!ReleaseMutex(sm->ghMutex)) {
+		printf("ERROR: Unable to release mutex\n");
+		return IP_ERROR;
+	} else {
+		return IP_SUCCESS;
+	}
+
+}
+
+#else /* POSIX */
+
+int AcquireLock(SharedMemory_handle sm) {
+	struct SharedData_t* sd = (struct SharedData_t*) sm->pBuf;
+	if (sd == NULL) {
+		printf("DUDE! shared memory is not mapped!\n");
+		return IP_ERROR;
+	}
+
+	/* Uncontended case: no system call at all */
+	long long start = statsClock();
+	int ret = ticketLock(&(sd->lock), sm->lockWaitTime);
+	countLockWait(sm, start, ret);
+	if (ret == IP_SUCCESS && IP_LOAD_RELAXED(&(sd->lock.damaged))) {
+		/** The last holder died with the lock, maybe halfway through changing the layout **/
+		repairLayout(sd);
+		IP_STORE_RELAXED(&(sd->lock.damaged), 0);
+	}
+	return ret;
+}
+
+/*
+ * Tries to release the mutex. Returns IP_ERROR or IP_SUCCESS;
+ */
+int ReleaseLock(SharedMemory_handle sm) {
+	struct SharedData_t* sd = (struct SharedData_t*) sm->pBuf;
+	if (sd == NULL || IP_LOAD_RELAXED(&(sd->lock.next)) == IP_LOAD_RELAXED(&(sd->lock.serving))) {
+		printf("ERROR: Unable to release mutex\n");
+		return IP_ERROR;
+	}
+	countLockHold(sm);
+	ticketUnlock(&(sd->lock));
+	return IP_SUCCESS;
+}
+
+#endif /* _WIN32 */
+
+/*********************************************************************************/
+/*********************************************************************************/
+/* 			P U B L I C        F U N C T I O N S                                 */
+/*********************************************************************************/
+/*********************************************************************************/
+
+/*************
+ *  Create and Destroy Shared Memory
+ *
+ *
+ */
+
+/*
+ * Start the shared memory host and create a shared memory object.
+ * This is to be run on the host process.
+ */
+SharedMemory_handle ip_CreateSharedMemoryHost(char* name) {
+	return ip_CreateSharedMemoryHostEx(name, NULL);
+}
+
+/*
+ * Start the shared memory host and create a shared memory object
+ * laid out as described by config.
+ * This is to be run on the host process.
+ */
+SharedMemory_handle ip_CreateSharedMemoryHostEx(char* name, SharedMemory_config* config) {
+	SharedMemory_config geometry;
+	resolveConfig(&geometry, config);
+	if (geometry.capacity < (int) sizeof(struct SharedData_t)) {
+		printf("ERROR: a shared memory of %d bytes is too small.\n", geometry.capacity);
+		return NULL;
+	}
+
+	/* Create Local Shared Memory Object to Store Information */
+	SharedMemory_handle sm = createSharedMemoryObj(name);
+	if (sm == NULL)
+		return NULL;
+
+	/** Create file mapping **/
+	if (mapSharedMemory(sm, 1, geometry.capacity, geometry.hugePages) != IP_SUCCESS) {
+		destroySharedMemoryObj(sm);
+		return NULL;
+	}
+	geometry.hugePages = sm->hugePages;
+	sm->syncPolicy = geometry.syncPolicy;
+
+	/** A file kept from an earlier host is taken over as it is, if it was closed cleanly **/
+	int kept = (sm->path[0] != '\0' && keptSharedData(sm, &geometry) == IP_SUCCESS);
+	if (sm->path[0] != '\0' && !kept)
+		memset(sm->pBuf, 0, sizeof(struct SharedData_t));
+
+	/** and the lock that guards it: a client may hold that of a kept file (if it died, it is taken over) **/
+	if (createLock(sm, !kept) != IP_SUCCESS) {
+		destroySharedMemoryObj(sm);
+		return NULL;
+	}
+
+	/*Try to Attain Mutex Lock */
+	if (AcquireLock(sm) == IP_SUCCESS) {
+		/* Lay out the Shared Data Object directly in Shared Memory (all of it, if it was rounded up) */
+		int ret = IP_SUCCESS;
+		if (kept)
+			reopenSharedData(sm);
+		else
+			ret = initSharedData((struct SharedData_t*) sm->pBuf, sm->BufferSize, &geometry);
+		// Release ownership of the mutex object
+		ReleaseLock(sm);
+		if (ret != IP_SUCCESS) {
+			destroySharedMemoryObj(sm);
+			return NULL;
+		}
+
+		/* Update the Shared MEmory Obj to reflect that the local data is now in shared MEmory */
+		sm->sd = (SharedData_t*) sm->pBuf;
+		sm->ownsFile = (sm->path[0] != '\0');
+
+	} else {
+		printf("The mutex appears to be busy!. Sad. \n");
+		destroySharedMemoryObj(sm);
+		sm = NULL;
+	}
+
+	return sm;
+}
+
+/*
+ * Start the shared memory client and create a shared memory object.
+ * This is to be run on the client process.
+ */
+SharedMemory_handle ip_CreateSharedMemoryClient(char* name) {
+	/* Create Local Shared Memory Object to Store Information */
+	SharedMemory_handle sm = createSharedMemoryObj(name);
+	if (sm == NULL)
+		return NULL;
+
+	/** Open file mapping (sized by the host) and the lock that guards it **/
+	if (mapSharedMemory(sm, 0, 0, 0) != IP_SUCCESS || createLock(sm, 0) != IP_SUCCESS) {
+		destroySharedMemoryObj(sm);
+		return NULL;
+	}
+
+	/* Update the Shared MEmory Obj to reflect that shared data  is now in shared MEmory */
+	sm->sd = (SharedData_t*) sm->pBuf;
+
+	 /*Attain Mutex Lock */
+	if (AcquireLock(sm) == IP_SUCCESS) {
+
+		/* Check to see that Shared Data Struct is Valid, and that we mapped all of it */
+		if (verifySharedDataStruct(sm->sd) == IP_SUCCESS
+				&& sm->sd->bufferSize <= sm->BufferSize) {
+			printf("SUCCESS: Shared data structure verified!\n");
+			printf("sm->sd->usedFields=	 %d\n", sm->sd->usedFields);
+			ReleaseLock(sm);
+		} else {
+			printf("ERROR: The Shared Data Struct is not valid!\n");
+			ReleaseLock(sm);
+			destroySharedMemoryObj(sm);
+			sm = NULL;
+		}
+	} else {
+		printf(
+				"Shared memory busy.\nUnable to attain lock to verify the shared data structs.\n");
+		destroySharedMemoryObj(sm);
+		sm = NULL;
+	}
+
+	/* if sm is null something went wrong */
+	return sm;
+}
+
+/*
+ * Start the shared memory client like ip_CreateSharedMemoryClient(), but only if the
+ * host created the shared memory with the schema whose ip_SchemaHash() is schemaHash
+ * (0 for no schema). Returns NULL if the schemas differ.
+ */
+SharedMemory_handle ip_CreateSharedMemoryClientEx(char* name, unsigned long long schemaHash) {
+	SharedMemory_handle sm = ip_CreateSharedMemoryClient(name);
+	if (sm == NULL)
+		return NULL;
+	if (sm->sd->schemaHash != schemaHash) {
+		printf("ERROR: the shared memory was created with another schema (%016llx, not %016llx).\n",
+				sm->sd->schemaHash, schemaHash);
+		destroySharedMemoryObj(sm);
+		return NULL;
+	}
+	return sm;
+}
+
+/*
+ * Open the shared memory only to look at it, e.g. to monitor it from another process.
+ * The shared memory is mapped read-only and the lock is never taken, so watching
+ * cannot slow down the processes using it.
+ * The handle works with ip_GetSharedMemoryName(), ip_GetSharedMemorySize(),
+ * ip_GetSharedMemoryConfig(), ip_GetSchemaHash(), ip_GetStats(), ip_ListFields()
+ * and ip_CloseSharedMemory(); everything else turns it away with IP_ERROR.
+ * Returns NULL if the shared memory does not exist or is not laid out yet.
+ */
+SharedMemory_handle ip_CreateSharedMemoryObserver(char* name) {
+	SharedMemory_handle sm = createSharedMemoryObj(name);
+	if (sm == NULL)
+		return NULL;
+
+	/** No lock: the magic number is only published once the host is done **/
+	sm->readOnly = 1;
+	if (mapSharedMemory(sm, 0, 0, 0) != IP_SUCCESS) {
+		destroySharedMemoryObj(sm);
+		return NULL;
+	}
+	struct SharedData_t* sd = (struct SharedData_t*) sm->pBuf;
+	if (verifySharedDataStruct(sd) == IP_ERROR || sd->bufferSize > sm->BufferSize) {
+		printf("ERROR: The Shared Data Struct is not valid!\n");
+		destroySharedMemoryObj(sm);
+		return NULL;
+	}
+	sm->observed = sd;
+	return sm;
+}
+
+/*
+ * Fingerprint of a schema: a 64 bit FNV-1a hash of the names and sizes of its fields,
+ * in order. 0 for an empty schema.
+ * interprocess.hpp computes the same hash at compile time.
+ */
+unsigned long long ip_SchemaHash(const Schema_field* schema, int count) {
+	if (schema == NULL || count <= 0)
+		return 0;
+	unsigned long long hash = 14695981039346656037ULL;
+	int k = 0;
+	for (k = 0; k < count; ++k) {
+		const char* c = (schema[k].name != NULL) ? schema[k].name : "";
+		/* the name with its terminating zero, then the size, least significant byte first */
+		do {
+			hash = (hash ^ (unsigned char) *c) * 1099511628211ULL;
+		} while (*c++ != '\0');
+		int b = 0;
+		for (b = 0; b < 4; ++b)
+			hash = (hash ^ (((unsigned int) schema[k].size >> (8 * b)) & 0xff)) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+ * Get the ip_SchemaHash() of the schema the shared memory was created with,
+ * 0 if none.
+ */
+unsigned long long ip_GetSchemaHash(SharedMemory_handle sm) {
+	if (sm == NULL || observedData(sm) == NULL)
+		return 0;
+	return observedData(sm)->schemaHash;
+}
+
+/*
+ *  Close the shared memory.
+ *  Returns 0 if success (IP_SUCCESS).
+ *  Returns -1 if error (IP_ERROR).
+ */
+int ip_CloseSharedMemory(SharedMemory_handle sm) {
+	/* the host of a file leaves it for the next one */
+	if (sm != NULL && sm->path[0] != '\0' && sm->sd != NULL && sm->ownsFile)
+		closeSharedData(sm);
+	return destroySharedMemoryObj(sm);
+
+}
+
+/*********************
+ *
+ *  Get Properties of Shared Memory
+ *
+ *
+ */
+
+/*
+ * Get the name of the shared memory. This name is used as the unique identifier.
+ */
+char* ip_GetSharedMemoryName(SharedMemory_handle sm) {
+	return (sm->path[0] != '\0') ? sm->path : sm->name;
+
+}
+
+/*
+ * Get the size of the shared memory.
+ *
+ */
+int ip_GetSharedMemorySize(SharedMemory_handle sm) {
+	return sm->BufferSize;
+
+}
+
+/*
+ * Get the geometry of the shared memory, as the host laid it out.
+ * The capacity may be larger than the host asked for, see ip_CreateSharedMemoryHostEx().
+ *
+ * Returns IP_SUCCESS 0
+ * or IP_ERROR -1
+ */
+int ip_GetSharedMemoryConfig(SharedMemory_handle sm, SharedMemory_config* config) {
+	if (sm == NULL || observedData(sm) == NULL || config == NULL)
+		return IP_ERROR;
+	struct SharedData_t* sd = observedData(sm);
+	config->capacity = sd->bufferSize;
+	config->maxNumFields = sd->maxNumFields;
+	config->maxValueSize = sd->maxValueSize;
+	config->hugePages = sd->hugePages;
+	config->schema = NULL;
+	config->schemaCount = sd->schemaFields;
+	config->syncPolicy = sm->syncPolicy;
+	return IP_SUCCESS;
+}
+
+/*
+ *
+ * Get shared memory status
+ *
+ * Returns 0 (IP_SUCCESS) if shared memory exists and is available
+ * Returns 1 (IP_BUSY) if shared memory exists but is busy
+ * Returns -1 (IP_ERROR) if error
+ * Returns -2 (IP_DOESNOTEXIST) if shared memory does not exist
+ *
+ */
+int ip_GetSharedMemoryStatus(SharedMemory_handle sm) {
+	if (sm == NULL) {
+		return IP_DOES_NOT_EXIST;
+	}
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	if (AcquireLock(sm) == IP_BUSY) {
+		return IP_BUSY;
+
+	} else {
+
+		if (verifySharedDataStruct(sm->sd) == IP_ERROR) {
+			ReleaseLock(sm);
+			printf("Shared Data struct in shared memory is invalid.\n");
+			return IP_ERROR;
+		}
+
+		ReleaseLock(sm);
+		return IP_SUCCESS;
+
+	}
+}
+
+/*
+ * Get the statistics of the shared memory: what all processes using it did so far
+ * (or since ip_ResetStats()). Every process adds to the counters in the shared memory
+ * with relaxed atomics, so a read taken while others are busy may be a little behind.
+ * Processes built with IP_ENABLE_STATS set to 0 count nothing, and pay nothing for it.
+ *
+ * Returns IP_SUCCESS 0
+ * or IP_ERROR -1
+ */
+int ip_GetStats(SharedMemory_handle sm, SharedMemory_stats* stats) {
+	if (sm == NULL || stats == NULL || observedData(sm) == NULL
+			|| verifySharedDataStruct(observedData(sm)) == IP_ERROR)
+		return IP_ERROR;
+
+	memset(stats, 0, sizeof(SharedMemory_stats));
+	struct SharedData_t* sd = observedData(sm);
+	struct statsStripe_t* stripes = (struct statsStripe_t*) ((char*) sd + sd->statsOffset);
+	int k = 0;
+	for (k = 0; k < IP_STATS_STRIPES; ++k) {
+		struct statsStripe_t* stripe = &(stripes[k]);
+		stats->reads += IP_LOAD_RELAXED(&(stripe->reads));
+		stats->writes += IP_LOAD_RELAXED(&(stripe->writes));
+		stats->misses += IP_LOAD_RELAXED(&(stripe->misses));
+		stats->busy += IP_LOAD_RELAXED(&(stripe->busy));
+		int b = 0;
+		for (b = 0; b < IP_STATS_BUCKETS; ++b) {
+			stats->lockWait[b] += IP_LOAD_RELAXED(&(stripe->lockWait[b]));
+			stats->lockHold[b] += IP_LOAD_RELAXED(&(stripe->lockHold[b]));
+		}
+	}
+	return IP_SUCCESS;
+}
+
+/*
+ * Get how often a field was read and written since it was created (or since
+ * ip_ResetStats()), in *reads and *writes.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_GetFieldStats(SharedMemory_handle sm, char* fieldName, unsigned long long* reads,
+		unsigned long long* writes) {
+	if (reads == NULL || writes == NULL)
+		return IP_ERROR;
+
+	/** The field may be moved while its counters are copied, then look it up again **/
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SEQLOCK_MAX_RETRIES; ++attempt) {
+		Field_handle handle;
+		int ret = ip_ResolveField(sm, fieldName, &handle);
+		if (ret != IP_SUCCESS)
+			return ret;
+		struct fieldStats_t* fs = fieldStatsAt(sm->sd, handle.slot);
+		*reads = IP_LOAD_RELAXED(&(fs->reads));
+		*writes = IP_LOAD_RELAXED(&(fs->writes));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (IP_LOAD_RELAXED(&(fieldAt(sm->sd, handle.slot)->generation)) == handle.generation)
+			return IP_SUCCESS;
+	}
+	return IP_BUSY;
+}
+
+/*
+ * Set all of the statistics of the shared memory back to zero, those of the fields included.
+ * Counts made by other processes while this runs may survive it.
+ *
+ * Returns IP_SUCCESS 0
+ * or IP_ERROR -1
+ */
+int ip_ResetStats(SharedMemory_handle sm) {
+	if (sm == NULL || sm->sd == NULL || verifySharedDataStruct(sm->sd) == IP_ERROR)
+		return IP_ERROR;
+
+	unsigned long long* counters = (unsigned long long*) ((char*) sm->sd + sm->sd->statsOffset);
+	int count = (int) ((IP_STATS_STRIPES * sizeof(struct statsStripe_t)
+			+ sm->sd->maxNumFields * sizeof(struct fieldStats_t)) / sizeof(unsigned long long));
+	int k = 0;
+	for (k = 0; k < count; ++k)
+		IP_STORE_RELAXED(&(counters[k]), 0);
+	return IP_SUCCESS;
+}
+
+/*
+ * List the fields in the shared memory, in the order of the field table, storing up
+ * to max of them in out and how many that is in *count. To be sure of getting all of
+ * them, make room for the maxNumFields of ip_GetSharedMemoryConfig().
+ * No lock is taken: the list is a consistent snapshot of which fields exist, but each
+ * field's version and counters are only as fresh as the moment it was copied.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if fields kept being added or removed meanwhile
+ *
+ */
+int ip_ListFields(SharedMemory_handle sm, Field_info* out, int max, int* count) {
+	if (sm == NULL || out == NULL || count == NULL || max < 0)
+		return IP_ERROR;
+	struct SharedData_t* sd = observedData(sm);
+	if (sd == NULL || verifySharedDataStruct(sd) == IP_ERROR) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** Fields are only added, moved or removed while the layout sequence counter is odd **/
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SEQLOCK_MAX_RETRIES; ++attempt) {
+		unsigned int layout = IP_LOAD_ACQUIRE(&(sd->layoutSeq));
+		if (layout & 1) {
+			IP_CPU_RELAX();
+			continue;
+		}
+
+		int n = IP_LOAD_RELAXED(&(sd->usedFields));
+		if (n > sd->maxNumFields)
+			n = sd->maxNumFields; /* torn, the check below throws it away */
+		if (n > max)
+			n = max;
+		int k = 0;
+		for (k = 0; k < n; ++k) {
+			struct field_t* f = fieldAt(sd, k);
+			Field_info* info = &(out[k]);
+			memcpy(info->name, f->name, IP_FIELD_NAME_SIZE);
+			info->name[IP_FIELD_NAME_SIZE - 1] = '\0';
+			info->kind = IP_LOAD_RELAXED(&(f->kind));
+			info->size = (info->kind == IP_KIND_VALUE) ? IP_LOAD_RELAXED(&(f->size))
+					: IP_LOAD_RELAXED(&(f->capacity));
+			info->version = IP_LOAD_ACQUIRE(&(f->seq)) & ~1u; /* a write in progress still has the old version */
+			struct fieldStats_t* fs = fieldStatsAt(sd, k);
+			info->reads = IP_LOAD_RELAXED(&(fs->reads));
+			info->writes = IP_LOAD_RELAXED(&(fs->writes));
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (IP_LOAD_RELAXED(&(sd->layoutSeq)) == layout) {
+			*count = n;
+			return IP_SUCCESS;
+		}
+	}
+	return IP_BUSY;
+}
+
+/*
+ * Copy the value of every field (objects such as queues are left out) into buffer,
+ * which is *size bytes long, as a snapshot (see Snapshot_header). *size is set to the
+ * number of bytes used, or if that is not enough, to the number needed.
+ *
+ * No lock is taken, so writers are never held up. The snapshot is checked against
+ * the fields' versions, so it is normally IP_SNAPSHOT_POINT_IN_TIME: every value in
+ * it was current at the same moment. If writers keep changing values while it is
+ * copied, it is taken again value by value: each value is then still whole, but the
+ * values may be from slightly different moments (and a batch written with
+ * ip_WriteValues() meanwhile may be seen half written). A handle from
+ * ip_CreateSharedMemoryObserver() can take snapshots too.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if fields kept being added or removed, or a value kept changing
+ *  IP_NO_MORE_ROOM -3  if the snapshot does not fit in the buffer
+ *
+ */
+int ip_Snapshot(SharedMemory_handle sm, void* buffer, int* size) {
+	if (sm == NULL || size == NULL || *size < 0 || (buffer == NULL && *size > 0))
+		return IP_ERROR;
+	struct SharedData_t* sd = observedData(sm);
+	if (sd == NULL || verifySharedDataStruct(sd) == IP_ERROR) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+	int capacity = *size;
+
+	/** Fast path: copy everything without any lock, and check that nothing changed **/
+	int ret = IP_BUSY;
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SNAPSHOT_MAX_RETRIES && ret == IP_BUSY; ++attempt)
+		ret = takeSnapshot(sd, (char*) buffer, capacity, size, 0);
+
+	/** Writers kept getting in the way, so settle for each value whole, still without a lock **/
+	for (attempt = 0; attempt < IP_SNAPSHOT_MAX_RETRIES && ret == IP_BUSY; ++attempt)
+		ret = takeSnapshot(sd, (char*) buffer, capacity, size, 1);
+	return ret;
+}
+
+/*
+ * Set how long to wait for a lock held by another process before giving up with
+ * IP_BUSY, in milliseconds (default 4). Zero means don't wait at all.
+ * Returns IP_SUCCESS 0 or IP_ERROR -1
+ */
+int ip_SetSharedMemoryLockWaitTime(SharedMemory_handle sm, int time_ms) {
+	if (sm != NULL) {
+		sm->lockWaitTime = (long long) time_ms * 1000000LL;
+		return IP_SUCCESS;
+	} else {
+		return IP_ERROR;
+	}
+}
+
+/*
+ * Get how long to wait for a lock held by another process, in milliseconds
+ * (rounded down), or IP_ERROR -1
+ */
+int ip_GetSharedMemoryLockWaitTime(SharedMemory_handle sm) {
+	if (sm == NULL)
+		return IP_ERROR;
+	return (int) (sm->lockWaitTime / 1000000LL);
+}
+
+/*
+ * Set how long to wait for a lock held by another process before giving up with
+ * IP_BUSY, in nanoseconds. Zero means don't wait at all. On Windows the wait is
+ * rounded up to whole milliseconds.
+ * Returns IP_SUCCESS 0 or IP_ERROR -1
+ */
+int ip_SetSharedMemoryLockWaitTimeNs(SharedMemory_handle sm, long long time_ns) {
+	if (sm == NULL || time_ns < 0)
+		return IP_ERROR;
+	sm->lockWaitTime = time_ns;
+	return IP_SUCCESS;
+}
+
+/*
+ * Get how long to wait for a lock held by another process, in nanoseconds,
+ * or IP_ERROR -1
+ */
+long long ip_GetSharedMemoryLockWaitTimeNs(SharedMemory_handle sm) {
+	if (sm == NULL)
+		return IP_ERROR;
+	return sm->lockWaitTime;
+}
+
+
+/*
+ * Get The Refactory Period (Time Delay) for reading from shared memory
+ * time_ms stores the time delayin ms
+ *
+ * Writing a value locks the shared memory. Reading normally does not (see ip_ReadValue()),
+ * but when writers keep interfering a read falls back to taking the lock. By default, when a client
+ * successfully reads a value under the lock, the client is forced to sleep for a specified time
+ * (default is 5ms on Windows, and 0 on POSIX where the lock itself is fair). I call this
+ * the Read Time Delay.
+ *
+ * The Read Time Delay gives another process time to access the shared memory, and prevents an overly
+ * aggressive client from reading in a loop and hogging the lock.
+ *
+ * Note.. this implicitly prioritizes writing over reading.
+ *
+ * To turn off the Read Time Delay, set the time to zero.
+ *
+ * Returns IP_SUCCESS 0
+ * or IP_ERROR -1
+ *
+ */
+int ip_GetSharedMemoryReadRefractoryPeriodTimeDelay(SharedMemory_handle sm, int* time_ms){
+	if (sm==NULL) return IP_ERROR;
+	*time_ms = sm->ReadTimeDelay;
+	return IP_SUCCESS;
+}
+
+/*
+ * Set the number of milliseconds of the Read Time Delay.
+ *
+ * Writing a value locks the shared memory. Reading normally does not (see ip_ReadValue()),
+ * but when writers keep interfering a read falls back to taking the lock. By default, when a client
+ * successfully reads a value under the lock, the client is forced to sleep for a specified time
+ * (default is 5ms on Windows, and 0 on POSIX where the lock itself is fair). I call this
+ * the Read Time Delay.
+ *
+ * The Read Time Delay gives another process time to access the shared memory, and prevents an overly
+ * aggressive client from reading in a loop and hogging the lock.
+ *
+ * Note.. this implicitly prioritizes writing over reading.
+ *
+ * To turn off the Read Time Delay, set the time to zero.
+ * Returns IP_SUCCESS 0
+ * or IP_ERROR -1
+ */
+int ip_SetSharedMemoryReadRefractoryPeriodTimeDelay(SharedMemory_handle sm, int time_ms){
+	if (sm==NULL) return IP_ERROR;
+	sm->ReadTimeDelay=time_ms;
+	return IP_SUCCESS;
+}
+
+
+
+
+/*********************
+ *
+ *  Read/Write Memory
+ *
+ *
+ */
+
+/*
+ * Write a value to shared memory
+ *
+ * If the name of that value does not exist, it creates that value.
+ *
+ * Writing an existing field only takes that field's own lock, so writers of
+ * different fields do not wait for each other. Creating a field also takes the
+ * shared memory lock.
+ *
+ * Values can be of any size up to the shared memory's maxValueSize (by default
+ * IP_FIELD_DATA_CONTAINER_SIZE, see ip_CreateSharedMemoryHostEx()) bytes and a
+ * field may change size from one write to the next. The space for each value
+ * is carved out of a heap inside the shared memory.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if dataSize is larger than maxValueSize)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields or no space left for the value
+ *
+ */
+int ip_WriteValue(SharedMemory_handle sm, char* fieldName, void *data,
+		int dataSize) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (strlen(fieldName) < 1 || strlen(fieldName) > IP_FIELD_NAME_SIZE)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** Fast path: the field already exists, so only its own lock is needed **/
+	Field_handle handle;
+	if (ip_ResolveField(sm, fieldName, &handle) == IP_SUCCESS) {
+		int ret = ip_WriteValueByHandle(sm, handle, data, dataSize);
+		if (ret != IP_STALE_HANDLE)
+			return ret;
+		/** the field moved or vanished in the meantime, so take the slow path **/
+	}
+
+	/** Adding a field changes the layout, which needs the shared memory lock **/
+	if (AcquireLock(sm) == IP_BUSY)
+		return IP_BUSY;
+
+	if (verifySharedDataStruct(sm->sd) == IP_ERROR) {
+		ReleaseLock(sm);
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** Action Happens Here **/
+
+	/** The value goes straight into its new slot **/
+	int ret = addFieldToSharedData(fieldName, data, dataSize, sm->sd, sm->lockWaitTime, NULL);
+
+	ReleaseLock(sm);
+
+	return ret;
+
+}
+
+/*
+ * Read a value from shared memory
+ *
+ * Reading does not take the lock. Every field carries a sequence counter that writers
+ * bump before and after an update, so the reader copies the value optimistically and
+ * simply retries if a writer got in the way. Only if writers keep interfering does
+ * the read fall back to the lock, followed by the Read Time Delay.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if shared memory doesn't exist
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_ReadValue(SharedMemory_handle sm, char* fieldName, void *data) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** Fast path: copy the field without the lock, retrying on a torn read **/
+	int ret = readFieldLockFree(sm->sd, fieldName, data);
+	if (ret != IP_BUSY)
+		return ret;
+
+	/** Writers kept getting in the way, so queue up for the lock instead **/
+	if (AcquireLock(sm) == IP_BUSY)
+		return IP_BUSY;
+
+	if (verifySharedDataStruct(sm->sd) == IP_ERROR) {
+		ReleaseLock(sm);
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** Action Happens Here **/
+
+	/** Read out the field, holding its writer lock so that the copy cannot tear **/
+	struct field_t* f = NULL;
+	ret = findField(&f, sm->sd, fieldName);
+	if (ret == IP_SUCCESS) {
+		if (lockField(sm->sd, f, sm->lockWaitTime) == IP_SUCCESS) {
+			if (readField(sm->sd, f, data, -1) < 0)
+				ret = IP_ERROR;
+			else
+				countRead(sm->sd, fieldSlot(sm->sd, f));
+			unlockFieldUnchanged(f);
+		} else {
+			ret = IP_BUSY;
+		}
+	} else if (ret == IP_DOES_NOT_EXIST) {
+		countMiss(sm->sd);
+	}
+
+	ReleaseLock(sm);
+
+	/** Refractory Period **/
+	sleepMs(sm->ReadTimeDelay);// sleep the thread for a little bit so that other threads can capture lock
+
+	return ret;
+
+}
+
+/*
+ * Look at a value in place, without copying it out of shared memory.
+ *
+ * On success *data points at the value inside the shared memory and *size holds its
+ * size in bytes. The value is not locked: a writer may change it at any time (and a
+ * value that grows or shrinks moves somewhere else entirely). Once you are done with
+ * the data, ask ip_ValidateView() whether token is still valid. If it is not, what you
+ * saw may be torn and you should look again. Never write through the pointer.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if writers kept interfering
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_ReadValueView(SharedMemory_handle sm, char* fieldName, const void** data, int* size,
+		View_token* token) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (data == NULL || size == NULL || token == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** Same dance as readFieldLockFree(), except that nothing is copied **/
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SEQLOCK_MAX_RETRIES; ++attempt) {
+		unsigned int layout = IP_LOAD_ACQUIRE(&(sm->sd->layoutSeq));
+		if (layout & 1) {
+			IP_CPU_RELAX();
+			continue;
+		}
+
+		struct field_t* f = NULL;
+		int ret = findField(&f, sm->sd, fieldName);
+		if (ret != IP_SUCCESS) {
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (IP_LOAD_RELAXED(&(sm->sd->layoutSeq)) != layout)
+				continue;
+			if (ret == IP_DOES_NOT_EXIST)
+				countMiss(sm->sd);
+			return ret;
+		}
+
+		unsigned int seq = IP_LOAD_ACQUIRE(&(f->seq));
+		if (seq & 1) {
+			IP_CPU_RELAX();
+			continue;
+		}
+		int kind = IP_LOAD_RELAXED(&(f->kind));
+		int valueSize = IP_LOAD_RELAXED(&(f->size));
+		char* value = valueAt(sm->sd, IP_LOAD_RELAXED(&(f->offset)), valueSize);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (value != NULL && IP_LOAD_RELAXED(&(f->seq)) == seq
+				&& IP_LOAD_RELAXED(&(sm->sd->layoutSeq)) == layout) {
+			if (kind != IP_KIND_VALUE)
+				return IP_ERROR;
+			/* every change to the field, including removing it, moves its counter on */
+			token->seq = &(f->seq);
+			token->value = seq;
+			*data = value;
+			*size = valueSize;
+			countRead(sm->sd, fieldSlot(sm->sd, f));
+			return IP_SUCCESS;
+		}
+	}
+	return IP_BUSY;
+}
+
+/*
+ * Check whether a value seen through ip_ReadValueView() is still the value that was
+ * there when the view was taken, i.e. whether what you read from it is consistent.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0  the value has not changed
+ *  IP_STALE_HANDLE -4  the value was changed or removed; look again
+ *
+ */
+int ip_ValidateView(View_token token) {
+	if (token.seq == NULL)
+		return IP_STALE_HANDLE;
+	/* everything read from the view must be read before the counter is checked */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (IP_LOAD_RELAXED(token.seq) != token.value)
+		return IP_STALE_HANDLE;
+	return IP_SUCCESS;
+}
+
+/*
+ * Get the size in bytes of a field's value, e.g. to size the buffer for ip_ReadValue().
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_GetValueSize(SharedMemory_handle sm, char* fieldName, int* size) {
+	const void* data = NULL;
+	View_token token;
+	return ip_ReadValueView(sm, fieldName, &data, size, &token);
+}
+
+/*
+ * Look up a field once so that it can be read and written by handle,
+ * skipping the name lookup on every access.
+ *
+ * A handle becomes stale when its field is cleared (or when clearing another
+ * field moves it). Calls using a stale handle return IP_STALE_HANDLE; resolve
+ * the name again when that happens.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_ResolveField(SharedMemory_handle sm, char* fieldName, Field_handle* handle) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (handle == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** Fields only move while the layout sequence counter is odd **/
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SEQLOCK_MAX_RETRIES; ++attempt) {
+		unsigned int layout = IP_LOAD_ACQUIRE(&(sm->sd->layoutSeq));
+		if (layout & 1) {
+			IP_CPU_RELAX();
+			continue;
+		}
+
+		struct field_t* f = NULL;
+		int ret = findField(&f, sm->sd, fieldName);
+		if (ret == IP_SUCCESS) {
+			handle->slot = fieldSlot(sm->sd, f);
+			handle->generation = IP_LOAD_RELAXED(&(f->generation));
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (IP_LOAD_RELAXED(&(sm->sd->layoutSeq)) == layout)
+			return ret;
+	}
+	return IP_BUSY;
+}
+
+/*
+ * Read a value from shared memory by handle. Works like ip_ReadValue().
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_STALE_HANDLE -4
+ *
+ */
+int ip_ReadValueByHandle(SharedMemory_handle sm, Field_handle handle, void *data) {
+	return ip_ReadValueByHandleEx(sm, handle, data, -1, NULL);
+}
+
+/*
+ * Read a value from shared memory by handle into a buffer of capacity bytes,
+ * storing the size of the value in *size (unless size is NULL).
+ * Works like ip_ReadValueByHandle(), except that a value larger than the buffer is
+ * not copied at all; *size then tells how large a buffer it needs.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if the value is larger than capacity
+ *  IP_STALE_HANDLE -4
+ *
+ */
+int ip_ReadValueByHandleEx(SharedMemory_handle sm, Field_handle handle, void *data, int capacity,
+		int* size) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** Fast path: copy the field without the lock, retrying on a torn read **/
+	int ret = readHandleLockFree(sm->sd, handle, data, capacity, size);
+	if (ret != IP_BUSY)
+		return ret;
+
+	/** Writers kept getting in the way, so queue up for the field's lock instead **/
+	struct field_t* f = NULL;
+	ret = findFieldByHandle(&f, sm->sd, handle);
+	if (ret != IP_SUCCESS)
+		return ret;
+	if (lockField(sm->sd, f, sm->lockWaitTime) != IP_SUCCESS)
+		return IP_BUSY;
+	if (f->generation == handle.generation) {
+		int copied = readField(sm->sd, f, data, capacity);
+		if (size != NULL)
+			*size = f->size;
+		if (copied < 0)
+			ret = (copied == IP_NO_MORE_ROOM) ? IP_NO_MORE_ROOM : IP_ERROR;
+		else
+			countRead(sm->sd, handle.slot);
+	} else {
+		ret = IP_STALE_HANDLE;
+	}
+	unlockFieldUnchanged(f);
+
+	/** Refractory Period **/
+	sleepMs(sm->ReadTimeDelay);
+
+	return ret;
+}
+
+/*
+ * Write a value to shared memory by handle. Works like ip_WriteValue(),
+ * except that the field must already exist.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if dataSize is larger than maxValueSize)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3
+ *  IP_STALE_HANDLE -4
+ *
+ */
+int ip_WriteValueByHandle(SharedMemory_handle sm, Field_handle handle, void *data, int dataSize) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+	if (dataSize < 0 || dataSize > sm->sd->maxValueSize)
+		return IP_ERROR;
+
+	struct field_t* f = NULL;
+	int ret = findFieldByHandle(&f, sm->sd, handle);
+	if (ret != IP_SUCCESS)
+		return ret;
+
+	/** Only this field's lock is needed; writers of other fields are not held up **/
+	if (lockField(sm->sd, f, sm->lockWaitTime) != IP_SUCCESS)
+		return IP_BUSY;
+
+	/** The slot may have been reused while we waited for its lock **/
+	if (f->generation != handle.generation) {
+		unlockFieldUnchanged(f);
+		return IP_STALE_HANDLE;
+	}
+
+	/** Straight into the field's block, no temporary field **/
+	ret = writeField(sm->sd, f, data, dataSize);
+	if (ret == IP_SUCCESS) {
+		unlockField(sm->sd, f);
+	} else {
+		unlockFieldUnchanged(f);
+	}
+	return ret;
+}
+
+/*
+ * Reserve room for a value of dataSize bytes directly in shared memory, so that it
+ * can be built in place instead of being copied in from a buffer.
+ * If the name of that value does not exist, it creates that value.
+ *
+ * On success *data points at the value's bytes inside the shared memory. Fill in all
+ * dataSize of them (the old contents are not kept), then call ip_CommitWrite() to
+ * publish the new value. Until then the field stays locked: readers wait for (or
+ * retry around) the write, and other writers of the field get IP_BUSY. Only one write
+ * per shared memory object can be open at a time.
+ *
+ * Don't forget to call ip_CommitWrite()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if dataSize is larger than maxValueSize, or another write is open)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields or no space left for the value
+ *
+ */
+int ip_BeginWrite(SharedMemory_handle sm, char* fieldName, int dataSize, void** data) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (strlen(fieldName) < 1 || strlen(fieldName) > IP_FIELD_NAME_SIZE || data == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+	if (sm->reserved != NULL) {
+		printf("ERROR: call ip_CommitWrite() before beginning another write.\n");
+		return IP_ERROR;
+	}
+	if (dataSize < 0 || dataSize > sm->sd->maxValueSize)
+		return IP_ERROR;
+
+	struct field_t* f = NULL;
+	Field_handle handle;
+	int ret = ip_ResolveField(sm, fieldName, &handle);
+	if (ret == IP_SUCCESS) {
+		ret = findFieldByHandle(&f, sm->sd, handle);
+		if (ret == IP_SUCCESS && lockField(sm->sd, f, sm->lockWaitTime) != IP_SUCCESS)
+			return IP_BUSY;
+		if (ret == IP_SUCCESS && f->generation != handle.generation) {
+			unlockFieldUnchanged(f);
+			ret = IP_STALE_HANDLE;
+		}
+		/** Make room, but leave the copying to the caller **/
+		if (ret == IP_SUCCESS) {
+			ret = writeField(sm->sd, f, NULL, dataSize);
+			if (ret != IP_SUCCESS) {
+				unlockFieldUnchanged(f);
+				return ret;
+			}
+		}
+	}
+	if (ret == IP_DOES_NOT_EXIST || ret == IP_STALE_HANDLE) {
+		/** Make the field, and keep it locked so nobody sees it before it is filled in **/
+		if (AcquireLock(sm) == IP_BUSY)
+			return IP_BUSY;
+		ret = addFieldToSharedData(fieldName, NULL, dataSize, sm->sd, sm->lockWaitTime, &f);
+		ReleaseLock(sm);
+	}
+	if (ret != IP_SUCCESS)
+		return ret;
+	sm->reserved = f;
+	*data = (char*) sm->sd + f->offset;
+	return IP_SUCCESS;
+}
+
+/*
+ * Publish the value written in place since ip_BeginWrite(), and unlock its field.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if no write is open
+ *
+ */
+int ip_CommitWrite(SharedMemory_handle sm) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (sm->reserved == NULL)
+		return IP_ERROR;
+	appendHistory(sm->sd, sm->reserved);
+	countWrite(sm->sd, fieldSlot(sm->sd, sm->reserved));
+	unlockField(sm->sd, sm->reserved);
+	sm->reserved = NULL;
+	return IP_SUCCESS;
+}
+
+/*
+ * Write a batch of values at once
+ *
+ * Each entry names its field, either by name or (with name set to NULL) by handle,
+ * and holds the value to write in data and size. Fields named that do not exist yet
+ * are created. The whole batch takes the shared memory lock once, and holds the locks
+ * of all its fields until every value is in place, so ip_ReadValues() never sees the
+ * batch half written.
+ *
+ * The status of every entry is stored in its status (see ip_WriteValue() and
+ * ip_WriteValueByHandle() for the values). The batch may hold at most
+ * IP_MAX_BATCH_SIZE entries.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0  if every entry was written
+ *  otherwise the status of the first entry that was not
+ *
+ */
+int ip_WriteValues(SharedMemory_handle sm, Field_value* values, int count) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (values == NULL || count < 0 || count > IP_MAX_BATCH_SIZE)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	int k = 0;
+	if (AcquireLock(sm) == IP_BUSY) {
+		for (k = 0; k < count; ++k)
+			values[k].status = IP_BUSY;
+		return (count > 0) ? IP_BUSY : IP_SUCCESS;
+	}
+
+	if (verifySharedDataStruct(sm->sd) == IP_ERROR) {
+		ReleaseLock(sm);
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** Lock and write each field in turn, keeping every lock until the end **/
+	struct batchSlot_t slots[IP_MAX_BATCH_SIZE];
+	int numLocked = 0;
+	for (k = 0; k < count; ++k) {
+		Field_value* value = &(values[k]);
+		struct field_t* f = NULL;
+		int ret = findBatchField(&f, sm->sd, value);
+		if (ret == IP_SUCCESS && batchHolds(slots, numLocked, f)) {
+			/* named twice, the last one wins */
+			value->status = writeField(sm->sd, f, value->data, value->size);
+		} else if (ret == IP_DOES_NOT_EXIST && value->name != NULL) {
+			/* a new field, born locked */
+			value->status = addFieldToSharedData(value->name, value->data, value->size,
+					sm->sd, sm->lockWaitTime, &f);
+			if (value->status == IP_SUCCESS)
+				slots[numLocked++].f = f;
+		} else if (ret != IP_SUCCESS) {
+			value->status = ret;
+		} else if (lockField(sm->sd, f, sm->lockWaitTime) != IP_SUCCESS) {
+			value->status = IP_BUSY;
+		} else if (value->name == NULL && f->generation != value->handle.generation) {
+			unlockFieldUnchanged(f);
+			value->status = IP_STALE_HANDLE;
+		} else {
+			value->status = writeField(sm->sd, f, value->data, value->size);
+			if (value->status == IP_SUCCESS) {
+				slots[numLocked++].f = f;
+			} else {
+				unlockFieldUnchanged(f);
+			}
+		}
+	}
+
+	/** Publish them all **/
+	for (k = 0; k < numLocked; ++k)
+		unlockField(sm->sd, slots[k].f);
+	ReleaseLock(sm);
+
+	for (k = 0; k < count; ++k) {
+		if (values[k].status != IP_SUCCESS)
+			return values[k].status;
+	}
+	return IP_SUCCESS;
+}
+
+/*
+ * Read a batch of values at once
+ *
+ * Each entry names its field, either by name or (with name set to NULL) by handle,
+ * and points data at a buffer large enough for the value. The size of every value
+ * read is stored in its entry's size, and the status in its status (see
+ * ip_ReadValue() and ip_ReadValueByHandle() for the values).
+ *
+ * The values read are a consistent snapshot: a batch written with ip_WriteValues()
+ * is seen either entirely or not at all. Like ip_ReadValue() no lock is taken, unless
+ * writers keep interfering; then the batch is read under the lock, followed by a single
+ * Read Time Delay. The batch may hold at most IP_MAX_BATCH_SIZE entries.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0  if every entry was read
+ *  otherwise the status of the first entry that was not
+ *
+ */
+int ip_ReadValues(SharedMemory_handle sm, Field_value* values, int count) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (values == NULL || count < 0 || count > IP_MAX_BATCH_SIZE)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** Fast path: copy the batch without any lock, retrying on a torn read **/
+	struct batchSlot_t slots[IP_MAX_BATCH_SIZE];
+	int k = 0;
+	if (readBatchLockFree(sm->sd, values, count, slots) != IP_SUCCESS) {
+		/** Writers kept getting in the way, so queue up for the locks instead **/
+		if (AcquireLock(sm) == IP_BUSY) {
+			for (k = 0; k < count; ++k)
+				values[k].status = IP_BUSY;
+			return (count > 0) ? IP_BUSY : IP_SUCCESS;
+		}
+
+		int numLocked = 0;
+		for (k = 0; k < count; ++k) {
+			Field_value* value = &(values[k]);
+			struct field_t* f = NULL;
+			value->status = findBatchField(&f, sm->sd, value);
+			if (value->status == IP_DOES_NOT_EXIST)
+				countMiss(sm->sd);
+			if (value->status != IP_SUCCESS)
+				continue;
+			if (!batchHolds(slots, numLocked, f)) {
+				if (lockField(sm->sd, f, sm->lockWaitTime) != IP_SUCCESS) {
+					value->status = IP_BUSY;
+					continue;
+				}
+				slots[numLocked++].f = f;
+			}
+			if (value->name == NULL && f->generation != value->handle.generation)
+				value->status = IP_STALE_HANDLE;
+			else if ((value->size = readField(sm->sd, f, value->data, -1)) < 0)
+				value->status = IP_ERROR;
+			else
+				countRead(sm->sd, fieldSlot(sm->sd, f));
+		}
+
+		for (k = 0; k < numLocked; ++k)
+			unlockFieldUnchanged(slots[k].f);
+		ReleaseLock(sm);
+
+		/** Refractory Period, once for the whole batch **/
+		sleepMs(sm->ReadTimeDelay);
+	}
+
+	for (k = 0; k < count; ++k) {
+		if (values[k].status != IP_SUCCESS)
+			return values[k].status;
+	}
+	return IP_SUCCESS;
+}
+
+/*
+ * Get the version of a field. The version changes every time the field is written;
+ * pass it to ip_WaitForFieldChange() to sleep until that happens.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_GetFieldVersion(SharedMemory_handle sm, char* fieldName, unsigned int* version) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (version == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** A write in progress has no version yet, give it a moment **/
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SEQLOCK_MAX_RETRIES; ++attempt) {
+		Field_handle handle;
+		struct field_t* f = NULL;
+		int ret = ip_ResolveField(sm, fieldName, &handle);
+		if (ret == IP_SUCCESS)
+			ret = findFieldByHandle(&f, sm->sd, handle);
+		if (ret == IP_STALE_HANDLE)
+			continue;
+		if (ret != IP_SUCCESS)
+			return ret;
+		unsigned int seq = IP_LOAD_ACQUIRE(&(f->seq));
+		if (!(seq & 1)) {
+			*version = seq;
+			return IP_SUCCESS;
+		}
+		IP_CPU_RELAX();
+	}
+	return IP_BUSY;
+}
+
+/*
+ * Sleep until a field changes
+ *
+ * Blocks until the version of the field (see ip_GetFieldVersion()) is no longer
+ * lastVersion, or until timeout_ns nanoseconds have passed (pass a negative timeout
+ * to wait forever), and stores the new version in *version. Then read the new value.
+ * The field being moved in shared memory (when another field is cleared) also counts
+ * as a change.
+ *
+ * Waiting takes no CPU: on Linux the caller sleeps in the kernel (futex) and is woken
+ * by the write itself, within microseconds. Elsewhere it naps a millisecond at a time.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if the time was up first
+ *  IP_DOES_NOT_EXIST -2  (also if the field is cleared while waiting)
+ *
+ */
+int ip_WaitForFieldChange(SharedMemory_handle sm, char* fieldName, unsigned int lastVersion,
+		long long timeout_ns, unsigned int* version) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (fieldName == NULL || version == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	return waitFieldChange(sm, fieldName, NULL, lastVersion, timeout_ns, version);
+}
+
+/*
+ * Sleep until a field changes, by handle. Works like ip_WaitForFieldChange().
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if the time was up first
+ *  IP_STALE_HANDLE -4  (also if the field is cleared or moved while waiting)
+ *
+ */
+int ip_WaitForFieldChangeByHandle(SharedMemory_handle sm, Field_handle handle,
+		unsigned int lastVersion, long long timeout_ns, unsigned int* version) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (version == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	return waitFieldChange(sm, NULL, &handle, lastVersion, timeout_ns, version);
+}
+
+/*
+ * Remove all fields in shared memory
+ * All field slots become available for new fields.
+ * Fields of the schema are not removed, but their values are zeroed.
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if SharedMemory doesn't exist
+ *  IP_BUSY 1
+ *
+ */
+int ip_ClearAllFields(SharedMemory_handle sm) {
+
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	if (AcquireLock(sm) == IP_BUSY)
+		return IP_BUSY;
+
+	if (verifySharedDataStruct(sm->sd) == IP_ERROR) {
+		ReleaseLock(sm);
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** Wait for all writers to get out of the way before changing anything **/
+	int k = 0;
+	for (k = 0; k < sm->sd->usedFields; ++k) {
+		if (lockField(sm->sd, fieldAt(sm->sd, k), sm->lockWaitTime) != IP_SUCCESS) {
+			while (--k >= 0)
+				unlockFieldUnchanged(fieldAt(sm->sd, k));
+			ReleaseLock(sm);
+			return IP_BUSY;
+		}
+	}
+
+	beginLayoutUpdate(sm->sd);
+	int schemaFields = sm->sd->schemaFields;
+	for (k = 0; k < sm->sd->usedFields; ++k) {
+		struct field_t* f = fieldAt(sm->sd, k);
+		if (k < schemaFields) {
+			/* the schema's fields stay where they are, and locked until they get new blocks */
+			f->offset = 0;
+			f->capacity = 0;
+			continue;
+		}
+		zeroField(f);
+		clearFieldStats(sm->sd, k);
+		f->generation++;
+		unlockField(sm->sd, f);
+	}
+	/* the slots and all of the heap are free again */
+	memset(fieldIndex(sm->sd), 0, sm->sd->indexSize * sizeof(int));
+	sm->sd->usedFields = 0;
+	lockWord(&(sm->sd->heap.lock), -1);
+	initHeap(sm->sd);
+	unlockWord(&(sm->sd->heap.lock));
+
+	/** Fields of the schema come back with zeroed values of the same size **/
+	for (k = 0; k < schemaFields; ++k) {
+		struct field_t* f = fieldAt(sm->sd, k);
+		fillSchemaField(sm->sd, k, f->size); /* fits, since it did before */
+		sm->sd->usedFields++;
+		unlockField(sm->sd, f);
+	}
+	endLayoutUpdate(sm->sd);
+
+	ReleaseLock(sm);
+	return IP_SUCCESS;
+
+}
+
+/*
+ *  Clear a single field in shared memory
+ *  The field is removed and its slot becomes available for a new field.
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if SharedMemory doesn't exist, or if the field is part of the schema
+ *  IP_BUSY 1
+ *
+ */
+int ip_ClearField(SharedMemory_handle sm, char* fieldName) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	if (AcquireLock(sm) == IP_BUSY)
+		return IP_BUSY;
+
+	if (verifySharedDataStruct(sm->sd) == IP_ERROR) {
+		ReleaseLock(sm);
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/* Removing the field frees its slot for the next new field */
+	int ret = deleteFieldFromSharedData(fieldName, sm->sd, sm->lockWaitTime);
+	ReleaseLock(sm);
+	return ret;
+
+}
+
+
+
+/*************
+ *  Queues
+ *
+ */
+
+/*
+ * Create a queue of capacity messages of up to maxMessageSize bytes each, in a new
+ * field called name, and open it. capacity is rounded up to a power of two.
+ * The queue is not bound by maxValueSize (see ip_CreateSharedMemoryHostEx()),
+ * only by the room left in the shared memory.
+ *
+ * Don't forget to call ip_CloseQueue()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if a field called name already exists)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields or no space left for the queue
+ *
+ */
+int ip_CreateQueue(SharedMemory_handle sm, char* name, int capacity, int maxMessageSize,
+		Queue_handle* queue) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (name == NULL || strlen(name) < 1 || strlen(name) > IP_FIELD_NAME_SIZE || queue == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+	if (capacity <= 0 || capacity > (1 << 30) || maxMessageSize < 0)
+		return IP_ERROR;
+
+	int slots = 1;
+	while (slots < capacity)
+		slots <<= 1;
+	int bytes = queueBytes(slots, maxMessageSize);
+	if (bytes < 0)
+		return IP_NO_MORE_ROOM;
+
+	if (AcquireLock(sm) == IP_BUSY)
+		return IP_BUSY;
+
+	/** Make the field, and keep it locked until the queue in it is set up **/
+	struct field_t* f = NULL;
+	int ret = addObjectField(sm, name, IP_KIND_QUEUE, bytes, &f);
+	if (ret == IP_SUCCESS) {
+		struct queue_t* q = (struct queue_t*) ((char*) sm->sd + f->offset);
+		q->capacity = slots;
+		q->slotSize = IP_ALIGN_UP((int) sizeof(int) + maxMessageSize, 8);
+		q->maxMessageSize = maxMessageSize;
+		ret = openQueueField(sm, f, queue);
+		unlockField(sm->sd, f);
+	}
+
+	ReleaseLock(sm);
+	return ret;
+}
+
+/*
+ * Open a queue created (by any process) with ip_CreateQueue().
+ *
+ * Don't forget to call ip_CloseQueue()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if the field is not a queue)
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_OpenQueue(SharedMemory_handle sm, char* name, Queue_handle* queue) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (name == NULL || strlen(name) < 1 || strlen(name) > IP_FIELD_NAME_SIZE || queue == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	struct field_t* f = NULL;
+	int ret = lockObjectField(sm, name, IP_KIND_QUEUE, &f);
+	if (ret != IP_SUCCESS)
+		return ret;
+	ret = openQueueField(sm, f, queue);
+	unlockFieldUnchanged(f);
+	return ret;
+}
+
+/*
+ * Close this process's end of a queue. The queue itself stays in shared memory
+ * until its field is cleared.
+ */
+int ip_CloseQueue(Queue_handle queue) {
+	if (queue == NULL)
+		return IP_ERROR;
+	free(queue);
+	return IP_SUCCESS;
+}
+
+/*
+ * Get the largest message a queue holds
+ */
+int ip_GetQueueMaxMessageSize(Queue_handle queue) {
+	if (queue == NULL)
+		return IP_ERROR;
+	return queue->maxMessageSize;
+}
+
+/*
+ * Push a message of size bytes onto a queue. Producer only.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if the message is larger than the queue's maxMessageSize
+ *  IP_BUSY 1  if the queue is full
+ *  IP_STALE_HANDLE -4  if the queue's field was cleared
+ *
+ */
+int ip_QueuePush(Queue_handle queue, void* data, int size) {
+	if (queue == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (size < 0 || size > queue->maxMessageSize || (data == NULL && size > 0))
+		return IP_ERROR;
+
+	int ret = checkObject(queue->sm, &(queue->ref));
+	if (ret != IP_SUCCESS)
+		return ret;
+
+	/** Only look at the consumer's cache line if the queue seems full **/
+	struct queue_t* q = queue->q;
+	unsigned int tail = IP_LOAD_RELAXED(&(q->tail));
+	if (tail - queue->cachedHead > queue->mask) {
+		queue->cachedHead = IP_LOAD_ACQUIRE(&(q->head));
+		if (tail - queue->cachedHead > queue->mask)
+			return IP_BUSY;
+	}
+
+	char* slot = queue->slots + (size_t) (tail & queue->mask) * queue->slotSize;
+	memcpy(slot, &size, sizeof(int));
+	memcpy(slot + sizeof(int), data, size);
+
+	/* the message must be in place before the consumer sees the new tail */
+	IP_STORE_RELEASE(&(q->tail), tail + 1);
+	return IP_SUCCESS;
+}
+
+/*
+ * Pop the oldest message off a queue into data, which must hold the queue's
+ * maxMessageSize bytes, and store its size in *size. Consumer only.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if the queue is empty
+ *  IP_STALE_HANDLE -4  if the queue's field was cleared
+ *
+ */
+int ip_QueuePop(Queue_handle queue, void* data, int* size) {
+	if (queue == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (data == NULL || size == NULL)
+		return IP_ERROR;
+
+	int ret = checkObject(queue->sm, &(queue->ref));
+	if (ret != IP_SUCCESS)
+		return ret;
+
+	/** Only look at the producer's cache line if the queue seems empty **/
+	struct queue_t* q = queue->q;
+	unsigned int head = IP_LOAD_RELAXED(&(q->head));
+	if (head == queue->cachedTail) {
+		queue->cachedTail = IP_LOAD_ACQUIRE(&(q->tail));
+		if (head == queue->cachedTail)
+			return IP_BUSY;
+	}
+
+	char* slot = queue->slots + (size_t) (head & queue->mask) * queue->slotSize;
+	int length = 0;
+	memcpy(&length, slot, sizeof(int));
+	if (length < 0 || length > queue->maxMessageSize)
+		return IP_ERROR;
+	memcpy(data, slot + sizeof(int), length);
+	*size = length;
+
+	/* the copy must be done before the producer may reuse the slot */
+	IP_STORE_RELEASE(&(q->head), head + 1);
+	return IP_SUCCESS;
+}
+
+/*
+ * Push up to count messages, data[k] of sizes[k] bytes, onto a queue. Producer only.
+ * The consumer sees them all at once, and the queue's tail is only moved once, so
+ * this is much cheaper than count calls to ip_QueuePush().
+ *
+ * Returns the number of messages pushed, which is less than count if the queue
+ * filled up (or a message was too large), IP_ERROR, or IP_STALE_HANDLE if the
+ * queue's field was cleared.
+ */
+int ip_QueuePushBatch(Queue_handle queue, void** data, int* sizes, int count) {
+	if (queue == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (data == NULL || sizes == NULL || count < 0)
+		return IP_ERROR;
+
+	int ret = checkObject(queue->sm, &(queue->ref));
+	if (ret != IP_SUCCESS)
+		return (ret == IP_BUSY) ? 0 : ret;
+
+	struct queue_t* q = queue->q;
+	unsigned int tail = IP_LOAD_RELAXED(&(q->tail));
+	unsigned int room = queue->mask + 1 - (tail - queue->cachedHead);
+	if (room < (unsigned int) count) {
+		queue->cachedHead = IP_LOAD_ACQUIRE(&(q->head));
+		room = queue->mask + 1 - (tail - queue->cachedHead);
+	}
+
+	int n = 0;
+	for (n = 0; n < count && (unsigned int) n < room; ++n) {
+		if (sizes[n] < 0 || sizes[n] > queue->maxMessageSize || (data[n] == NULL && sizes[n] > 0))
+			break;
+		char* slot = queue->slots + (size_t) ((tail + n) & queue->mask) * queue->slotSize;
+		memcpy(slot, &(sizes[n]), sizeof(int));
+		memcpy(slot + sizeof(int), data[n], sizes[n]);
+	}
+	if (n > 0)
+		IP_STORE_RELEASE(&(q->tail), tail + n);
+	else if (count > 0 && room > 0)
+		return IP_ERROR; /* the first message was too large */
+	return n;
+}
+
+/*
+ * Pop up to count messages off a queue into data[k], each of which must hold the
+ * queue's maxMessageSize bytes, storing their sizes in sizes[k]. Consumer only.
+ *
+ * Returns the number of messages popped, which is less than count if the queue
+ * ran empty, IP_ERROR, or IP_STALE_HANDLE if the queue's field was cleared.
+ */
+int ip_QueuePopBatch(Queue_handle queue, void** data, int* sizes, int count) {
+	if (queue == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (data == NULL || sizes == NULL || count < 0)
+		return IP_ERROR;
+
+	int ret = checkObject(queue->sm, &(queue->ref));
+	if (ret != IP_SUCCESS)
+		return (ret == IP_BUSY) ? 0 : ret;
+
+	struct queue_t* q = queue->q;
+	unsigned int head = IP_LOAD_RELAXED(&(q->head));
+	unsigned int ready = queue->cachedTail - head;
+	if (ready < (unsigned int) count) {
+		queue->cachedTail = IP_LOAD_ACQUIRE(&(q->tail));
+		ready = queue->cachedTail - head;
+	}
+
+	int n = 0;
+	for (n = 0; n < count && (unsigned int) n < ready; ++n) {
+		char* slot = queue->slots + (size_t) ((head + n) & queue->mask) * queue->slotSize;
+		int length = 0;
+		memcpy(&length, slot, sizeof(int));
+		if (length < 0 || length > queue->maxMessageSize || data[n] == NULL)
+			break;
+		memcpy(data[n], slot + sizeof(int), length);
+		sizes[n] = length;
+	}
+	if (n > 0)
+		IP_STORE_RELEASE(&(q->head), head + n);
+	else if (count > 0 && ready > 0)
+		return IP_ERROR;
+	return n;
+}
+
+
+/*************
+ *  Broadcast Rings
+ *
+ */
+
+/*
+ * Create a ring of capacity messages of up to maxMessageSize bytes each, with room
+ * for maxReaders readers, in a new field called name, and open it for writing.
+ * capacity is rounded up to a power of two. Like a queue, a ring is not bound
+ * by maxValueSize, only by the room left in the shared memory.
+ *
+ * Don't forget to call ip_CloseRing()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if a field called name already exists)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields or no space left for the ring
+ *
+ */
+int ip_CreateRing(SharedMemory_handle sm, char* name, int capacity, int maxMessageSize,
+		int maxReaders, Ring_handle* writer) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (name == NULL || strlen(name) < 1 || strlen(name) > IP_FIELD_NAME_SIZE || writer == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+	if (capacity <= 0 || capacity > (1 << 30) || maxMessageSize < 0 || maxReaders < 0)
+		return IP_ERROR;
+
+	int slots = 1;
+	while (slots < capacity)
+		slots <<= 1;
+	int bytes = ringBytes(slots, maxMessageSize, maxReaders);
+	if (bytes < 0)
+		return IP_NO_MORE_ROOM;
+
+	if (AcquireLock(sm) == IP_BUSY)
+		return IP_BUSY;
+
+	/** Make the field, and keep it locked until the ring in it is set up **/
+	struct field_t* f = NULL;
+	int ret = addObjectField(sm, name, IP_KIND_RING, bytes, &f);
+	if (ret == IP_SUCCESS) {
+		struct ring_t* r = (struct ring_t*) ((char*) sm->sd + f->offset);
+		r->capacity = slots;
+		r->slotSize = IP_ALIGN_UP((int) sizeof(struct ringSlot_t) + maxMessageSize, 8);
+		r->maxMessageSize = maxMessageSize;
+		r->maxReaders = maxReaders;
+		ret = openRingField(sm, f, 0, writer);
+		unlockField(sm->sd, f);
+	}
+
+	ReleaseLock(sm);
+	return ret;
+}
+
+/*
+ * Register as a reader of a ring created (by any process) with ip_CreateRing().
+ * The reader starts at the next message written.
+ *
+ * Don't forget to call ip_CloseRing(), which frees the reader's place (the place
+ * of a reader whose process died is taken over).
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if the field is not a ring)
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *  IP_NO_MORE_ROOM -3  if running processes already have maxReaders readers open
+ *
+ */
+int ip_OpenRingReader(SharedMemory_handle sm, char* name, Ring_handle* reader) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (name == NULL || strlen(name) < 1 || strlen(name) > IP_FIELD_NAME_SIZE || reader == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	struct field_t* f = NULL;
+	int ret = lockObjectField(sm, name, IP_KIND_RING, &f);
+	if (ret != IP_SUCCESS)
+		return ret;
+	ret = openRingField(sm, f, 1, reader);
+	unlockFieldUnchanged(f);
+	return ret;
+}
+
+/*
+ * Close the writer or a reader of a ring. The ring itself stays in shared memory
+ * until its field is cleared.
+ */
+int ip_CloseRing(Ring_handle ring) {
+	if (ring == NULL)
+		return IP_ERROR;
+	/* the reader table went with the ring if its field was cleared */
+	if (ring->reader >= 0 && checkObject(ring->sm, &(ring->ref)) == IP_SUCCESS)
+		IP_STORE_RELEASE(&(ring->readers[ring->reader].pid), 0);
+	free(ring);
+	return IP_SUCCESS;
+}
+
+/*
+ * Append a message of size bytes to a ring, overwriting the oldest message if the
+ * ring is full. Writer only; never waits.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if the message is larger than the ring's maxMessageSize
+ *  IP_BUSY 1  if the ring's field is being moved just now
+ *  IP_STALE_HANDLE -4  if the ring's field was cleared
+ *
+ */
+int ip_RingWrite(Ring_handle writer, void* data, int size) {
+	if (writer == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (writer->reader >= 0 || size < 0 || size > writer->maxMessageSize
+			|| (data == NULL && size > 0))
+		return IP_ERROR;
+
+	int ret = checkObject(writer->sm, &(writer->ref));
+	if (ret != IP_SUCCESS)
+		return ret;
+
+	unsigned int n = writer->cursor;
+	struct ringSlot_t* slot = (struct ringSlot_t*) (writer->slots
+			+ (size_t) (n & writer->mask) * writer->slotSize);
+
+	/** Make the slot's counter odd before touching the old message, like lockField() **/
+	unsigned int seq = IP_LOAD_RELAXED(&(slot->seq));
+	IP_STORE_RELAXED(&(slot->seq), seq + 1);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	IP_STORE_RELAXED(&(slot->number), n);
+	IP_STORE_RELAXED(&(slot->length), size);
+	memcpy((char*) slot + sizeof(struct ringSlot_t), data, size);
+
+	/* the message must be complete before the counter is even again, and before readers see it */
+	IP_STORE_RELEASE(&(slot->seq), seq + 2);
+	IP_STORE_RELEASE(&(writer->r->tail), n + 1);
+	writer->cursor = n + 1;
+	return IP_SUCCESS;
+}
+
+/*
+ * Read the reader's next message into data, which must hold the ring's
+ * maxMessageSize bytes, and store its size in *size. Reader only.
+ *
+ * If the writer overwrote messages before they were read, nothing is read: the number
+ * of messages lost is stored in *lost and the reader skips ahead to the oldest message
+ * still in the ring, which the next call reads.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if there is no new message
+ *  IP_LAPPED -5  if the reader was lapped
+ *  IP_STALE_HANDLE -4  if the ring's field was cleared
+ *
+ */
+int ip_RingRead(Ring_handle reader, void* data, int* size, unsigned int* lost) {
+	if (reader == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (reader->reader < 0 || data == NULL || size == NULL)
+		return IP_ERROR;
+
+	int ret = checkObject(reader->sm, &(reader->ref));
+	if (ret != IP_SUCCESS)
+		return ret;
+
+	unsigned int n = reader->cursor;
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SEQLOCK_MAX_RETRIES; ++attempt) {
+		unsigned int tail = IP_LOAD_ACQUIRE(&(reader->r->tail));
+		if (tail == n)
+			return IP_BUSY;
+
+		/*
+		 * The slot of the oldest message, tail - capacity, is the one the writer
+		 * fills next, so that message counts as lost already.
+		 */
+		if (tail - n > reader->mask) {
+			reader->cursor = tail - reader->mask;
+			IP_STORE_RELAXED(&(reader->readers[reader->reader].cursor), reader->cursor);
+			if (lost != NULL)
+				*lost = reader->cursor - n;
+			return IP_LAPPED;
+		}
+
+		int length = readRingSlot(reader, n, data);
+		if (length >= 0) {
+			*size = length;
+			reader->cursor = n + 1;
+			IP_STORE_RELAXED(&(reader->readers[reader->reader].cursor), reader->cursor);
+			return IP_SUCCESS;
+		}
+		/* overwritten while we copied it, so tail has moved on: look again */
+	}
+	return IP_BUSY;
+}
+
+/*
+ * Get how far behind the readers of a ring are: the number of messages written that
+ * each reader has not read yet is stored in lags, for up to count readers.
+ * Returns the number of readers open in running processes, IP_ERROR, or
+ * IP_STALE_HANDLE if the ring's field was cleared.
+ */
+int ip_GetRingReaders(Ring_handle ring, unsigned int* lags, int count) {
+	if (ring == NULL || (lags == NULL && count > 0))
+		return IP_ERROR;
+
+	int ret = checkObject(ring->sm, &(ring->ref));
+	if (ret != IP_SUCCESS)
+		return (ret == IP_BUSY) ? 0 : ret;
+
+	unsigned int tail = IP_LOAD_ACQUIRE(&(ring->r->tail));
+	int numReaders = 0;
+	int k = 0;
+	for (k = 0; k < ring->maxReaders; ++k) {
+		unsigned int pid = IP_LOAD_ACQUIRE(&(ring->readers[k].pid));
+		if (pid == 0 || !processAlive(pid))
+			continue;
+		if (numReaders < count)
+			lags[numReaders] = tail - IP_LOAD_RELAXED(&(ring->readers[k].cursor));
+		numReaders++;
+	}
+	return numReaders;
+}
+
+
+/*************
+ *  Triple-Buffered Frames
+ *
+ */
+
+/*
+ * Create a triple-buffered frame of up to maxFrameSize bytes in a new field called
+ * name, and open it for writing. Like a queue, a frame is not bound by maxValueSize,
+ * only by the room left in the shared memory (it takes three times maxFrameSize).
+ *
+ * Don't forget to call ip_CloseFrame()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if a field called name already exists)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields or no space left for the frame
+ *
+ */
+int ip_CreateFrame(SharedMemory_handle sm, char* name, int maxFrameSize, Frame_handle* writer) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (name == NULL || strlen(name) < 1 || strlen(name) > IP_FIELD_NAME_SIZE || writer == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+	if (maxFrameSize < 0)
+		return IP_ERROR;
+	int bytes = frameBytes(maxFrameSize);
+	if (bytes < 0)
+		return IP_NO_MORE_ROOM;
+
+	if (AcquireLock(sm) == IP_BUSY)
+		return IP_BUSY;
+
+	/** Make the field, and keep it locked until the frame in it is set up **/
+	struct field_t* f = NULL;
+	int ret = addObjectField(sm, name, IP_KIND_FRAME, bytes, &f);
+	if (ret == IP_SUCCESS) {
+		struct frame_t* fr = (struct frame_t*) ((char*) sm->sd + f->offset);
+		fr->maxFrameSize = maxFrameSize;
+		fr->bufferSize = IP_ALIGN_UP((int) sizeof(struct frameBuffer_t) + maxFrameSize,
+				IP_CACHE_LINE);
+		fr->back = 0;
+		fr->state = 1;
+		fr->front = 2;
+		ret = openFrameField(sm, f, 0, writer);
+		unlockField(sm->sd, f);
+	}
+
+	ReleaseLock(sm);
+	return ret;
+}
+
+/*
+ * Open the reader of a frame created (by any process) with ip_CreateFrame().
+ *
+ * Don't forget to call ip_CloseFrame(), which lets another reader open it.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if the field is not a frame)
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *  IP_NO_MORE_ROOM -3  if a running process has the reader open
+ *
+ */
+int ip_OpenFrameReader(SharedMemory_handle sm, char* name, Frame_handle* reader) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (name == NULL || strlen(name) < 1 || strlen(name) > IP_FIELD_NAME_SIZE || reader == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	struct field_t* f = NULL;
+	int ret = lockObjectField(sm, name, IP_KIND_FRAME, &f);
+	if (ret != IP_SUCCESS)
+		return ret;
+	ret = openFrameField(sm, f, 1, reader);
+	unlockFieldUnchanged(f);
+	return ret;
+}
+
+/*
+ * Close the writer or the reader of a frame. The frame itself stays in shared memory
+ * until its field is cleared.
+ */
+int ip_CloseFrame(Frame_handle frame) {
+	if (frame == NULL)
+		return IP_ERROR;
+	if (frame->isReader && checkObject(frame->sm, &(frame->ref)) == IP_SUCCESS)
+		IP_STORE_RELEASE(&(frame->fr->reader), 0);
+	free(frame);
+	return IP_SUCCESS;
+}
+
+/*
+ * Get the buffer the next frame goes into, to build it in place. Writer only.
+ * Fill it with up to maxFrameSize bytes, then call ip_PublishFrame() with data NULL.
+ * The buffer changes with every frame published, so get it again each time.
+ * Returns IP_SUCCESS, IP_ERROR, or IP_STALE_HANDLE if the frame's field was cleared.
+ */
+int ip_GetFrameBuffer(Frame_handle writer, void** data) {
+	if (writer == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (writer->isReader || data == NULL)
+		return IP_ERROR;
+	int ret = checkObject(writer->sm, &(writer->ref));
+	if (ret != IP_SUCCESS)
+		return ret;
+	*data = (char*) frameBuffer(writer, writer->index) + sizeof(struct frameBuffer_t);
+	return IP_SUCCESS;
+}
+
+/*
+ * Publish a frame of size bytes. The frame is copied from data, or if data is NULL,
+ * it is the one written in place in the buffer from ip_GetFrameBuffer(). Writer only;
+ * never waits.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if the frame is larger than maxFrameSize
+ *  IP_BUSY 1  if the frame's field is being moved just now
+ *  IP_STALE_HANDLE -4  if the frame's field was cleared
+ *
+ */
+int ip_PublishFrame(Frame_handle writer, void* data, int size) {
+	if (writer == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (writer->isReader || size < 0 || size > writer->maxFrameSize)
+		return IP_ERROR;
+
+	int ret = checkObject(writer->sm, &(writer->ref));
+	if (ret != IP_SUCCESS)
+		return ret;
+
+	struct frameBuffer_t* buffer = frameBuffer(writer, writer->index);
+	if (data != NULL)
+		memcpy((char*) buffer + sizeof(struct frameBuffer_t), data, size);
+	buffer->number = ++(writer->published);
+	buffer->size = size;
+
+	/** Swap the finished buffer in as the latest frame, and take back whichever was there **/
+	unsigned int old = __atomic_exchange_n(&(writer->fr->state), writer->index | IP_FRAME_NEW,
+			__ATOMIC_ACQ_REL);
+	writer->index = old & IP_FRAME_INDEX;
+	IP_STORE_RELAXED(&(writer->fr->back), writer->index);
+	return IP_SUCCESS;
+}
+
+/*
+ * Take the latest frame published. *data points at it in shared memory, *size holds its
+ * size and *number its number (frames are numbered from 1 as they are published; the
+ * same number as last time means nothing new was published). Reader only.
+ *
+ * The frame stays put until ip_ReleaseFrame() is called, whatever the writer does.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if the last frame has not been released)
+ *  IP_BUSY 1  if no frame has been published yet
+ *  IP_STALE_HANDLE -4  if the frame's field was cleared
+ *
+ */
+int ip_AcquireLatestFrame(Frame_handle reader, const void** data, int* size,
+		unsigned int* number) {
+	if (reader == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (!reader->isReader || reader->held || data == NULL || size == NULL)
+		return IP_ERROR;
+
+	int ret = checkObject(reader->sm, &(reader->ref));
+	if (ret != IP_SUCCESS)
+		return ret;
+
+	/** Only swap buffers if there is something new; otherwise look at the same frame again **/
+	if (IP_LOAD_RELAXED(&(reader->fr->state)) & IP_FRAME_NEW) {
+		unsigned int old = __atomic_exchange_n(&(reader->fr->state), reader->index,
+				__ATOMIC_ACQ_REL);
+		reader->index = old & IP_FRAME_INDEX;
+		IP_STORE_RELAXED(&(reader->fr->front), reader->index);
+	}
+
+	struct frameBuffer_t* buffer = frameBuffer(reader, reader->index);
+	if (buffer->number == 0)
+		return IP_BUSY;
+	if (buffer->size < 0 || buffer->size > reader->maxFrameSize)
+		return IP_ERROR;
+	*data = (char*) buffer + sizeof(struct frameBuffer_t);
+	*size = buffer->size;
+	if (number != NULL)
+		*number = buffer->number;
+	reader->held = 1;
+	return IP_SUCCESS;
+}
+
+/*
+ * Let go of the frame taken with ip_AcquireLatestFrame(). Its pointer must no longer
+ * be used. Reader only.
+ */
+int ip_ReleaseFrame(Frame_handle reader) {
+	if (reader == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (!reader->isReader || !reader->held)
+		return IP_ERROR;
+	reader->held = 0;
+	return IP_SUCCESS;
 }
 
-/*
- * Get the size of the shared memory.
+
+/*************
+ *  Blobs
  *
  */
-int ip_GetSharedMemorySize(SharedMemory_handle sm) {
-	return sm->BufferSize;
-
-}
 
 /*
+ * Create a blob of up to capacity bytes in a new field called name, with the options
+ * in flags (IP_BLOB_HUGE_PAGES, IP_BLOB_PREFAULT, IP_BLOB_STREAMING, or 0), and open it.
  *
- * Get shared memory status
+ * Don't forget to call ip_CloseBlob()
  *
- * Returns 0 (IP_SUCCESS) if shared memory exists and is available
- * Returns 1 (IP_BUSY) if shared memory exists but is busy
- * Returns -1 (IP_ERROR) if error
- * Returns -2 (IP_DOESNOTEXIST) if shared memory does not exist
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if a field called name already exists, or the payload could
+ *               not be created)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields
  *
  */
-int ip_GetSharedMemoryStatus(SharedMemory_handle sm) {
-	if (sm == NULL) {
+int ip_CreateBlob(SharedMemory_handle sm, char* name, int capacity, int flags, Blob_handle* blob) {
+	if (sm == NULL)
 		return IP_DOES_NOT_EXIST;
-	}
+	if (name == NULL || strlen(name) < 1 || strlen(name) > IP_FIELD_NAME_SIZE || blob == NULL)
+		return IP_ERROR;
 
 	if (sm->sd == NULL) {
 		printf("Shared Data struct in shared memory is invalid.\n");
 		return IP_ERROR;
 	}
+	/* leave room to round up to a whole number of huge pages */
+	if (capacity <= 0 || capacity > 0x7fffffff - IP_HUGE_PAGE_SIZE)
+		return IP_ERROR;
+
+	Blob_handle blobObj = createBlobObj(sm, name);
+	if (blobObj == NULL)
+		return IP_ERROR;
 
 	if (AcquireLock(sm) == IP_BUSY) {
+		free(blobObj);
 		return IP_BUSY;
+	}
 
-	} else {
-
-		if (verifySharedDataStruct(sm->sd) == IP_ERROR) {
-			ReleaseLock(sm);
-			printf("Shared Data struct in shared memory is invalid.\n");
-			return IP_ERROR;
+	/** Make the field, and keep it locked until the payload is there **/
+	struct field_t* f = NULL;
+	int ret = addObjectField(sm, name, IP_KIND_BLOB, sizeof(struct blob_t), &f);
+	if (ret == IP_SUCCESS) {
+		ret = mapBlob(blobObj, 1, capacity, flags & IP_BLOB_HUGE_PAGES);
+		if (ret != IP_SUCCESS) {
+			unlockFieldUnchanged(f);
+			deleteFieldFromSharedData(name, sm->sd, sm->lockWaitTime);
 		}
+	}
+	if (ret == IP_SUCCESS) {
+		struct blob_t* desc = (struct blob_t*) ((char*) sm->sd + f->offset);
+		desc->capacity = capacity;
+		desc->size = 0;
+		desc->flags = flags;
+		desc->hugePages = blobObj->hugePages;
+		blobObj->capacity = capacity;
+		blobObj->flags = flags;
+		blobObj->isOwner = 1;
+		unlockField(sm->sd, f);
+	}
+	ReleaseLock(sm);
 
-		ReleaseLock(sm);
-		return IP_SUCCESS;
-
+	if (ret != IP_SUCCESS) {
+		free(blobObj);
+		return ret;
 	}
+	/* fault in the payload only now, so the lock is not held for it */
+	if (flags & IP_BLOB_PREFAULT)
+		prefaultPages(blobObj->base, blobObj->mapSize, 1);
+	*blob = blobObj;
+	return IP_SUCCESS;
 }
 
-int ip_SetSharedMemoryLockWaitTime(SharedMemory_handle sm, int time_ms) {
-	if (sm != NULL) {
-		sm->lockWaitTime = (DWORD) time_ms;
-		return IP_SUCCESS;
-	} else {
+/*
+ * Open a blob created (by any process) with ip_CreateBlob(), mapping its payload.
+ *
+ * Don't forget to call ip_CloseBlob()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if the field is not a blob)
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_OpenBlob(SharedMemory_handle sm, char* name, Blob_handle* blob) {
+	if (sm == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (name == NULL || strlen(name) < 1 || strlen(name) > IP_FIELD_NAME_SIZE || blob == NULL)
+		return IP_ERROR;
+
+	if (sm->sd == NULL) {
+		printf("Shared Data struct in shared memory is invalid.\n");
+		return IP_ERROR;
+	}
+
+	/** Read the description of the payload **/
+	struct field_t* f = NULL;
+	int ret = lockObjectField(sm, name, IP_KIND_BLOB, &f);
+	if (ret != IP_SUCCESS)
+		return ret;
+	struct blob_t* desc = (struct blob_t*) valueAt(sm->sd, f->offset, sizeof(struct blob_t));
+	struct blob_t info;
+	if (desc != NULL)
+		memcpy(&info, desc, sizeof(struct blob_t));
+	unlockFieldUnchanged(f);
+	if (desc == NULL || info.capacity <= 0 || info.capacity > 0x7fffffff - IP_HUGE_PAGE_SIZE) {
+		printf("ERROR: blob %s is corrupt\n", name);
+		return IP_ERROR;
+	}
+
+	Blob_handle blobObj = createBlobObj(sm, name);
+	if (blobObj == NULL)
+		return IP_ERROR;
+	blobObj->capacity = info.capacity;
+	blobObj->flags = info.flags;
+	blobObj->hugePages = info.hugePages;
+	if (mapBlob(blobObj, 0, info.capacity, info.hugePages) != IP_SUCCESS) {
+		free(blobObj);
 		return IP_ERROR;
 	}
+	if (info.flags & IP_BLOB_PREFAULT)
+		prefaultPages(blobObj->base, blobObj->mapSize, 0);
+	*blob = blobObj;
+	return IP_SUCCESS;
 }
 
-int ip_GetSharedMemoryLockWaitTime(SharedMemory_handle sm) {
-	if (sm == NULL)
+/*
+ * Unmap a blob's payload from this process. The creator closing it also removes the
+ * payload's name, so clear the blob's field then too.
+ */
+int ip_CloseBlob(Blob_handle blob) {
+	if (blob == NULL)
 		return IP_ERROR;
-	return (int) sm->lockWaitTime;
+	if (blob->reserved != NULL)
+		unlockField(blob->sm->sd, blob->reserved);
+	unmapBlob(blob);
+	free(blob);
+	return IP_SUCCESS;
 }
 
+/*
+ * Get the largest payload a blob holds
+ */
+int ip_GetBlobCapacity(Blob_handle blob) {
+	if (blob == NULL)
+		return IP_ERROR;
+	return blob->capacity;
+}
 
 /*
- * Get The Refactory Period (Time Delay) for reading from shared memory
- * time_ms stores the time delayin ms
- *
- * Both reading or writing a value locks the shared memory. By default, when a client
- * successfully reads a value from shared memory, the client is forced to sleep for a specified time
- * (default is 7ms). I call this the Read Time Delay.
- *
- * The Read Time Delay gives another process time to access the shared memory, and prevents an overly
- * aggressive client from reading in a loop and hogging the lock.
- *
- * Note.. this implicitly prioritizes writing over reading.
- *
- * To turn off the Read Time Delay, set the time to zero.
+ * Write a payload of size bytes to a blob, with non-temporal stores if the blob was
+ * created with IP_BLOB_STREAMING.
  *
- * Returns IP_SUCCESS 0
- * or IP_ERROR -1
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if size is larger than the blob's capacity)
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
  *
  */
-int ip_GetSharedMemoryReadRefractoryPeriodTimeDelay(SharedMemory_handle sm, int* time_ms){
-	if (sm==NULL) return IP_ERROR;
-	*time_ms = sm->ReadTimeDelay;
+int ip_WriteBlob(Blob_handle blob, void* data, int size) {
+	if (blob == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (size < 0 || size > blob->capacity || (data == NULL && size > 0))
+		return IP_ERROR;
+
+	struct field_t* f = NULL;
+	int ret = lockObjectField(blob->sm, blob->name, IP_KIND_BLOB, &f);
+	if (ret != IP_SUCCESS)
+		return ret;
+	struct blob_t* desc = (struct blob_t*) ((char*) blob->sm->sd + f->offset);
+
+	if (blob->flags & IP_BLOB_STREAMING) {
+		streamCopy(blob->base, (const char*) data, size);
+	} else {
+		memcpy(blob->base, data, size);
+	}
+	desc->size = size;
+	unlockField(blob->sm->sd, f);
 	return IP_SUCCESS;
 }
 
 /*
- * Set the number of milliseconds of the Read Time Delay.
+ * Lock a blob and get its payload to write in place, like ip_BeginWrite().
+ * Fill in up to the blob's capacity, then call ip_CommitBlobWrite().
  *
- * Both reading or writing a value locks the shared memory. By default, when a client
- * successfully reads a value from shared memory, the client is forced to sleep for a specified time
- * (default is 7ms). I call this the Read Time Delay.
- *
- * The Read Time Delay gives another process time to access the shared memory, and prevents an overly
- * aggressive client from reading in a loop and hogging the lock.
+ * Don't forget to call ip_CommitBlobWrite()
  *
- * Note.. this implicitly prioritizes writing over reading.
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if a write of this blob is already open)
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
  *
- * To turn off the Read Time Delay, set the time to zero.
- * Returns IP_SUCCESS 0
- * or IP_ERROR -1
  */
-int ip_SetSharedMemoryReadRefractoryPeriodTimeDelay(SharedMemory_handle sm, int time_ms){
-	if (sm==NULL) return IP_ERROR;
-	sm->ReadTimeDelay=time_ms;
+int ip_BeginBlobWrite(Blob_handle blob, void** data) {
+	if (blob == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (data == NULL)
+		return IP_ERROR;
+	if (blob->reserved != NULL) {
+		printf("ERROR: call ip_CommitBlobWrite() before beginning another write.\n");
+		return IP_ERROR;
+	}
+
+	struct field_t* f = NULL;
+	int ret = lockObjectField(blob->sm, blob->name, IP_KIND_BLOB, &f);
+	if (ret != IP_SUCCESS)
+		return ret;
+	blob->reserved = f;
+	*data = blob->base;
 	return IP_SUCCESS;
 }
 
-
-
-
-/*********************
- *
- *  Read/Write Memory
+/*
+ * Publish the size bytes written in place since ip_BeginBlobWrite(), and unlock the blob.
  *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if no write is open, or size is larger than the blob's capacity
  *
  */
+int ip_CommitBlobWrite(Blob_handle blob, int size) {
+	if (blob == NULL)
+		return IP_DOES_NOT_EXIST;
+	if (blob->reserved == NULL || size < 0 || size > blob->capacity)
+		return IP_ERROR;
+
+#ifdef IP_HAVE_STREAMING_STORES
+	/* in case the caller filled the payload with streaming stores of its own */
+	_mm_sfence();
+#endif
+	struct blob_t* desc = (struct blob_t*) ((char*) blob->sm->sd + blob->reserved->offset);
+	desc->size = size;
+	unlockField(blob->sm->sd, blob->reserved);
+	blob->reserved = NULL;
+	return IP_SUCCESS;
+}
 
 /*
- * Write a value to shared memory
- *
- * If the name of that value does not exist, it creates that value.
+ * Look at a blob's payload in place, without copying it. Works like ip_ReadValueView():
+ * check the view with ip_ValidateView() once done with it.
  *
  * Return Values:
  *  IP_SUCCESS 0
  *  IP_ERROR -1
  *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
  *
  */
-int ip_WriteValue(SharedMemory_handle sm, char* fieldName, void *data,
-		int dataSize) {
-	if (sm == NULL)
+int ip_ReadBlobView(Blob_handle blob, const void** data, int* size, View_token* token) {
+	if (blob == NULL)
 		return IP_DOES_NOT_EXIST;
-	if (strlen(fieldName) < 1)
-		return IP_ERROR;
-
-	if (sm->sd == NULL) {
-		printf("Shared Data struct in shared memory is invalid.\n");
-		return IP_ERROR;
-	}
-
-	if (AcquireLock(sm) == IP_BUSY)
-		return IP_BUSY;
-
-	if (verifySharedDataStruct(sm->sd) == IP_ERROR) {
-		ReleaseLock(sm);
-		printf("Shared Data struct in shared memory is invalid.\n");
+	if (data == NULL || size == NULL || token == NULL)
 		return IP_ERROR;
-	}
+	struct SharedData_t* sd = blob->sm->sd;
+
+	/** Same dance as ip_ReadValueView(), with the size taken from the blob's description **/
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SEQLOCK_MAX_RETRIES; ++attempt) {
+		unsigned int layout = IP_LOAD_ACQUIRE(&(sd->layoutSeq));
+		if (layout & 1) {
+			IP_CPU_RELAX();
+			continue;
+		}
 
-	/** Action Happens Here **/
+		struct field_t* f = NULL;
+		int ret = findField(&f, sd, blob->name);
+		if (ret != IP_SUCCESS) {
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (IP_LOAD_RELAXED(&(sd->layoutSeq)) == layout)
+				return ret;
+			continue;
+		}
 
-	/** Create the Field **/
-	struct field_t* f = createField(fieldName);
-	int ret = writeField(f, data, dataSize);
-	if (ret == IP_SUCCESS) {
-		ret = addFieldToSharedData(f, sm->sd);
+		unsigned int seq = IP_LOAD_ACQUIRE(&(f->seq));
+		if (seq & 1) {
+			IP_CPU_RELAX();
+			continue;
+		}
+		int kind = IP_LOAD_RELAXED(&(f->kind));
+		struct blob_t* desc = (struct blob_t*) valueAt(sd, IP_LOAD_RELAXED(&(f->offset)),
+				sizeof(struct blob_t));
+		int blobSize = (desc != NULL) ? IP_LOAD_RELAXED(&(desc->size)) : -1;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (desc != NULL && IP_LOAD_RELAXED(&(f->seq)) == seq
+				&& IP_LOAD_RELAXED(&(sd->layoutSeq)) == layout) {
+			if (kind != IP_KIND_BLOB || blobSize < 0 || blobSize > blob->capacity)
+				return IP_ERROR;
+			token->seq = &(f->seq);
+			token->value = seq;
+			*data = blob->base;
+			*size = blobSize;
+			return IP_SUCCESS;
+		}
 	}
-
-	ReleaseLock(sm);
-	destroyField(&f);
-
-	return ret;
-
+	return IP_BUSY;
 }
 
 /*
- * Read a value from shared memory
+ * Copy a blob's payload into data, which must hold the blob's capacity, and store its
+ * size in *size. Works like ip_ReadValue().
  *
  * Return Values:
  *  IP_SUCCESS 0
- *  IP_ERROR -1  if shared memory doesn't exist
+ *  IP_ERROR -1
  *  IP_BUSY 1
  *  IP_DOES_NOT_EXIST -2
  *
  */
-int ip_ReadValue(SharedMemory_handle sm, char* fieldName, void *data) {
-	if (sm == NULL)
+int ip_ReadBlob(Blob_handle blob, void* data, int* size) {
+	if (blob == NULL)
 		return IP_DOES_NOT_EXIST;
-
-	if (sm->sd == NULL) {
-		printf("Shared Data struct in shared memory is invalid.\n");
+	if (data == NULL || size == NULL)
 		return IP_ERROR;
-	}
-
-	if (AcquireLock(sm) == IP_BUSY)
-		return IP_BUSY;
 
-	if (verifySharedDataStruct(sm->sd) == IP_ERROR) {
-		ReleaseLock(sm);
-		printf("Shared Data struct in shared memory is invalid.\n");
-		return IP_ERROR;
+	/** Fast path: copy out of a view, retrying if a write got in the way **/
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SEQLOCK_MAX_RETRIES; ++attempt) {
+		const void* view = NULL;
+		int viewSize = 0;
+		View_token token;
+		int ret = ip_ReadBlobView(blob, &view, &viewSize, &token);
+		if (ret != IP_SUCCESS)
+			return ret;
+		memcpy(data, view, viewSize);
+		if (ip_ValidateView(token) == IP_SUCCESS) {
+			*size = viewSize;
+			return IP_SUCCESS;
+		}
 	}
 
-	/** Action Happens Here **/
-
-	/** Read out the field **/
+	/** Writers kept getting in the way, so queue up for the blob's lock instead **/
 	struct field_t* f = NULL;
-	int ret = findField(&f, sm->sd, fieldName);
-	if (ret == IP_SUCCESS) {
-		memcpy(data, f->data, f->size);
+	int ret = lockObjectField(blob->sm, blob->name, IP_KIND_BLOB, &f);
+	if (ret != IP_SUCCESS)
+		return ret;
+	struct blob_t* desc = (struct blob_t*) ((char*) blob->sm->sd + f->offset);
+	if (desc->size >= 0 && desc->size <= blob->capacity) {
+		memcpy(data, blob->base, desc->size);
+		*size = desc->size;
+	} else {
+		ret = IP_ERROR;
 	}
-
-	ReleaseLock(sm);
+	unlockFieldUnchanged(f);
 
 	/** Refractory Period **/
-	Sleep(sm->ReadTimeDelay);// sleep the thread for a little bit so that other threads can capture lock
+	sleepMs(blob->sm->ReadTimeDelay);
 
 	return ret;
-
 }
 
+
+
+/*************
+ *  History
+ *
+ */
+
 /*
- * Remove all fields in shared memory
+ * Add an empty field called name that keeps its last depth versions, of up to
+ * maxValueSize bytes each (at most maxValueSize of the shared memory).
+ *
  * Return Values:
  *  IP_SUCCESS 0
- *  IP_ERROR -1  if SharedMemory doesn't exist
+ *  IP_ERROR -1  (also if a field called name already exists)
  *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields or no space left for the history
  *
  */
-int ip_ClearAllFields(SharedMemory_handle sm) {
-
+int ip_CreateHistoryField(SharedMemory_handle sm, char* name, int depth, int maxValueSize) {
 	if (sm == NULL)
 		return IP_DOES_NOT_EXIST;
+	if (name == NULL || strlen(name) < 1 || strlen(name) > IP_FIELD_NAME_SIZE)
+		return IP_ERROR;
 
 	if (sm->sd == NULL) {
 		printf("Shared Data struct in shared memory is invalid.\n");
 		return IP_ERROR;
 	}
+	if (depth <= 0 || maxValueSize < 0 || maxValueSize > sm->sd->maxValueSize)
+		return IP_ERROR;
+
+	int entrySize = IP_ALIGN_UP((int) sizeof(struct historyEntry_t) + maxValueSize, 8);
+	long long bytes = (long long) sizeof(struct history_t) + (long long) depth * entrySize;
+	if (bytes > 0x7fffffff)
+		return IP_NO_MORE_ROOM;
 
 	if (AcquireLock(sm) == IP_BUSY)
 		return IP_BUSY;
@@ -963,50 +7014,168 @@ int ip_ClearAllFields(SharedMemory_handle sm) {
 		return IP_ERROR;
 	}
 
-	int k = 0;
-	for (k = 0; k < sm->sd->usedFields; ++k) {
-		zeroField(&(sm->sd->fields[k]));
+	struct field_t* f = NULL;
+	if (findField(&f, sm->sd, name) == IP_SUCCESS) {
+		ReleaseLock(sm);
+		printf("ERROR: field %s already exists\n", name);
+		return IP_ERROR;
+	}
+	int ret = addFieldToSharedData(name, NULL, 0, sm->sd, sm->lockWaitTime, &f);
+	if (ret != IP_SUCCESS) {
+		ReleaseLock(sm);
+		return ret;
+	}
 
+	int offset = 0;
+	int capacity = 0;
+	ret = heapAlloc(sm->sd, (int) bytes, &offset, &capacity);
+	if (ret != IP_SUCCESS) {
+		unlockFieldUnchanged(f);
+		deleteFieldFromSharedData(name, sm->sd, sm->lockWaitTime);
+		ReleaseLock(sm);
+		return ret;
 	}
+	struct history_t* h = (struct history_t*) ((char*) sm->sd + offset);
+	memset(h, 0, bytes);
+	h->depth = depth;
+	h->entrySize = entrySize;
+	h->maxValueSize = maxValueSize;
+	f->history = offset;
+	unlockField(sm->sd, f);
 
 	ReleaseLock(sm);
 	return IP_SUCCESS;
+}
 
+/*
+ * Copy the versions of the history of field f newer than sinceSeq into out, up to max
+ * of them, and return how many were copied. Entries rewritten while being copied, or
+ * too large for their buffer in out, are skipped.
+ * Without the field's lock (locked 0) the history is checked to still be f's, and the
+ * layout to still be layout, before each copy; if either changed, returns
+ * IP_STALE_HANDLE for the caller to start over. Returns IP_ERROR if f keeps no history.
+ */
+int copyHistory(struct SharedData_t* sd, struct field_t* f, unsigned int layout, int locked,
+		unsigned int sinceSeq, History_entry* out, int max) {
+	/** Pin down whose history this is and its geometry before following it **/
+	unsigned int generation = IP_LOAD_RELAXED(&(f->generation));
+	int offset = IP_LOAD_RELAXED(&(f->history));
+	struct history_t* h = historyAt(sd, offset);
+	if (h == NULL)
+		return IP_ERROR;
+	int depth = IP_LOAD_RELAXED(&(h->depth));
+	int entrySize = IP_LOAD_RELAXED(&(h->entrySize));
+	int maxValueSize = IP_LOAD_RELAXED(&(h->maxValueSize));
+
+	unsigned int count = IP_LOAD_ACQUIRE(&(h->count));
+	if (sinceSeq >= count) /** nothing new **/
+		return 0;
+	unsigned int first = sinceSeq + 1;
+	if (count - sinceSeq > (unsigned int) depth) /** older versions are gone **/
+		first = count - depth + 1;
+
+	int copied = 0;
+	unsigned int n = 0;
+	for (n = first; n != count + 1 && copied < max; ++n) {
+		struct historyEntry_t* entry = (struct historyEntry_t*) ((char*) h
+				+ sizeof(struct history_t) + (size_t) ((n - 1) % (unsigned int) depth) * entrySize);
+		if (IP_LOAD_ACQUIRE(&(entry->seq)) != n)
+			continue;
+		int size = IP_LOAD_RELAXED(&(entry->size));
+		long long timestamp = IP_LOAD_RELAXED(&(entry->timestamp));
+		if (size < 0 || size > maxValueSize || size > out[copied].capacity)
+			continue;
+
+		/* the block may have been cleared and handed to another history meanwhile */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (!locked && (IP_LOAD_RELAXED(&(sd->layoutSeq)) != layout
+				|| IP_LOAD_RELAXED(&(f->history)) != offset
+				|| IP_LOAD_RELAXED(&(f->generation)) != generation
+				|| IP_LOAD_RELAXED(&(h->depth)) != depth
+				|| IP_LOAD_RELAXED(&(h->entrySize)) != entrySize
+				|| IP_LOAD_RELAXED(&(h->maxValueSize)) != maxValueSize))
+			return IP_STALE_HANDLE;
+		memcpy(out[copied].data, (char*) entry + sizeof(struct historyEntry_t), size);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (IP_LOAD_RELAXED(&(entry->seq)) != n)
+			continue; /** a writer lapped us while we copied **/
+		out[copied].seq = n;
+		out[copied].timestamp_ns = timestamp;
+		out[copied].size = size;
+		copied++;
+	}
+	return copied;
 }
 
 /*
- *  Clear a single field in shared memory
+ * Copy the versions of a history field newer than version sinceSeq, oldest first,
+ * into out, up to max of them. Pass 0 to get every version still kept, then the
+ * seq of the last entry returned to pick up where you left off. Versions that were
+ * pushed out of the history before they could be read are skipped: compare the
+ * seq numbers to tell.
+ *
  * Return Values:
- *  IP_SUCCESS 0
- *  IP_ERROR -1  if SharedMemory doesn't exist
- *  IP_BUSY 1
+ *  the number of entries copied (0 if there is nothing new, or the field is busy)
+ *  IP_ERROR -1  (also if the field keeps no history)
+ *  IP_DOES_NOT_EXIST -2
  *
  */
-int ip_ClearField(SharedMemory_handle sm, char* fieldName) {
+int ip_ReadHistory(SharedMemory_handle sm, char* fieldName, unsigned int sinceSeq,
+		History_entry* out, int max) {
 	if (sm == NULL)
 		return IP_DOES_NOT_EXIST;
-
+	if (fieldName == NULL || out == NULL || max < 0)
+		return IP_ERROR;
 	if (sm->sd == NULL) {
 		printf("Shared Data struct in shared memory is invalid.\n");
 		return IP_ERROR;
 	}
+	struct SharedData_t* sd = sm->sd;
+
+	/** Fast path: entries carry their own seq, so only the layout has to hold still **/
+	int attempt = 0;
+	for (attempt = 0; attempt < IP_SEQLOCK_MAX_RETRIES; ++attempt) {
+		unsigned int layout = IP_LOAD_ACQUIRE(&(sd->layoutSeq));
+		if (layout & 1) {
+			IP_CPU_RELAX();
+			continue;
+		}
 
-	if (AcquireLock(sm) == IP_BUSY)
-		return IP_BUSY;
+		struct field_t* f = NULL;
+		int ret = findField(&f, sd, fieldName);
+		if (ret != IP_SUCCESS) {
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (IP_LOAD_RELAXED(&(sd->layoutSeq)) == layout)
+				return ret;
+			continue;
+		}
 
-	if (verifySharedDataStruct(sm->sd) == IP_ERROR) {
-		ReleaseLock(sm);
-		printf("Shared Data struct in shared memory is invalid.\n");
-		return IP_ERROR;
+		/* the history is set up once, before the field is first unlocked */
+		unsigned int seq = IP_LOAD_ACQUIRE(&(f->seq));
+		ret = copyHistory(sd, f, layout, 0, sinceSeq, out, max);
+		if (ret == IP_STALE_HANDLE || (ret == IP_ERROR && (seq & 1))) {
+			IP_CPU_RELAX();
+			continue;
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (IP_LOAD_RELAXED(&(sd->layoutSeq)) == layout)
+			return ret;
 	}
 
+	/** Fields kept moving, so queue up for the field's lock instead **/
 	struct field_t* f = NULL;
-	int ret = findField(&f, sm->sd, fieldName);
-	if (ret == IP_SUCCESS) {
-		zeroField(f);
-	}
-	ReleaseLock(sm);
-	return ret;
+	int ret = lockObjectField(sm, fieldName, IP_KIND_VALUE, &f);
+	if (ret != IP_SUCCESS)
+		return (ret == IP_BUSY) ? 0 : ret;
+	ret = copyHistory(sd, f, 0, 1, sinceSeq, out, max);
+	if (ret == IP_ERROR)
+		printf("ERROR: field %s keeps no history\n", fieldName);
+	unlockFieldUnchanged(f);
 
-}
+	/** Refractory Period **/
+	sleepMs(sm->ReadTimeDelay);
 
+	return ret;
+}
@@ -5,11 +5,14 @@
  *      Author: andy
  *
  * InterProcess is a fast, compact library for sharing fields of data between two processes
- * on Windows. It exposes only a very simple interface and abstracts away all of the
- * underlying mechanics.
+ * on Windows and on POSIX systems such as Linux. It exposes only a very simple interface
+ * and abstracts away all of the underlying mechanics.
  *
  * Under the hood, InterProcess avoids conflicts using mutex and uses the Windows
- * Named Shared Memory to share fields of data.
+ * Named Shared Memory to share fields of data. On POSIX systems the shared memory is a
+ * shm_open() object mapped with mmap() and the mutex is a fair ticket lock that lives
+ * inside the shared memory itself (waiters sleep on a futex on Linux), so no separate
+ * kernel object is needed.
  */
 
 
@@ -41,10 +44,11 @@
 
 
 
-/** Hard code in the buffer sizes **/
-#define IP_BUF_SIZE 256000
+/** Hard code in the buffer sizes (all but the name size are defaults, see ip_CreateSharedMemoryHostEx()) **/
+#define IP_BUF_SIZE 1048576
 #define IP_FIELD_NAME_SIZE 32
-#define IP_FIELD_DATA_CONTAINER_SIZE 512
+#define IP_FIELD_DATA_CONTAINER_SIZE 16384 /* largest value a single field can hold */
+#define IP_MAX_NUM_FIELDS 4096
 
 /** Return Values **/
 #define IP_SUCCESS 0
@@ -52,6 +56,8 @@
 #define IP_BUSY 1
 #define IP_DOES_NOT_EXIST -2
 #define IP_NO_MORE_ROOM -3
+#define IP_STALE_HANDLE -4
+#define IP_LAPPED -5
 
 
 
@@ -78,6 +84,80 @@ typedef struct SharedMemory_t *SharedMemory_handle;
 SharedMemory_handle ip_CreateSharedMemoryHost(char* name);
 
 
+/*
+ * One field of a schema, see SharedMemory_config.
+ */
+typedef struct SchemaField_t {
+	const char* name; /* shorter than IP_FIELD_NAME_SIZE */
+	int size; /* size of the field's value in bytes */
+} Schema_field;
+
+/*
+ * Geometry of the shared memory, see ip_CreateSharedMemoryHostEx().
+ * Any member left at zero gets its default.
+ *
+ * A schema is a list of fields the shared memory is created with, when the fields
+ * are known in advance. Field k of the schema sits in slot k of the field table with
+ * a zeroed value, and stays there for the life of the shared memory (it can't be
+ * cleared, and ip_ClearAllFields() only zeroes it), so the handle
+ * { k, 0 } always refers to it and nobody has to look it up by name.
+ * Clients make sure they agree on the schema with ip_CreateSharedMemoryClientEx().
+ */
+typedef struct SharedMemoryConfig_t {
+	int capacity; /* size of the whole shared memory in bytes (default IP_BUF_SIZE) */
+	int maxNumFields; /* how many fields can exist at once (default IP_MAX_NUM_FIELDS) */
+	int maxValueSize; /* largest value a single field can hold (default IP_FIELD_DATA_CONTAINER_SIZE) */
+	int hugePages; /* nonzero to back the shared memory with huge pages if the system allows it */
+	const Schema_field* schema; /* fields to create up front (default none) */
+	int schemaCount; /* number of fields in schema */
+	int syncPolicy; /* shared memory kept in a file: when to write it out, IP_SYNC_NONE (default) or IP_SYNC_ON_CLOSE */
+} SharedMemory_config;
+
+/*
+ * Sync policies of shared memory kept in a file, see ip_CreateSharedMemoryHostEx().
+ *  IP_SYNC_NONE      leave writing the file to the operating system. Enough to survive
+ *                    the host restarting, but not the machine crashing.
+ *  IP_SYNC_ON_CLOSE  the host writes everything to disk when it closes the shared memory
+ *                    (and waits for it), before marking it clean.
+ */
+#define IP_SYNC_NONE 0
+#define IP_SYNC_ON_CLOSE 1
+
+/*
+ * Start the shared memory host and create a shared memory object laid out as described
+ * by config. Passing NULL is the same as calling ip_CreateSharedMemoryHost().
+ * This is to be run on the host process.
+ *
+ * The geometry is recorded at the start of the shared memory, so clients simply call
+ * ip_CreateSharedMemoryClient() and map exactly the right size.
+ *
+ * Huge pages: on Linux the shared memory becomes a file in hugetlbfs (/dev/hugepages),
+ * which needs huge pages to have been reserved (vm.nr_hugepages). If there are none,
+ * normal shared memory is used and the kernel is asked for transparent huge pages
+ * instead. On Windows a large page section is created, which needs the
+ * SeLockMemoryPrivilege. Either way the capacity is rounded up to a whole number of
+ * huge pages, and the extra space holds values.
+ *
+ * The fields of a schema (see SharedMemory_config) are in place before any client
+ * can open the shared memory.
+ *
+ * A name with a slash in it (or a backslash, on Windows) is the path of a file that
+ * holds the shared memory, instead of memory that goes away with the host. Clients
+ * open it by the same path. The file is marked dirty while a host has it open and
+ * clean when the host closes it, having written it out as config->syncPolicy asks.
+ * A host that finds the file clean and laid out with the same geometry and schema
+ * takes it over as it is, with every field and value in place, except for blobs
+ * whose payloads are gone along with their creators, which are cleared. A file that is
+ * dirty (its host crashed) or laid out differently is laid out anew. Huge pages are
+ * not used for files.
+ *
+ * Returns NULL if the shared memory could not be created, if the fields asked for
+ * leave no room for their values, or if the schema is invalid (a name that is empty,
+ * too long or used twice, or a size that is not positive or larger than maxValueSize).
+ */
+SharedMemory_handle ip_CreateSharedMemoryHostEx(char* name, SharedMemory_config* config);
+
+
 
 /*
  * Start the shared memory client and create a shared memory object.
@@ -85,6 +165,37 @@ SharedMemory_handle ip_CreateSharedMemoryHost(char* name);
  */
 SharedMemory_handle ip_CreateSharedMemoryClient(char* name);
 
+/*
+ * Start the shared memory client like ip_CreateSharedMemoryClient(), but only if the
+ * host created the shared memory with the schema whose ip_SchemaHash() is schemaHash
+ * (0 for no schema). Returns NULL if the schemas differ.
+ */
+SharedMemory_handle ip_CreateSharedMemoryClientEx(char* name, unsigned long long schemaHash);
+
+/*
+ * Open the shared memory only to look at it, e.g. to monitor it from another process.
+ * The shared memory is mapped read-only and the lock is never taken, so watching
+ * cannot slow down the processes using it.
+ * The handle works with ip_GetSharedMemoryName(), ip_GetSharedMemorySize(),
+ * ip_GetSharedMemoryConfig(), ip_GetSchemaHash(), ip_GetStats(), ip_ListFields()
+ * and ip_CloseSharedMemory(); everything else turns it away with IP_ERROR.
+ * Returns NULL if the shared memory does not exist or is not laid out yet.
+ */
+SharedMemory_handle ip_CreateSharedMemoryObserver(char* name);
+
+/*
+ * Fingerprint of a schema: a 64 bit FNV-1a hash of the names and sizes of its fields,
+ * in order. 0 for an empty schema.
+ * interprocess.hpp computes the same hash at compile time.
+ */
+unsigned long long ip_SchemaHash(const Schema_field* schema, int count);
+
+/*
+ * Get the ip_SchemaHash() of the schema the shared memory was created with,
+ * 0 if none.
+ */
+unsigned long long ip_GetSchemaHash(SharedMemory_handle sm);
+
 
 /*
  *  Close the shared memory.
@@ -112,6 +223,16 @@ char* ip_GetSharedMemoryName(SharedMemory_handle sm);
  */
 int ip_GetSharedMemorySize(SharedMemory_handle sm);
 
+/*
+ * Get the geometry of the shared memory, as the host laid it out.
+ * The capacity may be larger than the host asked for, see ip_CreateSharedMemoryHostEx().
+ * The schema itself is not returned, only its schemaCount.
+ *
+ * Returns IP_SUCCESS 0
+ * or IP_ERROR -1
+ */
+int ip_GetSharedMemoryConfig(SharedMemory_handle sm, SharedMemory_config* config);
+
 
 /*
  *
@@ -125,14 +246,158 @@ int ip_GetSharedMemorySize(SharedMemory_handle sm);
  */
 int ip_GetSharedMemoryStatus(SharedMemory_handle sm);
 
+/** Number of buckets of the lock time histograms in SharedMemory_stats **/
+#define IP_STATS_BUCKETS 24
+
+/*
+ * Statistics of a shared memory, see ip_GetStats().
+ * The histograms count how long the shared memory lock was waited for and held (the
+ * locks of single fields are not timed). Bucket 0 counts times under 64 ns, bucket k
+ * times from 2^(k+5) ns to just under twice that, and the last bucket all longer times.
+ */
+typedef struct SharedMemoryStats_t {
+	unsigned long long reads; /* values read (or looked at in place) */
+	unsigned long long writes; /* values written */
+	unsigned long long misses; /* reads of fields that do not exist */
+	unsigned long long busy; /* locks not taken in time, each ending in IP_BUSY */
+	unsigned long long lockWait[IP_STATS_BUCKETS];
+	unsigned long long lockHold[IP_STATS_BUCKETS];
+} SharedMemory_stats;
+
+/*
+ * Get the statistics of the shared memory: what all processes using it did so far
+ * (or since ip_ResetStats()). Every process adds to the counters in the shared memory
+ * with relaxed atomics, so a read taken while others are busy may be a little behind.
+ * Processes built with IP_ENABLE_STATS set to 0 count nothing, and pay nothing for it.
+ *
+ * Returns IP_SUCCESS 0
+ * or IP_ERROR -1
+ */
+int ip_GetStats(SharedMemory_handle sm, SharedMemory_stats* stats);
+
+/*
+ * Get how often a field was read and written since it was created (or since
+ * ip_ResetStats()), in *reads and *writes.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_GetFieldStats(SharedMemory_handle sm, char* fieldName, unsigned long long* reads,
+		unsigned long long* writes);
+
+/*
+ * Set all of the statistics of the shared memory back to zero, those of the fields included.
+ * Counts made by other processes while this runs may survive it.
+ *
+ * Returns IP_SUCCESS 0
+ * or IP_ERROR -1
+ */
+int ip_ResetStats(SharedMemory_handle sm);
+
+/** What a field holds, see Field_info **/
+#define IP_KIND_VALUE 0
+#define IP_KIND_QUEUE 1
+#define IP_KIND_RING 2
+#define IP_KIND_FRAME 3
+#define IP_KIND_BLOB 4
+
+/*
+ * A look at one field, see ip_ListFields()
+ */
+typedef struct FieldInfo_t {
+	char name[IP_FIELD_NAME_SIZE];
+	int kind; /* IP_KIND_VALUE, or the kind of object the field holds */
+	int size; /* size of the value, or of the data block of an object, in bytes */
+	unsigned int version; /* see ip_GetFieldVersion() */
+	unsigned long long reads; /* see ip_GetFieldStats() */
+	unsigned long long writes;
+} Field_info;
+
+/*
+ * List the fields in the shared memory, in the order of the field table, storing up
+ * to max of them in out and how many that is in *count. To be sure of getting all of
+ * them, make room for the maxNumFields of ip_GetSharedMemoryConfig().
+ * No lock is taken: the list is a consistent snapshot of which fields exist, but each
+ * field's version and counters are only as fresh as the moment it was copied.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if fields kept being added or removed meanwhile
+ *
+ */
+int ip_ListFields(SharedMemory_handle sm, Field_info* out, int max, int* count);
+
+/*
+ * A snapshot of the values in the shared memory, see ip_Snapshot(). It starts with
+ * this header, followed by a Snapshot_field and the value for each field, one record
+ * after the other, each starting on an 8 byte boundary. It describes itself, so it can
+ * be written to a file and decoded later without the shared memory. Numbers are in the
+ * byte order of the machine that took it; magic tells which that was.
+ */
+typedef struct SnapshotHeader_t {
+	unsigned int magic; /* IP_SNAPSHOT_MAGIC */
+	unsigned int format; /* IP_SNAPSHOT_FORMAT */
+	unsigned int headerSize; /* sizeof(Snapshot_header): the first record starts here */
+	unsigned int flags; /* IP_SNAPSHOT_POINT_IN_TIME or 0 */
+	unsigned int size; /* the whole snapshot, in bytes */
+	int numFields; /* number of records */
+	unsigned long long schemaHash; /* see ip_GetSchemaHash() */
+	long long timeNs; /* when the snapshot was taken, in ns since 1970 (UTC) */
+} Snapshot_header;
+
+/*
+ * One field of a snapshot, followed by its value
+ */
+typedef struct SnapshotField_t {
+	unsigned int recordSize; /* this, the value and padding: the next record is this many bytes on */
+	unsigned int version; /* see ip_GetFieldVersion() */
+	int size; /* size of the value in bytes */
+	int slot; /* the field's slot in the field table; field k of a schema is in slot k */
+	char name[IP_FIELD_NAME_SIZE];
+} Snapshot_field;
+
+#define IP_SNAPSHOT_MAGIC 0x53535049 /* "IPSS" */
+#define IP_SNAPSHOT_FORMAT 1
+/* Every value was current at one and the same moment (otherwise, see ip_Snapshot()) */
+#define IP_SNAPSHOT_POINT_IN_TIME 1
+
+/*
+ * Copy the value of every field (objects such as queues are left out) into buffer,
+ * which is *size bytes long, as a snapshot (see Snapshot_header). *size is set to the
+ * number of bytes used, or if that is not enough, to the number needed.
+ *
+ * No lock is taken, so writers are never held up. The snapshot is checked against
+ * the fields' versions, so it is normally IP_SNAPSHOT_POINT_IN_TIME: every value in
+ * it was current at the same moment. If writers keep changing values while it is
+ * copied, it is taken again value by value: each value is then still whole, but the
+ * values may be from slightly different moments (and a batch written with
+ * ip_WriteValues() meanwhile may be seen half written). A handle from
+ * ip_CreateSharedMemoryObserver() can take snapshots too.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if fields kept being added or removed, or a value kept changing
+ *  IP_NO_MORE_ROOM -3  if the snapshot does not fit in the buffer
+ *
+ */
+int ip_Snapshot(SharedMemory_handle sm, void* buffer, int* size);
+
 
 /*
  * Get The Refactory Period (Time Delay) for reading from shared memory
  * time_ms stores the time delayin ms
  *
- * Both reading or writing a value locks the shared memory. By default, when a client
- * successfully reads a value from shared memory, the client is forced to sleep for a specified time
- * (default is 7ms). I call this the Read Time Delay.
+ * Writing a value locks the shared memory. Reading normally does not (see ip_ReadValue()),
+ * but when writers keep interfering a read falls back to taking the lock. By default, when a client
+ * successfully reads a value under the lock, the client is forced to sleep for a specified time
+ * (default is 5ms on Windows, and 0 on POSIX where the lock itself is fair). I call this
+ * the Read Time Delay.
  *
  * The Read Time Delay gives another process time to access the shared memory, and prevents an overly
  * aggressive client from reading in a loop and hogging the lock.
@@ -150,9 +415,11 @@ int ip_GetSharedMemoryReadRefractoryPeriodTimeDelay(SharedMemory_handle sm, int*
 /*
  * Set the number of milliseconds of the Read Time Delay.
  *
- * Both reading or writing a value locks the shared memory. By default, when a client
- * successfully reads a value from shared memory, the client is forced to sleep for a specified time
- * (default is 7ms). I call this the Read Time Delay.
+ * Writing a value locks the shared memory. Reading normally does not (see ip_ReadValue()),
+ * but when writers keep interfering a read falls back to taking the lock. By default, when a client
+ * successfully reads a value under the lock, the client is forced to sleep for a specified time
+ * (default is 5ms on Windows, and 0 on POSIX where the lock itself is fair). I call this
+ * the Read Time Delay.
  *
  * The Read Time Delay gives another process time to access the shared memory, and prevents an overly
  * aggressive client from reading in a loop and hogging the lock.
@@ -167,10 +434,33 @@ int ip_SetSharedMemoryReadRefractoryPeriodTimeDelay(SharedMemory_handle sm, int
 
 
 
+/*
+ * Set how long to wait for a lock held by another process before giving up with
+ * IP_BUSY, in milliseconds (default 4). Zero means don't wait at all.
+ * Returns IP_SUCCESS 0 or IP_ERROR -1
+ */
 int ip_SetSharedMemoryLockWaitTime(SharedMemory_handle sm, int time_ms);
 
+/*
+ * Get how long to wait for a lock held by another process, in milliseconds
+ * (rounded down), or IP_ERROR -1
+ */
 int ip_GetSharedMemoryLockWaitTime(SharedMemory_handle sm);
 
+/*
+ * Set how long to wait for a lock held by another process before giving up with
+ * IP_BUSY, in nanoseconds. Zero means don't wait at all. On Windows the wait is
+ * rounded up to whole milliseconds.
+ * Returns IP_SUCCESS 0 or IP_ERROR -1
+ */
+int ip_SetSharedMemoryLockWaitTimeNs(SharedMemory_handle sm, long long time_ns);
+
+/*
+ * Get how long to wait for a lock held by another process, in nanoseconds,
+ * or IP_ERROR -1
+ */
+long long ip_GetSharedMemoryLockWaitTimeNs(SharedMemory_handle sm);
+
 /*********************
  *
  *  Read/Write Memory
@@ -185,10 +475,20 @@ int ip_GetSharedMemoryLockWaitTime(SharedMemory_handle sm);
  *
  * If the name of that value does not exist, it creates that value.
  *
+ * Writing an existing field only takes that field's own lock, so writers of
+ * different fields do not wait for each other. Creating a field also takes the
+ * shared memory lock.
+ *
+ * Values can be of any size up to the shared memory's maxValueSize (by default
+ * IP_FIELD_DATA_CONTAINER_SIZE, see ip_CreateSharedMemoryHostEx()) bytes and a
+ * field may change size from one write to the next. The space for each value
+ * is carved out of a heap inside the shared memory.
+ *
  * Return Values:
  *  IP_SUCCESS 0
- *  IP_ERROR -1
+ *  IP_ERROR -1  (also if dataSize is larger than maxValueSize)
  *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields or no space left for the value
  *
  */
 int ip_WriteValue(SharedMemory_handle sm, char* fieldName, void *data, int dataSize);
@@ -197,6 +497,11 @@ int ip_WriteValue(SharedMemory_handle sm, char* fieldName, void *data, int dataS
 /*
  * Read a value from shared memory
  *
+ * Reading does not take the lock. Every field carries a sequence counter that writers
+ * bump before and after an update, so the reader copies the value optimistically and
+ * simply retries if a writer got in the way. Only if writers keep interfering does
+ * the read fall back to the lock, followed by the Read Time Delay.
+ *
  * Return Values:
  *  IP_SUCCESS 0
  *  IP_ERROR -1  if shared memory doesn't exist
@@ -207,9 +512,267 @@ int ip_WriteValue(SharedMemory_handle sm, char* fieldName, void *data, int dataS
 int ip_ReadValue(SharedMemory_handle sm, char* fieldName, void *data);
 
 
+/*
+ * A view token remembers the state of a value looked at with ip_ReadValueView(),
+ * so that ip_ValidateView() can tell whether it has changed since.
+ * Treat its contents as opaque. It is only meaningful in the process that took it.
+ */
+typedef struct ViewToken_t {
+	unsigned int* seq; /* sequence counter of the field */
+	unsigned int value; /* what the counter read when the view was taken */
+} View_token;
+
+/*
+ * Look at a value in place, without copying it out of shared memory.
+ *
+ * On success *data points at the value inside the shared memory and *size holds its
+ * size in bytes. The value is not locked: a writer may change it at any time (and a
+ * value that grows or shrinks moves somewhere else entirely). Once you are done with
+ * the data, ask ip_ValidateView() whether token is still valid. If it is not, what you
+ * saw may be torn and you should look again. Never write through the pointer.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if writers kept interfering
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_ReadValueView(SharedMemory_handle sm, char* fieldName, const void** data, int* size,
+		View_token* token);
+
+/*
+ * Check whether a value seen through ip_ReadValueView() is still the value that was
+ * there when the view was taken, i.e. whether what you read from it is consistent.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0  the value has not changed
+ *  IP_STALE_HANDLE -4  the value was changed or removed; look again
+ *
+ */
+int ip_ValidateView(View_token token);
+
+/*
+ * Get the size in bytes of a field's value, e.g. to size the buffer for ip_ReadValue().
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_GetValueSize(SharedMemory_handle sm, char* fieldName, int* size);
+
+
+
+/*
+ * A field handle is a pre-resolved reference to a field, see ip_ResolveField().
+ * It is a small value type; copy it around freely but treat its contents as opaque.
+ */
+typedef struct FieldHandle_t {
+	int slot; /* position of the field in shared memory */
+	unsigned int generation; /* generation of that position when the handle was resolved */
+} Field_handle;
+
+/*
+ * Look up a field once so that it can be read and written by handle,
+ * skipping the name lookup on every access.
+ *
+ * A handle becomes stale when its field is cleared (or when clearing another
+ * field moves it). Calls using a stale handle return IP_STALE_HANDLE; resolve
+ * the name again when that happens.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_ResolveField(SharedMemory_handle sm, char* fieldName, Field_handle* handle);
+
+/*
+ * Read a value from shared memory by handle. Works like ip_ReadValue().
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_STALE_HANDLE -4
+ *
+ */
+int ip_ReadValueByHandle(SharedMemory_handle sm, Field_handle handle, void *data);
+
+/*
+ * Read a value from shared memory by handle into a buffer of capacity bytes,
+ * storing the size of the value in *size (unless size is NULL).
+ * Works like ip_ReadValueByHandle(), except that a value larger than the buffer is
+ * not copied at all; *size then tells how large a buffer it needs.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if the value is larger than capacity
+ *  IP_STALE_HANDLE -4
+ *
+ */
+int ip_ReadValueByHandleEx(SharedMemory_handle sm, Field_handle handle, void *data, int capacity,
+		int* size);
+
+/*
+ * Write a value to shared memory by handle. Works like ip_WriteValue(),
+ * except that the field must already exist.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if dataSize is larger than maxValueSize)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3
+ *  IP_STALE_HANDLE -4
+ *
+ */
+int ip_WriteValueByHandle(SharedMemory_handle sm, Field_handle handle, void *data, int dataSize);
+
+/*
+ * Reserve room for a value of dataSize bytes directly in shared memory, so that it
+ * can be built in place instead of being copied in from a buffer.
+ * If the name of that value does not exist, it creates that value.
+ *
+ * On success *data points at the value's bytes inside the shared memory. Fill in all
+ * dataSize of them (the old contents are not kept), then call ip_CommitWrite() to
+ * publish the new value. Until then the field stays locked: readers wait for (or
+ * retry around) the write, and other writers of the field get IP_BUSY. Only one write
+ * per shared memory object can be open at a time.
+ *
+ * Don't forget to call ip_CommitWrite()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if dataSize is larger than maxValueSize, or another write is open)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields or no space left for the value
+ *
+ */
+int ip_BeginWrite(SharedMemory_handle sm, char* fieldName, int dataSize, void** data);
+
+/*
+ * Publish the value written in place since ip_BeginWrite(), and unlock its field.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if no write is open
+ *
+ */
+int ip_CommitWrite(SharedMemory_handle sm);
+
+/*
+ * One entry of a batch for ip_WriteValues() and ip_ReadValues().
+ */
+typedef struct FieldValue_t {
+	char* name; /* name of the field, or NULL to use handle instead */
+	Field_handle handle; /* the field, if name is NULL */
+	void* data; /* value to write, or buffer to read the value into */
+	int size; /* size of the value to write, or of the value read */
+	int status; /* set to the outcome for this entry, e.g. IP_SUCCESS */
+} Field_value;
+
+/** Largest number of entries in a batch **/
+#define IP_MAX_BATCH_SIZE 256
+
+/*
+ * Write a batch of values at once
+ *
+ * Each entry names its field, either by name or (with name set to NULL) by handle,
+ * and holds the value to write in data and size. Fields named that do not exist yet
+ * are created. The whole batch takes the shared memory lock once, and holds the locks
+ * of all its fields until every value is in place, so ip_ReadValues() never sees the
+ * batch half written.
+ *
+ * The status of every entry is stored in its status (see ip_WriteValue() and
+ * ip_WriteValueByHandle() for the values). The batch may hold at most
+ * IP_MAX_BATCH_SIZE entries.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0  if every entry was written
+ *  otherwise the status of the first entry that was not
+ *
+ */
+int ip_WriteValues(SharedMemory_handle sm, Field_value* values, int count);
+
+/*
+ * Read a batch of values at once
+ *
+ * Each entry names its field, either by name or (with name set to NULL) by handle,
+ * and points data at a buffer large enough for the value. The size of every value
+ * read is stored in its entry's size, and the status in its status (see
+ * ip_ReadValue() and ip_ReadValueByHandle() for the values).
+ *
+ * The values read are a consistent snapshot: a batch written with ip_WriteValues()
+ * is seen either entirely or not at all. Like ip_ReadValue() no lock is taken, unless
+ * writers keep interfering; then the batch is read under the lock, followed by a single
+ * Read Time Delay. The batch may hold at most IP_MAX_BATCH_SIZE entries.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0  if every entry was read
+ *  otherwise the status of the first entry that was not
+ *
+ */
+int ip_ReadValues(SharedMemory_handle sm, Field_value* values, int count);
+
+/*
+ * Get the version of a field. The version changes every time the field is written;
+ * pass it to ip_WaitForFieldChange() to sleep until that happens.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_GetFieldVersion(SharedMemory_handle sm, char* fieldName, unsigned int* version);
+
+/*
+ * Sleep until a field changes
+ *
+ * Blocks until the version of the field (see ip_GetFieldVersion()) is no longer
+ * lastVersion, or until timeout_ns nanoseconds have passed (pass a negative timeout
+ * to wait forever), and stores the new version in *version. Then read the new value.
+ * The field being moved in shared memory (when another field is cleared) also counts
+ * as a change.
+ *
+ * Waiting takes no CPU: on Linux the caller sleeps in the kernel (futex) and is woken
+ * by the write itself, within microseconds. Elsewhere it naps a millisecond at a time.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if the time was up first
+ *  IP_DOES_NOT_EXIST -2  (also if the field is cleared while waiting)
+ *
+ */
+int ip_WaitForFieldChange(SharedMemory_handle sm, char* fieldName, unsigned int lastVersion,
+		long long timeout_ns, unsigned int* version);
+
+/*
+ * Sleep until a field changes, by handle. Works like ip_WaitForFieldChange().
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if the time was up first
+ *  IP_STALE_HANDLE -4  (also if the field is cleared or moved while waiting)
+ *
+ */
+int ip_WaitForFieldChangeByHandle(SharedMemory_handle sm, Field_handle handle,
+		unsigned int lastVersion, long long timeout_ns, unsigned int* version);
 
 /*
  * Remove all fields in shared memory
+ * All field slots become available for new fields.
+ * Fields of the schema are not removed, but their values are zeroed.
  * Return Values:
  *  IP_SUCCESS 0
  *  IP_ERROR -1  if SharedMemory doesn't exist
@@ -220,25 +783,545 @@ int ip_ClearAllFields(SharedMemory_handle sm);
 
 /*
  *  Clear a single field in shared memory
+ *  The field is removed and its slot becomes available for a new field.
   * Return Values:
  *  IP_SUCCESS 0
- *  IP_ERROR -1  if SharedMemory doesn't exist
+ *  IP_ERROR -1  if SharedMemory doesn't exist, or if the field is part of the schema
  *  IP_BUSY 1
  *
  */
 int ip_ClearField(SharedMemory_handle sm, char* fieldName);
 
 
+/*************
+ *  Queues
+ *
+ *  A queue carries a stream of messages from one process (the producer) to one
+ *  other process (the consumer) through the shared memory. It lives in a field of
+ *  its own, so it has a name like any other field, but it cannot be read or written
+ *  with ip_ReadValue() or ip_WriteValue().
+ *
+ *  Pushing and popping take no lock at all: the producer only ever moves the tail of
+ *  the queue and the consumer only ever moves its head, each on a cache line of its
+ *  own. That only works with exactly one producer and one consumer per queue; two
+ *  processes pushing to (or popping from) the same queue will corrupt it.
+ *
+ *  Once the queue's field is cleared (or all fields are), either end that still
+ *  uses the queue gets IP_STALE_HANDLE; a call caught halfway by the clearing may
+ *  still touch memory that is no longer the queue's, so close both ends first.
+ */
 
-/**************************************************************/
-/**************************************************************/
-/** PRIVATE FUNCTIONS!! DONT FORGET TO DELETE THESE.. FOR DEVEL ONLY **/
-/**************************************************************/
-/**************************************************************/
 /*
- *  Tries to acquire a lock by waiting until the mutex is released.
- *  The function will wait the amount of time specified in the SharedMemory object
- *  (the default is 4ms).
+ * This is a local object for one end of a queue.
+ */
+typedef struct Queue_t *Queue_handle;
+
+/*
+ * Create a queue of capacity messages of up to maxMessageSize bytes each, in a new
+ * field called name, and open it. capacity is rounded up to a power of two.
+ * The queue is not bound by maxValueSize (see ip_CreateSharedMemoryHostEx()),
+ * only by the room left in the shared memory.
+ *
+ * Don't forget to call ip_CloseQueue()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if a field called name already exists)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields or no space left for the queue
+ *
+ */
+int ip_CreateQueue(SharedMemory_handle sm, char* name, int capacity, int maxMessageSize,
+		Queue_handle* queue);
+
+/*
+ * Open a queue created (by any process) with ip_CreateQueue().
+ *
+ * Don't forget to call ip_CloseQueue()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if the field is not a queue)
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_OpenQueue(SharedMemory_handle sm, char* name, Queue_handle* queue);
+
+/*
+ * Close this process's end of a queue. The queue itself stays in shared memory
+ * until its field is cleared.
+ */
+int ip_CloseQueue(Queue_handle queue);
+
+/*
+ * Get the largest message a queue holds
+ */
+int ip_GetQueueMaxMessageSize(Queue_handle queue);
+
+/*
+ * Push a message of size bytes onto a queue. Producer only.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if the message is larger than the queue's maxMessageSize
+ *  IP_BUSY 1  if the queue is full
+ *  IP_STALE_HANDLE -4  if the queue's field was cleared
+ *
+ */
+int ip_QueuePush(Queue_handle queue, void* data, int size);
+
+/*
+ * Pop the oldest message off a queue into data, which must hold the queue's
+ * maxMessageSize bytes, and store its size in *size. Consumer only.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if the queue is empty
+ *  IP_STALE_HANDLE -4  if the queue's field was cleared
+ *
+ */
+int ip_QueuePop(Queue_handle queue, void* data, int* size);
+
+/*
+ * Push up to count messages, data[k] of sizes[k] bytes, onto a queue. Producer only.
+ * The consumer sees them all at once, and the queue's tail is only moved once, so
+ * this is much cheaper than count calls to ip_QueuePush().
+ *
+ * Returns the number of messages pushed, which is less than count if the queue
+ * filled up (or a message was too large), IP_ERROR, or IP_STALE_HANDLE if the
+ * queue's field was cleared.
+ */
+int ip_QueuePushBatch(Queue_handle queue, void** data, int* sizes, int count);
+
+/*
+ * Pop up to count messages off a queue into data[k], each of which must hold the
+ * queue's maxMessageSize bytes, storing their sizes in sizes[k]. Consumer only.
+ *
+ * Returns the number of messages popped, which is less than count if the queue
+ * ran empty, IP_ERROR, or IP_STALE_HANDLE if the queue's field was cleared.
+ */
+int ip_QueuePopBatch(Queue_handle queue, void** data, int* sizes, int count);
+
+
+/*************
+ *  Broadcast Rings
+ *
+ *  A ring carries a stream of messages from one process (the writer) to any number
+ *  of readers. The writer appends without ever waiting: once the ring is full every
+ *  new message overwrites the oldest one. Each reader keeps a cursor of its own and
+ *  reads every message in order at its own pace. A reader that falls more than the
+ *  ring's capacity behind finds out it was lapped, and by how many messages.
+ *
+ *  Writing and reading take no lock. Only the process that created the ring may
+ *  write to it. Readers register in the ring's reader table, so the writer can see
+ *  how far behind they are (see ip_GetRingReaders()), but it never waits for them.
+ *
+ *  Like a queue, the ring lives in a field of its own; once that is cleared, the
+ *  writer and readers still using it get IP_STALE_HANDLE. Close them all first.
+ */
+
+/*
+ * This is a local object for the writer or one reader of a ring.
+ */
+typedef struct Ring_t *Ring_handle;
+
+/*
+ * Create a ring of capacity messages of up to maxMessageSize bytes each, with room
+ * for maxReaders readers, in a new field called name, and open it for writing.
+ * capacity is rounded up to a power of two. Like a queue, a ring is not bound
+ * by maxValueSize, only by the room left in the shared memory.
+ *
+ * Don't forget to call ip_CloseRing()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if a field called name already exists)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields or no space left for the ring
+ *
+ */
+int ip_CreateRing(SharedMemory_handle sm, char* name, int capacity, int maxMessageSize,
+		int maxReaders, Ring_handle* writer);
+
+/*
+ * Register as a reader of a ring created (by any process) with ip_CreateRing().
+ * The reader starts at the next message written.
+ *
+ * Don't forget to call ip_CloseRing(), which frees the reader's place (the place
+ * of a reader whose process died is taken over).
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if the field is not a ring)
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *  IP_NO_MORE_ROOM -3  if running processes already have maxReaders readers open
+ *
+ */
+int ip_OpenRingReader(SharedMemory_handle sm, char* name, Ring_handle* reader);
+
+/*
+ * Close the writer or a reader of a ring. The ring itself stays in shared memory
+ * until its field is cleared.
+ */
+int ip_CloseRing(Ring_handle ring);
+
+/*
+ * Append a message of size bytes to a ring, overwriting the oldest message if the
+ * ring is full. Writer only; never waits.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if the message is larger than the ring's maxMessageSize
+ *  IP_BUSY 1  if the ring's field is being moved just now
+ *  IP_STALE_HANDLE -4  if the ring's field was cleared
+ *
+ */
+int ip_RingWrite(Ring_handle writer, void* data, int size);
+
+/*
+ * Read the reader's next message into data, which must hold the ring's
+ * maxMessageSize bytes, and store its size in *size. Reader only.
+ *
+ * If the writer overwrote messages before they were read, nothing is read: the number
+ * of messages lost is stored in *lost and the reader skips ahead to the oldest message
+ * still in the ring, which the next call reads.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1  if there is no new message
+ *  IP_LAPPED -5  if the reader was lapped
+ *  IP_STALE_HANDLE -4  if the ring's field was cleared
+ *
+ */
+int ip_RingRead(Ring_handle reader, void* data, int* size, unsigned int* lost);
+
+/*
+ * Get how far behind the readers of a ring are: the number of messages written that
+ * each reader has not read yet is stored in lags, for up to count readers.
+ * Returns the number of readers open in running processes, IP_ERROR, or
+ * IP_STALE_HANDLE if the ring's field was cleared.
+ */
+int ip_GetRingReaders(Ring_handle ring, unsigned int* lags, int count);
+
+
+/*************
+ *  Triple-Buffered Frames
+ *
+ *  A frame field holds the latest of a stream of large values, such as camera
+ *  frames, for one writer and one reader. It keeps three buffers: one the writer
+ *  fills, one the reader looks at and one with the latest frame published.
+ *  Publishing and taking a frame each swap a buffer with a single atomic exchange,
+ *  so the writer never waits for the reader and the reader always gets the most
+ *  recent complete frame, never a torn one. Frames the reader was too slow to take
+ *  are simply replaced.
+ *
+ *  The frame is read in place: ip_AcquireLatestFrame() hands out a pointer into the
+ *  shared memory, which stays valid until ip_ReleaseFrame(). The writer may build the
+ *  next frame in place too (ip_GetFrameBuffer()), so that publishing costs no copy.
+ *
+ *  Only the process that created the frame may publish to it, and only one reader
+ *  may be open at a time; a reader whose process died is taken over. Like a queue, the frame lives in a field of its own; once
+ *  that is cleared, either side still using it gets IP_STALE_HANDLE. Close both first.
+ */
+
+/*
+ * This is a local object for the writer or the reader of a frame.
+ */
+typedef struct Frame_t *Frame_handle;
+
+/*
+ * Create a triple-buffered frame of up to maxFrameSize bytes in a new field called
+ * name, and open it for writing. Like a queue, a frame is not bound by maxValueSize,
+ * only by the room left in the shared memory (it takes three times maxFrameSize).
+ *
+ * Don't forget to call ip_CloseFrame()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if a field called name already exists)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields or no space left for the frame
+ *
+ */
+int ip_CreateFrame(SharedMemory_handle sm, char* name, int maxFrameSize, Frame_handle* writer);
+
+/*
+ * Open the reader of a frame created (by any process) with ip_CreateFrame().
+ *
+ * Don't forget to call ip_CloseFrame(), which lets another reader open it.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if the field is not a frame)
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *  IP_NO_MORE_ROOM -3  if a running process has the reader open
+ *
+ */
+int ip_OpenFrameReader(SharedMemory_handle sm, char* name, Frame_handle* reader);
+
+/*
+ * Close the writer or the reader of a frame. The frame itself stays in shared memory
+ * until its field is cleared.
+ */
+int ip_CloseFrame(Frame_handle frame);
+
+/*
+ * Get the buffer the next frame goes into, to build it in place. Writer only.
+ * Fill it with up to maxFrameSize bytes, then call ip_PublishFrame() with data NULL.
+ * The buffer changes with every frame published, so get it again each time.
+ * Returns IP_SUCCESS, IP_ERROR, or IP_STALE_HANDLE if the frame's field was cleared.
+ */
+int ip_GetFrameBuffer(Frame_handle writer, void** data);
+
+/*
+ * Publish a frame of size bytes. The frame is copied from data, or if data is NULL,
+ * it is the one written in place in the buffer from ip_GetFrameBuffer(). Writer only;
+ * never waits.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if the frame is larger than maxFrameSize
+ *  IP_BUSY 1  if the frame's field is being moved just now
+ *  IP_STALE_HANDLE -4  if the frame's field was cleared
+ *
+ */
+int ip_PublishFrame(Frame_handle writer, void* data, int size);
+
+/*
+ * Take the latest frame published. *data points at it in shared memory, *size holds its
+ * size and *number its number (frames are numbered from 1 as they are published; the
+ * same number as last time means nothing new was published). Reader only.
+ *
+ * The frame stays put until ip_ReleaseFrame() is called, whatever the writer does.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if the last frame has not been released)
+ *  IP_BUSY 1  if no frame has been published yet
+ *  IP_STALE_HANDLE -4  if the frame's field was cleared
+ *
+ */
+int ip_AcquireLatestFrame(Frame_handle reader, const void** data, int* size,
+		unsigned int* number);
+
+/*
+ * Let go of the frame taken with ip_AcquireLatestFrame(). Its pointer must no longer
+ * be used. Reader only.
+ */
+int ip_ReleaseFrame(Frame_handle reader);
+
+
+/*************
+ *  Blobs
+ *
+ *  A blob is a field for payloads of megabytes, such as images, far larger than a
+ *  value or even the whole shared memory. Its payload lives in a shared memory object
+ *  of its own, named after the shared memory and the field, which every process maps
+ *  once when it opens the blob and then reads in place. The field itself (in the
+ *  shared memory) only describes the payload, and guards it like it guards a value:
+ *  readers never see a write half done, and ip_WaitForFieldChange() on the blob's name
+ *  wakes up when it is written.
+ *
+ *  The payload may be put on huge pages and faulted in up front, so the first frames
+ *  do not pay for page faults. Writes can use non-temporal (streaming) stores, so that
+ *  copying in megabytes does not evict everything the other processes have in cache.
+ *
+ *  Close every blob before closing its shared memory. A blob's payload disappears
+ *  (for processes that open it afterwards) once its creator closes it.
+ */
+
+/** Options of a blob **/
+#define IP_BLOB_HUGE_PAGES 1 /* put the payload on huge pages if the system has them */
+#define IP_BLOB_PREFAULT 2 /* fault in the whole payload when the blob is created or opened */
+#define IP_BLOB_STREAMING 4 /* ip_WriteBlob() copies with non-temporal stores, bypassing the cache */
+
+/*
+ * This is a local object for a blob, holding this process's mapping of its payload.
+ */
+typedef struct Blob_t *Blob_handle;
+
+/*
+ * Create a blob of up to capacity bytes in a new field called name, with the options
+ * in flags (IP_BLOB_HUGE_PAGES, IP_BLOB_PREFAULT, IP_BLOB_STREAMING, or 0), and open it.
+ *
+ * Don't forget to call ip_CloseBlob()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if a field called name already exists, or the payload could
+ *               not be created)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields
+ *
+ */
+int ip_CreateBlob(SharedMemory_handle sm, char* name, int capacity, int flags, Blob_handle* blob);
+
+/*
+ * Open a blob created (by any process) with ip_CreateBlob(), mapping its payload.
+ *
+ * Don't forget to call ip_CloseBlob()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if the field is not a blob)
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_OpenBlob(SharedMemory_handle sm, char* name, Blob_handle* blob);
+
+/*
+ * Unmap a blob's payload from this process. The creator closing it also removes the
+ * payload's name, so clear the blob's field then too.
+ */
+int ip_CloseBlob(Blob_handle blob);
+
+/*
+ * Get the largest payload a blob holds
+ */
+int ip_GetBlobCapacity(Blob_handle blob);
+
+/*
+ * Write a payload of size bytes to a blob, with non-temporal stores if the blob was
+ * created with IP_BLOB_STREAMING.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if size is larger than the blob's capacity)
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_WriteBlob(Blob_handle blob, void* data, int size);
+
+/*
+ * Lock a blob and get its payload to write in place, like ip_BeginWrite().
+ * Fill in up to the blob's capacity, then call ip_CommitBlobWrite().
+ *
+ * Don't forget to call ip_CommitBlobWrite()
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if a write of this blob is already open)
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_BeginBlobWrite(Blob_handle blob, void** data);
+
+/*
+ * Publish the size bytes written in place since ip_BeginBlobWrite(), and unlock the blob.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  if no write is open, or size is larger than the blob's capacity
+ *
+ */
+int ip_CommitBlobWrite(Blob_handle blob, int size);
+
+/*
+ * Look at a blob's payload in place, without copying it. Works like ip_ReadValueView():
+ * check the view with ip_ValidateView() once done with it.
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_ReadBlobView(Blob_handle blob, const void** data, int* size, View_token* token);
+
+/*
+ * Copy a blob's payload into data, which must hold the blob's capacity, and store its
+ * size in *size. Works like ip_ReadValue().
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1
+ *  IP_BUSY 1
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_ReadBlob(Blob_handle blob, void* data, int* size);
+
+
+
+/*************
+ *  History
+ *
+ *  A history field is a plain value that also keeps its last few versions, each
+ *  stamped with the time it was written (from a monotonic clock, in nanoseconds) and
+ *  its version number. The first value written is version 1. Write it with
+ *  ip_WriteValue() and friends as usual; ip_ReadHistory() then lets a reader catch up
+ *  on every version since the last one it saw, so a slow reader can tell exactly
+ *  what it missed instead of only ever seeing the latest value.
+ *
+ */
+
+/*
+ * One version of a history field. Point data at a buffer that holds the field's
+ * largest value (the maxValueSize given to ip_CreateHistoryField()) and set capacity
+ * to its size before calling ip_ReadHistory(). Versions larger than capacity are skipped.
+ */
+typedef struct HistoryEntry_t {
+	unsigned int seq; /* version number */
+	long long timestamp_ns; /* when the version was written */
+	void* data;
+	int capacity; /* size of the buffer data points at */
+	int size;
+} History_entry;
+
+/*
+ * Add an empty field called name that keeps its last depth versions, of up to
+ * maxValueSize bytes each (at most maxValueSize of the shared memory).
+ *
+ * Return Values:
+ *  IP_SUCCESS 0
+ *  IP_ERROR -1  (also if a field called name already exists)
+ *  IP_BUSY 1
+ *  IP_NO_MORE_ROOM -3  if there are no free fields or no space left for the history
+ *
+ */
+int ip_CreateHistoryField(SharedMemory_handle sm, char* name, int depth, int maxValueSize);
+
+/*
+ * Copy the versions of a history field newer than version sinceSeq, oldest first,
+ * into out, up to max of them. Pass 0 to get every version still kept, then the
+ * seq of the last entry returned to pick up where you left off. Versions that were
+ * pushed out of the history before they could be read are skipped: compare the
+ * seq numbers to tell.
+ *
+ * Return Values:
+ *  the number of entries copied (0 if there is nothing new, or the field is busy)
+ *  IP_ERROR -1  (also if the field keeps no history)
+ *  IP_DOES_NOT_EXIST -2
+ *
+ */
+int ip_ReadHistory(SharedMemory_handle sm, char* fieldName, unsigned int sinceSeq,
+		History_entry* out, int max);
+
+
+
+/**************************************************************/
+/**************************************************************/
+/** PRIVATE FUNCTIONS!! DONT FORGET TO DELETE THESE.. FOR DEVEL ONLY **/
+/**************************************************************/
+/**************************************************************/
+/*
+ *  Tries to acquire a lock by waiting until the mutex is released.
+ *  The function will wait the amount of time specified in the SharedMemory object
+ *  (the default is 4ms). On POSIX the lock is fair: processes get it in the order
+ *  they asked for it.
+ *
+ *  The lock guards the layout of the shared memory: while it is held no fields
+ *  can be added or removed. Values of existing fields are protected by a lock of
+ *  their own, so they can still be written by other processes.
  *
  *  This function returns
  *  0 IP_SUCCESS
@@ -0,0 +1,545 @@
+/*
+ * interprocess.hpp
+ *
+ * A typed C++ interface to InterProcess, on top of the C functions in interprocess.h.
+ * Everything is in this header; link against interprocess.o as usual.
+ *
+ *  ip::Segment       owns a SharedMemory_handle, closes it when it goes out of scope
+ *                    and can be moved but not copied.
+ *  ip::Field<T>      reads and writes a field as a T. The field is looked up once and
+ *                    then accessed by handle, and a value that does not have exactly
+ *                    the size of a T is never copied into one.
+ *  ip::View          a value looked at in place, as bytes.
+ *  ip::LockGuard     holds the shared memory lock (AcquireLock()) for a scope.
+ *  ip::InPlaceWrite  a value being built in place (ip_BeginWrite()), committed at the
+ *                    end of its scope.
+ *  ip::Queue, ip::Ring, ip::Frame, ip::Blob
+ *                    own the handles of those objects and close them.
+ *  ip::Schema        the fields of a shared memory, fixed at compile time, and
+ *  ip::SchemaSegment a shared memory laid out with one, whose fields are read and
+ *                    written by their position in the schema without any lookup.
+ *
+ * Like the C functions, nothing throws: calls return the IP_* codes of interprocess.h.
+ * Needs C++17. With C++20, byte ranges are std::span<const std::byte>.
+ */
+
+/*
+* Copyright 2010 Andrew M. Leifer  <leifer@fas.harvard.edu>
+*
+* Interprocess is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* Interprocess is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* See <http://www.gnu.org/licenses/>.
+*
+* For the most up to date version of this software, see:
+* https://github.com/samuellab/interprocess
+*
+*/
+
+
+#ifndef INTERPROCESS_HPP_
+#define INTERPROCESS_HPP_
+
+#include <cstddef>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#define IP_HAVE_STD_SPAN
+#endif
+#endif
+
+#include "interprocess.h"
+
+namespace ip {
+
+/*
+ * A run of bytes: std::span with C++20, a minimal stand-in before that.
+ */
+#ifdef IP_HAVE_STD_SPAN
+template <typename Byte>
+using Span = std::span<Byte>;
+#else
+template <typename Byte>
+class Span {
+public:
+	constexpr Span() noexcept : data_(nullptr), size_(0) {}
+	constexpr Span(Byte* data, std::size_t size) noexcept : data_(data), size_(size) {}
+
+	constexpr Byte* data() const noexcept { return data_; }
+	constexpr std::size_t size() const noexcept { return size_; }
+	constexpr bool empty() const noexcept { return size_ == 0; }
+	constexpr Byte* begin() const noexcept { return data_; }
+	constexpr Byte* end() const noexcept { return data_ + size_; }
+	constexpr Byte& operator[](std::size_t k) const noexcept { return data_[k]; }
+
+private:
+	Byte* data_;
+	std::size_t size_;
+};
+#endif
+
+typedef Span<const std::byte> Bytes;
+typedef Span<std::byte> MutableBytes;
+
+/*
+ * The C functions take names as char*, though they never write to them.
+ */
+inline char* cName(const char* name) {
+	return const_cast<char*>(name);
+}
+
+template <typename T>
+class Field;
+
+/*
+ * Read the value behind a handle into a T, but only if it is exactly sizeof(T) bytes:
+ * a larger one returns IP_NO_MORE_ROOM and a smaller one IP_ERROR, leaving the T alone.
+ */
+template <typename T>
+int readExact(SharedMemory_handle sm, Field_handle handle, T& value) {
+	/* read into a buffer first, so that a value of the wrong size leaves the T alone */
+	alignas(T) unsigned char copy[sizeof(T)];
+	int size = 0;
+	int ret = ip_ReadValueByHandleEx(sm, handle, copy, sizeof(T), &size);
+	if (ret == IP_SUCCESS && size != static_cast<int>(sizeof(T)))
+		ret = IP_ERROR;
+	if (ret == IP_SUCCESS)
+		std::memcpy(static_cast<void*>(&value), copy, sizeof(T));
+	return ret;
+}
+
+/*
+ * A value looked at in place with Segment::view(). Never write through it.
+ * The value may be changed by a writer at any time: once done with the bytes,
+ * check valid() and look again if it returns false.
+ */
+class View {
+public:
+	View() noexcept : data_(nullptr), size_(0) { token_.seq = NULL; token_.value = 0; }
+
+	Bytes bytes() const noexcept { return Bytes(data_, static_cast<std::size_t>(size_)); }
+	const std::byte* data() const noexcept { return data_; }
+	int size() const noexcept { return size_; }
+
+	/* true if the value has not changed since the view was taken, see ip_ValidateView() */
+	bool valid() const noexcept { return ip_ValidateView(token_) == IP_SUCCESS; }
+
+private:
+	friend class Segment;
+	const std::byte* data_;
+	int size_;
+	View_token token_;
+};
+
+/*
+ * An open shared memory. Closes it (see ip_CloseSharedMemory()) when it goes out of scope.
+ * A Segment that failed to open is empty: it tests false and every call on it fails.
+ */
+class Segment {
+public:
+	Segment() noexcept : sm_(NULL) {}
+	explicit Segment(SharedMemory_handle sm) noexcept : sm_(sm) {}
+	~Segment() { close(); }
+
+	Segment(Segment&& other) noexcept : sm_(std::exchange(other.sm_, nullptr)) {}
+	Segment& operator=(Segment&& other) noexcept {
+		if (this != &other) {
+			close();
+			sm_ = std::exchange(other.sm_, nullptr);
+		}
+		return *this;
+	}
+	Segment(const Segment&) = delete;
+	Segment& operator=(const Segment&) = delete;
+
+	/* Create the shared memory, see ip_CreateSharedMemoryHostEx(); config may be NULL */
+	static Segment host(const char* name, const SharedMemory_config* config = NULL) {
+		return Segment(ip_CreateSharedMemoryHostEx(cName(name),
+				const_cast<SharedMemory_config*>(config)));
+	}
+
+	/* Open shared memory created by a host, see ip_CreateSharedMemoryClient() */
+	static Segment client(const char* name) {
+		return Segment(ip_CreateSharedMemoryClient(cName(name)));
+	}
+
+	explicit operator bool() const noexcept { return sm_ != NULL; }
+	SharedMemory_handle get() const noexcept { return sm_; }
+
+	/* Give up ownership of the handle without closing it */
+	SharedMemory_handle release() noexcept { return std::exchange(sm_, nullptr); }
+
+	int close() noexcept {
+		if (sm_ == NULL)
+			return IP_SUCCESS;
+		return ip_CloseSharedMemory(std::exchange(sm_, nullptr));
+	}
+
+	/* Write a value of any size, see ip_WriteValue() */
+	int write(const char* name, Bytes value) {
+		return ip_WriteValue(sm_, cName(name), const_cast<std::byte*>(value.data()),
+				static_cast<int>(value.size()));
+	}
+
+	/* Look at a value in place, see ip_ReadValueView() */
+	int view(const char* name, View& view) {
+		const void* data = NULL;
+		int ret = ip_ReadValueView(sm_, cName(name), &data, &(view.size_), &(view.token_));
+		if (ret != IP_SUCCESS) {
+			view = View();
+			return ret;
+		}
+		view.data_ = static_cast<const std::byte*>(data);
+		return ret;
+	}
+
+	int clear(const char* name) { return ip_ClearField(sm_, cName(name)); }
+	int clearAll() { return ip_ClearAllFields(sm_); }
+
+	/* A typed accessor for the field called name, see Field */
+	template <typename T>
+	Field<T> field(const char* name) { return Field<T>(sm_, name); }
+
+private:
+	SharedMemory_handle sm_;
+};
+
+/*
+ * A field holding a T, which must be trivially copyable and fit in a field.
+ *
+ * The field is resolved to a handle once (when the Field is made, or on the first
+ * write if it did not exist yet), so reads and writes skip the name lookup. If the
+ * handle goes stale because the field was cleared or moved, it is resolved again
+ * and the call retried once.
+ *
+ * read() only stores a value that is exactly sizeof(T) bytes long: a larger one
+ * returns IP_NO_MORE_ROOM and a smaller one IP_ERROR, leaving the T untouched.
+ *
+ * A Field refers to the Segment it came from and must not outlive it.
+ */
+template <typename T>
+class Field {
+	static_assert(std::is_trivially_copyable<T>::value,
+			"a field can only hold trivially copyable types");
+	static_assert(sizeof(T) <= IP_FIELD_DATA_CONTAINER_SIZE,
+			"the type is larger than a field can hold");
+
+public:
+	Field(SharedMemory_handle sm, const char* name) : sm_(sm), handle_(), resolved_(false) {
+		std::strncpy(name_, name, IP_FIELD_NAME_SIZE - 1);
+		name_[IP_FIELD_NAME_SIZE - 1] = '\0';
+		resolve();
+	}
+
+	const char* name() const noexcept { return name_; }
+	Field_handle handle() const noexcept { return handle_; }
+
+	/* Look the field up again, e.g. after it was created elsewhere */
+	int resolve() {
+		int ret = ip_ResolveField(sm_, name_, &handle_);
+		resolved_ = (ret == IP_SUCCESS);
+		return ret;
+	}
+
+	int read(T& value) {
+		if (!resolved_) {
+			int ret = resolve();
+			if (ret != IP_SUCCESS)
+				return ret;
+		}
+		int ret = readExact(sm_, handle_, value);
+		if (ret == IP_STALE_HANDLE && resolve() == IP_SUCCESS)
+			ret = readExact(sm_, handle_, value);
+		return ret;
+	}
+
+	int write(const T& value) {
+		void* data = const_cast<T*>(&value);
+		if (!resolved_) {
+			/* writing by name creates the field */
+			int ret = ip_WriteValue(sm_, name_, data, sizeof(T));
+			if (ret == IP_SUCCESS)
+				resolve();
+			return ret;
+		}
+		int ret = ip_WriteValueByHandle(sm_, handle_, data, sizeof(T));
+		if (ret == IP_STALE_HANDLE) {
+			resolved_ = false;
+			return write(value);
+		}
+		return ret;
+	}
+
+	/* The version of the field, see ip_GetFieldVersion() */
+	int version(unsigned int& version) {
+		return ip_GetFieldVersion(sm_, name_, &version);
+	}
+
+	/* Sleep until the field changes, see ip_WaitForFieldChangeByHandle() */
+	int waitForChange(unsigned int lastVersion, long long timeout_ns, unsigned int& version) {
+		if (!resolved_) {
+			int ret = resolve();
+			if (ret != IP_SUCCESS)
+				return ret;
+		}
+		return ip_WaitForFieldChangeByHandle(sm_, handle_, lastVersion, timeout_ns, &version);
+	}
+
+private:
+	SharedMemory_handle sm_;
+	char name_[IP_FIELD_NAME_SIZE];
+	Field_handle handle_;
+	bool resolved_;
+};
+
+/*
+ * Holds the shared memory lock from construction to the end of its scope,
+ * see AcquireLock(). Check ownsLock(): like AcquireLock(), it gives up after
+ * the lock wait time.
+ */
+class LockGuard {
+public:
+	explicit LockGuard(Segment& segment) : sm_(segment.get()), status_(lock(sm_)) {}
+	explicit LockGuard(SharedMemory_handle sm) : sm_(sm), status_(lock(sm)) {}
+	~LockGuard() { unlock(); }
+
+	LockGuard(const LockGuard&) = delete;
+	LockGuard& operator=(const LockGuard&) = delete;
+
+	bool ownsLock() const noexcept { return status_ == IP_SUCCESS; }
+	explicit operator bool() const noexcept { return ownsLock(); }
+	int status() const noexcept { return status_; }
+
+	/* Release the lock before the end of the scope */
+	void unlock() {
+		if (ownsLock())
+			ReleaseLock(sm_);
+		status_ = IP_DOES_NOT_EXIST;
+	}
+
+private:
+	static int lock(SharedMemory_handle sm) {
+		return (sm == NULL) ? IP_DOES_NOT_EXIST : AcquireLock(sm);
+	}
+
+	SharedMemory_handle sm_;
+	int status_;
+};
+
+/*
+ * A value of size bytes built in place in the shared memory, see ip_BeginWrite().
+ * Fill in bytes(), then commit() or let it go out of scope to publish the value.
+ * Check status() first.
+ */
+class InPlaceWrite {
+public:
+	InPlaceWrite(Segment& segment, const char* name, int size)
+			: sm_(segment.get()), data_(NULL), size_(size) {
+		status_ = ip_BeginWrite(sm_, cName(name), size, &data_);
+	}
+	~InPlaceWrite() { commit(); }
+
+	InPlaceWrite(const InPlaceWrite&) = delete;
+	InPlaceWrite& operator=(const InPlaceWrite&) = delete;
+
+	int status() const noexcept { return status_; }
+	explicit operator bool() const noexcept { return status_ == IP_SUCCESS; }
+
+	MutableBytes bytes() const noexcept {
+		if (status_ != IP_SUCCESS)
+			return MutableBytes();
+		return MutableBytes(static_cast<std::byte*>(data_), static_cast<std::size_t>(size_));
+	}
+
+	/* Publish the value, see ip_CommitWrite() */
+	int commit() {
+		if (status_ != IP_SUCCESS)
+			return IP_ERROR;
+		status_ = IP_DOES_NOT_EXIST;
+		return ip_CommitWrite(sm_);
+	}
+
+private:
+	SharedMemory_handle sm_;
+	void* data_;
+	int size_;
+	int status_;
+};
+
+/*
+ * Owns the handle of a queue, ring, frame or blob, closing it when it goes out of
+ * scope. Open one with the C function, passing out(), then use get() with the rest
+ * of the C functions:
+ *
+ *	ip::Queue queue;
+ *	if (ip_OpenQueue(segment.get(), (char*) "jobs", queue.out()) == IP_SUCCESS)
+ *		ip_QueuePush(queue.get(), &job, sizeof(job));
+ */
+template <typename Handle, int (*Close)(Handle)>
+class Owned {
+public:
+	Owned() noexcept : handle_(NULL) {}
+	explicit Owned(Handle handle) noexcept : handle_(handle) {}
+	~Owned() { reset(); }
+
+	Owned(Owned&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+	Owned& operator=(Owned&& other) noexcept {
+		if (this != &other) {
+			reset();
+			handle_ = std::exchange(other.handle_, nullptr);
+		}
+		return *this;
+	}
+	Owned(const Owned&) = delete;
+	Owned& operator=(const Owned&) = delete;
+
+	explicit operator bool() const noexcept { return handle_ != NULL; }
+	Handle get() const noexcept { return handle_; }
+
+	/* Close the current handle, and hand out its slot for a C function to fill in */
+	Handle* out() {
+		reset();
+		return &handle_;
+	}
+
+	Handle release() noexcept { return std::exchange(handle_, nullptr); }
+
+	void reset() {
+		if (handle_ != NULL)
+			Close(std::exchange(handle_, nullptr));
+	}
+
+private:
+	Handle handle_;
+};
+
+typedef Owned<Queue_handle, ip_CloseQueue> Queue;
+typedef Owned<Ring_handle, ip_CloseRing> Ring;
+typedef Owned<Frame_handle, ip_CloseFrame> Frame;
+typedef Owned<Blob_handle, ip_CloseBlob> Blob;
+
+/*
+ * The fields of a shared memory, fixed at compile time: their types as template
+ * arguments, their names in the same order.
+ *
+ *	constexpr ip::Schema<Pose, int> telemetry = { { "pose", "mode" } };
+ *	enum { POSE, MODE };
+ *
+ * The schema's hash() (the same as ip_SchemaHash()) is a compile time constant, so
+ * processes built with different schemas refuse to share memory, see SchemaSegment.
+ */
+template <typename... Types>
+struct Schema {
+	static_assert(sizeof...(Types) > 0, "a schema needs at least one field");
+	static_assert((std::is_trivially_copyable<Types>::value && ...),
+			"a field can only hold trivially copyable types");
+	static_assert(((sizeof(Types) <= IP_FIELD_DATA_CONTAINER_SIZE) && ...),
+			"a type is larger than a field can hold");
+
+	static constexpr int count = sizeof...(Types);
+
+	/* the type of field K */
+	template <int K>
+	using Type = typename std::tuple_element<K, std::tuple<Types...> >::type;
+
+	const char* names[sizeof...(Types)];
+
+	static constexpr int size(int k) {
+		constexpr int sizes[] = { static_cast<int>(sizeof(Types))... };
+		return sizes[k];
+	}
+
+	/* FNV-1a over every name with its terminating zero and every size, like ip_SchemaHash() */
+	constexpr unsigned long long hash() const {
+		unsigned long long hash = 14695981039346656037ULL;
+		for (int k = 0; k < count; ++k) {
+			const char* c = names[k];
+			do {
+				hash = (hash ^ static_cast<unsigned char>(*c)) * 1099511628211ULL;
+			} while (*c++ != '\0');
+			for (int b = 0; b < 4; ++b)
+				hash = (hash ^ ((static_cast<unsigned int>(size(k)) >> (8 * b)) & 0xff))
+						* 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	/* The schema as the C functions take it */
+	void fields(Schema_field* out) const {
+		for (int k = 0; k < count; ++k) {
+			out[k].name = names[k];
+			out[k].size = size(k);
+		}
+	}
+};
+
+/*
+ * A shared memory laid out with the schema S. Field K of the schema always sits in
+ * slot K, so read<K>() and write<K>() go straight to it with a handle known at compile
+ * time, and only ever take a value of type S::Type<K>.
+ *
+ * host() creates the fields before any client can see them; client() refuses (tests
+ * false) to open shared memory laid out with a different schema.
+ */
+template <typename S>
+class SchemaSegment {
+public:
+	SchemaSegment() noexcept {}
+
+	static SchemaSegment host(const char* name, const S& schema,
+			SharedMemory_config config = SharedMemory_config()) {
+		Schema_field fields[S::count];
+		schema.fields(fields);
+		config.schema = fields;
+		config.schemaCount = S::count;
+		return SchemaSegment(Segment::host(name, &config));
+	}
+
+	static SchemaSegment client(const char* name, const S& schema) {
+		return SchemaSegment(Segment(ip_CreateSharedMemoryClientEx(cName(name), schema.hash())));
+	}
+
+	explicit operator bool() const noexcept { return static_cast<bool>(segment_); }
+
+	/* The shared memory, for everything besides the schema's fields */
+	Segment& segment() noexcept { return segment_; }
+	SharedMemory_handle get() const noexcept { return segment_.get(); }
+
+	template <int K>
+	static constexpr Field_handle handle() {
+		static_assert(K >= 0 && K < S::count, "no such field in the schema");
+		return Field_handle { K, 0 };
+	}
+
+	template <int K>
+	int read(typename S::template Type<K>& value) {
+		return readExact(segment_.get(), handle<K>(), value);
+	}
+
+	template <int K>
+	int write(const typename S::template Type<K>& value) {
+		return ip_WriteValueByHandle(segment_.get(), handle<K>(), const_cast<void*>(
+				static_cast<const void*>(&value)), sizeof(value));
+	}
+
+private:
+	explicit SchemaSegment(Segment&& segment) noexcept : segment_(std::move(segment)) {}
+
+	Segment segment_;
+};
+
+} /* namespace ip */
+
+#endif /* INTERPROCESS_HPP_ */
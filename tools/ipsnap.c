@@ -0,0 +1,174 @@
+/*
+ * ipsnap.c
+ *
+ * Log a shared memory while it is in use: take a snapshot of all of its values with
+ * ip_Snapshot() every so often and append it to a file, or print a file of snapshots
+ * taken earlier. Snapshots describe themselves (see Snapshot_header), so printing
+ * them needs neither the shared memory nor the program that wrote it.
+ *
+ * ipsnap opens the shared memory with ip_CreateSharedMemoryObserver(), so it never
+ * takes the lock or holds up a writer. A snapshot that writers keep changing while it
+ * is copied is skipped and tried again at the next tick.
+ *
+ * Usage: bin/ipsnap [--interval s] [--count n] name file
+ *        bin/ipsnap --print file
+ *  --interval  seconds between snapshots (default 1)
+ *  --count     stop after n snapshots (default: run until killed)
+ *  --print     print every snapshot in file, values in hex
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "../src/interprocess.h"
+
+#define DEFAULT_INTERVAL 1.0
+#define MAX_HEX_BYTES 32 /* bytes of a value printed, the rest is elided */
+
+static void sleepSeconds(double s) {
+#ifdef _WIN32
+	Sleep((DWORD) (s * 1e3));
+#else
+	usleep((useconds_t) (s * 1e6));
+#endif
+}
+
+/*
+ * Print the snapshots in a file, one after the other.
+ * Returns 0, or 1 if the file is not a file of snapshots.
+ */
+static int printSnapshots(const char* path) {
+	FILE* in = fopen(path, "rb");
+	if (in == NULL) {
+		printf("could not open %s.\n", path);
+		return 1;
+	}
+	Snapshot_header header;
+	while (fread(&header, sizeof(header), 1, in) == 1) {
+		if (header.magic != IP_SNAPSHOT_MAGIC || header.format != IP_SNAPSHOT_FORMAT
+				|| header.headerSize < sizeof(header) || header.size < header.headerSize) {
+			printf("%s: not a snapshot (or from another machine or version).\n", path);
+			fclose(in);
+			return 1;
+		}
+		char* snapshot = (char*) malloc(header.size);
+		if (snapshot != NULL)
+			memcpy(snapshot, &header, sizeof(header));
+		if (snapshot == NULL
+				|| fread(snapshot + sizeof(header), header.size - sizeof(header), 1, in) != 1) {
+			printf("%s: truncated snapshot.\n", path);
+			free(snapshot);
+			fclose(in);
+			return 1;
+		}
+
+		time_t seconds = (time_t) (header.timeNs / 1000000000LL);
+		char when[32];
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", gmtime(&seconds));
+		printf("snapshot at %s.%09lld UTC, %d fields, %s, schema %016llx\n", when,
+				header.timeNs % 1000000000LL, header.numFields,
+				(header.flags & IP_SNAPSHOT_POINT_IN_TIME) ? "point in time" : "per value",
+				header.schemaHash);
+
+		unsigned int pos = header.headerSize;
+		int k = 0;
+		for (k = 0; k < header.numFields && pos + sizeof(Snapshot_field) <= header.size; ++k) {
+			Snapshot_field* field = (Snapshot_field*) (snapshot + pos);
+			if (field->recordSize < sizeof(Snapshot_field) || pos + field->recordSize > header.size)
+				break;
+			unsigned char* value = (unsigned char*) field + sizeof(Snapshot_field);
+			printf("  %-*s v%-8u %6d ", IP_FIELD_NAME_SIZE - 1, field->name, field->version,
+					field->size);
+			int b = 0;
+			for (b = 0; b < field->size && b < MAX_HEX_BYTES; ++b)
+				printf("%02x", value[b]);
+			printf("%s\n", (field->size > MAX_HEX_BYTES) ? "..." : "");
+			pos += field->recordSize;
+		}
+		free(snapshot);
+	}
+	fclose(in);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	double interval = DEFAULT_INTERVAL;
+	long count = -1;
+	char* print = NULL;
+	char* name = NULL;
+	char* path = NULL;
+	int a = 0;
+	for (a = 1; a < argc; ++a) {
+		if (strcmp(argv[a], "--interval") == 0 && a + 1 < argc) {
+			interval = atof(argv[++a]);
+		} else if (strcmp(argv[a], "--count") == 0 && a + 1 < argc) {
+			count = atol(argv[++a]);
+		} else if (strcmp(argv[a], "--print") == 0 && a + 1 < argc) {
+			print = argv[++a];
+		} else if (argv[a][0] != '-' && name == NULL) {
+			name = argv[a];
+		} else if (argv[a][0] != '-' && path == NULL) {
+			path = argv[a];
+		} else {
+			name = NULL;
+			print = NULL;
+			break;
+		}
+	}
+	if (print != NULL)
+		return printSnapshots(print);
+	if (name == NULL || path == NULL || interval <= 0) {
+		printf("usage: %s [--interval s] [--count n] name file\n", argv[0]);
+		printf("       %s --print file\n", argv[0]);
+		return 1;
+	}
+
+	SharedMemory_handle sm = ip_CreateSharedMemoryObserver(name);
+	if (sm == NULL) {
+		printf("could not open shared memory %s.\n", name);
+		return 1;
+	}
+	FILE* out = fopen(path, "ab");
+	if (out == NULL) {
+		printf("could not open %s.\n", path);
+		return 1;
+	}
+
+	/** The buffer grows to whatever the snapshots need **/
+	int capacity = 0;
+	char* buffer = NULL;
+	long taken = 0;
+	while (count < 0 || taken < count) {
+		int size = capacity;
+		int ret = ip_Snapshot(sm, buffer, &size);
+		if (ret == IP_NO_MORE_ROOM) {
+			free(buffer);
+			capacity = size + size / 4;
+			buffer = (char*) malloc(capacity);
+			if (buffer == NULL) {
+				printf("out of memory.\n");
+				return 1;
+			}
+			continue;
+		}
+		if (ret == IP_SUCCESS) {
+			fwrite(buffer, size, 1, out);
+			fflush(out);
+			taken++;
+		}
+		if (count < 0 || taken < count)
+			sleepSeconds(interval);
+	}
+
+	free(buffer);
+	fclose(out);
+	ip_CloseSharedMemory(sm);
+	return 0;
+}
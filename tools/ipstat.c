@@ -0,0 +1,289 @@
+/*
+ * ipstat.c
+ *
+ * Watch a shared memory while it is in use, like top: its fields with their kind,
+ * size, version, how long ago they last changed and how often they are read and
+ * written per second, busiest first, along with the totals and the shared memory
+ * lock's wait times.
+ *
+ * ipstat opens the shared memory with ip_CreateSharedMemoryObserver(), so it maps it
+ * read-only and never takes the lock: watching does not slow anyone down. Rates come
+ * from the statistics every process keeps in the shared memory (see ip_GetStats()),
+ * and are zero for processes built without them. The age of a field is how long ago
+ * ipstat saw its version change, so it is only as precise as the refresh interval,
+ * and unknown ("-") until the field changes while ipstat watches.
+ *
+ * Usage: bin/ipstat [--interval s] [--count n] [--json] name
+ *  --interval  seconds between refreshes (default 1)
+ *  --count     stop after n refreshes (default: run until killed)
+ *  --json      print one JSON object per refresh instead of the table, for scraping
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "../src/interprocess.h"
+
+#define DEFAULT_INTERVAL 1.0
+#define MAX_ROWS 40 /* fields shown in the table; JSON has them all */
+
+/* What ipstat remembers about a field from one refresh to the next */
+struct Seen_t {
+	Field_info info;
+	double changed; /* when the version was last seen to change, < 0 if not yet */
+	double readRate, writeRate;
+};
+
+static const char* kindNames[] = { "value", "queue", "ring", "frame", "blob" };
+
+static double nowSeconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleepSeconds(double s) {
+#ifdef _WIN32
+	Sleep((DWORD) (s * 1e3));
+#else
+	usleep((useconds_t) (s * 1e6));
+#endif
+}
+
+static const char* kindName(int kind) {
+	return (kind >= 0 && kind <= IP_KIND_BLOB) ? kindNames[kind] : "?";
+}
+
+/*
+ * Find the field called name among the n seen last time, looking in slot k first
+ * since fields rarely move. Returns NULL if it is new.
+ */
+static struct Seen_t* findSeen(struct Seen_t* seen, int n, int k, const char* name) {
+	if (k < n && strcmp(seen[k].info.name, name) == 0)
+		return &(seen[k]);
+	int j = 0;
+	for (j = 0; j < n; ++j) {
+		if (strcmp(seen[j].info.name, name) == 0)
+			return &(seen[j]);
+	}
+	return NULL;
+}
+
+/* Busiest first */
+static int byActivity(const void* a, const void* b) {
+	const struct Seen_t* x = (const struct Seen_t*) a;
+	const struct Seen_t* y = (const struct Seen_t*) b;
+	double dx = x->readRate + x->writeRate;
+	double dy = y->readRate + y->writeRate;
+	if (dx != dy)
+		return (dx < dy) ? 1 : -1;
+	return strcmp(x->info.name, y->info.name);
+}
+
+/*
+ * Upper bound of the bucket of a lock time histogram holding the given fraction
+ * of the counts, in ns (see SharedMemory_stats). 0 if the histogram is empty.
+ */
+static double percentile(unsigned long long* histogram, double fraction) {
+	unsigned long long total = 0;
+	int b = 0;
+	for (b = 0; b < IP_STATS_BUCKETS; ++b)
+		total += histogram[b];
+	if (total == 0)
+		return 0;
+	unsigned long long sum = 0;
+	for (b = 0; b < IP_STATS_BUCKETS - 1; ++b) {
+		sum += histogram[b];
+		if (sum >= fraction * total)
+			break;
+	}
+	return (double) (64ULL << b);
+}
+
+/* A field name as a JSON string */
+static void printJsonString(const char* s) {
+	putchar('"');
+	for (; *s != '\0'; ++s) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+static void printAge(double now, double changed) {
+	if (changed < 0)
+		printf("%8s", "-");
+	else if (now - changed < 100)
+		printf("%7.1fs", now - changed);
+	else
+		printf("%7.0fs", now - changed);
+}
+
+int main(int argc, char** argv) {
+	double interval = DEFAULT_INTERVAL;
+	long count = -1;
+	int json = 0;
+	char* name = NULL;
+	int a = 0;
+	for (a = 1; a < argc; ++a) {
+		if (strcmp(argv[a], "--interval") == 0 && a + 1 < argc) {
+			interval = atof(argv[++a]);
+		} else if (strcmp(argv[a], "--count") == 0 && a + 1 < argc) {
+			count = atol(argv[++a]);
+		} else if (strcmp(argv[a], "--json") == 0) {
+			json = 1;
+		} else if (argv[a][0] != '-' && name == NULL) {
+			name = argv[a];
+		} else {
+			name = NULL;
+			break;
+		}
+	}
+	if (name == NULL || interval <= 0) {
+		printf("usage: %s [--interval s] [--count n] [--json] name\n", argv[0]);
+		return 1;
+	}
+
+	SharedMemory_handle sm = ip_CreateSharedMemoryObserver(name);
+	SharedMemory_config config;
+	if (sm == NULL || ip_GetSharedMemoryConfig(sm, &config) != IP_SUCCESS) {
+		printf("could not open shared memory %s.\n", name);
+		return 1;
+	}
+	int maxFields = config.maxNumFields;
+	Field_info* fields = (Field_info*) malloc(maxFields * sizeof(Field_info));
+	struct Seen_t* seen = (struct Seen_t*) malloc(maxFields * sizeof(struct Seen_t));
+	struct Seen_t* next = (struct Seen_t*) malloc(maxFields * sizeof(struct Seen_t));
+	if (fields == NULL || seen == NULL || next == NULL) {
+		printf("out of memory.\n");
+		return 1;
+	}
+
+	/** First look, so that the first refresh has something to compare with **/
+	int numSeen = 0;
+	if (ip_ListFields(sm, fields, maxFields, &numSeen) != IP_SUCCESS)
+		numSeen = 0;
+	int k = 0;
+	for (k = 0; k < numSeen; ++k) {
+		seen[k].info = fields[k];
+		seen[k].changed = -1;
+	}
+	SharedMemory_stats before;
+	SharedMemory_stats after;
+	ip_GetStats(sm, &before);
+	double then = nowSeconds();
+
+	long refresh = 0;
+	for (refresh = 0; count < 0 || refresh < count; ++refresh) {
+		sleepSeconds(interval);
+		int n = 0;
+		if (ip_ListFields(sm, fields, maxFields, &n) != IP_SUCCESS)
+			continue; /* the layout kept changing, try again next time */
+		ip_GetStats(sm, &after);
+		double now = nowSeconds();
+		double elapsed = now - then;
+
+		/** Match the fields up with last time's **/
+		for (k = 0; k < n; ++k) {
+			struct Seen_t* old = findSeen(seen, numSeen, k, fields[k].name);
+			struct Seen_t* s = &(next[k]);
+			s->info = fields[k];
+			s->changed = -1;
+			s->readRate = 0;
+			s->writeRate = 0;
+			if (old == NULL)
+				continue;
+			s->changed = (old->info.version != fields[k].version) ? now : old->changed;
+			/* counters go down when the statistics are reset */
+			if (fields[k].reads >= old->info.reads)
+				s->readRate = (fields[k].reads - old->info.reads) / elapsed;
+			if (fields[k].writes >= old->info.writes)
+				s->writeRate = (fields[k].writes - old->info.writes) / elapsed;
+		}
+		struct Seen_t* swap = seen;
+		seen = next;
+		next = swap;
+		numSeen = n;
+
+		unsigned long long wait[IP_STATS_BUCKETS];
+		unsigned long long waits = 0;
+		int b = 0;
+		for (b = 0; b < IP_STATS_BUCKETS; ++b) {
+			wait[b] = (after.lockWait[b] >= before.lockWait[b]) ? after.lockWait[b] - before.lockWait[b] : 0;
+			waits += wait[b];
+		}
+		double reads = (after.reads >= before.reads) ? (after.reads - before.reads) / elapsed : 0;
+		double writes = (after.writes >= before.writes) ? (after.writes - before.writes) / elapsed : 0;
+		double misses = (after.misses >= before.misses) ? (after.misses - before.misses) / elapsed : 0;
+		double busy = (after.busy >= before.busy) ? (after.busy - before.busy) / elapsed : 0;
+		before = after;
+		then = now;
+
+		/** The busiest fields first; the table is in order of activity **/
+		struct Seen_t* sorted = next; /* free until the next refresh */
+		memcpy(sorted, seen, n * sizeof(struct Seen_t));
+		qsort(sorted, n, sizeof(struct Seen_t), byActivity);
+
+		if (json) {
+			printf("{\"name\": ");
+			printJsonString(name);
+			printf(", \"interval_s\": %.3f, \"fields\": %d, \"max_fields\": %d, "
+					"\"reads_per_s\": %.1f, \"writes_per_s\": %.1f, \"misses_per_s\": %.1f, "
+					"\"busy_per_s\": %.1f, \"lock_waits_per_s\": %.1f, \"lock_wait_p50_ns\": %.0f, "
+					"\"lock_wait_p99_ns\": %.0f, \"field_stats\": [", elapsed, n, maxFields,
+					reads, writes, misses, busy, waits / elapsed, percentile(wait, 0.5),
+					percentile(wait, 0.99));
+			for (k = 0; k < n; ++k) {
+				struct Seen_t* s = &(sorted[k]);
+				printf("%s{\"name\": ", (k > 0) ? ", " : "");
+				printJsonString(s->info.name);
+				printf(", \"kind\": \"%s\", \"size\": %d, \"version\": %u, \"age_s\": ",
+						kindName(s->info.kind), s->info.size, s->info.version);
+				if (s->changed < 0)
+					printf("null");
+				else
+					printf("%.1f", now - s->changed);
+				printf(", \"reads_per_s\": %.1f, \"writes_per_s\": %.1f}", s->readRate, s->writeRate);
+			}
+			printf("]}\n");
+		} else {
+			printf("\033[H\033[2J"); /* clear the screen */
+			printf("%s: %d of %d fields, %d bytes, every %.1f s\n", name, n, maxFields,
+					config.capacity, interval);
+			printf("reads %.0f/s  writes %.0f/s  misses %.0f/s  busy %.0f/s  lock waits %.0f/s",
+					reads, writes, misses, busy, waits / elapsed);
+			if (waits > 0)
+				printf(" (p50 < %.0f ns, p99 < %.0f ns)", percentile(wait, 0.5), percentile(wait, 0.99));
+			printf("\n\n");
+			printf("%-*s %-5s %8s %10s %8s %10s %10s\n", IP_FIELD_NAME_SIZE - 1, "FIELD", "KIND",
+					"SIZE", "VERSION", "AGE", "READS/S", "WRITES/S");
+			for (k = 0; k < n && k < MAX_ROWS; ++k) {
+				struct Seen_t* s = &(sorted[k]);
+				printf("%-*s %-5s %8d %10u ", IP_FIELD_NAME_SIZE - 1, s->info.name,
+						kindName(s->info.kind), s->info.size, s->info.version);
+				printAge(now, s->changed);
+				printf(" %10.0f %10.0f\n", s->readRate, s->writeRate);
+			}
+			if (n > MAX_ROWS)
+				printf("... and %d more\n", n - MAX_ROWS);
+		}
+		fflush(stdout);
+	}
+
+	free(fields);
+	free(seen);
+	free(next);
+	ip_CloseSharedMemory(sm);
+	return 0;
+}